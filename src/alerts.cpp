@@ -0,0 +1,229 @@
+#include "alerts.h"
+#include "can.h"
+#include "logger.h"
+#include <Arduino.h>
+
+extern Config Cfg;
+
+namespace Alerts {
+
+namespace {
+
+const uint8_t RING_SIZE = 16;
+const float POWER_HYSTERESIS = 0.5;     // A, never more than the threshold
+const float CHARGE_HYSTERESIS = 2;      // %
+const float TEMPERATURE_HYSTERESIS = 2; // °C
+const uint32_t RATE_WINDOW_MS = 1000;   // Current change measured over at least this
+
+const char *NAMES[RULE_COUNT] = {"charging", "discharging", "bms_error", "bms_warning",
+                                 "low_charge", "high_temperature", "current_step"};
+const char *LABELS[RULE_COUNT] = {"Charging", "Discharging", "BMS error", "BMS warning",
+                                  "Low charge", "High temperature", "Current step"};
+
+typedef struct RuleState {
+  bool active;
+  bool pending; // Condition changed, waiting for the hold time
+  uint32_t pendingSinceMs;
+} RuleState;
+
+portMUX_TYPE eventMux = portMUX_INITIALIZER_UNLOCKED;
+Event ring[RING_SIZE];
+volatile uint32_t written = 0;
+volatile uint32_t activeMask = 0;
+volatile bool primed = false;
+volatile uint32_t evaluationCount = 0;
+
+// CAN task only
+RuleState rules[RULE_COUNT];
+uint8_t lastError = 0;
+uint8_t lastWarning = 0;
+bool rateValid = false;
+float rateFromCurrent = 0;
+uint32_t rateFromMs = 0;
+
+void emit(Rule rule, bool active, float value, float previous, const EssStatus &ess,
+          uint32_t now) {
+  Event event;
+  event.ms = now;
+  event.rule = rule;
+  event.active = active;
+  event.value = value;
+  event.previous = previous;
+  event.ess = ess;
+
+  portENTER_CRITICAL(&eventMux);
+  ring[written % RING_SIZE] = event;
+  written++;
+  if (active) {
+    activeMask |= 1UL << rule;
+  } else {
+    activeMask &= ~(1UL << rule);
+  }
+  portEXIT_CRITICAL(&eventMux);
+
+  LOG_I("ALERT", "%s %s at %.1f", NAMES[rule], active ? "raised" : "cleared", value);
+}
+
+// Raised past limit, cleared once back past limit -/+ hysteresis; either
+// change has to hold for holdMs
+void threshold(Rule rule, float value, bool above, float limit, float hysteresis,
+               uint32_t holdMs, const EssStatus &ess, uint32_t now) {
+  RuleState &st = rules[rule];
+  bool want;
+  if (above) {
+    want = st.active ? value >= limit - hysteresis : value > limit;
+  } else {
+    want = st.active ? value <= limit + hysteresis : value < limit;
+  }
+  if (want == st.active) {
+    st.pending = false;
+    return;
+  }
+  if (!st.pending) {
+    st.pending = true;
+    st.pendingSinceMs = now;
+  }
+  if (now - st.pendingSinceMs < holdMs) {
+    return;
+  }
+  st.active = want;
+  st.pending = false;
+  emit(rule, want, value, 0, ess, now);
+}
+
+// Rule turned off in the settings
+void disable(Rule rule, const EssStatus &ess, uint32_t now) {
+  RuleState &st = rules[rule];
+  st.pending = false;
+  if (st.active) {
+    st.active = false;
+    emit(rule, false, 0, 0, ess, now);
+  }
+}
+
+// BMS codes: every change is an event, a new nonzero code raises again
+void code(Rule rule, uint8_t value, uint8_t &last, const EssStatus &ess, uint32_t now) {
+  if (value == last) {
+    return;
+  }
+  rules[rule].active = value != 0;
+  emit(rule, value != 0, value, last, ess, now);
+  last = value;
+}
+
+void evaluateCurrent(const EssStatus &ess, uint32_t now, uint32_t holdMs) {
+  float limit = Cfg.tgCurrentThreshold;
+  float hysteresis = limit < POWER_HYSTERESIS ? limit : POWER_HYSTERESIS;
+  if (!primed) {
+    // Starting state, not a change
+    rules[RULE_CHARGING].active = ess.current > limit;
+    rules[RULE_DISCHARGING].active = ess.current < -limit;
+    portENTER_CRITICAL(&eventMux);
+    activeMask |= (rules[RULE_CHARGING].active ? 1UL << RULE_CHARGING : 0) |
+                  (rules[RULE_DISCHARGING].active ? 1UL << RULE_DISCHARGING : 0);
+    portEXIT_CRITICAL(&eventMux);
+    primed = true;
+  } else {
+    threshold(RULE_CHARGING, ess.current, true, limit, hysteresis, holdMs, ess, now);
+    threshold(RULE_DISCHARGING, ess.current, false, -limit, hysteresis, holdMs, ess, now);
+  }
+
+  if (!Cfg.alertCurrentRate) {
+    disable(RULE_CURRENT_STEP, ess, now);
+    rateValid = false;
+  } else if (!rateValid) {
+    rateFromCurrent = ess.current;
+    rateFromMs = now;
+    rateValid = true;
+  } else if (now - rateFromMs >= RATE_WINDOW_MS) {
+    float rate = fabsf(ess.current - rateFromCurrent) * 1000 / (now - rateFromMs);
+    rateFromCurrent = ess.current;
+    rateFromMs = now;
+    threshold(RULE_CURRENT_STEP, rate, true, Cfg.alertCurrentRate, Cfg.alertCurrentRate / 4.0f,
+              0, ess, now);
+  }
+}
+
+} // namespace
+
+void evaluate(uint32_t frameId, uint32_t now) {
+  if (frameId != 0x355 && frameId != 0x356 && frameId != 0x359) {
+    return;
+  }
+  EssStatus ess = CAN::getEssStatus();
+  uint32_t holdMs = Cfg.alertHold * 1000UL;
+  evaluationCount++;
+
+  switch (frameId) {
+  case 0x355: // Charge
+    if (Cfg.alertLowCharge) {
+      threshold(RULE_LOW_CHARGE, ess.charge, false, Cfg.alertLowCharge, CHARGE_HYSTERESIS,
+                holdMs, ess, now);
+    } else {
+      disable(RULE_LOW_CHARGE, ess, now);
+    }
+    break;
+  case 0x356: // Voltage, current, temperature
+    evaluateCurrent(ess, now, holdMs);
+    if (Cfg.alertHighTemp) {
+      threshold(RULE_HIGH_TEMPERATURE, ess.temperature, true, Cfg.alertHighTemp,
+                TEMPERATURE_HYSTERESIS, holdMs, ess, now);
+    } else {
+      disable(RULE_HIGH_TEMPERATURE, ess, now);
+    }
+    break;
+  case 0x359: // BMS error and warning
+    code(RULE_BMS_ERROR, ess.bmsError, lastError, ess, now);
+    code(RULE_BMS_WARNING, ess.bmsWarning, lastWarning, ess, now);
+    break;
+  }
+}
+
+bool next(uint32_t *cursor, Event *event) {
+  bool found = false;
+  portENTER_CRITICAL(&eventMux);
+  if (written - *cursor > RING_SIZE) {
+    *cursor = written - RING_SIZE; // Fell behind, the oldest are gone
+  }
+  if (*cursor != written) {
+    *event = ring[*cursor % RING_SIZE];
+    (*cursor)++;
+    found = true;
+  }
+  portEXIT_CRITICAL(&eventMux);
+  return found;
+}
+
+uint32_t head() {
+  return written;
+}
+
+uint32_t getActive() {
+  return activeMask;
+}
+
+bool isActive(Rule rule) {
+  return activeMask & 1UL << rule;
+}
+
+bool isPrimed() {
+  return primed;
+}
+
+const char *ruleName(Rule rule) {
+  return rule < RULE_COUNT ? NAMES[rule] : "unknown";
+}
+
+const char *ruleLabel(Rule rule) {
+  return rule < RULE_COUNT ? LABELS[rule] : "Unknown";
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.evaluations = evaluationCount;
+  stats.events = written;
+  stats.active = activeMask;
+  return stats;
+}
+
+} // namespace Alerts
@@ -0,0 +1,64 @@
+#ifndef _ALERTS_H_
+#define _ALERTS_H_
+
+#include "types.h"
+
+namespace Alerts {
+
+// Conditions on the battery status, evaluated by the CAN task on every
+// decoded frame that carries their value. Each change of a rule produces an
+// event in a small ring; every consumer (Telegram, MQTT, web, LCD) reads it
+// with its own cursor, so none of them can hold up another.
+
+typedef enum : uint8_t {
+  RULE_CHARGING = 0,     // current above tgCurrentThreshold
+  RULE_DISCHARGING,      // current below -tgCurrentThreshold
+  RULE_BMS_ERROR,        // any BMS error code
+  RULE_BMS_WARNING,      // any BMS warning code
+  RULE_LOW_CHARGE,       // charge below alertLowCharge
+  RULE_HIGH_TEMPERATURE, // temperature above alertHighTemp
+  RULE_CURRENT_STEP,     // current changing faster than alertCurrentRate
+  RULE_COUNT
+} Rule;
+
+// Rules that are alerts rather than the power state
+const uint32_t ALERT_RULES = (1UL << RULE_COUNT) - 1 - (1UL << RULE_CHARGING) -
+                             (1UL << RULE_DISCHARGING);
+
+typedef struct Event {
+  uint32_t ms;    // Frame that caused it
+  Rule rule;
+  bool active;    // Raised, or cleared
+  float value;    // Current, code, charge, temperature or A/s
+  float previous; // BMS rules: the code before
+  EssStatus ess;  // Status at that frame
+} Event;
+
+typedef struct Stats {
+  uint32_t evaluations; // Frames evaluated
+  uint32_t events;
+  uint32_t active;      // Bit per Rule
+} Stats;
+
+// CAN task, after a frame was decoded into the status
+void evaluate(uint32_t frameId, uint32_t now);
+
+// Events are numbered from 0; a consumer starts with cursor 0 (everything
+// since boot still in the ring) or head() (from now on). Returns false when
+// there is nothing newer. A consumer that fell behind the ring skips ahead.
+bool next(uint32_t *cursor, Event *event);
+uint32_t head();
+
+uint32_t getActive();
+bool isActive(Rule rule);
+// Power rules are set silently from the first status frame
+bool isPrimed();
+
+const char *ruleName(Rule rule);  // snake_case, for MQTT
+const char *ruleLabel(Rule rule); // For people
+
+Stats getStats();
+
+} // namespace Alerts
+
+#endif
@@ -0,0 +1,117 @@
+#include "backlog.h"
+#include "logger.h"
+#include <Arduino.h>
+
+namespace Backlog {
+
+namespace {
+
+Sample *samples = nullptr;
+uint32_t capacity = 0;
+uint32_t first = 0; // Oldest
+volatile uint32_t count = 0;
+
+volatile uint32_t takenCount = 0;
+volatile uint32_t sentCount = 0;
+volatile uint32_t droppedCount = 0;
+
+int16_t scaled(float value, float scale) {
+  float v = roundf(value * scale);
+  return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : (int16_t)v;
+}
+
+uint16_t scaledUnsigned(float value, float scale) {
+  float v = roundf(value * scale);
+  return v > UINT16_MAX ? UINT16_MAX : v < 0 ? 0 : (uint16_t)v;
+}
+
+} // namespace
+
+void begin(size_t budget) {
+  capacity = budget / sizeof(Sample);
+  if (capacity == 0) {
+    return;
+  }
+  samples = (Sample *)malloc(capacity * sizeof(Sample));
+  if (!samples) {
+    LOG_E("HASS", "No memory for the %u byte offline buffer", budget);
+    capacity = 0;
+    return;
+  }
+  LOG_I("HASS", "Offline buffer: %lu samples in %u bytes", capacity, capacity * sizeof(Sample));
+}
+
+bool enabled() {
+  return capacity > 0;
+}
+
+void push(const EssStatus &ess) {
+  if (!capacity) {
+    return;
+  }
+  Sample *s;
+  if (count == capacity) {
+    s = &samples[first]; // Overwrite the oldest
+    first = (first + 1) % capacity;
+    droppedCount++;
+  } else {
+    s = &samples[(first + count) % capacity];
+    count++;
+  }
+  s->ms = millis();
+  s->voltage = scaledUnsigned(ess.voltage, 100);
+  s->ratedVoltage = scaledUnsigned(ess.ratedVoltage, 100);
+  s->current = scaled(ess.current, 10);
+  s->ratedChargeCurrent = scaled(ess.ratedChargeCurrent, 10);
+  s->ratedDischargeCurrent = scaled(ess.ratedDischargeCurrent, 10);
+  s->temperature = scaled(ess.temperature, 10);
+  s->charge = ess.charge;
+  s->health = ess.health;
+  s->bmsWarning = ess.bmsWarning;
+  s->bmsError = ess.bmsError;
+  takenCount++;
+}
+
+bool peek(Sample *sample) {
+  if (count == 0) {
+    return false;
+  }
+  *sample = samples[first];
+  return true;
+}
+
+void pop() {
+  if (count == 0) {
+    return;
+  }
+  first = (first + 1) % capacity;
+  count--;
+  sentCount++;
+}
+
+EssStatus toStatus(const Sample &s) {
+  EssStatus ess;
+  ess.charge = s.charge;
+  ess.health = s.health;
+  ess.voltage = s.voltage / 100.0f;
+  ess.ratedVoltage = s.ratedVoltage / 100.0f;
+  ess.current = s.current / 10.0f;
+  ess.ratedChargeCurrent = s.ratedChargeCurrent / 10.0f;
+  ess.ratedDischargeCurrent = s.ratedDischargeCurrent / 10.0f;
+  ess.temperature = s.temperature / 10.0f;
+  ess.bmsWarning = s.bmsWarning;
+  ess.bmsError = s.bmsError;
+  return ess;
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.stored = count;
+  stats.capacity = capacity;
+  stats.taken = takenCount;
+  stats.sent = sentCount;
+  stats.dropped = droppedCount;
+  return stats;
+}
+
+} // namespace Backlog
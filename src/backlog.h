@@ -0,0 +1,49 @@
+#ifndef _BACKLOG_H_
+#define _BACKLOG_H_
+
+#include "types.h"
+
+namespace Backlog {
+
+// Samples taken while the broker is unreachable, oldest dropped first when
+// the memory budget is used up. Packed to 20 bytes at the precision the
+// sensors are published with. HASS task only, except getStats().
+
+typedef struct Sample {
+  uint32_t ms;                   // millis() when taken
+  uint16_t voltage;              // 10 mV
+  uint16_t ratedVoltage;         // 10 mV
+  int16_t current;               // 100 mA
+  int16_t ratedChargeCurrent;    // 100 mA
+  int16_t ratedDischargeCurrent; // 100 mA
+  int16_t temperature;           // 0.1 °C
+  uint8_t charge;
+  uint8_t health;
+  uint8_t bmsWarning;
+  uint8_t bmsError;
+} Sample;
+
+typedef struct Stats {
+  uint32_t stored;   // Samples waiting now
+  uint32_t capacity; // Samples the budget holds
+  uint32_t taken;    // Samples recorded since boot
+  uint32_t sent;     // Handed to MQTT after a reconnect
+  uint32_t dropped;  // Oldest overwritten because the buffer was full
+} Stats;
+
+// Allocates budget bytes; 0 disables buffering
+void begin(size_t budget);
+bool enabled();
+
+void push(const EssStatus &ess);
+// Oldest sample, false when empty
+bool peek(Sample *sample);
+void pop();
+
+EssStatus toStatus(const Sample &sample);
+
+Stats getStats();
+
+} // namespace Backlog
+
+#endif
@@ -0,0 +1,42 @@
+#include "boot.h"
+#include <Arduino.h>
+
+namespace Boot {
+
+namespace {
+
+const char *NAMES[PHASE_COUNT] = {"config", "can",  "keepalive", "battery", "lcd",
+                                  "wifi",   "ota",  "web",       "network", "mqtt"};
+
+portMUX_TYPE bootMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t times[PHASE_COUNT];
+volatile uint32_t reachedMask = 0;
+
+} // namespace
+
+void mark(Phase phase) {
+  if (reachedMask & 1UL << phase) {
+    return; // Cheap path for callers on every frame
+  }
+  uint32_t now = millis();
+  portENTER_CRITICAL(&bootMux);
+  if (!(reachedMask & 1UL << phase)) {
+    times[phase] = now;
+    reachedMask |= 1UL << phase;
+  }
+  portEXIT_CRITICAL(&bootMux);
+}
+
+bool reached(Phase phase) {
+  return reachedMask & 1UL << phase;
+}
+
+uint32_t at(Phase phase) {
+  return reached(phase) ? times[phase] : 0;
+}
+
+const char *phaseName(Phase phase) {
+  return phase < PHASE_COUNT ? NAMES[phase] : "?";
+}
+
+} // namespace Boot
@@ -0,0 +1,35 @@
+#ifndef _BOOT_H_
+#define _BOOT_H_
+
+#include <stdint.h>
+
+namespace Boot {
+
+// Boot timeline: when each phase was first reached, in ms since reset.
+// setup() starts CAN first so the battery gets keep-alives right away, and
+// leaves WiFi (up to 3 minutes in the captive portal) and everything that
+// needs it to a task of its own. /api/boot and "status" show the timeline.
+
+typedef enum : uint8_t {
+  PHASE_CONFIG = 0,  // Preferences loaded
+  PHASE_CAN,         // MCP2515 initialized
+  PHASE_KEEPALIVE,   // First keep-alive sent
+  PHASE_BATTERY,     // First frame from the battery
+  PHASE_LCD,         // Display initialized
+  PHASE_WIFI,        // Connected, or the portal gave up
+  PHASE_OTA,
+  PHASE_WEB,         // Web server, WebSerial and logger
+  PHASE_NETWORK,     // MQTT and Telegram started; loop() serves the network
+  PHASE_MQTT,        // First broker connect
+  PHASE_COUNT
+} Phase;
+
+// First call per phase counts, later ones are ignored
+void mark(Phase phase);
+bool reached(Phase phase);
+uint32_t at(Phase phase); // 0 when not reached
+const char *phaseName(Phase phase);
+
+} // namespace Boot
+
+#endif
@@ -1,5 +1,9 @@
 #include "can.h"
+#include "alerts.h"
+#include "boot.h"
 #include "logger.h"
+#include "telemetry.h"
+#include "trace.h"
 #include "types.h"
 #include <HardwareSerial.h>
 #include <SPI.h>
@@ -26,6 +30,17 @@ static uint32_t lastKeepAliveMillis = 0;
 // CAN initialization status
 static bool canInitialized = false;
 
+// Voltage, current and temperature in frame units since the last
+// takeAggregates(), guarded by stateMux
+typedef struct Accumulator {
+  int64_t sum;
+  int16_t min;
+  int16_t max;
+} Accumulator;
+
+static Accumulator accVoltage, accCurrent, accTemperature;
+static uint32_t accFrames = 0;
+
 void begin(uint8_t core, uint8_t priority);
 void task(void *pvParameters);
 void loop();
@@ -35,7 +50,9 @@ void writeCAN();
 void logReadDataFrame(DataFrame *f);
 void logWriteDataFrame(DataFrame *f);
 int16_t bytesToInt16(uint8_t low, uint8_t high);
-void processDataFrame(DataFrame *f);
+void accumulate(Accumulator &acc, int16_t raw);
+Range toRange(const Accumulator &acc, uint32_t frames, float scale);
+uint32_t processDataFrame(DataFrame *f);
 uint8_t getChargeControlByte();
 DataFrame getChargeDataFrame();
 
@@ -54,6 +71,7 @@ void task(void *pvParameters) {
       if (Cfg.watchdogEnabled) {
         esp_task_wdt_reset();
       }
+      Trace::alive(Trace::TASK_CAN);
 
       vTaskDelay(10 / portTICK_PERIOD_MS); // Small delay to prevent WDT
     }
@@ -72,6 +90,7 @@ bool initCAN() {
     // readCAN() is called from loop() every 10ms which is sufficient
     pinMode(INT_PIN, INPUT);
     canInitialized = true;
+    Boot::mark(Boot::PHASE_CAN);
     LOG_I("CAN", "✓ MCP2515 initialized successfully at 500KBPS");
     LOG_I("CAN", "CAN bus is active and ready");
     return true;
@@ -90,10 +109,12 @@ bool initCAN() {
 }
 
 void loop() {
-  static uint32_t previousMillis;
+  // The first keep-alive goes out right away, the battery may be waiting
+  static uint32_t previousMillis = millis() - Cfg.canKeepAliveInterval;
   uint32_t currentMillis = millis();
 
   readCAN();
+  Telemetry::flush(millis());
 
   // Send keep-alive at configured interval (default: 3 seconds)
   if (currentMillis - previousMillis >= Cfg.canKeepAliveInterval) {
@@ -111,7 +132,16 @@ void readCAN() {
   DataFrame f = {};
   can.readMsgBuf((unsigned long *)&f.id, &f.dlc, f.data);
   // logReadDataFrame(&f);
-  processDataFrame(&f);
+  Boot::mark(Boot::PHASE_BATTERY);
+  uint32_t alerts = Alerts::head();
+  uint32_t changed = processDataFrame(&f);
+  Alerts::evaluate(f.id, millis());
+  if (Alerts::head() != alerts) {
+    changed |= 1UL << Telemetry::FIELD_ALERTS;
+  }
+  if (changed) {
+    Telemetry::publish(changed, millis());
+  }
 
   // vTaskDelay(1000 / portTICK_PERIOD_MS);
 
@@ -162,11 +192,13 @@ void writeCAN() {
 
   // Update counters (quick, inside critical section)
   bool keepAliveOk = (sendStatus == CAN_OK);
+  Trace::keepAlive(keepAliveOk);
   uint32_t failures = 0;
   uint32_t counter = 0;
 
   portENTER_CRITICAL(&keepAliveMux);
   if (keepAliveOk) {
+    Boot::mark(Boot::PHASE_KEEPALIVE);
     keepAliveCounter++;
     lastKeepAliveMillis = millis();
     counter = keepAliveCounter;
@@ -220,8 +252,33 @@ void logWriteDataFrame(DataFrame *f) {
 
 int16_t bytesToInt16(uint8_t low, uint8_t high) { return (high << 8) | low; }
 
-void processDataFrame(DataFrame *f) {
+void accumulate(Accumulator &acc, int16_t raw) {
+  if (accFrames == 0) {
+    acc.sum = raw;
+    acc.min = acc.max = raw;
+    return;
+  }
+  acc.sum += raw;
+  if (raw < acc.min) {
+    acc.min = raw;
+  }
+  if (raw > acc.max) {
+    acc.max = raw;
+  }
+}
+
+Range toRange(const Accumulator &acc, uint32_t frames, float scale) {
+  Range range;
+  range.mean = (float)acc.sum / frames / scale;
+  range.min = acc.min / scale;
+  range.max = acc.max / scale;
+  return range;
+}
+
+// Returns the Telemetry fields the frame changed
+uint32_t processDataFrame(DataFrame *f) {
   portENTER_CRITICAL(&stateMux);
+  EssStatus before = const_cast<EssStatus &>(Ess);
   switch (f->id) {
   case 849: // 0x351 Battery Limits
     Ess.ratedVoltage = bytesToInt16(f->data[0], f->data[1]) / 10.0;
@@ -232,17 +289,27 @@ void processDataFrame(DataFrame *f) {
     Ess.charge = bytesToInt16(f->data[0], f->data[1]);
     Ess.health = bytesToInt16(f->data[2], f->data[3]);
     break;
-  case 854: // 0x356 System Voltage, Current, Temp
-    Ess.voltage = bytesToInt16(f->data[0], f->data[1]) / 100.0;
-    Ess.current = bytesToInt16(f->data[2], f->data[3]) / 10.0;
-    Ess.temperature = bytesToInt16(f->data[4], f->data[5]) / 10.0;
+  case 854: { // 0x356 System Voltage, Current, Temp
+    int16_t voltage = bytesToInt16(f->data[0], f->data[1]);
+    int16_t current = bytesToInt16(f->data[2], f->data[3]);
+    int16_t temperature = bytesToInt16(f->data[4], f->data[5]);
+    Ess.voltage = voltage / 100.0;
+    Ess.current = current / 10.0;
+    Ess.temperature = temperature / 10.0;
+    accumulate(accVoltage, voltage);
+    accumulate(accCurrent, current);
+    accumulate(accTemperature, temperature);
+    accFrames++;
     break;
+  }
   case 857: // 0x359 BMS Error
     Ess.bmsWarning = f->data[1];
     Ess.bmsError = f->data[3];
     break;
   }
+  uint32_t changed = Telemetry::diff(before, const_cast<EssStatus &>(Ess));
   portEXIT_CRITICAL(&stateMux);
+  return changed;
 }
 
 uint8_t getChargeControlByte() {
@@ -310,6 +377,25 @@ EssStatus getEssStatus() {
   return copy;
 }
 
+Aggregates takeAggregates() {
+  Accumulator voltage, current, temperature;
+  Aggregates agg;
+  portENTER_CRITICAL(&stateMux);
+  agg.frames = accFrames;
+  voltage = accVoltage;
+  current = accCurrent;
+  temperature = accTemperature;
+  accFrames = 0;
+  portEXIT_CRITICAL(&stateMux);
+
+  if (agg.frames) {
+    agg.voltage = toRange(voltage, agg.frames, 100);
+    agg.current = toRange(current, agg.frames, 10);
+    agg.temperature = toRange(temperature, agg.frames, 10);
+  }
+  return agg;
+}
+
 bool isInitialized() {
   return canInitialized;
 }
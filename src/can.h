@@ -28,11 +28,28 @@ const DataFrame DF_35A = {0x35a, 8};
 // One Battery (Luxpower)
 const DataFrame DF_379 = {0x379, 1, {0x7e}};
 
+typedef struct Range {
+  float mean;
+  float min;
+  float max;
+} Range;
+
+// Every 0x356 frame since the previous takeAggregates(), so peaks between
+// two publishes are not lost
+typedef struct Aggregates {
+  uint32_t frames; // 0: nothing received, ranges are not valid
+  Range voltage;
+  Range current;
+  Range temperature;
+} Aggregates;
+
 void begin(uint8_t core, uint8_t priority);
 uint32_t getKeepAliveCounter();
 uint32_t getKeepAliveFailures();
 uint32_t getTimeSinceLastKeepAlive();
 EssStatus getEssStatus();
+// Returns the aggregates and starts a new interval
+Aggregates takeAggregates();
 bool isInitialized();
 
 } // namespace CAN
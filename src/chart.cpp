@@ -0,0 +1,320 @@
+#include "chart.h"
+#include "history.h"
+#include <math.h>
+#include <string.h>
+
+namespace Chart {
+
+namespace {
+
+const uint8_t PANEL_HEIGHT = 76;
+const uint8_t PANEL_GAP = 4; // Above each panel
+const uint8_t NONE = 0xFF;
+const uint16_t ROW_BYTES = WIDTH / 2; // 4-bit pixels
+
+typedef enum : uint8_t {
+  COLOR_BACKGROUND = 0,
+  COLOR_FRAME,
+  COLOR_GRID,
+  COLOR_ZERO,
+  COLOR_CHARGE,
+  COLOR_CURRENT,
+  COLOR_VOLTAGE,
+  COLOR_COUNT
+} Color;
+
+// Same dark theme as the web page
+const uint8_t PALETTE[COLOR_COUNT][3] = {
+    {0x1e, 0x1e, 0x1e}, {0x55, 0x55, 0x55}, {0x33, 0x33, 0x33}, {0x88, 0x88, 0x88},
+    {0x4c, 0xaf, 0x50}, {0xff, 0x98, 0x00}, {0x21, 0x96, 0xf3},
+};
+const Color SERIES_COLORS[SERIES_COUNT] = {COLOR_CHARGE, COLOR_CURRENT, COLOR_VOLTAGE};
+
+const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+const uint8_t STORED_HEADER = 5; // BFINAL/BTYPE, LEN, NLEN
+const uint8_t ZLIB_HEADER[2] = {0x78, 0x01};
+
+typedef enum : uint8_t { STAGE_HEADER = 0, STAGE_ROWS, STAGE_END, STAGE_DONE } Stage;
+
+// CRC-32 of PNG chunks, a nibble at a time: 64 bytes of table
+const uint32_t CRC_NIBBLE[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+    0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t crc32(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ CRC_NIBBLE[crc & 0x0F];
+    crc = (crc >> 4) ^ CRC_NIBBLE[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+uint32_t adler32(uint32_t adler, const uint8_t *data, size_t len) {
+  uint32_t a = adler & 0xFFFF;
+  uint32_t b = adler >> 16;
+  for (size_t i = 0; i < len; i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return b << 16 | a;
+}
+
+void put32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// Length and type now, CRC once the data is in
+uint8_t *beginChunk(Renderer &r, const char *type) {
+  memcpy(r.chunk + r.chunkLen + 4, type, 4);
+  return r.chunk + r.chunkLen + 8;
+}
+
+void endChunk(Renderer &r, size_t dataLen) {
+  uint8_t *start = r.chunk + r.chunkLen;
+  put32(start, dataLen);
+  put32(start + 8 + dataLen, crc32(start + 4, dataLen + 4));
+  r.chunkLen += 12 + dataLen;
+}
+
+void writeHeader(Renderer &r) {
+  memcpy(r.chunk, SIGNATURE, sizeof(SIGNATURE));
+  r.chunkLen = sizeof(SIGNATURE);
+
+  uint8_t *p = beginChunk(r, "IHDR");
+  put32(p, WIDTH);
+  put32(p + 4, HEIGHT);
+  p[8] = 4;  // Bit depth
+  p[9] = 3;  // Palette
+  p[10] = 0; // Deflate
+  p[11] = 0; // Adaptive filtering, always "none" here
+  p[12] = 0; // Not interlaced
+  endChunk(r, 13);
+
+  p = beginChunk(r, "PLTE");
+  memcpy(p, PALETTE, sizeof(PALETTE));
+  endChunk(r, sizeof(PALETTE));
+}
+
+uint8_t pixel(const Renderer &r, uint16_t x, uint16_t y) {
+  uint16_t panelY = y % (PANEL_GAP + PANEL_HEIGHT);
+  if (panelY < PANEL_GAP) {
+    return COLOR_BACKGROUND;
+  }
+  uint8_t row = panelY - PANEL_GAP;
+  uint8_t series = y / (PANEL_GAP + PANEL_HEIGHT);
+
+  if (r.lo[series][x] != NONE && row >= r.lo[series][x] && row <= r.hi[series][x]) {
+    return SERIES_COLORS[series];
+  }
+  if (row == 0 || row == PANEL_HEIGHT - 1 || x == 0 || x == WIDTH - 1) {
+    return COLOR_FRAME;
+  }
+  if (series == SERIES_CURRENT && row == r.zeroRow) {
+    return COLOR_ZERO;
+  }
+  // Quarter lines, and a time line every 15 min, hour or 3 h
+  uint32_t minutes = r.hours * 60UL;
+  uint32_t span = WIDTH * (r.hours <= 2 ? 15UL : r.hours <= 12 ? 60UL : 180UL);
+  if (row == PANEL_HEIGHT / 4 || row == PANEL_HEIGHT / 2 || row == PANEL_HEIGHT * 3 / 4 ||
+      x * minutes / span != (x - 1) * minutes / span) {
+    return COLOR_GRID;
+  }
+  return COLOR_BACKGROUND;
+}
+
+// One IDAT chunk: filter byte and pixels as a stored deflate block, the
+// zlib header before the first row and the checksum after the last
+void writeRow(Renderer &r) {
+  bool first = r.row == 0;
+  bool last = r.row == HEIGHT - 1;
+  r.chunkLen = 0;
+  uint8_t *p = beginChunk(r, "IDAT");
+  uint8_t *start = p;
+  if (first) {
+    memcpy(p, ZLIB_HEADER, sizeof(ZLIB_HEADER));
+    p += sizeof(ZLIB_HEADER);
+  }
+  uint16_t blockLen = 1 + ROW_BYTES;
+  p[0] = last ? 1 : 0;
+  p[1] = blockLen;
+  p[2] = blockLen >> 8;
+  p[3] = ~blockLen;
+  p[4] = ~blockLen >> 8;
+  p += STORED_HEADER;
+
+  uint8_t *line = p;
+  *p++ = 0; // Filter: none
+  for (uint16_t x = 0; x < WIDTH; x += 2) {
+    *p++ = pixel(r, x, r.row) << 4 | pixel(r, x + 1, r.row);
+  }
+  r.adler = adler32(r.adler, line, blockLen);
+
+  if (last) {
+    put32(p, r.adler);
+    p += 4;
+  }
+  endChunk(r, p - start);
+  r.row++;
+}
+
+void writeEnd(Renderer &r) {
+  r.chunkLen = 0;
+  beginChunk(r, "IEND");
+  endChunk(r, 0);
+}
+
+uint8_t toRow(const Renderer &r, uint8_t series, float value) {
+  float span = r.scaleMax[series] - r.scaleMin[series];
+  long row = lroundf((r.scaleMax[series] - value) / span * (PANEL_HEIGHT - 1));
+  return row < 0 ? 0 : row > PANEL_HEIGHT - 1 ? PANEL_HEIGHT - 1 : row;
+}
+
+float valueOf(const History::Sample &s, uint8_t series) {
+  switch (series) {
+  case SERIES_CHARGE:
+    return s.charge;
+  case SERIES_CURRENT:
+    return s.current / 10.0f;
+  default:
+    return s.voltage / 100.0f;
+  }
+}
+
+// Sample i of a window ending now; false before boot and for gaps
+bool windowSample(uint32_t window, uint16_t stored, uint32_t i, History::Sample *s) {
+  if (window - i > stored) {
+    return false;
+  }
+  return History::get(stored - (window - i), s) && s->charge != History::NO_DATA;
+}
+
+} // namespace
+
+void begin(Renderer &r, uint8_t hours) {
+  r.hours = hours < 1 ? 1 : hours > MAX_HOURS ? MAX_HOURS : hours;
+  uint32_t window = (uint32_t)r.hours * 3600000UL / History::INTERVAL_MS;
+  uint16_t stored = History::count();
+  History::Sample s;
+
+  for (uint8_t k = 0; k < SERIES_COUNT; k++) {
+    r.data[k] = {0, 0, false};
+  }
+  for (uint32_t i = 0; i < window; i++) {
+    if (!windowSample(window, stored, i, &s)) {
+      continue;
+    }
+    for (uint8_t k = 0; k < SERIES_COUNT; k++) {
+      float v = valueOf(s, k);
+      Range &d = r.data[k];
+      d.min = d.valid && d.min < v ? d.min : v;
+      d.max = d.valid && d.max > v ? d.max : v;
+      d.valid = true;
+    }
+  }
+
+  // Charge always 0-100 %, current always shows zero, voltage zoomed in
+  const Range &current = r.data[SERIES_CURRENT];
+  const Range &voltage = r.data[SERIES_VOLTAGE];
+  r.scaleMin[SERIES_CHARGE] = 0;
+  r.scaleMax[SERIES_CHARGE] = 100;
+  r.scaleMin[SERIES_CURRENT] = current.valid && current.min < 0 ? current.min : 0;
+  r.scaleMax[SERIES_CURRENT] = current.valid && current.max > 0 ? current.max : 0;
+  if (r.scaleMax[SERIES_CURRENT] - r.scaleMin[SERIES_CURRENT] < 2) {
+    r.scaleMin[SERIES_CURRENT] -= 1;
+    r.scaleMax[SERIES_CURRENT] += 1;
+  }
+  r.scaleMin[SERIES_VOLTAGE] = voltage.valid ? voltage.min - 0.1f : 0;
+  r.scaleMax[SERIES_VOLTAGE] = voltage.valid ? voltage.max + 0.1f : 1;
+  r.zeroRow = toRow(r, SERIES_CURRENT, 0);
+
+  // Rows each series covers per column, joined to the column before so
+  // steep changes stay one line
+  uint8_t previous[SERIES_COUNT];
+  memset(previous, NONE, sizeof(previous));
+  for (uint16_t x = 0; x < WIDTH; x++) {
+    uint32_t from = (uint32_t)x * window / WIDTH;
+    uint32_t to = (uint32_t)(x + 1) * window / WIDTH;
+    if (to <= from) {
+      to = from + 1; // Fewer samples than columns
+    }
+    uint8_t last[SERIES_COUNT];
+    memset(last, NONE, sizeof(last));
+    for (uint8_t k = 0; k < SERIES_COUNT; k++) {
+      r.lo[k][x] = NONE;
+      r.hi[k][x] = 0;
+    }
+    for (uint32_t i = from; i < to; i++) {
+      if (!windowSample(window, stored, i, &s)) {
+        continue;
+      }
+      for (uint8_t k = 0; k < SERIES_COUNT; k++) {
+        last[k] = toRow(r, k, valueOf(s, k));
+        r.lo[k][x] = last[k] < r.lo[k][x] ? last[k] : r.lo[k][x];
+        r.hi[k][x] = last[k] > r.hi[k][x] ? last[k] : r.hi[k][x];
+      }
+    }
+    for (uint8_t k = 0; k < SERIES_COUNT; k++) {
+      if (last[k] != NONE && previous[k] != NONE) {
+        r.lo[k][x] = previous[k] < r.lo[k][x] ? previous[k] : r.lo[k][x];
+        r.hi[k][x] = previous[k] > r.hi[k][x] ? previous[k] : r.hi[k][x];
+      }
+      previous[k] = last[k]; // A gap breaks the line
+    }
+  }
+
+  r.stage = STAGE_HEADER;
+  r.row = 0;
+  r.adler = 1;
+  r.chunkLen = 0;
+  r.chunkPos = 0;
+}
+
+size_t size() {
+  return sizeof(SIGNATURE) + (12 + 13) + (12 + sizeof(PALETTE)) +
+         HEIGHT * (12 + STORED_HEADER + 1 + ROW_BYTES) + sizeof(ZLIB_HEADER) + 4 + 12;
+}
+
+size_t read(Renderer &r, uint8_t *buf, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (r.chunkPos == r.chunkLen) {
+      if (r.stage == STAGE_DONE) {
+        break;
+      }
+      r.chunkPos = 0;
+      switch (r.stage) {
+      case STAGE_HEADER:
+        writeHeader(r);
+        r.stage = STAGE_ROWS;
+        break;
+      case STAGE_ROWS:
+        writeRow(r);
+        if (r.row == HEIGHT) {
+          r.stage = STAGE_END;
+        }
+        break;
+      default:
+        writeEnd(r);
+        r.stage = STAGE_DONE;
+        break;
+      }
+    }
+    size_t n = r.chunkLen - r.chunkPos;
+    if (n > len - written) {
+      n = len - written;
+    }
+    memcpy(buf + written, r.chunk + r.chunkPos, n);
+    r.chunkPos += n;
+    written += n;
+  }
+  return written;
+}
+
+} // namespace Chart
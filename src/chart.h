@@ -0,0 +1,57 @@
+#ifndef _CHART_H_
+#define _CHART_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Chart {
+
+// History chart as a PNG that is produced row by row while it is being
+// sent: charge, current and voltage in three stacked panels. Deflate
+// "stored" blocks, one IDAT chunk per row, so the whole image is never in
+// memory and its size is known before the first byte (Content-Length).
+// The renderer only keeps the span each series covers in each column.
+
+const uint16_t WIDTH = 320;
+const uint16_t HEIGHT = 240;
+const uint8_t MAX_HOURS = 24;
+
+typedef enum : uint8_t {
+  SERIES_CHARGE = 0,
+  SERIES_CURRENT,
+  SERIES_VOLTAGE,
+  SERIES_COUNT
+} Series;
+
+typedef struct Range {
+  float min;
+  float max;
+  bool valid; // Any sample in the window
+} Range;
+
+typedef struct Renderer {
+  uint8_t hours;
+  Range data[SERIES_COUNT];  // Values seen, for a caption
+  float scaleMin[SERIES_COUNT];
+  float scaleMax[SERIES_COUNT];
+  uint8_t lo[SERIES_COUNT][WIDTH]; // Panel rows covered per column, NONE: no data
+  uint8_t hi[SERIES_COUNT][WIDTH];
+  uint8_t zeroRow; // Current panel
+  uint8_t stage;
+  uint16_t row; // Next image row
+  uint32_t adler;
+  uint8_t chunk[192]; // Chunk being sent
+  uint16_t chunkLen;
+  uint16_t chunkPos;
+} Renderer;
+
+// Samples the last hours (1..MAX_HOURS) of History
+void begin(Renderer &r, uint8_t hours);
+// PNG bytes read() will produce
+size_t size();
+// Next bytes of the PNG, 0 once all were read
+size_t read(Renderer &r, uint8_t *buf, size_t len);
+
+} // namespace Chart
+
+#endif
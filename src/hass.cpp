@@ -1,226 +1,958 @@
 #include "hass.h"
+#include "alerts.h"
+#include "backlog.h"
+#include "boot.h"
 #include "can.h"
+#include "logger.h"
+#include "mqtt_client.h"
+#include "runtime_cache.h"
+#include "sched.h"
+#include "telemetry.h"
+#include "trace.h"
+#include <Preferences.h>
+#include <WiFi.h>
 #include <esp_task_wdt.h>
+#include <time.h>
 
 extern Config Cfg;
 extern volatile EssStatus Ess;
 
 namespace HASS {
 
-WiFiClient client;
-HADevice device;
-HAMqtt mqtt(client, device);
-HASensorNumber chargeSensor("charge");
-HASensorNumber healthSensor("health");
-HASensorNumber voltageSensor("voltage", HASensorNumber::PrecisionP2);
-HASensorNumber ratedVoltageSensor("rated_voltage", HASensorNumber::PrecisionP2);
-HASensorNumber currentSensor("current", HASensorNumber::PrecisionP1);
-HASensorNumber ratedChargeCurrentSensor("rated_charge_current",
-                                        HASensorNumber::PrecisionP1);
-HASensorNumber ratedDischargeCurrentSensor("rated_discharge_current",
-                                           HASensorNumber::PrecisionP1);
-HASensorNumber temperatureSensor("temperature", HASensorNumber::PrecisionP1);
-HASensor bmsWarningSensor("bms_warning");
-HASensor bmsErrorSensor("bms_error");
+// Topic layout of the ArduinoHA library this replaced, so existing entities,
+// their history and retained configs carry over
+const char *DISCOVERY_PREFIX = "homeassistant";
+const char *DATA_PREFIX = "aha";
+const uint16_t KEEP_ALIVE_S = 30;
+
+const char *DEVICE_NAME = "ESS Monitor";
+const char *DEVICE_MODEL = "ess-monitor";
+const char *DEVICE_MANUFACTURER = "Bimba Perdoling.";
+
+// Discovery configs are retained on the broker, so they only need to go out
+// when something in them changed. A hash of everything that ends up in the
+// configs is kept in NVS; while it matches, the configs are left out of the
+// connect and one retained config (the canary) is checked instead. If the
+// canary is missing, everything is published after all.
+bool skipDiscovery = false;
+
+// Same order as ChannelId
+typedef struct Entity {
+  const char *id;
+  const char *name;
+  const char *icon;
+  const char *deviceClass; // nullptr: none
+  const char *unit;        // nullptr: none
+  uint8_t precision;       // Decimals sent
+} Entity;
+
+const Entity ENTITIES[] = {
+    {"charge", "Charge", "mdi:battery-high", "battery", "%", 0},
+    {"health", "Health", "mdi:heart", nullptr, "%", 0},
+    {"voltage", "Voltage", "mdi:flash-triangle-outline", "voltage", "V", 2},
+    {"rated_voltage", "Rated voltage", "mdi:flash-triangle", "voltage", "V", 2},
+    {"current", "Current", "mdi:current-dc", "current", "A", 1},
+    {"rated_charge_current", "Rated charge current", "mdi:current-dc", "current", "A", 1},
+    {"rated_discharge_current", "Rated discharge current", "mdi:current-dc", "current", "A", 1},
+    {"temperature", "Temperature", "mdi:thermometer", "temperature", "°C", 1},
+    {"bms_warning", "BMS warning", "mdi:alert", "enum", nullptr, 0},
+    {"bms_error", "BMS error", "mdi:alert-octagon", "enum", nullptr, 0},
+    // Aggregation mode only
+    {"voltage_min", "Voltage min", "mdi:flash-triangle-outline", "voltage", "V", 2},
+    {"voltage_max", "Voltage max", "mdi:flash-triangle-outline", "voltage", "V", 2},
+    {"current_min", "Current min", "mdi:current-dc", "current", "A", 1},
+    {"current_max", "Current max", "mdi:current-dc", "current", "A", 1},
+    {"temperature_min", "Temperature min", "mdi:thermometer", "temperature", "°C", 1},
+    {"temperature_max", "Temperature max", "mdi:thermometer", "temperature", "°C", 1},
+};
+const uint8_t ENTITY_COUNT = sizeof(ENTITIES) / sizeof(ENTITIES[0]);
+
+const uint32_t CANARY_TIMEOUT_MS = 3000;
+
+char deviceId[13]; // MAC as hex
+uint32_t discoveryHash = 0;
+char configUrl[24];
+char stateTopic[64];  // JSON state mode only
+char statsTopic[64];  // JSON state mode with aggregation
+char availabilityTopic[64];
+char historyTopic[64];
+char alertTopic[64];
+uint32_t alertCursor = 0; // Alert events missed while offline go out after the reconnect
+char canaryTopic[96];
+volatile bool canaryPending = false; // Written from the MQTT message callback too
+volatile bool canarySeen = false;
+volatile uint32_t canaryDeadlineMs = 0;
+bool canaryUnsubscribe = false; // Checked; the queue refused the UNSUBSCRIBE
+bool discoveryRetry = false; // Queue was full, try again
+uint8_t discoveryNext = 0;   // Next config to queue; ENTITY_COUNT is the alert entity
+
+// Offline buffer drain
+const float DRAIN_PER_SECOND = 10;
+float drainTokens = 0;
+uint32_t lastDrainMs = 0;
+uint32_t lastSampleMs = 0;
+
+uint32_t aggregateMs = 0; // Start of the current aggregation interval
+volatile uint32_t discoverySentCount = 0;
+volatile uint32_t discoverySkippedCount = 0;
+
+// Benchmark requested from WebSerial, run by the task
+volatile uint16_t benchRequest = 0;
+volatile uint8_t benchWindow = 0;
+uint16_t benchLeft = 0;
+uint16_t benchCount = 0;
+uint32_t benchStartMs = 0;
+
+// Last published value per sensor, for deadband and heartbeat checks
+typedef struct Channel {
+  float last;
+  uint32_t lastMs;
+  bool valid;
+} Channel;
+
+typedef enum {
+  CH_CHARGE = 0,
+  CH_HEALTH,
+  CH_VOLTAGE,
+  CH_RATED_VOLTAGE,
+  CH_CURRENT,
+  CH_RATED_CHARGE_CURRENT,
+  CH_RATED_DISCHARGE_CURRENT,
+  CH_TEMPERATURE,
+  CH_BMS_WARNING,
+  CH_BMS_ERROR,
+  CH_VOLTAGE_MIN, // Aggregation mode only from here
+  CH_VOLTAGE_MAX,
+  CH_CURRENT_MIN,
+  CH_CURRENT_MAX,
+  CH_TEMPERATURE_MIN,
+  CH_TEMPERATURE_MAX,
+  CH_COUNT
+} ChannelId;
+
+// Channel sets as bit masks
+const uint32_t SAMPLE_CHANNELS = (1UL << CH_VOLTAGE_MIN) - 1; // Values EssStatus has
+const uint32_t AGGREGATE_CHANNELS =
+    1UL << CH_VOLTAGE | 1UL << CH_CURRENT | 1UL << CH_TEMPERATURE |
+    ((1UL << CH_COUNT) - 1 - SAMPLE_CHANNELS);
+
+static_assert(sizeof(ENTITIES) / sizeof(ENTITIES[0]) == CH_COUNT,
+              "ENTITIES and ChannelId out of sync");
+
+Channel channels[CH_COUNT];
+volatile uint32_t publishedCount = 0;
+volatile uint32_t messageCount = 0;
+volatile uint32_t suppressedCount = 0;
+
+// Connection state machine. Backoff starts at 2 s and doubles up to
+// 5 minutes.
+const uint32_t BACKOFF_MIN_MS = 2000;
+const uint32_t BACKOFF_MAX_MS = 300000;
+
+volatile State state = STATE_WAIT_NETWORK;
+uint32_t taskStartMs = 0;
+uint32_t linkDownMs = 0;     // When the broker was lost, 0 before the first connect
+uint32_t nextAttemptMs = 0;
+uint8_t failedAttempts = 0;  // Since the last successful connect
+volatile uint32_t connectCount = 0;
+volatile uint32_t failedCount = 0;
+volatile uint32_t lastReconnectMs = 0;
+volatile uint32_t maxReconnectMs = 0;
+
+// Status changes come from the bus at most every hassMinInterval seconds
+int8_t subscriber = Telemetry::NO_SUBSCRIBER;
 
 void begin(uint8_t core, uint8_t priority);
+void attach();
 void task(void *pvParameters);
+void setup();
+uint32_t step(uint32_t now);
 void loop();
+void prepareDiscovery();
+void onMessage(const char *topic, const uint8_t *payload, uint16_t length);
+
+const uint32_t TASK_STACK = 20000;
+const uint32_t STEP_MS = 100; // Client events (connected, acks, send window) wake it early
 
 void begin(uint8_t core, uint8_t priority) {
-  xTaskCreatePinnedToCore(task, "hass_task", 20000, NULL, priority, NULL, core);
+  xTaskCreatePinnedToCore(task, "hass_task", TASK_STACK, NULL, priority, NULL, core);
+}
+
+void attach() {
+  Sched::add("hass", Trace::TASK_HASS, setup, step, TASK_STACK);
 }
 
 void task(void *pvParameters) {
   Serial.printf("[HASS] Task running in core %d.\n",
                 (uint32_t)xPortGetCoreID());
 
+  setup();
+
+  while (1) {
+    uint32_t wait = step(millis());
+
+    // Reset watchdog timer to prevent device reboot
+    if (Cfg.watchdogEnabled) {
+      esp_task_wdt_reset();
+    }
+    Trace::alive(Trace::TASK_HASS);
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+  }
+
+  Serial.println("[HASS] Task exited.");
+  vTaskDelete(NULL);
+};
+
+// On the task that runs step(): it owns the MQTT client and is woken by it
+// and by the bus
+void setup() {
   uint8_t mac[6];
   WiFi.macAddress(mac);
-  device.setUniqueId(mac, sizeof(mac));
-  device.enableExtendedUniqueIds();
-  device.setName("ESS Monitor");
-  device.setModel("ess-monitor");
-  device.setManufacturer("Bimba Perdoling.");
-  device.setSoftwareVersion(VERSION);
-  char url[24];
-  String("http://" + WiFi.localIP().toString()).toCharArray(url, sizeof(url));
-  device.setConfigurationUrl(url);
-  device.enableSharedAvailability();
-  device.enableLastWill();
-
-  chargeSensor.setIcon("mdi:battery-high");
-  chargeSensor.setName("Charge");
-  chargeSensor.setDeviceClass("battery");
-  chargeSensor.setUnitOfMeasurement("%");
-
-  healthSensor.setIcon("mdi:heart");
-  healthSensor.setName("Health");
-  healthSensor.setUnitOfMeasurement("%");
-
-  voltageSensor.setIcon("mdi:flash-triangle-outline");
-  voltageSensor.setName("Voltage");
-  voltageSensor.setDeviceClass("voltage");
-  voltageSensor.setUnitOfMeasurement("V");
-
-  ratedVoltageSensor.setIcon("mdi:flash-triangle");
-  ratedVoltageSensor.setName("Rated voltage");
-  ratedVoltageSensor.setDeviceClass("voltage");
-  ratedVoltageSensor.setUnitOfMeasurement("V");
-
-  currentSensor.setIcon("mdi:current-dc");
-  currentSensor.setName("Current");
-  currentSensor.setDeviceClass("current");
-  currentSensor.setUnitOfMeasurement("A");
-
-  ratedChargeCurrentSensor.setIcon("mdi:current-dc");
-  ratedChargeCurrentSensor.setName("Rated charge current");
-  ratedChargeCurrentSensor.setDeviceClass("current");
-  ratedChargeCurrentSensor.setUnitOfMeasurement("A");
-
-  ratedDischargeCurrentSensor.setIcon("mdi:current-dc");
-  ratedDischargeCurrentSensor.setName("Rated discharge current");
-  ratedDischargeCurrentSensor.setDeviceClass("current");
-  ratedDischargeCurrentSensor.setUnitOfMeasurement("A");
-
-  temperatureSensor.setIcon("mdi:thermometer");
-  temperatureSensor.setName("Temperature");
-  temperatureSensor.setDeviceClass("temperature");
-  temperatureSensor.setUnitOfMeasurement("°C");
-
-  bmsWarningSensor.setIcon("mdi:alert");
-  bmsWarningSensor.setDeviceClass("enum");
-  bmsWarningSensor.setName("BMS warning");
-
-  bmsErrorSensor.setIcon("mdi:alert-octagon");
-  bmsErrorSensor.setDeviceClass("enum");
-  bmsErrorSensor.setName("BMS error");
-
-  IPAddress ip;
-  ip.fromString(Cfg.mqttBrokerIp);
+  snprintf(deviceId, sizeof(deviceId), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2],
+           mac[3], mac[4], mac[5]);
+  String("http://" + WiFi.localIP().toString()).toCharArray(configUrl, sizeof(configUrl));
+
+  prepareDiscovery();
+  Backlog::begin(Cfg.hassBufferKb * 1024UL);
+
+  taskStartMs = millis();
+  subscriber = Telemetry::subscribe("hass", xTaskGetCurrentTaskHandle(),
+                                    Telemetry::FIELDS_ALL & ~(1UL << Telemetry::FIELD_ALERTS),
+                                    Cfg.hassMinInterval * 1000UL);
+
+  MqttClient::Options options;
+  options.ip.fromString(Cfg.mqttBrokerIp);
+  options.port = Cfg.mqttPort;
+  options.clientId = deviceId;
+  options.username = nullptr;
+  options.password = nullptr;
+  options.willTopic = availabilityTopic;
+  options.willPayload = "offline";
+  options.keepAlive = KEEP_ALIVE_S;
 
   // Use authentication if username and password are provided
   if (strlen(Cfg.mqttUsername) > 0 && strlen(Cfg.mqttPassword) > 0) {
     Serial.printf("[HASS] Connecting to MQTT broker %s:%d with authentication (user: %s)\n",
                   Cfg.mqttBrokerIp, Cfg.mqttPort, Cfg.mqttUsername);
-    mqtt.begin(ip, Cfg.mqttPort, Cfg.mqttUsername, Cfg.mqttPassword);
+    options.username = Cfg.mqttUsername;
+    options.password = Cfg.mqttPassword;
   } else {
     Serial.printf("[HASS] Connecting to MQTT broker %s:%d without authentication\n",
                   Cfg.mqttBrokerIp, Cfg.mqttPort);
-    mqtt.begin(ip, Cfg.mqttPort);
   }
+  // This task owns the client
+  MqttClient::begin(options);
+  MqttClient::onMessage(onMessage);
 
-  Serial.println("[HASS] Waiting for MQTT connection...");
+  Serial.printf("[HASS] Device info: Name='%s', Model='%s', MAC=%02X:%02X:%02X:%02X:%02X:%02X\n",
+                DEVICE_NAME, DEVICE_MODEL, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  Serial.printf("[HASS] MQTT will publish to discovery prefix: %s\n", DISCOVERY_PREFIX);
+  Serial.printf("[HASS] Number of entities to publish: %u sensors\n", ENTITY_COUNT);
 
-  // Wait for MQTT connection to establish
-  uint8_t connectionAttempts = 0;
-  while (!mqtt.isConnected() && connectionAttempts < 30) {
-    mqtt.loop();
-    vTaskDelay(500 / portTICK_PERIOD_MS);
-    connectionAttempts++;
-    if (connectionAttempts % 5 == 0) {
-      Serial.printf("[HASS] Still connecting... attempt %d/30\n", connectionAttempts);
+  // No waiting here: loop() connects, publishes as soon as the broker
+  // accepts us and backs off on failures
+}
+
+uint32_t step(uint32_t now) {
+  loop();
+  return STEP_MS;
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.published = publishedCount;
+  stats.suppressed = suppressedCount;
+  stats.messages = messageCount;
+  stats.state = state;
+  stats.connects = connectCount;
+  stats.failedAttempts = failedCount;
+  stats.lastReconnectMs = lastReconnectMs;
+  stats.maxReconnectMs = maxReconnectMs;
+  stats.discoverySent = discoverySentCount;
+  stats.discoverySkipped = discoverySkippedCount;
+  return stats;
+}
+
+// deadband 0 means any change
+bool isDue(ChannelId id, float value, float deadband, uint32_t now) {
+  const Channel &ch = channels[id];
+  if (!ch.valid) {
+    return true;
+  }
+  uint32_t age = now - ch.lastMs;
+  if (age >= Cfg.hassHeartbeat * 1000UL) {
+    return true;
+  }
+  if (age < Cfg.hassMinInterval * 1000UL) {
+    return false;
+  }
+  return deadband > 0 ? fabsf(value - ch.last) >= deadband : value != ch.last;
+}
+
+// Channels sent on change; with aggregation on, voltage, current and
+// temperature are sent once per interval instead
+uint32_t liveChannels() {
+  return Cfg.hassAggregate ? SAMPLE_CHANNELS & ~AGGREGATE_CHANNELS : SAMPLE_CHANNELS;
+}
+
+uint32_t discoveredChannels() {
+  return Cfg.hassAggregate ? SAMPLE_CHANNELS | AGGREGATE_CHANNELS : SAMPLE_CHANNELS;
+}
+
+float deadband(ChannelId id) {
+  switch (id) {
+  case CH_CHARGE:
+    return Cfg.hassDbCharge;
+  case CH_VOLTAGE:
+    return Cfg.hassDbVoltage;
+  case CH_CURRENT:
+    return Cfg.hassDbCurrent;
+  case CH_TEMPERATURE:
+    return Cfg.hassDbTemperature;
+  default:
+    return 0; // Any change
+  }
+}
+
+// Some live channel has not been sent for hassHeartbeat seconds
+bool heartbeatDue(uint32_t now) {
+  uint32_t mask = liveChannels();
+  for (uint8_t i = 0; i < CH_COUNT; i++) {
+    const Channel &ch = channels[i];
+    if ((mask & 1UL << i) && (!ch.valid || now - ch.lastMs >= Cfg.hassHeartbeat * 1000UL)) {
+      return true;
     }
   }
+  return false;
+}
 
-  if (mqtt.isConnected()) {
-    Serial.println("[HASS] ✓ MQTT connected successfully!");
-  } else {
-    Serial.println("[HASS] ⚠️ WARNING: Could not connect to MQTT broker!");
+void markPublished(ChannelId id, float value, uint32_t now) {
+  channels[id].last = value;
+  channels[id].lastMs = now;
+  channels[id].valid = true;
+  publishedCount++;
+}
+
+void entityTopic(char *out, size_t size, const Entity &e, const char *suffix) {
+  snprintf(out, size, "%s/%s/%s/%s", DATA_PREFIX, deviceId, e.id, suffix);
+}
+
+void sendValue(ChannelId id, float value, uint32_t now) {
+  const Entity &e = ENTITIES[id];
+  char topic[96];
+  entityTopic(topic, sizeof(topic), e, "stat_t");
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%.*f", e.precision, value);
+  if (MqttClient::publish(topic, buf, false)) {
+    markPublished(id, value, now);
+    messageCount++;
   }
+}
 
-  // Start MQTT loop immediately to publish discovery messages
-  Serial.println("[HASS] Starting MQTT loop and publishing discovery...");
-  Serial.printf("[HASS] Device info: Name='%s', Model='%s', MAC=%02X:%02X:%02X:%02X:%02X:%02X\n",
-                "ESS Monitor", "ess-monitor", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  Serial.printf("[HASS] MQTT will publish to discovery prefix: homeassistant\n");
-  Serial.printf("[HASS] Number of entities to publish: 10 sensors\n");
+void publishValue(ChannelId id, float value, uint32_t now) {
+  if (!isDue(id, value, deadband(id), now)) {
+    suppressedCount++;
+    return;
+  }
+  sendValue(id, value, now);
+}
 
-  // Run initial loops to publish discovery and establish connection
-  for (int i = 0; i < 100; i++) {
-    mqtt.loop();
-    vTaskDelay(200 / portTICK_PERIOD_MS);
+const char *stateToString(State s) {
+  return s == STATE_WAIT_NETWORK ? "waiting for network" :
+         s == STATE_CONNECTING ? "connecting" :
+         s == STATE_DISCOVERY ? "discovery" :
+         s == STATE_ONLINE ? "online" : "backoff";
+}
 
-    // CRITICAL FIX: Reset watchdog during long initialization (20 seconds total)
-    if (Cfg.watchdogEnabled) {
-      esp_task_wdt_reset();
+// JSON state mode: one document with every value, sent when any of them is
+// due, so Home Assistant always sees a consistent sample
+void toValues(const EssStatus &ess, float *values) {
+  values[CH_CHARGE] = ess.charge;
+  values[CH_HEALTH] = ess.health;
+  values[CH_VOLTAGE] = ess.voltage;
+  values[CH_RATED_VOLTAGE] = ess.ratedVoltage;
+  values[CH_CURRENT] = ess.current;
+  values[CH_RATED_CHARGE_CURRENT] = ess.ratedChargeCurrent;
+  values[CH_RATED_DISCHARGE_CURRENT] = ess.ratedDischargeCurrent;
+  values[CH_TEMPERATURE] = ess.temperature;
+  values[CH_BMS_WARNING] = ess.bmsWarning;
+  values[CH_BMS_ERROR] = ess.bmsError;
+}
+
+// {<head>"charge":87,...} with the channels in mask; false if it does not fit
+bool formatDocument(char *doc, size_t size, const char *head, const float *values,
+                    uint32_t mask) {
+  size_t len = snprintf(doc, size, "{%s", head);
+  bool first = true;
+  for (uint8_t i = 0; i < CH_COUNT && len < size; i++) {
+    if (!(mask & 1UL << i)) {
+      continue;
     }
+    len += snprintf(doc + len, size - len, "%s\"%s\":%.*f", first ? "" : ",", ENTITIES[i].id,
+                    ENTITIES[i].precision, values[i]);
+    first = false;
+  }
+  if (len + 2 > size) {
+    return false;
+  }
+  doc[len++] = '}';
+  doc[len] = '\0';
+  return true;
+}
 
-    if (i % 20 == 0) {
-      Serial.printf("[HASS] Discovery progress: %d/100 loops... (connected: %s)\n",
-                    i, mqtt.isConnected() ? "YES" : "NO");
+// One document with the channels in mask to topic
+bool sendDocument(const char *topic, const char *head, const float *values, uint32_t mask,
+                  uint32_t now) {
+  char doc[256];
+  if (!formatDocument(doc, sizeof(doc), head, values, mask)) {
+    LOG_E("HASS", "State document too long");
+    return false;
+  }
+  if (!MqttClient::publish(topic, doc, false)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < CH_COUNT; i++) {
+    if (mask & 1UL << i) {
+      markPublished((ChannelId)i, values[i], now);
     }
   }
+  messageCount++;
+  return true;
+}
 
-  Serial.println("[HASS] ✓ Discovery published, entering main loop.");
+void publishState(uint32_t now, const float *values, uint32_t mask) {
+  bool due = false;
+  for (uint8_t i = 0; i < CH_COUNT && !due; i++) {
+    due = (mask & 1UL << i) && isDue((ChannelId)i, values[i], deadband((ChannelId)i), now);
+  }
+  if (!due) {
+    suppressedCount++;
+    return;
+  }
+  sendDocument(stateTopic, "", values, mask, now);
+}
 
-  while (1) {
-    loop();
+void publishValues(uint32_t now) {
+  // Get thread-safe copy of battery status
+  EssStatus ess = CAN::getEssStatus();
+  float values[CH_COUNT];
+  toValues(ess, values);
+  uint32_t mask = liveChannels();
 
-    // Reset watchdog timer to prevent device reboot
-    if (Cfg.watchdogEnabled) {
-      esp_task_wdt_reset();
+  if (Cfg.hassJsonState) {
+    publishState(now, values, mask);
+    return;
+  }
+
+  for (uint8_t i = 0; i < CH_COUNT; i++) {
+    if (mask & 1UL << i) {
+      publishValue((ChannelId)i, values[i], now);
     }
+  }
+}
 
-    vTaskDelay(100 / portTICK_PERIOD_MS); // Small delay to prevent task starvation
+// Aggregation mode: mean (under the plain entity), min and max of every CAN
+// frame in the interval. Sent whole, without deadband or heartbeat checks.
+void publishAggregates(uint32_t now) {
+  aggregateMs = now;
+  CAN::Aggregates agg = CAN::takeAggregates();
+  if (!agg.frames) {
+    return; // Nothing from the battery this interval
+  }
+  float values[CH_COUNT];
+  values[CH_VOLTAGE] = agg.voltage.mean;
+  values[CH_VOLTAGE_MIN] = agg.voltage.min;
+  values[CH_VOLTAGE_MAX] = agg.voltage.max;
+  values[CH_CURRENT] = agg.current.mean;
+  values[CH_CURRENT_MIN] = agg.current.min;
+  values[CH_CURRENT_MAX] = agg.current.max;
+  values[CH_TEMPERATURE] = agg.temperature.mean;
+  values[CH_TEMPERATURE_MIN] = agg.temperature.min;
+  values[CH_TEMPERATURE_MAX] = agg.temperature.max;
+
+  if (Cfg.hassJsonState) {
+    char head[24];
+    snprintf(head, sizeof(head), "\"frames\":%lu,", agg.frames);
+    sendDocument(statsTopic, head, values, AGGREGATE_CHANNELS, now);
+    return;
   }
+  for (uint8_t i = 0; i < CH_COUNT; i++) {
+    if (AGGREGATE_CHANNELS & 1UL << i) {
+      sendValue((ChannelId)i, values[i], now);
+    }
+  }
+}
 
-  Serial.println("[HASS] Task exited.");
-  vTaskDelete(NULL);
-};
+// FNV-1a, strings separated so "ab"+"c" and "a"+"bc" differ
+uint32_t hashString(uint32_t hash, const char *str) {
+  if (str) {
+    while (*str) {
+      hash = (hash ^ (uint8_t)*str++) * 16777619UL;
+    }
+  }
+  return (hash ^ 0x1F) * 16777619UL;
+}
 
-void loop() {
-  static uint32_t previousMillis = 0;
-  static uint32_t statusCheckMillis = 0;
-  static bool firstRun = true;
-  uint32_t currentMillis = millis();
+void prepareDiscovery() {
+  snprintf(stateTopic, sizeof(stateTopic), "%s/%s/state", DATA_PREFIX, deviceId);
+  snprintf(statsTopic, sizeof(statsTopic), "%s/%s/stats", DATA_PREFIX, deviceId);
+  snprintf(availabilityTopic, sizeof(availabilityTopic), "%s/%s/avty_t", DATA_PREFIX,
+           deviceId);
+  snprintf(historyTopic, sizeof(historyTopic), "%s/%s/history", DATA_PREFIX, deviceId);
+  snprintf(alertTopic, sizeof(alertTopic), "%s/%s/alert", DATA_PREFIX, deviceId);
+
+  // Everything that ends up in a config payload or topic
+  uint32_t hash = 2166136261UL;
+  hash = hashString(hash, VERSION);
+  hash = hashString(hash, DISCOVERY_PREFIX);
+  hash = hashString(hash, DATA_PREFIX);
+  hash = hashString(hash, deviceId);
+  hash = hashString(hash, DEVICE_NAME);
+  hash = hashString(hash, DEVICE_MODEL);
+  hash = hashString(hash, DEVICE_MANUFACTURER);
+  hash = hashString(hash, configUrl);
+  hash = hashString(hash, Cfg.hassJsonState ? stateTopic : nullptr);
+  hash = hashString(hash, Cfg.hassJsonState && Cfg.hassAggregate ? statsTopic : nullptr);
+  for (uint8_t i = 0; i < ENTITY_COUNT; i++) {
+    if (!(discoveredChannels() & 1UL << i)) {
+      continue;
+    }
+    const Entity &e = ENTITIES[i];
+    hash = hashString(hash, e.id);
+    hash = hashString(hash, e.name);
+    hash = hashString(hash, e.icon);
+    hash = hashString(hash, e.deviceClass);
+    hash = hashString(hash, e.unit);
+    hash = (hash ^ e.precision) * 16777619UL;
+  }
+  hash = hashString(hash, alertTopic);
+  for (uint8_t i = 0; i < Alerts::RULE_COUNT; i++) {
+    hash = hashString(hash, Alerts::ruleName((Alerts::Rule)i));
+  }
+  discoveryHash = hash;
+
+  Preferences prefs;
+  prefs.begin("ess", true);
+  uint32_t stored = prefs.getULong(CFG_HASS_DISCOVERY_HASH, 0);
+  prefs.end();
+  skipDiscovery = stored == hash;
+
+  snprintf(canaryTopic, sizeof(canaryTopic), "%s/sensor/%s/%s/config", DISCOVERY_PREFIX,
+           deviceId, ENTITIES[CH_CHARGE].id);
+  LOG_I("HASS", "Discovery hash %08lx (stored %08lx), %s", hash, stored,
+        skipDiscovery ? "checking broker before resending" : "full discovery");
+}
 
-  // Check MQTT connection status every 30 seconds
-  if (currentMillis - statusCheckMillis >= 1000 * 30) {
-    statusCheckMillis = currentMillis;
-    Serial.printf("[HASS] MQTT connection status: %s\n",
-                  mqtt.isConnected() ? "CONNECTED" : "DISCONNECTED");
+void storeDiscoveryHash() {
+  Preferences prefs;
+  prefs.begin("ess");
+  if (prefs.getULong(CFG_HASS_DISCOVERY_HASH, 0) != discoveryHash) {
+    prefs.putULong(CFG_HASS_DISCOVERY_HASH, discoveryHash);
   }
+  prefs.end();
+  skipDiscovery = true; // Reconnects only need the canary check
+}
+
+void invalidateChannels() {
+  for (uint8_t i = 0; i < CH_COUNT; i++) {
+    channels[i].valid = false;
+  }
+}
+
+// Availability and device block every config ends with
+int formatDevice(char *out, size_t size) {
+  return snprintf(out, size,
+                  "\"avty_t\":\"%s\",\"dev\":{\"ids\":\"%s\",\"name\":\"%s\",\"mdl\":\"%s\","
+                  "\"mf\":\"%s\",\"sw\":\"%s\",\"cu\":\"%s\"}}",
+                  availabilityTopic, deviceId, DEVICE_NAME, DEVICE_MODEL,
+                  DEVICE_MANUFACTURER, VERSION, configUrl);
+}
 
-  // Publish initial values immediately, then every 5 seconds
-  if (firstRun || (currentMillis - previousMillis >= 1000 * 5)) {
-    previousMillis = currentMillis;
+// Per-sensor mode points each entity at its own state topic, JSON state
+// mode at the shared document with a value_template
+bool publishConfig(ChannelId id) {
+  const Entity &e = ENTITIES[id];
+  char topic[96];
+  snprintf(topic, sizeof(topic), "%s/sensor/%s/%s/config", DISCOVERY_PREFIX, deviceId, e.id);
+  if (!(discoveredChannels() & 1UL << id)) {
+    // Empty retained config removes the entity (aggregation turned off)
+    return MqttClient::publish(topic, "", true);
+  }
+
+  char payload[512];
+  int len = snprintf(payload, sizeof(payload),
+                     "{\"name\":\"%s\",\"uniq_id\":\"%s_%s\",\"ic\":\"%s\",",
+                     e.name, deviceId, e.id, e.icon);
+  if (e.deviceClass) {
+    len += snprintf(payload + len, sizeof(payload) - len, "\"dev_cla\":\"%s\",",
+                    e.deviceClass);
+  }
+  if (e.unit) {
+    len += snprintf(payload + len, sizeof(payload) - len, "\"unit_of_meas\":\"%s\",",
+                    e.unit);
+  }
+  if (Cfg.hassJsonState) {
+    const char *state = Cfg.hassAggregate && (AGGREGATE_CHANNELS & 1UL << id) ? statsTopic
+                                                                              : stateTopic;
+    len += snprintf(payload + len, sizeof(payload) - len,
+                    "\"stat_t\":\"%s\",\"val_tpl\":\"{{value_json.%s}}\",", state, e.id);
+  } else {
+    char state[96];
+    entityTopic(state, sizeof(state), e, "stat_t");
+    len += snprintf(payload + len, sizeof(payload) - len, "\"stat_t\":\"%s\",", state);
+  }
+  if (len < (int)sizeof(payload)) {
+    len += formatDevice(payload + len, sizeof(payload) - len);
+  }
+  if (len >= (int)sizeof(payload)) {
+    LOG_E("HASS", "Discovery config for %s too long", e.id);
+    return false;
+  }
+  return MqttClient::publish(topic, payload, true);
+}
 
-#ifdef DEBUG
-    Serial.printf("[HASS] Publishing sensor updates (connected: %s)...\n",
-                  mqtt.isConnected() ? "YES" : "NO");
-#endif
+// One event entity for all alert rules, event types "<rule>" when raised
+// and "<rule>_cleared"
+bool publishAlertConfig() {
+  char topic[96];
+  snprintf(topic, sizeof(topic), "%s/event/%s/alert/config", DISCOVERY_PREFIX, deviceId);
+
+  char payload[768];
+  int len = snprintf(payload, sizeof(payload),
+                     "{\"name\":\"Alert\",\"uniq_id\":\"%s_alert\",\"ic\":\"mdi:bell-alert\","
+                     "\"stat_t\":\"%s\",\"evt_typ\":[",
+                     deviceId, alertTopic);
+  for (uint8_t i = 0; i < Alerts::RULE_COUNT && len < (int)sizeof(payload); i++) {
+    const char *name = Alerts::ruleName((Alerts::Rule)i);
+    len += snprintf(payload + len, sizeof(payload) - len, "%s\"%s\",\"%s_cleared\"",
+                    i ? "," : "", name, name);
+  }
+  if (len < (int)sizeof(payload)) {
+    len += snprintf(payload + len, sizeof(payload) - len, "],");
+  }
+  if (len < (int)sizeof(payload)) {
+    len += formatDevice(payload + len, sizeof(payload) - len);
+  }
+  if (len >= (int)sizeof(payload)) {
+    LOG_E("HASS", "Discovery config for alert too long");
+    return false;
+  }
+  return MqttClient::publish(topic, payload, true);
+}
 
-    if (firstRun) {
-      Serial.println("[HASS] First sensor value publication...");
-      firstRun = false;
+// fromStart: a full set. Otherwise the retry goes on from the config the
+// queue refused, the ones before it are still queued. The hash is only
+// stored once all went out.
+void publishDiscovery(bool fromStart) {
+  if (fromStart) {
+    discoveryNext = 0;
+  }
+  for (; discoveryNext <= ENTITY_COUNT; discoveryNext++) {
+    bool queued = discoveryNext < ENTITY_COUNT ? publishConfig((ChannelId)discoveryNext)
+                                               : publishAlertConfig();
+    if (!queued) {
+      LOG_W("HASS", "MQTT queue full, discovery resumed later at %u", discoveryNext);
+      discoveryRetry = true;
+      return;
     }
+  }
+  discoveryRetry = false;
+  discoverySentCount++;
+  storeDiscoveryHash();
+}
 
-    // Get thread-safe copy of battery status
-    EssStatus ess = CAN::getEssStatus();
+// MQTT message callback, runs in the AsyncTCP task
+void onMessage(const char *topic, const uint8_t *payload, uint16_t length) {
+  if (canaryPending && strcmp(topic, canaryTopic) == 0) {
+    canarySeen = length > 0;
+    canaryDeadlineMs = millis(); // Answered, decide on the next check
+  }
+}
 
-    char buf[4];
+void checkCanary(uint32_t now) {
+  if (!canaryPending || (int32_t)(now - canaryDeadlineMs) < 0) {
+    return;
+  }
+  canaryPending = false;
+  // Otherwise every hash-verify publish of the config comes back to us
+  canaryUnsubscribe = !MqttClient::unsubscribe(canaryTopic);
+  if (canarySeen) {
+    discoverySkippedCount++;
+    LOG_I("HASS", "Broker still has the discovery configs, %u not resent",
+          __builtin_popcount(discoveredChannels()));
+    return;
+  }
+  // Broker lost its retained messages or the entity was removed
+  LOG_W("HASS", "Retained discovery config missing, publishing all");
+  publishDiscovery(true);
+  // Values sent before the configs existed were dropped by Home Assistant
+  invalidateChannels();
+}
 
-    chargeSensor.setValue(ess.charge);
-    healthSensor.setValue(ess.health);
-    voltageSensor.setValue(ess.voltage);
-    ratedVoltageSensor.setValue(ess.ratedVoltage);
-    currentSensor.setValue(ess.current);
-    ratedChargeCurrentSensor.setValue(ess.ratedChargeCurrent);
-    ratedDischargeCurrentSensor.setValue(ess.ratedDischargeCurrent);
-    temperatureSensor.setValue(ess.temperature);
-    sprintf(buf, "%d", ess.bmsWarning);
-    bmsWarningSensor.setValue(buf);
-    sprintf(buf, "%d", ess.bmsError);
-    bmsErrorSensor.setValue(buf);
+// Alert events as Home Assistant events, not retained: each is a moment,
+// not a state. The cursor only moves on once the queue took the message.
+void publishAlerts() {
+  Alerts::Event event;
+  uint32_t cursor = alertCursor;
+  while (Alerts::next(&cursor, &event)) {
+    char payload[96];
+    snprintf(payload, sizeof(payload), "{\"event_type\":\"%s%s\",\"value\":%.1f}",
+             Alerts::ruleName(event.rule), event.active ? "" : "_cleared", event.value);
+    if (!MqttClient::publish(alertTopic, payload, false)) {
+      return; // Queue full, again on the next pass
+    }
+    messageCount++;
+    alertCursor = cursor;
+  }
+}
 
-#ifdef DEBUG
-    Serial.printf("[HASS] Published: SOC=%d%%, SOH=%d%%, V=%.2f, I=%.1f, T=%.1f\n",
-                  ess.charge, ess.health, ess.voltage, ess.current, ess.temperature);
-#endif
+void onLinkUp(uint32_t now) {
+  uint32_t latency = now - (linkDownMs ? linkDownMs : taskStartMs);
+  Boot::mark(Boot::PHASE_MQTT);
+  connectCount++;
+  lastReconnectMs = latency;
+  if (linkDownMs && latency > maxReconnectMs) {
+    maxReconnectMs = latency;
   }
+  failedAttempts = 0;
+  lastDrainMs = now;
+  drainTokens = 0;
+  Trace::mark(Trace::MARK_MQTT, 1);
+  LOG_I("HASS", "MQTT connected after %lu ms", latency);
+
+  MqttClient::publish(availabilityTopic, "online", true);
+  if (skipDiscovery) {
+    // The retained canary arrives right after subscribing
+    canarySeen = false;
+    canaryDeadlineMs = now + CANARY_TIMEOUT_MS;
+    canaryPending = MqttClient::subscribe(canaryTopic);
+    if (!canaryPending) {
+      publishDiscovery(true);
+    }
+  } else {
+    publishDiscovery(true);
+  }
+
+  invalidateChannels(); // Every value is sent again
+  state = STATE_DISCOVERY;
+}
+
+void scheduleRetry(uint32_t now) {
+  uint32_t waitMs = BACKOFF_MIN_MS;
+  for (uint8_t i = 0; i < failedAttempts && waitMs < BACKOFF_MAX_MS; i++) {
+    waitMs *= 2;
+  }
+  if (waitMs > BACKOFF_MAX_MS) {
+    waitMs = BACKOFF_MAX_MS;
+  }
+  // +-25% jitter so devices do not reconnect in lockstep after a broker restart
+  waitMs = waitMs / 100 * (75 + esp_random() % 51);
+  nextAttemptMs = now + waitMs;
+  if (failedAttempts < UINT8_MAX) {
+    failedAttempts++;
+  }
+  state = STATE_BACKOFF;
+}
+
+void onLinkDown(uint32_t now) {
+  linkDownMs = now;
+  failedAttempts = 0;
+  canaryPending = false; // Checked again after the reconnect
+  canaryUnsubscribe = false; // Clean session, the subscription is gone
+  nextAttemptMs = now; // First retry right away
+  state = STATE_BACKOFF;
+  Trace::mark(Trace::MARK_MQTT, 0);
+  lastSampleMs = now; // First offline sample one interval from now
+  LOG_W("HASS", "MQTT connection lost");
+}
 
-  mqtt.loop();
+// While the broker is unreachable, a sample every hassBufferInterval
+// seconds goes into the backlog
+void recordOffline(uint32_t now) {
+  if (!Backlog::enabled() || now - lastSampleMs < Cfg.hassBufferInterval * 1000UL) {
+    return;
+  }
+  lastSampleMs = now;
+  EssStatus ess = CAN::getEssStatus();
+  if (ess.voltage > 0) { // Nothing from the battery yet otherwise
+    Backlog::push(ess);
+  }
+}
+
+// Sends buffered samples to <data prefix>/<device>/history, oldest first.
+// Home Assistant cannot backdate MQTT sensor states, so they go to their
+// own topic with the time they were taken, for recorders that can. Limited
+// to DRAIN_PER_SECOND and to a mostly empty queue, so live values and
+// discovery are never held up.
+void drainBacklog(uint32_t now) {
+  drainTokens += (now - lastDrainMs) * DRAIN_PER_SECOND / 1000.0f;
+  if (drainTokens > DRAIN_PER_SECOND) {
+    drainTokens = DRAIN_PER_SECOND;
+  }
+  lastDrainMs = now;
+
+  Backlog::Sample sample;
+  while (drainTokens >= 1 && Backlog::peek(&sample)) {
+    MqttClient::Stats stats = MqttClient::getStats();
+    if (stats.queued > stats.capacity / 4) {
+      break;
+    }
+
+    // Unix time once SNTP has set the clock, otherwise the age in seconds
+    char head[48];
+    uint32_t ageMs = now - sample.ms;
+    time_t t = time(nullptr);
+    if (t > 1600000000) {
+      snprintf(head, sizeof(head), "\"ts\":%lu,", (uint32_t)(t - ageMs / 1000));
+    } else {
+      snprintf(head, sizeof(head), "\"age\":%lu,", ageMs / 1000);
+    }
+    float values[CH_COUNT];
+    toValues(Backlog::toStatus(sample), values);
+    char doc[288];
+    if (!formatDocument(doc, sizeof(doc), head, values, SAMPLE_CHANNELS)) {
+      Backlog::pop(); // Cannot happen with the fixed layout; do not get stuck
+      continue;
+    }
+    if (!MqttClient::publish(historyTopic, doc, false)) {
+      break;
+    }
+    Backlog::pop();
+    drainTokens -= 1;
+  }
+}
+
+// QoS 1 publishes to <data prefix>/<device>/bench, as fast as the queue
+// takes them; done when every one is acknowledged
+void runBenchmark(uint32_t now) {
+  if (benchRequest && !benchLeft) {
+    benchCount = benchLeft = benchRequest;
+    benchRequest = 0;
+    benchStartMs = now;
+    MqttClient::setWindow(benchWindow);
+    MqttClient::resetLatency();
+  }
+  if (!benchCount) {
+    return;
+  }
+
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s/%s/bench", DATA_PREFIX, deviceId);
+  char payload[65];
+  while (benchLeft) {
+    // Half the queue at most, discovery and values must still fit
+    MqttClient::Stats stats = MqttClient::getStats();
+    if (stats.queued > stats.capacity / 2) {
+      break; // More on the next pass
+    }
+    snprintf(payload, sizeof(payload), "%-64u", benchCount - benchLeft);
+    if (!MqttClient::publish(topic, payload, false)) {
+      break;
+    }
+    benchLeft--;
+  }
+
+  if (!benchLeft && MqttClient::idle()) {
+    uint32_t ms = now - benchStartMs;
+    MqttClient::Stats stats = MqttClient::getStats();
+    LOG_I("HASS", "MQTT bench: %u QoS 1 publishes (64 B, window %u) in %lu ms, %lu msg/s, "
+                  "PUBACK latency avg %lu us, max %lu us",
+          benchCount, benchWindow, ms, ms ? benchCount * 1000UL / ms : 0,
+          stats.ackLatencyAvgUs, stats.ackLatencyMaxUs);
+    benchCount = 0;
+    MqttClient::setWindow(0);
+  }
+}
+
+void benchmark(uint16_t count, uint8_t window) {
+  benchWindow = window;
+  benchRequest = count;
+}
+
+void loop() {
+  static uint32_t previousMillis = 0;
+  static uint32_t statusCheckMillis = 0;
+
+  MqttClient::loop();
+  uint32_t now = millis();
+
+  switch (state) {
+  case STATE_WAIT_NETWORK:
+    recordOffline(now);
+    if (RuntimeCache::isWifiConnected()) {
+      MqttClient::connect();
+      state = STATE_CONNECTING;
+    }
+    break;
+
+  case STATE_BACKOFF:
+    recordOffline(now);
+    if (!RuntimeCache::isWifiConnected()) {
+      state = STATE_WAIT_NETWORK;
+    } else if ((int32_t)(now - nextAttemptMs) >= 0) {
+      MqttClient::connect();
+      state = STATE_CONNECTING;
+    }
+    break;
+
+  case STATE_CONNECTING:
+    recordOffline(now);
+    // The client reports connected or gives up (refused, timeout) by itself
+    if (MqttClient::isConnected()) {
+      onLinkUp(now);
+    } else if (MqttClient::getState() == MqttClient::STATE_DISCONNECTED) {
+      failedCount++;
+      scheduleRetry(now);
+      LOG_W("HASS", "MQTT connect to %s:%u failed, retry %u in %lu ms", Cfg.mqttBrokerIp,
+            Cfg.mqttPort, failedAttempts, nextAttemptMs - now);
+    }
+    break;
+
+  case STATE_DISCOVERY:
+    publishValues(now);
+    if (Cfg.hassAggregate) {
+      publishAggregates(now); // Interval so far, values were invalidated
+    }
+    previousMillis = now;
+    state = STATE_ONLINE;
+    break;
+
+  case STATE_ONLINE:
+    if (!MqttClient::isConnected()) {
+      onLinkDown(now);
+      break;
+    }
+    checkCanary(now);
+    publishAlerts();
+    runBenchmark(now);
+    drainBacklog(now);
+    // Only when the bus reported a change or a heartbeat is due; each
+    // sensor still decides on its deadband
+    if (Telemetry::take(subscriber, now) || heartbeatDue(now)) {
+      publishValues(now);
+    }
+    if (now - previousMillis >= 1000) {
+      if (discoveryRetry) {
+        publishDiscovery(false);
+      }
+      if (canaryUnsubscribe) {
+        canaryUnsubscribe = !MqttClient::unsubscribe(canaryTopic);
+      }
+      previousMillis = now;
+      if (Cfg.hassAggregate && now - aggregateMs >= Cfg.hassAggregate * 1000UL) {
+        publishAggregates(now);
+      }
+    }
+    break;
+  }
+
+  // Report connection status every 30 seconds
+  if (now - statusCheckMillis >= 1000 * 30) {
+    statusCheckMillis = now;
+    Serial.printf("[HASS] MQTT %s, %lu values published in %lu messages, %lu suppressed\n",
+                  stateToString(state), publishedCount, messageCount, suppressedCount);
+  }
 }
 
 } // namespace HASS
@@ -2,12 +2,39 @@
 #define _HASS_H_
 
 #include "types.h"
-#include <ArduinoHA.h>
-#include <WiFi.h>
 
 namespace HASS {
 
+typedef enum {
+  STATE_WAIT_NETWORK = 0,
+  STATE_CONNECTING,
+  STATE_DISCOVERY, // Connected, sending every value once
+  STATE_ONLINE,
+  STATE_BACKOFF    // Waiting for the next connect attempt
+} State;
+
+typedef struct Stats {
+  uint32_t published;  // Sensor values sent
+  uint32_t messages;   // MQTT messages carrying them (one per value unless JSON state)
+  uint32_t suppressed; // Checks that sent nothing (inside deadband or too soon)
+  State state;
+  uint32_t connects;        // Successful connects, including the first
+  uint32_t failedAttempts;  // Connect attempts the broker did not accept
+  uint32_t lastReconnectMs; // Connection lost (or task start) to connected
+  uint32_t maxReconnectMs;
+  uint32_t discoverySent;    // Connects that published every discovery config
+  uint32_t discoverySkipped; // Connects where the broker already had them
+} Stats;
+
 void begin(uint8_t core, uint8_t priority);
+// Runs on the Sched event loop instead of its own task
+void attach();
+Stats getStats();
+const char *stateToString(State state);
+
+// Queues a publish benchmark (count QoS 1 messages, window in flight, 0 =
+// default); the result is logged when every message is acknowledged
+void benchmark(uint16_t count, uint8_t window);
 
 } // namespace HASS
 
@@ -0,0 +1,65 @@
+#include "history.h"
+#include "logger.h"
+#include <Arduino.h>
+
+namespace History {
+
+namespace {
+
+Sample *samples = nullptr;
+uint16_t first = 0; // Oldest
+volatile uint16_t stored = 0;
+portMUX_TYPE historyMux = portMUX_INITIALIZER_UNLOCKED;
+
+} // namespace
+
+void begin() {
+  samples = (Sample *)malloc(CAPACITY * sizeof(Sample));
+  if (!samples) {
+    LOG_E("HIST", "No memory for %u history samples", CAPACITY);
+  }
+}
+
+void record(const EssStatus &ess) {
+  if (!samples) {
+    return;
+  }
+  Sample s;
+  if (ess.voltage > 0) {
+    float current = roundf(ess.current * 10);
+    s.voltage = (uint16_t)constrain(roundf(ess.voltage * 100), 0, UINT16_MAX);
+    s.current = (int16_t)constrain(current, INT16_MIN, INT16_MAX);
+    s.charge = (uint8_t)constrain(ess.charge, 0, 100);
+  } else {
+    s.voltage = 0;
+    s.current = 0;
+    s.charge = NO_DATA;
+  }
+
+  portENTER_CRITICAL(&historyMux);
+  if (stored == CAPACITY) {
+    samples[first] = s; // Overwrite the oldest
+    first = (first + 1) % CAPACITY;
+  } else {
+    samples[(first + stored) % CAPACITY] = s;
+    stored++;
+  }
+  portEXIT_CRITICAL(&historyMux);
+}
+
+uint16_t count() {
+  return stored;
+}
+
+bool get(uint16_t index, Sample *sample) {
+  bool found = false;
+  portENTER_CRITICAL(&historyMux);
+  if (index < stored) {
+    *sample = samples[(first + index) % CAPACITY];
+    found = true;
+  }
+  portEXIT_CRITICAL(&historyMux);
+  return found;
+}
+
+} // namespace History
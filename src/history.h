@@ -0,0 +1,31 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include "types.h"
+
+namespace History {
+
+// One point a minute for the last day, for the /history chart. Recorded by
+// the main loop, read by whoever renders a chart.
+
+const uint32_t INTERVAL_MS = 60000;
+const uint16_t CAPACITY = 24 * 60;
+
+typedef struct Sample {
+  uint16_t voltage; // 10 mV
+  int16_t current;  // 100 mA
+  uint8_t charge;   // NO_DATA: nothing from the battery at that time
+} Sample;
+
+const uint8_t NO_DATA = 0xFF;
+
+void begin();
+void record(const EssStatus &ess);
+
+// Samples stored, up to CAPACITY; index 0 is the oldest
+uint16_t count();
+bool get(uint16_t index, Sample *sample);
+
+} // namespace History
+
+#endif
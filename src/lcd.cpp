@@ -1,11 +1,18 @@
+#include "lcd.h"
+#include "alerts.h"
+#include "boot.h"
 #include "can.h"
+#include "telemetry.h"
 #include "types.h"
 #include "runtime_cache.h"
+#include "sched.h"
+#include "trace.h"
 #include <HardwareSerial.h>
 #include <U8g2lib.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <stdint.h>
+#include <string.h>
 #include <esp_task_wdt.h>
 
 extern Config Cfg;
@@ -14,46 +21,155 @@ extern volatile EssStatus Ess;
 namespace LCD {
 
 void begin(uint8_t core, uint8_t priority);
+void attach();
 void task(void *pvParameters);
-void loop();
+void setup();
+uint32_t step(uint32_t now);
 void draw();
+void send();
+void updatePower(uint32_t now);
+uint32_t wakeIn(uint32_t now, uint32_t lastDrawMs);
+
+const uint32_t TASK_STACK = 20000;
+const uint32_t I2C_CLOCK_HZ = 400000; // Fast mode, the SSD1306 is rated for it
+const uint32_t MIN_FRAME_MS = 250;      // Bus interval, at most 4 frames a second
+const uint32_t IDLE_REFRESH_MS = 10000; // WiFi and IP have no version to wait on
+const uint8_t CONTRAST_NORMAL = 0xCF;   // What U8g2 sets up
+const uint8_t CONTRAST_DIM = 0x10;
+const uint8_t TILE_COLUMNS = 16; // 8x8 tiles, 128x64 pixels
+const uint8_t TILE_ROWS = 8;
+const uint16_t BUFFER_SIZE = TILE_COLUMNS * TILE_ROWS * 8;
 
 U8G2_SSD1306_128X64_NONAME_F_HW_I2C *lcd = nullptr;
 
+// What the display shows now; only tiles that differ from it are sent
+uint8_t shadow[BUFFER_SIZE];
+bool shadowValid = false;
+
+// Dimmed and then switched off after lcdDimTimeout / lcdOffTimeout
+// seconds without an alert change; kept on while an alert is active
+Power power = POWER_ON;
+uint32_t activeSinceMs = 0;
+
+int8_t subscriber = Telemetry::NO_SUBSCRIBER;
+
+volatile uint32_t wakeCount = 0;
+volatile uint32_t frameCount = 0;
+volatile uint32_t updateCount = 0;
+volatile uint32_t tileCount = 0;
+volatile uint32_t busUsLast = 0;
+volatile uint32_t busUsAvg = 0;
+volatile uint32_t busUsMax = 0;
+
 void begin(uint8_t core, uint8_t priority) {
-  xTaskCreatePinnedToCore(task, "lcd_task", 20000, NULL, priority, NULL, core);
+  xTaskCreatePinnedToCore(task, "lcd_task", TASK_STACK, NULL, priority, NULL, core);
+}
+
+void attach() {
+  Sched::add("lcd", Trace::TASK_LCD, setup, step, TASK_STACK);
 }
 
 void task(void *pvParameters) {
   Serial.printf("[LCD] Task running in core %d.\n", (uint32_t)xPortGetCoreID());
 
-  lcd = new U8G2_SSD1306_128X64_NONAME_F_HW_I2C(U8G2_R0,
-                                                /* reset=*/U8X8_PIN_NONE);
-  lcd->begin();
-  lcd->clear();
+  setup();
 
   while (1) {
-    loop();
+    uint32_t wait = step(millis());
 
     // Reset watchdog timer to prevent device reboot
     if (Cfg.watchdogEnabled) {
       esp_task_wdt_reset();
     }
+    Trace::alive(Trace::TASK_LCD);
 
-    // Safety delay in case loop() returns early
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    // Until the bus has a change (paced to MIN_FRAME_MS), the idle refresh
+    // or the next dim/off step
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
   }
 
   Serial.println("[LCD] Task exited.");
   vTaskDelete(NULL);
 }
 
-void loop() {
-  vTaskDelay(3000 / portTICK_PERIOD_MS);
-  draw();
+// On the task that runs step(), which the bus then wakes
+void setup() {
+  lcd = new U8G2_SSD1306_128X64_NONAME_F_HW_I2C(U8G2_R0,
+                                                /* reset=*/U8X8_PIN_NONE);
+  lcd->setBusClock(I2C_CLOCK_HZ); // Before begin()
+  lcd->begin();
+  lcd->clear();
+  activeSinceMs = millis();
+  subscriber = Telemetry::subscribe("lcd", xTaskGetCurrentTaskHandle(), Telemetry::FIELDS_ALL,
+                                    MIN_FRAME_MS);
+  Boot::mark(Boot::PHASE_LCD);
+}
+
+// Draws after a bus change, a power change or the idle refresh; other
+// wakeups (the event loop runs every step on a notification) draw nothing.
+// Returns ms until the next refresh or dim/off step.
+uint32_t step(uint32_t now) {
+  static uint32_t lastDrawMs = 0;
+  wakeCount++;
+
+  uint32_t fields = Telemetry::take(subscriber, now);
+  if (fields & 1UL << Telemetry::FIELD_ALERTS) {
+    activeSinceMs = now;
+  }
+  Power before = power;
+  updatePower(now);
+
+  if (power != POWER_OFF && (fields || power != before || !shadowValid ||
+                             now - lastDrawMs >= IDLE_REFRESH_MS)) {
+    lastDrawMs = now;
+    draw();
 #ifdef DEBUG
-  Serial.println("[LCD] Draw.");
+    Serial.println("[LCD] Draw.");
 #endif
+  }
+  return wakeIn(now, lastDrawMs);
+}
+
+void updatePower(uint32_t now) {
+  if (Alerts::getActive() & Alerts::ALERT_RULES) {
+    activeSinceMs = now;
+  }
+  uint32_t idle = now - activeSinceMs;
+  Power want = POWER_ON;
+  if (Cfg.lcdOffTimeout && idle >= Cfg.lcdOffTimeout * 1000UL) {
+    want = POWER_OFF;
+  } else if (Cfg.lcdDimTimeout && idle >= Cfg.lcdDimTimeout * 1000UL) {
+    want = POWER_DIM;
+  }
+  if (want == power) {
+    return;
+  }
+  if (want == POWER_OFF) {
+    lcd->setPowerSave(1); // Display RAM is kept, so is the shadow
+  } else {
+    if (power == POWER_OFF) {
+      lcd->setPowerSave(0);
+    }
+    lcd->setContrast(want == POWER_DIM ? CONTRAST_DIM : CONTRAST_NORMAL);
+  }
+  power = want;
+}
+
+uint32_t wakeIn(uint32_t now, uint32_t lastDrawMs) {
+  uint32_t sinceDraw = now - lastDrawMs;
+  uint32_t wait = IDLE_REFRESH_MS;
+  if (power != POWER_OFF && sinceDraw < IDLE_REFRESH_MS) {
+    wait = IDLE_REFRESH_MS - sinceDraw;
+  }
+  uint32_t idle = now - activeSinceMs;
+  const uint16_t timeouts[] = {Cfg.lcdDimTimeout, Cfg.lcdOffTimeout};
+  for (uint16_t timeout : timeouts) {
+    uint32_t ms = timeout * 1000UL;
+    if (ms && idle < ms && ms - idle < wait) {
+      wait = ms - idle;
+    }
+  }
+  return wait;
 }
 
 void draw() {
@@ -100,6 +216,10 @@ void draw() {
     lcd->print(ess.bmsError);
     lcd->setCursor(90, 50);
     lcd->print(ess.bmsWarning);
+  } else if (Alerts::getActive() & Alerts::ALERT_RULES) {
+    // First active alert, the line fits 16 characters
+    uint32_t active = Alerts::getActive() & Alerts::ALERT_RULES;
+    lcd->drawStr(0, 50, Alerts::ruleLabel((Alerts::Rule)__builtin_ctz(active)));
   } else {
     // CRITICAL FIX: Use cached WiFi status from Core 0 (main loop)
     // WiFi.status() is not thread-safe when called from Core 1 (LCD task)
@@ -122,7 +242,71 @@ void draw() {
   lcd->print(ess.ratedDischargeCurrent, 0);
   lcd->drawLine(0, 52, 128, 52);
 
-  lcd->sendBuffer();
+  send();
+}
+
+// Sends the tiles that changed since the last frame, adjacent ones (or
+// with one unchanged tile between them) as one area
+void send() {
+  const uint8_t *buf = lcd->getBufferPtr();
+  uint32_t startUs = micros();
+  uint32_t tiles = 0;
+  frameCount++;
+
+  if (!shadowValid) {
+    lcd->sendBuffer();
+    tiles = TILE_COLUMNS * TILE_ROWS;
+    shadowValid = true;
+  } else {
+    for (uint8_t ty = 0; ty < TILE_ROWS; ty++) {
+      const uint8_t *row = buf + ty * TILE_COLUMNS * 8;
+      const uint8_t *shown = shadow + ty * TILE_COLUMNS * 8;
+      int8_t first = -1;
+      int8_t last = -1;
+      for (uint8_t tx = 0; tx <= TILE_COLUMNS; tx++) {
+        bool dirty = tx < TILE_COLUMNS && memcmp(row + tx * 8, shown + tx * 8, 8) != 0;
+        if (dirty && first >= 0 && tx - last > 2) {
+          lcd->updateDisplayArea(first, ty, last - first + 1, 1);
+          tiles += last - first + 1;
+          first = -1;
+        }
+        if (dirty) {
+          first = first < 0 ? tx : first;
+          last = tx;
+        }
+      }
+      if (first >= 0) {
+        lcd->updateDisplayArea(first, ty, last - first + 1, 1);
+        tiles += last - first + 1;
+      }
+    }
+  }
+
+  if (tiles == 0) {
+    return;
+  }
+  memcpy(shadow, buf, BUFFER_SIZE);
+  uint32_t busUs = micros() - startUs;
+  updateCount++;
+  tileCount += tiles;
+  busUsLast = busUs;
+  busUsAvg = busUsAvg ? (busUsAvg * 7 + busUs) / 8 : busUs;
+  if (busUs > busUsMax) {
+    busUsMax = busUs;
+  }
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.wakeups = wakeCount;
+  stats.frames = frameCount;
+  stats.updated = updateCount;
+  stats.tiles = tileCount;
+  stats.busUsLast = busUsLast;
+  stats.busUsAvg = busUsAvg;
+  stats.busUsMax = busUsMax;
+  stats.power = power;
+  return stats;
 }
 
 } // namespace LCD
@@ -5,7 +5,23 @@
 
 namespace LCD {
 
+typedef enum : uint8_t { POWER_ON = 0, POWER_DIM, POWER_OFF } Power;
+
+typedef struct Stats {
+  uint32_t wakeups;   // Steps run, drawn or not
+  uint32_t frames;    // Drawn
+  uint32_t updated;   // Frames that changed at least one tile
+  uint32_t tiles;     // 8x8 tiles sent, 128 for a whole screen
+  uint32_t busUsLast; // I2C time of the last update
+  uint32_t busUsAvg;  // Moving average over updates
+  uint32_t busUsMax;
+  Power power;
+} Stats;
+
 void begin(uint8_t core, uint8_t priority);
+// Runs on the Sched event loop instead of its own task
+void attach();
+Stats getStats();
 
 } // namespace LCD
 
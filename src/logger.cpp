@@ -1,6 +1,11 @@
 #include "logger.h"
+#include "syslog_sink.h"
+#include "trace.h"
 #include "types.h"
 #include <WebSerialLite.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 extern Config Cfg;
 
@@ -8,6 +13,285 @@ namespace Logger {
 
 bool webSerialEnabled = false;
 Level currentLevel = LEVEL_DEBUG; // Default log level
+uint8_t unresolvedLevel = 0xFF;
+
+namespace {
+
+// Bounded lock-free multi-producer / single-consumer ring (Vyukov style).
+// Producers claim a slot with one CAS on `tail`, fill it and publish it by
+// bumping the slot sequence. Only the drain task reads slots.
+const uint32_t RING_SIZE = 32; // Power of two
+const size_t MESSAGE_SIZE = 224;
+
+typedef struct Entry {
+  uint8_t level;
+  uint8_t len;        // Argument bytes of a deferred record
+  const char *tag;
+  const char *format; // nullptr: message holds formatted text
+  uint32_t timestamp; // millis() at the call site
+  char message[MESSAGE_SIZE];
+} Entry;
+
+typedef struct Slot {
+  // Stored relative to the slot index so zero-initialised memory is a valid
+  // empty ring even for messages logged before begin()
+  std::atomic<uint32_t> seq;
+  Entry entry;
+} Slot;
+
+Slot ring[RING_SIZE];
+std::atomic<uint32_t> tail{0};
+uint32_t head = 0; // Drain task only
+
+std::atomic<uint32_t> queuedCount{0};
+std::atomic<uint32_t> droppedCount{0};
+uint32_t reportedDrops = 0;
+uint32_t highWater = 0;
+uint32_t deferredCount = 0;
+
+TaskHandle_t drainTaskHandle = nullptr;
+
+// Records with this tag are timed by benchmark() and never printed
+const char BENCH_TAG[] = "BENCH";
+
+// Recent deferred records, oldest first, kept in binary for /api/logdump.
+// Layout of each record (little endian): level u8, len u8, timestamp u32,
+// format u32, tag u32, then len argument bytes. A byte ring: records wrap
+// around the end, and dumpMux only guards the indices. Written by the
+// drain task only.
+const size_t DUMP_SIZE = 4096;
+const size_t DUMP_RECORD_HEADER = 14;
+uint8_t dumpBuffer[DUMP_SIZE];
+size_t dumpStart = 0; // Oldest record
+size_t dumpLen = 0;   // Bytes readers may copy from dumpStart
+portMUX_TYPE dumpMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Tags seen by LOG_x call sites or configured from WebSerial. Entries are
+// never removed, so call sites can keep pointers to `level`.
+const uint8_t MAX_TAGS = 24;
+
+typedef struct TagLevel {
+  char name[12];
+  uint8_t level;
+  bool custom; // false: follows currentLevel
+} TagLevel;
+
+TagLevel tagLevels[MAX_TAGS];
+uint8_t tagCount = 0;
+uint8_t sharedLevel = LEVEL_DEBUG; // Tags that did not fit in the table
+portMUX_TYPE tagMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Caller holds tagMux
+TagLevel *findTag(const char *tag) {
+  for (uint8_t i = 0; i < tagCount; i++) {
+    if (strncasecmp(tagLevels[i].name, tag, sizeof(tagLevels[i].name) - 1) == 0) {
+      return &tagLevels[i];
+    }
+  }
+  return nullptr;
+}
+
+// Caller holds tagMux; nullptr when the table is full
+TagLevel *addTag(const char *tag) {
+  if (tagCount >= MAX_TAGS) {
+    return nullptr;
+  }
+  TagLevel *entry = &tagLevels[tagCount];
+  strlcpy(entry->name, tag, sizeof(entry->name));
+  entry->level = currentLevel;
+  entry->custom = false;
+  tagCount++;
+  return entry;
+}
+
+
+// Returns the claimed slot, or nullptr when the ring is full
+Slot *claim(uint32_t *posOut) {
+  uint32_t pos = tail.load(std::memory_order_relaxed);
+  while (true) {
+    uint32_t idx = pos & (RING_SIZE - 1);
+    Slot *slot = &ring[idx];
+    uint32_t seq = slot->seq.load(std::memory_order_acquire) + idx;
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0) {
+      if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        *posOut = pos;
+        return slot;
+      }
+    } else if (diff < 0) {
+      return nullptr; // Oldest entry not drained yet
+    } else {
+      pos = tail.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void publish(Slot *slot, uint32_t pos) {
+  uint32_t idx = pos & (RING_SIZE - 1);
+  slot->seq.store(pos + 1 - idx, std::memory_order_release);
+  queuedCount.fetch_add(1, std::memory_order_relaxed);
+
+  if (drainTaskHandle) {
+    xTaskNotifyGive(drainTaskHandle);
+  }
+}
+
+// Copies the oldest published entry out and frees its slot
+bool take(Entry *entry) {
+  uint32_t idx = head & (RING_SIZE - 1);
+  Slot *slot = &ring[idx];
+  uint32_t seq = slot->seq.load(std::memory_order_acquire) + idx;
+  if (seq != head + 1) {
+    return false;
+  }
+
+  // Deferred records only copy their argument bytes
+  size_t used = slot->entry.format ? slot->entry.len : MESSAGE_SIZE;
+  memcpy(entry, &slot->entry, offsetof(Entry, message) + used);
+
+  slot->seq.store(head + RING_SIZE - idx, std::memory_order_release);
+  head++;
+  return true;
+}
+
+void putU32(uint8_t *dst, uint32_t v) {
+  dst[0] = v;
+  dst[1] = v >> 8;
+  dst[2] = v >> 16;
+  dst[3] = v >> 24;
+}
+
+void keepRecord(const Entry &entry) {
+  uint8_t rec[DUMP_RECORD_HEADER + MESSAGE_SIZE];
+  size_t size = DUMP_RECORD_HEADER + entry.len;
+  rec[0] = entry.level;
+  rec[1] = entry.len;
+  putU32(rec + 2, entry.timestamp);
+  putU32(rec + 6, (uint32_t)(uintptr_t)entry.format);
+  putU32(rec + 10, (uint32_t)(uintptr_t)entry.tag);
+  memcpy(rec + DUMP_RECORD_HEADER, entry.message, entry.len);
+
+  // Drop whole records from the front until the new one fits, and reserve
+  // its bytes; readers do not see them until dumpLen covers them
+  portENTER_CRITICAL(&dumpMux);
+  while (dumpLen + size > DUMP_SIZE) {
+    size_t oldest = DUMP_RECORD_HEADER + dumpBuffer[(dumpStart + 1) % DUMP_SIZE];
+    dumpStart = (dumpStart + oldest) % DUMP_SIZE;
+    dumpLen -= oldest;
+  }
+  size_t at = (dumpStart + dumpLen) % DUMP_SIZE;
+  portEXIT_CRITICAL(&dumpMux);
+
+  size_t first = DUMP_SIZE - at < size ? DUMP_SIZE - at : size;
+  memcpy(dumpBuffer + at, rec, first);
+  memcpy(dumpBuffer, rec + first, size - first);
+
+  portENTER_CRITICAL(&dumpMux);
+  dumpLen += size;
+  portEXIT_CRITICAL(&dumpMux);
+}
+
+void output(uint8_t level, const char *tag, const char *message) {
+  char line[MESSAGE_SIZE + 32];
+  snprintf(line, sizeof(line), "[%s][%s] %s", levelToString(level), tag, message);
+
+  Serial.println(line);
+  if (webSerialEnabled) {
+    WebSerial.println(line);
+  }
+}
+
+void drain() {
+  uint32_t pending = tail.load(std::memory_order_relaxed) - head;
+  if (pending > highWater) {
+    highWater = pending;
+  }
+
+  Entry entry;
+  while (take(&entry)) {
+    if (entry.tag == BENCH_TAG) {
+      continue;
+    }
+    if (entry.format) {
+      // Deferred record: this is the only place it gets formatted
+      char message[MESSAGE_SIZE];
+      formatRecord(entry.format, (const uint8_t *)entry.message, entry.len,
+                   message, sizeof(message));
+      keepRecord(entry);
+      deferredCount++;
+      output(entry.level, entry.tag, message);
+      SyslogSink::write(entry.level, entry.tag, entry.timestamp, message);
+    } else {
+      output(entry.level, entry.tag, entry.message);
+      SyslogSink::write(entry.level, entry.tag, entry.timestamp, entry.message);
+    }
+  }
+  SyslogSink::flush();
+
+  uint32_t dropped = droppedCount.load(std::memory_order_relaxed);
+  if (dropped != reportedDrops) {
+    char note[64];
+    snprintf(note, sizeof(note), "%lu messages dropped, log ring full",
+             dropped - reportedDrops);
+    output(LEVEL_WARNING, "LOGGER", note);
+    reportedDrops = dropped;
+  }
+}
+
+void drainTask(void *pvParameters) {
+  while (1) {
+    // Woken by producers; the timeout only bounds latency of lost wakeups
+    ulTaskNotifyTake(pdTRUE, 500 / portTICK_PERIOD_MS);
+    drain();
+  }
+}
+
+void vlog(Level level, const char *tag, const char *format, va_list args,
+          bool filter = true) {
+  // Filter by log level before doing any formatting work
+  if (filter && level > currentLevel) {
+    return;
+  }
+
+  Trace::log(level, tag, format, 0);
+
+  uint32_t pos;
+  Slot *slot = claim(&pos);
+  if (!slot) {
+    droppedCount.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  slot->entry.level = level;
+  slot->entry.tag = tag;
+  slot->entry.format = nullptr;
+  slot->entry.timestamp = millis();
+  vsnprintf(slot->entry.message, sizeof(slot->entry.message), format, args);
+  publish(slot, pos);
+}
+
+// Reads a little-endian argument word, or returns false when the record ran
+// out of arguments (truncated or format/argument mismatch)
+bool readArg(const uint8_t *args, size_t len, size_t *pos, void *out, size_t n) {
+  if (*pos + n > len) {
+    return false;
+  }
+  memcpy(out, args + *pos, n);
+  *pos += n;
+  return true;
+}
+
+} // namespace
+
+const char *levelToString(uint8_t level) {
+  return level == LEVEL_EMERG ? "EMERG" :
+         level == LEVEL_ALERT ? "ALERT" :
+         level == LEVEL_CRIT ? "CRIT" :
+         level == LEVEL_ERR ? "ERROR" :
+         level == LEVEL_WARNING ? "WARN" :
+         level == LEVEL_NOTICE ? "NOTICE" :
+         level == LEVEL_INFO ? "INFO" : "DEBUG";
+}
 
 void begin() {
   // WebSerial should be already initialized by web server
@@ -31,6 +315,11 @@ Type 'status' for system information.
   Serial.println(welcomeMsg);
   WebSerial.println(welcomeMsg);
 
+  // Low priority drain task on core 0, away from the CAN task on core 1.
+  // Anything logged before this point is still in the ring and goes out first.
+  xTaskCreatePinnedToCore(drainTask, "log_drain", 6144, NULL, 1,
+                          &drainTaskHandle, 0);
+
   Serial.println("[LOGGER] Logger initialized with WebSerial support");
   Serial.printf("[LOGGER] Log level: %d (DEBUG)\n", currentLevel);
 }
@@ -44,7 +333,15 @@ bool isEnabled() {
 }
 
 void setLevel(Level level) {
+  portENTER_CRITICAL(&tagMux);
   currentLevel = level;
+  sharedLevel = level;
+  for (uint8_t i = 0; i < tagCount; i++) {
+    if (!tagLevels[i].custom) {
+      tagLevels[i].level = level;
+    }
+  }
+  portEXIT_CRITICAL(&tagMux);
   Serial.printf("[LOGGER] Log level changed to: %d\n", level);
 }
 
@@ -52,118 +349,318 @@ Level getLevel() {
   return currentLevel;
 }
 
-// Internal function for already-formatted messages (used by wrapper functions)
-static void logFormatted(Level level, const char* tag, const char* message) {
-  // Filter by log level
-  if (level > currentLevel) {
+const uint8_t *tagLevel(const char *tag) {
+  portENTER_CRITICAL(&tagMux);
+  TagLevel *entry = findTag(tag);
+  if (!entry) {
+    entry = addTag(tag);
+  }
+  portEXIT_CRITICAL(&tagMux);
+  return entry ? &entry->level : &sharedLevel;
+}
+
+bool setTagLevel(const char *tag, Level level) {
+  portENTER_CRITICAL(&tagMux);
+  TagLevel *entry = findTag(tag);
+  if (!entry) {
+    entry = addTag(tag);
+  }
+  if (entry) {
+    entry->level = level;
+    entry->custom = true;
+  }
+  portEXIT_CRITICAL(&tagMux);
+  return entry != nullptr;
+}
+
+bool clearTagLevel(const char *tag) {
+  portENTER_CRITICAL(&tagMux);
+  TagLevel *entry = findTag(tag);
+  if (entry) {
+    entry->level = currentLevel;
+    entry->custom = false;
+  }
+  portEXIT_CRITICAL(&tagMux);
+  return entry != nullptr;
+}
+
+void printLevels(Print &out) {
+  out.printf("Global: %s, compiled in up to %s\n", levelToString(currentLevel),
+             levelToString(LOG_COMPILE_LEVEL));
+  for (uint8_t i = 0; i < tagCount; i++) {
+    out.printf("  %-11s %s%s\n", tagLevels[i].name, levelToString(tagLevels[i].level),
+               tagLevels[i].custom ? "" : " (global)");
+  }
+}
+
+bool parseLevel(const char *text, Level *level) {
+  static const struct {
+    const char *name;
+    Level level;
+  } names[] = {
+    {"emerg", LEVEL_EMERG}, {"alert", LEVEL_ALERT}, {"crit", LEVEL_CRIT},
+    {"error", LEVEL_ERR}, {"err", LEVEL_ERR}, {"warn", LEVEL_WARNING},
+    {"warning", LEVEL_WARNING}, {"notice", LEVEL_NOTICE}, {"info", LEVEL_INFO},
+    {"debug", LEVEL_DEBUG},
+  };
+  if (text[0] >= '0' && text[0] <= '7' && text[1] == '\0') {
+    *level = (Level)(text[0] - '0');
+    return true;
+  }
+  for (const auto &n : names) {
+    if (strcasecmp(text, n.name) == 0) {
+      *level = n.level;
+      return true;
+    }
+  }
+  return false;
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.queued = queuedCount.load(std::memory_order_relaxed);
+  stats.dropped = droppedCount.load(std::memory_order_relaxed);
+  stats.highWater = highWater;
+  stats.capacity = RING_SIZE;
+  stats.deferred = deferredCount;
+  return stats;
+}
+
+void submit(Level level, const char *tag, const char *format,
+            const uint8_t *args, size_t len) {
+  uint32_t arg0 = 0;
+  memcpy(&arg0, args, len < sizeof(arg0) ? len : sizeof(arg0));
+  Trace::log(level, tag, format, arg0);
+
+  uint32_t pos;
+  Slot *slot = claim(&pos);
+  if (!slot) {
+    droppedCount.fetch_add(1, std::memory_order_relaxed);
     return;
   }
 
-  // Format message with level indicator
-  const char* levelStr =
-    level == LEVEL_EMERG ? "EMERG" :
-    level == LEVEL_ALERT ? "ALERT" :
-    level == LEVEL_CRIT ? "CRIT" :
-    level == LEVEL_ERR ? "ERROR" :
-    level == LEVEL_WARNING ? "WARN" :
-    level == LEVEL_NOTICE ? "NOTICE" :
-    level == LEVEL_INFO ? "INFO" : "DEBUG";
+  slot->entry.level = level;
+  slot->entry.tag = tag;
+  slot->entry.format = format;
+  slot->entry.timestamp = millis();
+  slot->entry.len = len;
+  memcpy(slot->entry.message, args, len);
+  publish(slot, pos);
+}
+
+size_t formatRecord(const char *format, const uint8_t *args, size_t len,
+                    char *out, size_t outSize) {
+  size_t o = 0;
+  size_t a = 0;
+  const char *p = format;
 
-  char formattedMsg[512];
-  snprintf(formattedMsg, sizeof(formattedMsg), "[%s][%s] %s", levelStr, tag, message);
+  while (*p && o + 1 < outSize) {
+    if (*p != '%') {
+      out[o++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      out[o++] = '%';
+      p += 2;
+      continue;
+    }
 
-  // Always write to Serial
-  Serial.println(formattedMsg);
+    // Copy one conversion spec ("%-08.2lf") so snprintf does the formatting
+    char spec[16];
+    size_t n = 0;
+    int longs = 0;
+    spec[n++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 4) {
+      spec[n++] = *p++;
+    }
+    while (*p && strchr("hlLzjt", *p) && n < sizeof(spec) - 2) {
+      longs += (*p == 'l');
+      spec[n++] = *p++;
+    }
+    char conv = *p;
+    if (!conv) {
+      break;
+    }
+    spec[n++] = *p++;
+    spec[n] = '\0';
 
-  // Also write to WebSerial if enabled
-  if (webSerialEnabled) {
-    WebSerial.println(formattedMsg);
+    char *dst = out + o;
+    size_t room = outSize - o;
+    int written = -1;
+    switch (conv) {
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        if (longs >= 2) {
+          int64_t v;
+          if (readArg(args, len, &a, &v, sizeof(v))) {
+            written = snprintf(dst, room, spec, (long long)v);
+          }
+        } else {
+          uint32_t v;
+          if (readArg(args, len, &a, &v, sizeof(v))) {
+            written = longs ? snprintf(dst, room, spec, (unsigned long)v)
+                            : snprintf(dst, room, spec, (unsigned int)v);
+          }
+        }
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+        double v;
+        if (readArg(args, len, &a, &v, sizeof(v))) {
+          written = snprintf(dst, room, spec, v);
+        }
+        break;
+      }
+      case 's': {
+        uint8_t slen;
+        char str[Deferred::MAX_STRING + 1];
+        if (readArg(args, len, &a, &slen, 1) && readArg(args, len, &a, str, slen)) {
+          str[slen] = '\0';
+          written = snprintf(dst, room, spec, str);
+        }
+        break;
+      }
+      case 'p': {
+        uint32_t v;
+        if (readArg(args, len, &a, &v, sizeof(v))) {
+          written = snprintf(dst, room, spec, (void *)(uintptr_t)v);
+        }
+        break;
+      }
+      default:
+        written = snprintf(dst, room, "%s", spec);
+        break;
+    }
+
+    if (written < 0) {
+      written = snprintf(dst, room, "?");
+    }
+    o += (size_t)written < room ? (size_t)written : room - 1;
+  }
+
+  out[o] = '\0';
+  return o;
+}
+
+size_t dumpRecords(uint8_t *out, size_t outSize) {
+  // File header for tools/log_decode.py: "ESLG", version, 3 reserved bytes
+  const uint8_t header[8] = {'E', 'S', 'L', 'G', 1, 0, 0, 0};
+  if (outSize < sizeof(header)) {
+    return 0;
   }
+  memcpy(out, header, sizeof(header));
+
+  portENTER_CRITICAL(&dumpMux);
+  size_t n = dumpLen < outSize - sizeof(header) ? dumpLen : 0;
+  size_t first = DUMP_SIZE - dumpStart < n ? DUMP_SIZE - dumpStart : n;
+  memcpy(out + sizeof(header), dumpBuffer + dumpStart, first);
+  memcpy(out + sizeof(header) + first, dumpBuffer, n - first);
+  portEXIT_CRITICAL(&dumpMux);
+  return sizeof(header) + n;
+}
+
+void benchmark(uint32_t *textNs, uint32_t *deferredNs) {
+  // Batches smaller than the ring, each after the drain task caught up, so
+  // every call is timed on the accept path rather than the ring-full path
+  const int BATCHES = 8;
+  const int BATCH = 16;
+  const uint32_t mhz = ESP.getCpuFreqMHz();
+  uint64_t textCycles = 0;
+  uint64_t deferredCycles = 0;
+
+  Level savedLevel = currentLevel;
+  currentLevel = LEVEL_DEBUG;
+  for (int b = 0; b < BATCHES; b++) {
+    vTaskDelay(20 / portTICK_PERIOD_MS);
+    uint32_t start = ESP.getCycleCount();
+    for (int i = 0; i < BATCH; i++) {
+      debug(BENCH_TAG, "V %.2f I %.1f SOC %d%% T %.1f %s", 52.31, -12.5, 87, 24.5, "OK");
+    }
+    textCycles += ESP.getCycleCount() - start;
+
+    vTaskDelay(20 / portTICK_PERIOD_MS);
+    start = ESP.getCycleCount();
+    for (int i = 0; i < BATCH; i++) {
+      record(LEVEL_DEBUG, BENCH_TAG, "V %.2f I %.1f SOC %d%% T %.1f %s", 52.31, -12.5, 87, 24.5, "OK");
+    }
+    deferredCycles += ESP.getCycleCount() - start;
+  }
+  currentLevel = savedLevel;
+
+  *textNs = textCycles * 1000 / mhz / (BATCHES * BATCH);
+  *deferredNs = deferredCycles * 1000 / mhz / (BATCHES * BATCH);
+}
+
+size_t dumpSize() {
+  return 8 + DUMP_SIZE;
 }
 
 void log(Level level, const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
-
-  // Format the message
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(level, tag, format, args);
   va_end(args);
+}
 
-  // Use internal function to avoid double formatting
-  logFormatted(level, tag, buffer);
+void emit(Level level, const char* tag, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vlog(level, tag, format, args, false);
+  va_end(args);
 }
 
 void emergency(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_EMERG, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_EMERG, tag, buffer);
 }
 
 void alert(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_ALERT, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_ALERT, tag, buffer);
 }
 
 void critical(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_CRIT, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_CRIT, tag, buffer);
 }
 
 void error(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_ERR, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_ERR, tag, buffer);
 }
 
 void warning(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_WARNING, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_WARNING, tag, buffer);
 }
 
 void notice(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_NOTICE, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_NOTICE, tag, buffer);
 }
 
 void info(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_INFO, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_INFO, tag, buffer);
 }
 
 void debug(const char* tag, const char* format, ...) {
-  char buffer[256];
   va_list args;
   va_start(args, format);
-  vsnprintf(buffer, sizeof(buffer), format, args);
+  vlog(LEVEL_DEBUG, tag, format, args);
   va_end(args);
-  logFormatted(LEVEL_DEBUG, tag, buffer);
 }
 
 } // namespace Logger
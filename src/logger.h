@@ -3,6 +3,20 @@
 
 #include <Arduino.h>
 #include <stdarg.h>
+#include <type_traits>
+
+// LOG_x macros store deferred binary records (format pointer, timestamp and
+// raw argument words) instead of formatting at the call site. Set to 0 to
+// format with vsnprintf in the calling task as before.
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 1
+#endif
+
+// LOG_x calls less severe than this are removed at compile time
+// (7 = keep everything, 6 = drop LOG_D, ...)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 7
+#endif
 
 namespace Logger {
 
@@ -19,11 +33,36 @@ typedef enum {
   LEVEL_DEBUG = 7    // Debug-level messages
 } Level;
 
+// Log calls only format the message into a lock-free ring and return;
+// a low-priority drain task writes the ring to Serial and WebSerial.
+typedef struct Stats {
+  uint32_t queued;    // Messages accepted into the ring
+  uint32_t dropped;   // Messages lost because the ring was full
+  uint32_t highWater; // Most entries waiting at once
+  uint32_t capacity;  // Ring size
+  uint32_t deferred;  // Records formatted by the drain task instead of the caller
+} Stats;
+
 void begin();
 void setEnabled(bool enabled);
 bool isEnabled();
 void setLevel(Level level);
 Level getLevel();
+Stats getStats();
+const char *levelToString(uint8_t level);
+
+// Per-tag runtime levels. A tag without its own level follows setLevel().
+// Tags are matched case-insensitively, up to 11 characters.
+bool setTagLevel(const char *tag, Level level);
+bool clearTagLevel(const char *tag);
+void printLevels(Print &out);
+bool parseLevel(const char *text, Level *level);
+
+// Level slot of a tag for the LOG_x macros; registers the tag on first use.
+// Call sites cache the pointer, so a filtered LOG_x costs one load and one
+// branch and never evaluates its arguments.
+const uint8_t *tagLevel(const char *tag);
+extern uint8_t unresolvedLevel; // Placeholder slot until a call site resolves its tag
 
 // Logging functions
 void log(Level level, const char* tag, const char* format, ...);
@@ -36,12 +75,142 @@ void notice(const char* tag, const char* format, ...);
 void info(const char* tag, const char* format, ...);
 void debug(const char* tag, const char* format, ...);
 
+// Formats at the call site without a level check (LOG_x with LOG_DEFERRED=0)
+void emit(Level level, const char* tag, const char* format, ...);
+
+// Deferred records. Arguments are captured as raw words: integers up to
+// 32 bit as 4 bytes, 64-bit integers and floating point (as double) as
+// 8 bytes, strings copied inline (length byte + text) because the
+// caller's buffer may be gone by the time the record is formatted.
+// Arguments that do not fit in ARGS_SIZE are not cut: the call is
+// formatted at the call site instead.
+// format and tag must point to string literals.
+namespace Deferred {
+
+const size_t ARGS_SIZE = 200;
+const size_t MAX_STRING = ARGS_SIZE - 1;
+
+typedef struct Args {
+  uint8_t data[ARGS_SIZE];
+  size_t len = 0;
+  bool overflow = false;
+
+  void put(const void *src, size_t n) {
+    if (overflow || len + n > sizeof(data)) {
+      overflow = true;
+      return;
+    }
+    memcpy(data + len, src, n);
+    len += n;
+  }
+} Args;
+
+inline void encodeOne(Args &args, const char *s) {
+  size_t n = s ? strnlen(s, MAX_STRING + 1) : 0;
+  if (n > MAX_STRING) {
+    args.overflow = true;
+    return;
+  }
+  uint8_t n8 = n;
+  args.put(&n8, 1);
+  args.put(s, n);
+}
+
+inline void encodeOne(Args &args, char *s) {
+  encodeOne(args, (const char *)s);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+encodeOne(Args &args, T value) {
+  double d = value; // Same promotion as varargs
+  args.put(&d, sizeof(d));
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+encodeOne(Args &args, T value) {
+  if (sizeof(T) > 4) {
+    int64_t v = (int64_t)value;
+    args.put(&v, sizeof(v));
+  } else {
+    int32_t v = (int32_t)value;
+    args.put(&v, sizeof(v));
+  }
+}
+
+template <typename T>
+inline void encodeOne(Args &args, const T *ptr) {
+  uint32_t v = (uint32_t)(uintptr_t)ptr;
+  args.put(&v, sizeof(v));
+}
+
+inline void encode(Args &) {}
+
+template <typename T, typename... Rest>
+inline void encode(Args &args, T first, Rest... rest) {
+  encodeOne(args, first);
+  encode(args, rest...);
+}
+
+} // namespace Deferred
+
+void submit(Level level, const char *tag, const char *format,
+            const uint8_t *args, size_t len);
+
+// No level check here, the LOG_x macros filter before evaluating arguments
+template <typename... Ts>
+inline void record(Level level, const char *tag, const char *format, Ts... values) {
+  Deferred::Args args;
+  Deferred::encode(args, values...);
+  if (args.overflow) {
+    emit(level, tag, format, values...); // Long strings: text now, not cut
+    return;
+  }
+  submit(level, tag, format, args.data, args.len);
+}
+
+// Formats a deferred record with the argument layout above
+size_t formatRecord(const char *format, const uint8_t *args, size_t len,
+                    char *out, size_t outSize);
+
+// Copy of the most recent deferred records for tools/log_decode.py.
+// Returns the number of bytes written to out.
+size_t dumpRecords(uint8_t *out, size_t outSize);
+size_t dumpSize();
+
+// Average cost of one Logger::debug() call vs one deferred record, in ns
+void benchmark(uint32_t *textNs, uint32_t *deferredNs);
+
 } // namespace Logger
 
 // Convenience macros
-#define LOG_E(tag, ...) Logger::error(tag, __VA_ARGS__)
-#define LOG_W(tag, ...) Logger::warning(tag, __VA_ARGS__)
-#define LOG_I(tag, ...) Logger::info(tag, __VA_ARGS__)
-#define LOG_D(tag, ...) Logger::debug(tag, __VA_ARGS__)
+#if LOG_DEFERRED
+#define LOG_EMIT(level, tag, ...) Logger::record(level, tag, __VA_ARGS__)
+#else
+#define LOG_EMIT(level, tag, ...) Logger::emit(level, tag, __VA_ARGS__)
+#endif
+
+// The static slot pointer starts at a placeholder that lets the first call
+// through to look up the tag; it is constant-initialised, so no guard
+#define LOG_AT(level, tag, ...)                                              \
+  do {                                                                       \
+    if ((level) <= LOG_COMPILE_LEVEL) {                                      \
+      static const uint8_t *logSlot_ = &Logger::unresolvedLevel;             \
+      if ((level) <= *logSlot_) {                                            \
+        if (logSlot_ == &Logger::unresolvedLevel) {                          \
+          logSlot_ = Logger::tagLevel(tag);                                  \
+        }                                                                    \
+        if ((level) <= *logSlot_) {                                          \
+          LOG_EMIT(level, tag, __VA_ARGS__);                                 \
+        }                                                                    \
+      }                                                                      \
+    }                                                                        \
+  } while (0)
+
+#define LOG_E(tag, ...) LOG_AT(Logger::LEVEL_ERR, tag, __VA_ARGS__)
+#define LOG_W(tag, ...) LOG_AT(Logger::LEVEL_WARNING, tag, __VA_ARGS__)
+#define LOG_I(tag, ...) LOG_AT(Logger::LEVEL_INFO, tag, __VA_ARGS__)
+#define LOG_D(tag, ...) LOG_AT(Logger::LEVEL_DEBUG, tag, __VA_ARGS__)
 
 #endif
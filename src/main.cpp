@@ -1,78 +1,47 @@
+#include "boot.h"
 #include "can.h"
 #include "hass.h"
+#include "history.h"
 #include "lcd.h"
 #include "logger.h"
 #include "ota.h"
+#include "sched.h"
 #include "tg.h"
+#include "trace.h"
 #include "types.h"
 #include "web.h"
-#include "runtime_cache.h"
+#include "telemetry.h"
 #include "wifi_manager.h"
 #include <Arduino.h>
 #include <Preferences.h>
 #include <esp_system.h>
 #include <esp_task_wdt.h>
 
-static const char *resetReasonToString(esp_reset_reason_t reason) {
-  switch (reason) {
-  case ESP_RST_UNKNOWN:
-    return "Unknown";
-  case ESP_RST_POWERON:
-    return "Power-on";
-  case ESP_RST_EXT:
-    return "External pin";
-  case ESP_RST_SW:
-    return "Software";
-  case ESP_RST_PANIC:
-    return "Software panic";
-  case ESP_RST_INT_WDT:
-    return "Interrupt watchdog";
-  case ESP_RST_TASK_WDT:
-    return "Task watchdog";
-  case ESP_RST_WDT:
-    return "Other watchdog";
-  case ESP_RST_DEEPSLEEP:
-    return "Deep sleep";
-  case ESP_RST_BROWNOUT:
-    return "Brownout";
-  case ESP_RST_SDIO:
-    return "SDIO";
-#ifdef ESP_RST_USB
-  case ESP_RST_USB:
-    return "USB";
-#endif
-#ifdef ESP_RST_JTAG
-  case ESP_RST_JTAG:
-    return "JTAG";
-#endif
-#ifdef ESP_RST_TIMEWDT
-  case ESP_RST_TIMEWDT:
-    return "Time watchdog";
-#endif
-#ifdef ESP_RST_RTCWDT
-  case ESP_RST_RTCWDT:
-    return "RTC watchdog";
-#endif
-  default:
-    return "Other";
-  }
-}
-
 Preferences Pref;
 Config Cfg;
 volatile EssStatus Ess;
 
 void initConfig();
 void logBatteryState();
+void networkTask(void *pvParameters);
 
 bool needRestart = false;
 
+// Web clients get status changes right away, paced by the bus; uptime, WiFi
+// and heap only change the page every LIVE_REFRESH_MS
+const uint32_t LIVE_MIN_INTERVAL_MS = 500;
+const uint32_t LIVE_REFRESH_MS = 10000;
+int8_t liveSubscriber = Telemetry::NO_SUBSCRIBER;
+
 void setup() {
   Serial.begin(115200);
   Serial.println("\n\n========== ESS Monitor Starting ==========");
 
+  // Before anything logs: keeps the previous boot's trace, starts a new one
+  Trace::begin();
+
   esp_reset_reason_t resetReason = esp_reset_reason();
-  const char *resetReasonStr = resetReasonToString(resetReason);
+  const char *resetReasonStr = Trace::resetReasonToString(resetReason);
   Serial.printf("[MAIN] Previous reset reason: %s (code=%d)\n", resetReasonStr,
                 static_cast<int>(resetReason));
   if (resetReason == ESP_RST_TASK_WDT || resetReason == ESP_RST_WDT
@@ -92,30 +61,76 @@ void setup() {
 
   // Load configuration from flash
   initConfig();
+  History::begin();
+  Boot::mark(Boot::PHASE_CONFIG);
+
+  // CAN first: after a power cut the battery must not wait for WiFi, which
+  // can sit in the captive portal for 3 minutes. Logs are kept in the ring
+  // until the logger is up.
+  CAN::begin(1, 1);
+
+  // Initialize LCD display
+  if (Cfg.eventLoop) {
+    LCD::attach();
+    // MQTT joins the event loop once the network is up
+    Sched::begin(1, 1);
+  } else {
+    LCD::begin(1, 1);
+  }
+
+  Trace::mark(Trace::MARK_BOOT, 1);
+
+  // WiFi and everything that needs it, while CAN already runs
+  xTaskCreatePinnedToCore(networkTask, "net_boot", 12288, NULL, 1, NULL, 0);
+
+  // Initialize Hardware Watchdog Timer
+  if (Cfg.watchdogEnabled) {
+    Serial.printf("[MAIN] Enabling Hardware Watchdog Timer: %d seconds\n", Cfg.watchdogTimeout);
+    esp_task_wdt_init(Cfg.watchdogTimeout, true); // timeout in seconds, panic on timeout
+    esp_task_wdt_add(NULL); // Add current task (loop task) to WDT
+    Serial.println("[MAIN] ✓ Watchdog Timer enabled");
+  } else {
+    Serial.println("[MAIN] Watchdog Timer disabled by configuration");
+  }
+}
+
+// Runs once and exits; loop() leaves OTA and the web clients alone until
+// PHASE_NETWORK
+void networkTask(void *pvParameters) {
+  Serial.printf("[MAIN] Network start-up running in core %d.\n", (uint32_t)xPortGetCoreID());
 
   // Initialize WiFi with captive portal
   bool wifiConnected = WiFiMgr::begin();
+  Boot::mark(Boot::PHASE_WIFI);
 
   // Initialize OTA updates (must be after WiFi)
   if (wifiConnected) {
     OTA::begin();
+    // UTC; SNTP keeps retrying in the background. Timestamps buffered
+    // MQTT samples and syslog messages.
+    configTime(0, 0, "pool.ntp.org", "time.google.com");
+    Boot::mark(Boot::PHASE_OTA);
   }
 
-  // Initialize web server first (to setup WebSerial for logging)
+  // Initialize web server first (to setup WebSerial for logging); port 80
+  // is only free once the WiFi manager is done
   WEB::begin();
 
+  // Polled from loop(), which runs anyway
+  liveSubscriber = Telemetry::subscribe("web", nullptr, Telemetry::FIELDS_ALL, LIVE_MIN_INTERVAL_MS);
+
   // Initialize Logger AFTER WebSerial is ready
   Logger::begin();
-
-  // Initialize CAN bus (logs will go to WebSerial now)
-  CAN::begin(1, 1);
-
-  // Initialize LCD display
-  LCD::begin(1, 1);
+  Trace::report();
+  Boot::mark(Boot::PHASE_WEB);
 
   // Initialize MQTT if WiFi connected and enabled
   if (wifiConnected && Cfg.mqttEnabled) {
-    HASS::begin(1, 1);
+    if (Cfg.eventLoop) {
+      HASS::attach();
+    } else {
+      HASS::begin(1, 1);
+    }
   }
 
   // Initialize Telegram if WiFi connected and enabled
@@ -123,45 +138,58 @@ void setup() {
     TG::begin(1, 1);
   }
 
-  // Initialize Hardware Watchdog Timer
-  if (Cfg.watchdogEnabled) {
-    Serial.printf("[MAIN] Enabling Hardware Watchdog Timer: %d seconds\n", Cfg.watchdogTimeout);
-    esp_task_wdt_init(Cfg.watchdogTimeout, true); // timeout in seconds, panic on timeout
-    esp_task_wdt_add(NULL); // Add current task (loop task) to WDT
-    Serial.println("[MAIN] ✓ Watchdog Timer enabled");
-  } else {
-    Serial.println("[MAIN] Watchdog Timer disabled by configuration");
-  }
+  Trace::mark(Trace::MARK_BOOT, 2);
+  Boot::mark(Boot::PHASE_NETWORK);
+  LOG_I("MAIN", "Network up after %lu ms, first keep-alive at %lu ms",
+        Boot::at(Boot::PHASE_NETWORK), Boot::at(Boot::PHASE_KEEPALIVE));
+  vTaskDelete(NULL);
 }
 
 void loop() {
   static uint32_t previousMillis;
   uint32_t currentMillis = millis();
+  bool networkUp = Boot::reached(Boot::PHASE_NETWORK);
 
   // Handle OTA updates
-  OTA::handle();
+  if (networkUp) {
+    OTA::handle();
+  }
 
-  // Update runtime status (WiFi status for tasks running on other core)
-  RuntimeCache::updateFromWiFi();
+  // WiFi reconnects and RSSI samples; the runtime cache is fed by events
+  WiFiMgr::loop(currentMillis);
 
   // Reset Watchdog Timer to prevent reboot
   if (Cfg.watchdogEnabled) {
     esp_task_wdt_reset();
   }
+  Trace::alive(Trace::TASK_MAIN);
+
+  // Status and alert changes go to web clients right away
+  static uint32_t liveMillis = 0;
+  if (networkUp && (Telemetry::take(liveSubscriber, currentMillis) ||
+                    currentMillis - liveMillis >= LIVE_REFRESH_MS)) {
+    liveMillis = currentMillis;
+    WEB::updateLiveData();
+  }
+
+  // Every minute: a point for the history chart
+  static uint32_t historyMillis = 0;
+  if (currentMillis - historyMillis >= History::INTERVAL_MS) {
+    historyMillis = currentMillis;
+    History::record(CAN::getEssStatus());
+  }
 
-  // Every 3 seconds: update WebSocket data and log battery state
+  // Every 3 seconds: log battery state
   if (currentMillis - previousMillis >= 3000) {
     previousMillis = currentMillis;
 
-    // Update live data for web clients
-    WEB::updateLiveData();
-
     // Log battery state (if DEBUG defined)
     logBatteryState();
 
     // Soft restart if requested
     if (needRestart) {
       Serial.println("[MAIN] Restarting device...");
+      Trace::mark(Trace::MARK_RESTART, 0);
       ESP.restart();
     }
   }
@@ -173,6 +201,10 @@ void initConfig() {
   Cfg.wifiSTA = Pref.getBool(CFG_WIFI_STA, Cfg.wifiSTA);
   Pref.getString(CFG_WIFI_SSID, Cfg.wifiSSID, sizeof(Cfg.wifiSSID));
   Pref.getString(CFG_WIFI_PASS, Cfg.wifiPass, sizeof(Cfg.wifiPass));
+  Pref.getString(CFG_WIFI_STATIC_IP, Cfg.wifiStaticIP, sizeof(Cfg.wifiStaticIP));
+  Pref.getString(CFG_WIFI_GATEWAY, Cfg.wifiGateway, sizeof(Cfg.wifiGateway));
+  Pref.getString(CFG_WIFI_SUBNET, Cfg.wifiSubnet, sizeof(Cfg.wifiSubnet));
+  Pref.getString(CFG_WIFI_DNS, Cfg.wifiDNS, sizeof(Cfg.wifiDNS));
 
   Pref.getString(CFG_HOSTNAME, Cfg.hostname, sizeof(Cfg.hostname));
 
@@ -188,21 +220,44 @@ void initConfig() {
                  sizeof(Cfg.mqttUsername));
   Pref.getString(CFG_MQQTT_PASSWORD, Cfg.mqttPassword,
                  sizeof(Cfg.mqttPassword));
+  Cfg.hassMinInterval = Pref.getUShort(CFG_HASS_MIN_INTERVAL, Cfg.hassMinInterval);
+  Cfg.hassHeartbeat = Pref.getUShort(CFG_HASS_HEARTBEAT, Cfg.hassHeartbeat);
+  if (Cfg.hassHeartbeat < HASS_HEARTBEAT_MIN) { // Stored before the server checked it
+    Cfg.hassHeartbeat = HASS_HEARTBEAT_MIN;
+  }
+  Cfg.hassDbVoltage = Pref.getFloat(CFG_HASS_DB_VOLTAGE, Cfg.hassDbVoltage);
+  Cfg.hassDbCurrent = Pref.getFloat(CFG_HASS_DB_CURRENT, Cfg.hassDbCurrent);
+  Cfg.hassDbTemperature = Pref.getFloat(CFG_HASS_DB_TEMPERATURE, Cfg.hassDbTemperature);
+  Cfg.hassDbCharge = Pref.getUChar(CFG_HASS_DB_CHARGE, Cfg.hassDbCharge);
+  Cfg.hassJsonState = Pref.getBool(CFG_HASS_JSON_STATE, Cfg.hassJsonState);
+  Cfg.hassBufferKb = Pref.getUShort(CFG_HASS_BUFFER_KB, Cfg.hassBufferKb);
+  Cfg.hassBufferInterval = Pref.getUShort(CFG_HASS_BUFFER_INTERVAL, Cfg.hassBufferInterval);
+  Cfg.hassAggregate = Pref.getUShort(CFG_HASS_AGGREGATE, Cfg.hassAggregate);
 
   Cfg.tgEnabled = Pref.getBool(CFG_TG_ENABLED, Cfg.tgEnabled);
   Pref.getString(CFG_TG_BOT_TOKEN, Cfg.tgBotToken, sizeof(Cfg.tgBotToken));
   Pref.getString(CFG_TG_CHAT_ID, Cfg.tgChatID, sizeof(Cfg.tgChatID));
   Cfg.tgCurrentThreshold = Pref.getUChar(CFG_TG_CURRENT_THRESHOLD, Cfg.tgCurrentThreshold);
+  Cfg.alertLowCharge = Pref.getUChar(CFG_ALERT_LOW_CHARGE, Cfg.alertLowCharge);
+  Cfg.alertHighTemp = Pref.getUChar(CFG_ALERT_HIGH_TEMP, Cfg.alertHighTemp);
+  Cfg.alertCurrentRate = Pref.getUChar(CFG_ALERT_CURRENT_RATE, Cfg.alertCurrentRate);
+  Cfg.alertHold = Pref.getUChar(CFG_ALERT_HOLD, Cfg.alertHold);
 
   Cfg.watchdogEnabled = Pref.getBool(CFG_WATCHDOG_ENABLED, Cfg.watchdogEnabled);
   Cfg.watchdogTimeout = Pref.getUChar(CFG_WATCHDOG_TIMEOUT, Cfg.watchdogTimeout);
+  Cfg.eventLoop = Pref.getBool(CFG_EVENT_LOOP, Cfg.eventLoop);
 
   Cfg.syslogEnabled = Pref.getBool(CFG_SYSLOG_ENABLED, Cfg.syslogEnabled);
   Pref.getString(CFG_SYSLOG_SERVER, Cfg.syslogServer, sizeof(Cfg.syslogServer));
   Cfg.syslogPort = Pref.getUShort(CFG_SYSLOG_PORT, Cfg.syslogPort);
   Cfg.syslogLevel = Pref.getUChar(CFG_SYSLOG_LEVEL, Cfg.syslogLevel);
+  Cfg.syslogBatch = Pref.getBool(CFG_SYSLOG_BATCH, Cfg.syslogBatch);
 
   Cfg.canKeepAliveInterval = Pref.getUShort(CFG_CAN_KEEPALIVE_INTERVAL, Cfg.canKeepAliveInterval);
+  Cfg.lcdDimTimeout = Pref.getUShort(CFG_LCD_DIM_TIMEOUT, Cfg.lcdDimTimeout);
+  Cfg.lcdOffTimeout = Pref.getUShort(CFG_LCD_OFF_TIMEOUT, Cfg.lcdOffTimeout);
+
+  Pref.getString(CFG_OTA_URL, Cfg.otaUrl, sizeof(Cfg.otaUrl));
 
   Pref.end();
 }
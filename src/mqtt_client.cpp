@@ -0,0 +1,670 @@
+#include "mqtt_client.h"
+#include "logger.h"
+#include <AsyncTCP.h>
+#include <esp_timer.h>
+
+namespace MqttClient {
+
+namespace {
+
+const size_t QUEUE_SIZE = 8192;   // Outbound bytes, the memory bound
+const uint32_t MAX_PACKETS = 64;  // Power of two
+const uint8_t MAX_INFLIGHT = 8;   // Unacknowledged QoS 1 publishes
+const size_t RX_SIZE = 1024;      // Larger incoming packets are skipped
+const uint32_t CONNECT_TIMEOUT_MS = 10000;
+
+const uint8_t CONNECT = 0x10;
+const uint8_t CONNACK = 0x20;
+const uint8_t PUBLISH = 0x30;
+const uint8_t PUBACK = 0x40;
+const uint8_t SUBSCRIBE = 0x82; // Flags 0010 are mandatory
+const uint8_t SUBACK = 0x90;
+const uint8_t UNSUBSCRIBE = 0xA2; // Flags 0010 are mandatory
+const uint8_t UNSUBACK = 0xB0;
+const uint8_t PINGREQ = 0xC0;
+const uint8_t PINGRESP = 0xD0;
+const uint8_t DISCONNECT = 0xE0;
+const uint8_t DUP = 0x08;
+
+typedef struct Packet {
+  uint16_t offset; // In queue
+  uint16_t len;
+  uint16_t id;     // 0: QoS 0, nothing to wait for
+  bool done;       // QoS 0 written or QoS 1 acknowledged, can be released
+  int64_t sentUs;  // 0: not completely written on this connection
+} Packet;
+
+AsyncClient client;
+Options opts;
+TaskHandle_t owner = nullptr;
+MessageCallback messageCallback = nullptr;
+
+// Packets are contiguous in queue; when one does not fit before the end it
+// starts at 0 again and the gap is skipped. Descriptors run tail -> next
+// (written, maybe waiting for PUBACK) -> head (not written yet).
+uint8_t queue[QUEUE_SIZE];
+Packet packets[MAX_PACKETS];
+uint32_t tail = 0;
+uint32_t next = 0;
+uint32_t head = 0;
+uint16_t nextOffset = 0; // Bytes of packets[next] already written
+size_t byteHead = 0;
+uint16_t nextId = 1;
+uint8_t window = MAX_INFLIGHT;
+
+// tail/next and Packet::done are shared with the AsyncTCP task (acks)
+portMUX_TYPE queueMux = portMUX_INITIALIZER_UNLOCKED;
+
+volatile State state = STATE_DISCONNECTED;
+uint32_t connectStartMs = 0;
+bool connectSent = false;
+uint32_t lastTxMs = 0;
+
+// Connection generation, passed to the AsyncTCP callbacks as their arg.
+// close() can still report the old connection after the next connect();
+// callbacks with another generation are ignored.
+volatile uint32_t linkId = 0;
+
+// Set by AsyncTCP callbacks, handled in loop()
+volatile bool tcpUp = false;
+volatile bool linkLost = false;
+volatile int16_t connackCode = -1;
+volatile uint32_t lastRxMs = 0;
+
+// AsyncTCP task only
+uint8_t rx[RX_SIZE];
+size_t rxLen = 0;
+size_t rxSkip = 0;
+
+volatile uint32_t publishedCount = 0;
+volatile uint32_t ackedCount = 0;
+volatile uint32_t retransmitCount = 0;
+volatile uint32_t droppedCount = 0;
+volatile uint32_t queuedBytes = 0;
+volatile uint32_t peakQueuedBytes = 0;
+volatile uint8_t inflight = 0;
+uint64_t latencySumUs = 0;
+uint32_t latencyCount = 0;
+uint32_t latencyMaxUs = 0;
+
+inline Packet &packet(uint32_t index) {
+  return packets[index & (MAX_PACKETS - 1)];
+}
+
+void wake() {
+  if (owner) {
+    xTaskNotifyGive(owner);
+  }
+}
+
+size_t remainingLengthSize(size_t len) {
+  return len < 128 ? 1 : len < 16384 ? 2 : len < 2097152 ? 3 : 4;
+}
+
+uint8_t *putRemainingLength(uint8_t *out, size_t len) {
+  do {
+    uint8_t byte = len & 0x7F;
+    len >>= 7;
+    *out++ = len ? byte | 0x80 : byte;
+  } while (len);
+  return out;
+}
+
+uint8_t *putString(uint8_t *out, const char *str, size_t len) {
+  *out++ = len >> 8;
+  *out++ = len & 0xFF;
+  memcpy(out, str, len);
+  return out + len;
+}
+
+// Room for a packet of len bytes, or nullptr. Owner only.
+uint8_t *reserve(size_t len) {
+  if (head - tail >= MAX_PACKETS) {
+    return nullptr;
+  }
+  if (head == tail) {
+    byteHead = 0; // Empty, start over
+  }
+  size_t offset = byteHead;
+  if (head != tail) {
+    size_t tailOffset = packet(tail).offset;
+    if (byteHead > tailOffset) {
+      if (len > QUEUE_SIZE - byteHead) {
+        if (len > tailOffset) {
+          return nullptr;
+        }
+        offset = 0; // Wrap
+      }
+    } else if (len > tailOffset - byteHead) {
+      return nullptr;
+    }
+  } else if (len > QUEUE_SIZE) {
+    return nullptr;
+  }
+  return queue + offset;
+}
+
+void commit(uint8_t *start, size_t len, uint16_t id) {
+  Packet &p = packet(head);
+  p.offset = start - queue;
+  p.len = len;
+  p.id = id;
+  p.done = false;
+  p.sentUs = 0;
+  byteHead = p.offset + len;
+  head++;
+  queuedBytes += len;
+  if (queuedBytes > peakQueuedBytes) {
+    peakQueuedBytes = queuedBytes;
+  }
+}
+
+uint16_t takeId() {
+  uint16_t id = nextId++;
+  if (nextId == 0) {
+    nextId = 1;
+  }
+  return id;
+}
+
+// Drops acknowledged packets from the front. Owner only.
+void release() {
+  portENTER_CRITICAL(&queueMux);
+  while (tail != next && packet(tail).done) {
+    queuedBytes -= packet(tail).len;
+    tail++;
+  }
+  portEXIT_CRITICAL(&queueMux);
+}
+
+// After a lost connection everything not acknowledged is written again
+void rewind() {
+  portENTER_CRITICAL(&queueMux);
+  for (uint32_t i = tail; i != next; i++) {
+    Packet &p = packet(i);
+    if (!p.done && (queue[p.offset] & 0xF0) == PUBLISH) {
+      queue[p.offset] |= DUP;
+    }
+    p.sentUs = 0;
+  }
+  next = tail;
+  nextOffset = 0;
+  inflight = 0;
+  portEXIT_CRITICAL(&queueMux);
+}
+
+void ack(uint16_t id) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&queueMux);
+  for (uint32_t i = tail; i != next; i++) {
+    Packet &p = packet(i);
+    if (p.id != id || p.done) {
+      continue;
+    }
+    p.done = true;
+    if (inflight > 0) {
+      inflight--;
+    }
+    if ((queue[p.offset] & 0xF0) == PUBLISH) {
+      ackedCount++;
+      uint32_t us = now - p.sentUs;
+      latencySumUs += us;
+      latencyCount++;
+      if (us > latencyMaxUs) {
+        latencyMaxUs = us;
+      }
+    }
+    break;
+  }
+  portEXIT_CRITICAL(&queueMux);
+}
+
+void handlePacket(uint8_t type, const uint8_t *body, size_t len) {
+  switch (type & 0xF0) {
+  case CONNACK:
+    if (len >= 2) {
+      connackCode = body[1];
+    }
+    break;
+  case PUBACK:
+  case SUBACK:
+  case UNSUBACK:
+    if (len >= 2) {
+      ack((body[0] << 8) | body[1]);
+    }
+    break;
+  case PUBLISH: {
+    // Subscriptions are QoS 0, so there is never a packet id to answer
+    if (len < 2 || !messageCallback) {
+      break;
+    }
+    size_t topicLen = (body[0] << 8) | body[1];
+    size_t skip = 2 + topicLen + ((type & 0x06) ? 2 : 0);
+    char topic[128];
+    if (skip > len || topicLen >= sizeof(topic)) {
+      break;
+    }
+    memcpy(topic, body + 2, topicLen);
+    topic[topicLen] = '\0';
+    messageCallback(topic, body + skip, len - skip);
+    break;
+  }
+  default: // PINGRESP: lastRxMs is all it is for
+    break;
+  }
+}
+
+// Returns the bytes of rx that were consumed
+size_t parse(size_t available) {
+  size_t pos = 0;
+  while (available - pos >= 2) {
+    size_t remaining = 0;
+    size_t header = 1;
+    uint8_t shift = 0;
+    bool complete = false;
+    while (pos + header < available && header <= 4) {
+      uint8_t byte = rx[pos + header++];
+      remaining |= (size_t)(byte & 0x7F) << shift;
+      shift += 7;
+      if (!(byte & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      if (header > 4) {
+        // Not MQTT; drop the connection rather than guess
+        client.close(true);
+        return available;
+      }
+      break;
+    }
+    size_t total = header + remaining;
+    if (total > RX_SIZE) {
+      // Too big for the buffer (a large retained message): skip it
+      rxSkip = total - (available - pos);
+      return available;
+    }
+    if (available - pos < total) {
+      break;
+    }
+    handlePacket(rx[pos], rx + pos + header, remaining);
+    pos += total;
+  }
+  return pos;
+}
+
+bool current(void *arg) {
+  return (uint32_t)(uintptr_t)arg == linkId;
+}
+
+void onData(void *arg, AsyncClient *c, void *data, size_t len) {
+  if (!current(arg)) {
+    return;
+  }
+  const uint8_t *in = (const uint8_t *)data;
+  lastRxMs = millis();
+  while (len > 0) {
+    if (rxSkip > 0) {
+      size_t n = len < rxSkip ? len : rxSkip;
+      rxSkip -= n;
+      in += n;
+      len -= n;
+      continue;
+    }
+    size_t n = len < RX_SIZE - rxLen ? len : RX_SIZE - rxLen;
+    memcpy(rx + rxLen, in, n);
+    rxLen += n;
+    in += n;
+    len -= n;
+    size_t used = parse(rxLen);
+    memmove(rx, rx + used, rxLen - used);
+    rxLen -= used;
+  }
+  wake();
+}
+
+void onConnect(void *arg, AsyncClient *c) {
+  if (!current(arg)) {
+    return;
+  }
+  tcpUp = true;
+  wake();
+}
+
+void onDisconnect(void *arg, AsyncClient *c) {
+  if (!current(arg)) {
+    return;
+  }
+  linkLost = true;
+  wake();
+}
+
+void onAck(void *arg, AsyncClient *c, size_t len, uint32_t time) {
+  wake(); // Send window has room again
+}
+
+void onError(void *arg, AsyncClient *c, int8_t error) {
+  LOG_W("MQTT", "TCP error %d (%s)", error, c->errorToString(error));
+}
+
+void sendConnect() {
+  size_t clientIdLen = strlen(opts.clientId);
+  bool auth = opts.username && opts.username[0];
+  bool will = opts.willTopic != nullptr;
+  size_t len = 10 + 2 + clientIdLen;
+  if (will) {
+    len += 2 + strlen(opts.willTopic) + 2 + strlen(opts.willPayload);
+  }
+  if (auth) {
+    len += 2 + strlen(opts.username) + 2 + strlen(opts.password);
+  }
+
+  uint8_t buf[512];
+  if (1 + remainingLengthSize(len) + len > sizeof(buf)) {
+    LOG_E("MQTT", "CONNECT too long");
+    client.close(true);
+    return;
+  }
+  uint8_t flags = 0x02; // Clean session
+  if (will) {
+    flags |= 0x04 | 0x08 | 0x20; // Will, QoS 1, retained
+  }
+  if (auth) {
+    flags |= 0x80 | 0x40;
+  }
+
+  uint8_t *out = buf;
+  *out++ = CONNECT;
+  out = putRemainingLength(out, len);
+  out = putString(out, "MQTT", 4);
+  *out++ = 4; // 3.1.1
+  *out++ = flags;
+  *out++ = opts.keepAlive >> 8;
+  *out++ = opts.keepAlive & 0xFF;
+  out = putString(out, opts.clientId, clientIdLen);
+  if (will) {
+    out = putString(out, opts.willTopic, strlen(opts.willTopic));
+    out = putString(out, opts.willPayload, strlen(opts.willPayload));
+  }
+  if (auth) {
+    out = putString(out, opts.username, strlen(opts.username));
+    out = putString(out, opts.password, strlen(opts.password));
+  }
+  client.add((const char *)buf, out - buf);
+  client.send();
+  connectSent = true;
+  lastTxMs = millis();
+}
+
+// Moves queued packets into the TCP send window, never more than fits
+void writeQueued() {
+  size_t space = client.space();
+  bool wrote = false;
+  while (next != head && space > 0) {
+    Packet &p = packet(next);
+    if (p.done) {
+      next++; // QoS 0 that went out before a reconnect
+      continue;
+    }
+    if (nextOffset == 0 && p.id && inflight >= window) {
+      break;
+    }
+    size_t chunk = p.len - nextOffset;
+    if (chunk > space) {
+      chunk = space;
+    }
+    size_t added = client.add((const char *)queue + p.offset + nextOffset, chunk);
+    if (added == 0) {
+      break;
+    }
+    wrote = true;
+    space -= added;
+    nextOffset += added;
+    if (nextOffset < p.len) {
+      break;
+    }
+
+    bool isPublish = (queue[p.offset] & 0xF0) == PUBLISH;
+    if (isPublish) {
+      publishedCount++;
+      if (queue[p.offset] & DUP) {
+        retransmitCount++;
+      }
+    }
+    portENTER_CRITICAL(&queueMux);
+    p.sentUs = esp_timer_get_time();
+    if (p.id) {
+      inflight++;
+    } else {
+      p.done = true;
+    }
+    next++;
+    nextOffset = 0;
+    portEXIT_CRITICAL(&queueMux);
+  }
+  if (wrote) {
+    client.send();
+    lastTxMs = millis();
+  }
+}
+
+void closeLink() {
+  linkId++; // What close() reports is about the old connection
+  client.close(true);
+  rewind();
+  state = STATE_DISCONNECTED;
+}
+
+} // namespace
+
+void begin(const Options &options) {
+  opts = options;
+  owner = xTaskGetCurrentTaskHandle();
+  client.setNoDelay(true);
+}
+
+void onMessage(MessageCallback callback) {
+  messageCallback = callback;
+}
+
+bool connect() {
+  if (state != STATE_DISCONNECTED) {
+    return false;
+  }
+  tcpUp = false;
+  linkLost = false;
+  connectSent = false;
+  connackCode = -1;
+  rxLen = 0;
+  rxSkip = 0;
+  connectStartMs = millis();
+  state = STATE_CONNECTING;
+
+  // The client is closed here, so AsyncTCP has no events queued for it
+  void *tag = (void *)(uintptr_t)++linkId;
+  client.onConnect(onConnect, tag);
+  client.onDisconnect(onDisconnect, tag);
+  client.onData(onData, tag);
+  client.onAck(onAck, tag);
+  client.onError(onError, tag);
+  if (!client.connect(opts.ip, opts.port)) {
+    state = STATE_DISCONNECTED;
+    return false;
+  }
+  return true;
+}
+
+void disconnect() {
+  if (state == STATE_CONNECTED) {
+    const uint8_t packet[2] = {DISCONNECT, 0};
+    client.add((const char *)packet, sizeof(packet));
+    client.send();
+  }
+  closeLink();
+}
+
+State getState() {
+  return state;
+}
+
+bool isConnected() {
+  return state == STATE_CONNECTED;
+}
+
+bool publish(const char *topic, const char *payload, bool retained, uint8_t qos) {
+  size_t topicLen = strlen(topic);
+  size_t payloadLen = strlen(payload);
+  size_t len = 2 + topicLen + (qos ? 2 : 0) + payloadLen;
+  size_t total = 1 + remainingLengthSize(len) + len;
+
+  uint8_t *start = reserve(total);
+  if (!start) {
+    droppedCount++;
+    return false;
+  }
+  uint16_t id = qos ? takeId() : 0;
+  uint8_t *out = start;
+  *out++ = PUBLISH | (qos ? 0x02 : 0) | (retained ? 0x01 : 0);
+  out = putRemainingLength(out, len);
+  out = putString(out, topic, topicLen);
+  if (id) {
+    *out++ = id >> 8;
+    *out++ = id & 0xFF;
+  }
+  memcpy(out, payload, payloadLen);
+  commit(start, total, id);
+  wake();
+  return true;
+}
+
+bool subscribe(const char *topic) {
+  size_t topicLen = strlen(topic);
+  size_t len = 2 + 2 + topicLen + 1;
+  size_t total = 1 + remainingLengthSize(len) + len;
+
+  uint8_t *start = reserve(total);
+  if (!start) {
+    droppedCount++;
+    return false;
+  }
+  uint16_t id = takeId();
+  uint8_t *out = start;
+  *out++ = SUBSCRIBE;
+  out = putRemainingLength(out, len);
+  *out++ = id >> 8;
+  *out++ = id & 0xFF;
+  out = putString(out, topic, topicLen);
+  *out++ = 0; // QoS 0
+  commit(start, total, id);
+  wake();
+  return true;
+}
+
+bool unsubscribe(const char *topic) {
+  size_t topicLen = strlen(topic);
+  size_t len = 2 + 2 + topicLen;
+  size_t total = 1 + remainingLengthSize(len) + len;
+
+  uint8_t *start = reserve(total);
+  if (!start) {
+    droppedCount++;
+    return false;
+  }
+  uint16_t id = takeId();
+  uint8_t *out = start;
+  *out++ = UNSUBSCRIBE;
+  out = putRemainingLength(out, len);
+  *out++ = id >> 8;
+  *out++ = id & 0xFF;
+  putString(out, topic, topicLen);
+  commit(start, total, id);
+  wake();
+  return true;
+}
+
+void setWindow(uint8_t packets) {
+  window = packets == 0 || packets > MAX_INFLIGHT ? MAX_INFLIGHT : packets;
+}
+
+bool idle() {
+  return head == tail;
+}
+
+void loop() {
+  uint32_t now = millis();
+
+  if (linkLost && state != STATE_DISCONNECTED) {
+    linkLost = false;
+    if (state == STATE_CONNECTED) {
+      LOG_W("MQTT", "Connection closed, %u packets kept for resending", head - tail);
+    }
+    rewind();
+    state = STATE_DISCONNECTED;
+    return;
+  }
+
+  switch (state) {
+  case STATE_DISCONNECTED:
+    break;
+
+  case STATE_CONNECTING:
+    if (tcpUp && !connectSent) {
+      sendConnect();
+    }
+    if (connackCode == 0) {
+      state = STATE_CONNECTED;
+      lastRxMs = now;
+      writeQueued();
+    } else if (connackCode > 0) {
+      LOG_W("MQTT", "Broker refused the connection, code %d", connackCode);
+      closeLink();
+    } else if (now - connectStartMs >= CONNECT_TIMEOUT_MS) {
+      LOG_W("MQTT", "No %s within %lu ms", tcpUp ? "CONNACK" : "TCP connection",
+            CONNECT_TIMEOUT_MS);
+      closeLink();
+    }
+    break;
+
+  case STATE_CONNECTED:
+    release();
+    writeQueued();
+    if (now - lastRxMs >= opts.keepAlive * 1500UL) {
+      LOG_W("MQTT", "Broker silent for %lu ms, closing", now - lastRxMs);
+      closeLink();
+    } else if (now - lastTxMs >= opts.keepAlive * 500UL && client.space() >= 2) {
+      const uint8_t ping[2] = {PINGREQ, 0};
+      client.add((const char *)ping, sizeof(ping));
+      client.send();
+      lastTxMs = now;
+    }
+    break;
+  }
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.published = publishedCount;
+  stats.acked = ackedCount;
+  stats.retransmits = retransmitCount;
+  stats.dropped = droppedCount;
+  stats.queued = queuedBytes;
+  stats.peakQueued = peakQueuedBytes;
+  stats.capacity = QUEUE_SIZE;
+  stats.inflight = inflight;
+  portENTER_CRITICAL(&queueMux);
+  stats.ackLatencyAvgUs = latencyCount ? latencySumUs / latencyCount : 0;
+  stats.ackLatencyMaxUs = latencyMaxUs;
+  portEXIT_CRITICAL(&queueMux);
+  return stats;
+}
+
+void resetLatency() {
+  portENTER_CRITICAL(&queueMux);
+  latencySumUs = 0;
+  latencyCount = 0;
+  latencyMaxUs = 0;
+  portEXIT_CRITICAL(&queueMux);
+}
+
+} // namespace MqttClient
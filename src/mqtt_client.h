@@ -0,0 +1,81 @@
+#ifndef _MQTT_CLIENT_H_
+#define _MQTT_CLIENT_H_
+
+#include <Arduino.h>
+
+namespace MqttClient {
+
+// MQTT 3.1.1 client on AsyncTCP. Nothing here waits for the network:
+// publish() encodes into a fixed-size outbound queue, loop() moves as much
+// of it as fits into the TCP send window, and replies are parsed in the
+// AsyncTCP task. Several QoS 1 publishes can be in flight at once; they stay
+// in the queue until acknowledged and are sent again (DUP) after a reconnect.
+//
+// Single owner: begin(), connect(), publish(), subscribe() and loop() must
+// all be called from the same task. AsyncTCP callbacks only record what
+// arrived and wake the owner.
+
+typedef enum {
+  STATE_DISCONNECTED = 0,
+  STATE_CONNECTING, // TCP handshake or waiting for CONNACK
+  STATE_CONNECTED
+} State;
+
+// Runs in the AsyncTCP task; keep it short
+typedef void (*MessageCallback)(const char *topic, const uint8_t *payload, uint16_t length);
+
+typedef struct Options {
+  IPAddress ip;
+  uint16_t port;
+  const char *clientId;
+  const char *username;    // nullptr or "": no authentication
+  const char *password;
+  const char *willTopic;   // nullptr: no last will
+  const char *willPayload; // Sent retained, QoS 1
+  uint16_t keepAlive;      // Seconds
+} Options;
+
+typedef struct Stats {
+  uint32_t published;    // Publishes written to the socket (QoS 0 and 1)
+  uint32_t acked;        // PUBACKs received
+  uint32_t retransmits;  // QoS 1 publishes sent again after a reconnect
+  uint32_t dropped;      // publish() refused, queue full
+  uint32_t queued;       // Bytes in the queue now
+  uint32_t peakQueued;
+  uint32_t capacity;
+  uint8_t inflight;      // QoS 1 sent, not yet acknowledged
+  uint32_t ackLatencyAvgUs; // Written to socket -> PUBACK
+  uint32_t ackLatencyMaxUs;
+} Stats;
+
+// Strings in options must stay valid. The calling task becomes the owner
+// and gets a task notification whenever there is something for loop().
+void begin(const Options &options);
+void onMessage(MessageCallback callback);
+
+// Starts a connection attempt and returns; watch getState()
+bool connect();
+void disconnect();
+State getState();
+bool isConnected();
+
+// Queues a publish. false when it does not fit; nothing is queued then.
+bool publish(const char *topic, const char *payload, bool retained, uint8_t qos = 1);
+bool subscribe(const char *topic);
+bool unsubscribe(const char *topic);
+
+// QoS 1 publishes in flight at once, 1..8; 0 restores the default (8)
+void setWindow(uint8_t packets);
+
+// Nothing queued or waiting for an acknowledgement
+bool idle();
+
+// Sends queued data, keep-alive and timeouts. Call often from the owner.
+void loop();
+
+Stats getStats();
+void resetLatency();
+
+} // namespace MqttClient
+
+#endif
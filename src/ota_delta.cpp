@@ -0,0 +1,246 @@
+#include "ota_delta.h"
+#include "logger.h"
+#include <Arduino.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_task_wdt.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mbedtls/sha256.h>
+
+namespace OtaDelta {
+
+namespace {
+
+typedef enum {
+  STATE_HEADER = 0,
+  STATE_CONTROL,
+  STATE_DIFF,
+  STATE_EXTRA,
+  STATE_FAILED
+} State;
+
+const size_t HEADER_SIZE = 48;
+const size_t CONTROL_SIZE = 12;
+const size_t COPY_CHUNK = 512;
+const uint32_t HASH_YIELD_BYTES = 32768; // About 5 ms of reading and hashing
+
+Sink output = nullptr;
+State state = STATE_HEADER;
+bool baseMismatch = false;
+char lastError[64] = "";
+
+const esp_partition_t *base = nullptr;
+uint32_t baseSize = 0;
+uint32_t newSize = 0;
+uint32_t newWritten = 0;
+
+uint8_t header[HEADER_SIZE];
+size_t headerPos = 0;
+
+uint8_t control[CONTROL_SIZE];
+size_t controlPos = 0;
+
+// Base hash of the running partition; it does not change until reboot
+uint32_t hashedSize = 0;
+uint8_t hashedDigest[32];
+
+uint32_t oldPos = 0;
+uint32_t diffLeft = 0;
+uint32_t extraLeft = 0;
+int32_t seek = 0;
+
+uint32_t readLE32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool fail(const char *msg) {
+  strlcpy(lastError, msg, sizeof(lastError));
+  state = STATE_FAILED;
+  return false;
+}
+
+bool emit(const uint8_t *data, size_t len) {
+  if (newWritten + len > newSize) {
+    return fail("Patch produces more data than declared");
+  }
+  newWritten += len;
+  return output(data, len);
+}
+
+// Hashes the running image over the declared base size. Up to the whole
+// partition: this runs in async_tcp for browser uploads, so it yields (and
+// feeds the watchdog, if the task is subscribed) between slices.
+bool hashBase() {
+  uint8_t buf[COPY_CHUNK];
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  for (uint32_t ofs = 0; ofs < baseSize; ofs += sizeof(buf)) {
+    size_t n = min((size_t)(baseSize - ofs), sizeof(buf));
+    if (esp_partition_read(base, ofs, buf, n) != ESP_OK) {
+      mbedtls_sha256_free(&sha);
+      return fail("Cannot read the running partition");
+    }
+    mbedtls_sha256_update(&sha, buf, n);
+    if ((ofs + n) % HASH_YIELD_BYTES == 0) {
+      if (esp_task_wdt_status(NULL) == ESP_OK) {
+        esp_task_wdt_reset();
+      }
+      vTaskDelay(1);
+    }
+  }
+  mbedtls_sha256_finish(&sha, hashedDigest);
+  mbedtls_sha256_free(&sha);
+  hashedSize = baseSize;
+  return true;
+}
+
+bool checkBase() {
+  if (memcmp(header, "ESSD", 4) != 0 || header[4] != 1) {
+    return fail("Unknown delta format");
+  }
+
+  baseSize = readLE32(header + 8);
+  newSize = readLE32(header + 44);
+
+  base = esp_ota_get_running_partition();
+  if (!base || baseSize > base->size) {
+    baseMismatch = true;
+    return fail("Delta base does not fit the running partition");
+  }
+
+  if (hashedSize != baseSize && !hashBase()) {
+    return false;
+  }
+  if (memcmp(hashedDigest, header + 12, sizeof(hashedDigest)) != 0) {
+    baseMismatch = true;
+    return fail("Delta base mismatch, upload the full image");
+  }
+
+  LOG_I("OTA", "Delta patch: base %lu bytes verified, new image %lu bytes",
+        baseSize, newSize);
+  return true;
+}
+
+// Adds diff bytes to the base image and emits the result
+bool applyDiff(const uint8_t *data, size_t len) {
+  uint8_t old[COPY_CHUNK];
+
+  while (len > 0) {
+    size_t n = min(len, sizeof(old));
+    if (oldPos + n > baseSize) {
+      return fail("Patch reads past the base image");
+    }
+    if (esp_partition_read(base, oldPos, old, n) != ESP_OK) {
+      return fail("Cannot read the running partition");
+    }
+    for (size_t i = 0; i < n; i++) {
+      old[i] += data[i];
+    }
+    if (!emit(old, n)) {
+      return false;
+    }
+    oldPos += n;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+} // namespace
+
+bool begin(Sink sink) {
+  output = sink;
+  state = STATE_HEADER;
+  baseMismatch = false;
+  lastError[0] = '\0';
+  headerPos = 0;
+  controlPos = 0;
+  oldPos = 0;
+  newWritten = 0;
+  return true;
+}
+
+bool write(const uint8_t *data, size_t len) {
+  size_t ofs = 0;
+
+  while (ofs < len) {
+    switch (state) {
+    case STATE_HEADER:
+      while (ofs < len && headerPos < HEADER_SIZE) {
+        header[headerPos++] = data[ofs++];
+      }
+      if (headerPos == HEADER_SIZE) {
+        if (!checkBase()) {
+          return false;
+        }
+        state = STATE_CONTROL;
+      }
+      break;
+
+    case STATE_CONTROL:
+      while (ofs < len && controlPos < CONTROL_SIZE) {
+        control[controlPos++] = data[ofs++];
+      }
+      if (controlPos == CONTROL_SIZE) {
+        controlPos = 0;
+        diffLeft = readLE32(control);
+        extraLeft = readLE32(control + 4);
+        seek = (int32_t)readLE32(control + 8);
+        state = diffLeft ? STATE_DIFF : STATE_EXTRA;
+      }
+      break;
+
+    case STATE_DIFF: {
+      size_t n = min((size_t)diffLeft, len - ofs);
+      if (!applyDiff(data + ofs, n)) {
+        return false;
+      }
+      ofs += n;
+      diffLeft -= n;
+      if (diffLeft == 0) {
+        state = STATE_EXTRA;
+      }
+      break;
+    }
+
+    case STATE_EXTRA: {
+      size_t n = min((size_t)extraLeft, len - ofs);
+      if (n && !emit(data + ofs, n)) {
+        return false;
+      }
+      ofs += n;
+      extraLeft -= n;
+      break;
+    }
+
+    case STATE_FAILED:
+      return false;
+    }
+
+    // A control block is done once its extra part is fully consumed
+    if (state == STATE_EXTRA && extraLeft == 0) {
+      if ((int64_t)oldPos + seek < 0 || (int64_t)oldPos + seek > baseSize) {
+        return fail("Patch seeks outside the base image");
+      }
+      oldPos += seek;
+      state = STATE_CONTROL;
+    }
+  }
+  return true;
+}
+
+bool isComplete() {
+  return state == STATE_CONTROL && controlPos == 0 && newWritten == newSize;
+}
+
+bool isBaseMismatch() {
+  return baseMismatch;
+}
+
+const char *errorString() {
+  return lastError;
+}
+
+} // namespace OtaDelta
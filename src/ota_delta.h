@@ -0,0 +1,43 @@
+#ifndef _OTA_DELTA_H_
+#define _OTA_DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace OtaDelta {
+
+// Streaming applier for delta images produced by tools/ota_delta.py.
+//
+// Patch layout (little endian):
+//   header  "ESSD" | u8 version | 3 x reserved | u32 baseSize |
+//           sha256(base image) | u32 newSize
+//   repeat  u32 diffLen | u32 extraLen | i32 seek
+//           diffLen bytes added to the base image at the current offset
+//           extraLen literal bytes
+//           base offset += seek
+//
+// The base image is read straight from the running partition, so RAM use is
+// bounded by two small copy buffers no matter how large the image is.
+
+const uint8_t MAGIC_FIRST_BYTE = 'E';
+
+typedef bool (*Sink)(const uint8_t *data, size_t len);
+
+// Start applying a patch; reconstructed image bytes are passed to sink
+bool begin(Sink sink);
+
+// Feed the next chunk of (decompressed) patch data
+bool write(const uint8_t *data, size_t len);
+
+// True once every control block of the patch has been applied
+bool isComplete();
+
+// True when the patch was made against a different firmware than the one
+// running - the caller should fall back to a full image
+bool isBaseMismatch();
+
+const char *errorString();
+
+} // namespace OtaDelta
+
+#endif
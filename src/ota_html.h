@@ -143,7 +143,9 @@ const char OTA_HTML[] PROGMEM = R"rawliteral(
       <div class="info">
         <p><strong>⚠️ Warning:</strong></p>
         <p>• Do not disconnect power during update</p>
-        <p>• Only upload .bin files from trusted sources</p>
+        <p>• Only upload .bin / .patch (optionally .gz) files from trusted sources</p>
+        <p>• A .patch only applies on top of the firmware it was built against</p>
+        <p>• Select the matching .manifest.json, its SHA-256 is verified before flashing</p>
         <p>• Device will reboot after successful update</p>
       </div>
 
@@ -151,10 +153,16 @@ const char OTA_HTML[] PROGMEM = R"rawliteral(
 
       <form id="uploadForm" class="upload-form">
         <label for="firmware" class="file-label">
-          📁 Click to select firmware (.bin file)
+          📁 Click to select firmware (.bin, .patch or .gz file)
           <div id="fileName" class="file-name"></div>
         </label>
-        <input type="file" id="firmware" name="firmware" accept=".bin" class="file-input" required>
+        <input type="file" id="firmware" name="firmware" accept=".bin,.patch,.gz" class="file-input" required>
+
+        <label for="manifest" class="file-label">
+          🔏 Click to select the manifest (.manifest.json)
+          <div id="manifestName" class="file-name"></div>
+        </label>
+        <input type="file" id="manifest" accept=".json" class="file-input" required>
 
         <div id="progress" class="progress">
           <div id="progressBar" class="progress-bar">0%</div>
@@ -164,11 +172,26 @@ const char OTA_HTML[] PROGMEM = R"rawliteral(
         <button type="button" onclick="window.location.href='/'" class="btn btn-secondary">← Back to Dashboard</button>
       </form>
     </div>
+
+    <div class="card">
+      <h1>🌐 Pull from LAN server</h1>
+      <div class="info">
+        <p>The device downloads the firmware itself and resumes if the connection drops.</p>
+        <p>The server must support HTTP Range requests (nginx, or tools/ota_serve.py).</p>
+      </div>
+      <input type="text" id="pullUrl" placeholder="http://192.168.0.10:8000/firmware.bin.gz" style="width: 100%; padding: 10px; margin-bottom: 15px; background: #333; border: 1px solid #555; color: #e0e0e0; border-radius: 4px; box-sizing: border-box;">
+      <div id="pullProgress" class="progress">
+        <div id="pullProgressBar" class="progress-bar">0%</div>
+      </div>
+      <button type="button" id="pullBtn" onclick="startPull()" class="btn btn-primary">⬇️ Pull Firmware</button>
+    </div>
   </div>
 
   <script>
     const fileInput = document.getElementById('firmware');
     const fileName = document.getElementById('fileName');
+    const manifestInput = document.getElementById('manifest');
+    const manifestName = document.getElementById('manifestName');
     const uploadForm = document.getElementById('uploadForm');
     const uploadBtn = document.getElementById('uploadBtn');
     const progress = document.getElementById('progress');
@@ -183,6 +206,10 @@ const char OTA_HTML[] PROGMEM = R"rawliteral(
       }
     });
 
+    manifestInput.addEventListener('change', function(e) {
+      manifestName.textContent = e.target.files.length > 0 ? '✓ ' + e.target.files[0].name : '';
+    });
+
     uploadForm.addEventListener('submit', function(e) {
       e.preventDefault();
 
@@ -192,17 +219,26 @@ const char OTA_HTML[] PROGMEM = R"rawliteral(
         return;
       }
 
-      if (!file.name.endsWith('.bin')) {
-        showMessage('Only .bin files are allowed', 'error');
+      if (!/\.(bin|patch)(\.gz)?$/.test(file.name)) {
+        showMessage('Only .bin, .patch or .gz files are allowed', 'error');
         return;
       }
 
-      uploadFirmware(file);
+      const manifestFile = manifestInput.files[0];
+      if (!manifestFile) {
+        showMessage('Please select the firmware.manifest.json made with the image', 'error');
+        return;
+      }
+      manifestFile.text().then(function(text) {
+        uploadFirmware(file, text);
+      });
     });
 
-    function uploadFirmware(file) {
+    function uploadFirmware(file, manifest) {
       const xhr = new XMLHttpRequest();
       const formData = new FormData();
+      // The manifest must precede the file so the device sees it before the first chunk
+      formData.append('manifest', manifest);
       formData.append('firmware', file);
 
       // Show progress bar
@@ -224,10 +260,13 @@ const char OTA_HTML[] PROGMEM = R"rawliteral(
         if (xhr.status === 200) {
           progressBar.style.width = '100%';
           progressBar.textContent = '100%';
-          showMessage('✓ Update successful! Device is rebooting...', 'success');
+          showMessage('✓ ' + xhr.responseText, 'success');
           setTimeout(function() {
             window.location.href = '/';
           }, 5000);
+        } else if (xhr.status === 409 && !xhr.responseText.startsWith('Busy')) {
+          showMessage('✗ This patch was built for a different firmware. Upload the full .bin / .bin.gz image instead.', 'error');
+          uploadBtn.disabled = false;
         } else {
           showMessage('✗ Update failed: ' + xhr.responseText, 'error');
           uploadBtn.disabled = false;
@@ -244,6 +283,56 @@ const char OTA_HTML[] PROGMEM = R"rawliteral(
       xhr.send(formData);
     }
 
+    const pullUrl = document.getElementById('pullUrl');
+    const pullBtn = document.getElementById('pullBtn');
+    const pullProgress = document.getElementById('pullProgress');
+    const pullProgressBar = document.getElementById('pullProgressBar');
+
+    fetch('/api/settings')
+      .then(r => r.json())
+      .then(data => { if (data.otaUrl) pullUrl.value = data.otaUrl; })
+      .catch(() => {});
+
+    function startPull() {
+      pullBtn.disabled = true;
+      fetch('/api/ota/pull', {
+        method: 'POST',
+        headers: {'Content-Type': 'application/json'},
+        body: JSON.stringify({url: pullUrl.value})
+      })
+      .then(r => r.json())
+      .then(result => {
+        if (result.success) {
+          pullProgress.style.display = 'block';
+          pollPull();
+        } else {
+          showMessage('✗ ' + result.error, 'error');
+          pullBtn.disabled = false;
+        }
+      })
+      .catch(err => { showMessage('✗ ' + err, 'error'); pullBtn.disabled = false; });
+    }
+
+    function pollPull() {
+      fetch('/api/ota/pull')
+        .then(r => r.json())
+        .then(s => {
+          const percent = s.total ? Math.round(s.received * 100 / s.total) : 0;
+          pullProgressBar.style.width = percent + '%';
+          pullProgressBar.textContent = percent + '% ' + s.state + (s.resumes ? ' (resumed ' + s.resumes + 'x)' : '');
+          if (s.state === 'done') {
+            showMessage('✓ Update successful! Device is rebooting...', 'success');
+            setTimeout(function() { window.location.href = '/'; }, 8000);
+          } else if (s.state === 'failed') {
+            showMessage('✗ Pull update failed: ' + s.error, 'error');
+            pullBtn.disabled = false;
+          } else {
+            setTimeout(pollPull, 1000);
+          }
+        })
+        .catch(() => setTimeout(pollPull, 2000));
+    }
+
     function showMessage(text, type) {
       message.textContent = text;
       message.className = 'message ' + type;
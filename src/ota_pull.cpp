@@ -0,0 +1,412 @@
+#include "ota_pull.h"
+#include "logger.h"
+#include "ota_stream.h"
+#include "types.h"
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+extern Config Cfg;
+extern bool needRestart;
+
+namespace OtaPull {
+
+namespace {
+
+const size_t BUFFER_SIZE = 4096;       // One flash sector
+const uint8_t END_OF_STREAM = 0xFF;    // Queue marker instead of a buffer index
+const uint8_t MAX_RETRIES = 10;
+const uint32_t STALL_TIMEOUT_MS = 10000;
+
+typedef struct Buffer {
+  uint8_t *data;
+  size_t len;
+} Buffer;
+
+Buffer buffers[2] = {};
+QueueHandle_t freeQueue = nullptr;   // Buffers the downloader may fill
+QueueHandle_t fullQueue = nullptr;   // Buffers waiting for the flash writer
+SemaphoreHandle_t writerDone = nullptr;
+
+volatile bool writerFailed = false;
+volatile bool writerAbort = false;
+volatile bool writerOk = false;
+
+portMUX_TYPE statusMux = portMUX_INITIALIZER_UNLOCKED;
+Status status = {};
+volatile bool running = false;
+uint32_t startMillis = 0;
+
+void setState(State state) {
+  portENTER_CRITICAL(&statusMux);
+  status.state = state;
+  status.elapsedMs = millis() - startMillis;
+  portEXIT_CRITICAL(&statusMux);
+}
+
+void setProgress(uint32_t received, uint32_t total) {
+  portENTER_CRITICAL(&statusMux);
+  status.received = received;
+  status.total = total;
+  status.elapsedMs = millis() - startMillis;
+  portEXIT_CRITICAL(&statusMux);
+}
+
+bool fail(const char *msg) {
+  LOG_E("OTA", "Pull update failed: %s", msg);
+  portENTER_CRITICAL(&statusMux);
+  strlcpy(status.error, msg, sizeof(status.error));
+  portEXIT_CRITICAL(&statusMux);
+  setState(STATE_FAILED);
+  return false;
+}
+
+bool endsWith(const char *s, const char *suffix) {
+  size_t len = strlen(s);
+  size_t suffixLen = strlen(suffix);
+  return len >= suffixLen && strcmp(s + len - suffixLen, suffix) == 0;
+}
+
+// firmware.bin[.gz] / firmware.patch[.gz] -> firmware<replacement>
+bool replaceImageSuffix(const char *url, const char *replacement, char *out,
+                        size_t outLen) {
+  static const char *const suffixes[] = {".bin.gz", ".patch.gz", ".bin", ".patch"};
+  for (const char *suffix : suffixes) {
+    if (endsWith(url, suffix)) {
+      size_t baseLen = strlen(url) - strlen(suffix);
+      if (baseLen + strlen(replacement) + 1 > outLen) {
+        return false;
+      }
+      memcpy(out, url, baseLen);
+      strcpy(out + baseLen, replacement);
+      return true;
+    }
+  }
+  return false;
+}
+
+String fetchManifest(const char *url) {
+  char manifestUrl[sizeof(status.url) + 16];
+  if (!replaceImageSuffix(url, ".manifest.json", manifestUrl, sizeof(manifestUrl))) {
+    return String();
+  }
+
+  HTTPClient http;
+  http.begin(manifestUrl);
+  http.setTimeout(10000);
+  int code = http.GET();
+  String manifest = code == HTTP_CODE_OK ? http.getString() : String();
+  http.end();
+
+  LOG_I("OTA", "Manifest %s: %s", manifestUrl,
+        manifest.isEmpty() ? "not found" : "loaded");
+  return manifest;
+}
+
+// Flash writer: the only place OtaStream::write() is called from during a
+// pull update. Sector erases stall here instead of in the download path.
+void writerTask(void *pvParameters) {
+  uint8_t idx;
+  while (xQueueReceive(fullQueue, &idx, portMAX_DELAY) == pdTRUE) {
+    if (idx == END_OF_STREAM) {
+      if (writerAbort || writerFailed) {
+        OtaStream::abort();
+        writerOk = false;
+      } else {
+        writerOk = OtaStream::end();
+      }
+      break;
+    }
+
+    if (!writerFailed && !OtaStream::write(buffers[idx].data, buffers[idx].len)) {
+      writerFailed = true;
+    }
+    xQueueSend(freeQueue, &idx, portMAX_DELAY);
+  }
+
+  xSemaphoreGive(writerDone);
+  vTaskDelete(NULL);
+}
+
+uint32_t parseContentRangeTotal(const String &contentRange) {
+  // "bytes 1000-1999/123456"
+  int slash = contentRange.lastIndexOf('/');
+  return slash >= 0 ? contentRange.substring(slash + 1).toInt() : 0;
+}
+
+// Downloads url into the buffer queue, resuming with Range requests
+bool download(const char *url) {
+  uint32_t offset = 0;
+  uint32_t total = 0;
+  uint8_t retries = 0;
+  uint8_t idx = 0;
+  Buffer *current = nullptr;
+  bool complete = false;
+
+  setProgress(0, 0);
+
+  while (!complete) {
+    if (writerFailed) {
+      return fail(OtaStream::errorString());
+    }
+
+    setState(STATE_DOWNLOADING);
+
+    HTTPClient http;
+    http.begin(url);
+    http.setTimeout(STALL_TIMEOUT_MS);
+    const char *headerKeys[] = {"Content-Range"};
+    http.collectHeaders(headerKeys, 1);
+    if (offset > 0) {
+      char range[32];
+      snprintf(range, sizeof(range), "bytes=%lu-", offset);
+      http.addHeader("Range", range);
+    }
+
+    int code = http.GET();
+    bool streaming = false;
+
+    if (code == HTTP_CODE_OK && offset == 0) {
+      total = http.getSize() > 0 ? http.getSize() : 0;
+      streaming = true;
+    } else if (code == HTTP_CODE_PARTIAL_CONTENT) {
+      total = parseContentRangeTotal(http.header("Content-Range"));
+      streaming = true;
+      portENTER_CRITICAL(&statusMux);
+      status.resumes++;
+      portEXIT_CRITICAL(&statusMux);
+      LOG_I("OTA", "Resuming download at %lu/%lu bytes", offset, total);
+    } else if (code == HTTP_CODE_OK) {
+      http.end();
+      return fail("Server does not support Range requests");
+    } else if (code >= 400 && code < 500) {
+      http.end();
+      char msg[48];
+      snprintf(msg, sizeof(msg), "HTTP %d", code);
+      return fail(msg);
+    }
+
+    if (streaming) {
+      WiFiClient *stream = http.getStreamPtr();
+      uint32_t lastData = millis();
+
+      while (total == 0 || offset < total) {
+        if (writerFailed) {
+          break;
+        }
+        if (!current) {
+          xQueueReceive(freeQueue, &idx, portMAX_DELAY);
+          current = &buffers[idx];
+          current->len = 0;
+        }
+
+        size_t available = stream->available();
+        if (available) {
+          size_t n = stream->readBytes(current->data + current->len,
+                                       min(available, BUFFER_SIZE - current->len));
+          current->len += n;
+          offset += n;
+          lastData = millis();
+          if (n) {
+            retries = 0;
+          }
+          setProgress(offset, total);
+
+          if (current->len == BUFFER_SIZE) {
+            xQueueSend(fullQueue, &idx, portMAX_DELAY);
+            current = nullptr;
+          }
+        } else if (!stream->connected()) {
+          break;
+        } else if (millis() - lastData > STALL_TIMEOUT_MS) {
+          LOG_W("OTA", "Download stalled at %lu bytes", offset);
+          break;
+        } else {
+          vTaskDelay(1);
+        }
+      }
+
+      // Without a length the server closing the connection is the end;
+      // a truncated stream is still caught by the gzip trailer / manifest.
+      complete = (total > 0 && offset >= total) ||
+                 (total == 0 && !stream->connected() && offset > 0);
+    }
+    http.end();
+
+    if (!complete && !writerFailed) {
+      if (++retries > MAX_RETRIES) {
+        return fail("Too many connection failures");
+      }
+      uint32_t backoff = 1000UL << min<uint8_t>(retries - 1, 5);
+      LOG_W("OTA", "Connection lost (HTTP %d), retry %u in %lu ms", code,
+            retries, backoff);
+      setState(STATE_RETRY_WAIT);
+      vTaskDelay(backoff / portTICK_PERIOD_MS);
+    }
+  }
+
+  if (current && current->len) {
+    xQueueSend(fullQueue, &idx, portMAX_DELAY);
+  } else if (current) {
+    xQueueSend(freeQueue, &idx, portMAX_DELAY);
+  }
+  return !writerFailed || fail(OtaStream::errorString());
+}
+
+// One complete attempt: manifest, download, verify, commit
+bool pull(const char *url, const String &manifest) {
+  writerFailed = false;
+  writerAbort = false;
+  writerOk = false;
+
+  if (!OtaStream::begin(manifest.c_str())) {
+    return fail(OtaStream::errorString());
+  }
+
+  xQueueReset(freeQueue);
+  xQueueReset(fullQueue);
+  for (uint8_t i = 0; i < 2; i++) {
+    xQueueSend(freeQueue, &i, 0);
+  }
+  xTaskCreatePinnedToCore(writerTask, "ota_writer", 6144, NULL, 1, NULL, 1);
+
+  bool downloaded = download(url);
+  writerAbort = !downloaded;
+  if (downloaded) {
+    setState(STATE_VERIFYING);
+  }
+  xQueueSend(fullQueue, &END_OF_STREAM, portMAX_DELAY);
+  xSemaphoreTake(writerDone, portMAX_DELAY);
+
+  if (!downloaded) {
+    return false;
+  }
+  if (!writerOk) {
+    return fail(OtaStream::errorString());
+  }
+  return true;
+}
+
+void downloadTask(void *pvParameters) {
+  char url[sizeof(status.url)];
+  portENTER_CRITICAL(&statusMux);
+  strlcpy(url, status.url, sizeof(url));
+  portEXIT_CRITICAL(&statusMux);
+
+  LOG_I("OTA", "Pull update from %s", url);
+
+  setState(STATE_MANIFEST);
+  String manifest = fetchManifest(url);
+
+  bool ok = pull(url, manifest);
+
+  // A patch for another base firmware: fetch the full image instead
+  if (!ok && OtaStream::isBaseMismatch()) {
+    char fullUrl[sizeof(status.url)];
+    if (replaceImageSuffix(url, endsWith(url, ".gz") ? ".bin.gz" : ".bin",
+                           fullUrl, sizeof(fullUrl))) {
+      LOG_W("OTA", "Delta base mismatch, falling back to %s", fullUrl);
+      portENTER_CRITICAL(&statusMux);
+      strlcpy(status.url, fullUrl, sizeof(status.url));
+      status.error[0] = '\0';
+      portEXIT_CRITICAL(&statusMux);
+      ok = pull(fullUrl, manifest);
+    }
+  }
+
+  if (ok) {
+    char summary[160];
+    OtaStream::formatSummary(summary, sizeof(summary));
+    LOG_I("OTA", "Pull update complete: %s", summary);
+    setState(STATE_DONE);
+    needRestart = true;
+  }
+
+  for (Buffer &b : buffers) {
+    free(b.data);
+    b.data = nullptr;
+  }
+  running = false;
+  vTaskDelete(NULL);
+}
+
+} // namespace
+
+bool start(const char *url) {
+  // OtaStream is running while a browser upload is
+  if (running || OtaStream::isRunning()) {
+    return false;
+  }
+  if (!url || !*url) {
+    url = Cfg.otaUrl;
+  }
+  if (!*url) {
+    return false;
+  }
+
+  if (!freeQueue) {
+    freeQueue = xQueueCreate(2, sizeof(uint8_t));
+    fullQueue = xQueueCreate(3, sizeof(uint8_t));
+    writerDone = xSemaphoreCreateBinary();
+  }
+
+  for (Buffer &b : buffers) {
+    b.data = (uint8_t *)malloc(BUFFER_SIZE);
+    if (!b.data) {
+      for (Buffer &f : buffers) {
+        free(f.data);
+        f.data = nullptr;
+      }
+      return false;
+    }
+  }
+
+  portENTER_CRITICAL(&statusMux);
+  status = {};
+  strlcpy(status.url, url, sizeof(status.url));
+  portEXIT_CRITICAL(&statusMux);
+
+  running = true;
+  startMillis = millis();
+  xTaskCreatePinnedToCore(downloadTask, "ota_pull", 8192, NULL, 1, NULL, 0);
+  return true;
+}
+
+bool isRunning() {
+  return running;
+}
+
+Status getStatus() {
+  Status copy;
+  portENTER_CRITICAL(&statusMux);
+  copy = status;
+  portEXIT_CRITICAL(&statusMux);
+  return copy;
+}
+
+const char *stateToString(State state) {
+  switch (state) {
+  case STATE_IDLE:
+    return "idle";
+  case STATE_MANIFEST:
+    return "manifest";
+  case STATE_DOWNLOADING:
+    return "downloading";
+  case STATE_RETRY_WAIT:
+    return "retry_wait";
+  case STATE_VERIFYING:
+    return "verifying";
+  case STATE_DONE:
+    return "done";
+  case STATE_FAILED:
+    return "failed";
+  default:
+    return "unknown";
+  }
+}
+
+} // namespace OtaPull
@@ -0,0 +1,51 @@
+#ifndef _OTA_PULL_H_
+#define _OTA_PULL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace OtaPull {
+
+// Device-initiated OTA: downloads firmware from a LAN HTTP server with Range
+// requests, resumes after connection drops and hands 4 KB sector-sized
+// buffers to a separate flash writer task, so neither async_tcp nor the
+// download stall while flash sectors are erased.
+//
+// Any format accepted by OtaStream works (.bin, .bin.gz, .patch, .patch.gz).
+// The manifest is fetched from the same location (firmware.manifest.json).
+// If a patch does not match the running firmware, the full image
+// (.bin.gz next to the patch) is downloaded instead.
+
+typedef enum {
+  STATE_IDLE = 0,
+  STATE_MANIFEST,
+  STATE_DOWNLOADING,
+  STATE_RETRY_WAIT,
+  STATE_VERIFYING,
+  STATE_DONE,
+  STATE_FAILED
+} State;
+
+typedef struct Status {
+  State state;
+  uint32_t received;   // Bytes downloaded so far (resume offset)
+  uint32_t total;      // Size reported by the server, 0 if unknown
+  uint16_t resumes;    // Reconnects that continued with a Range request
+  uint32_t elapsedMs;
+  char url[128];
+  char error[64];
+} Status;
+
+// Start a pull update. url may be NULL to use Cfg.otaUrl.
+// Returns false if an update (pull or browser upload) is already running
+// or no URL is known.
+bool start(const char *url);
+// From start() until the download task is done
+bool isRunning();
+
+Status getStatus();
+const char *stateToString(State state);
+
+} // namespace OtaPull
+
+#endif
@@ -0,0 +1,549 @@
+#include "ota_stream.h"
+#include "logger.h"
+#include "ota_delta.h"
+#include "trace.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Update.h>
+#include <esp32/rom/miniz.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/sha256.h>
+
+#if __has_include("ota_pubkey.h")
+// Defines OTA_PUBKEY_PEM - the public half of tools/ota_signing_key.pem
+#include "ota_pubkey.h"
+#endif
+
+namespace OtaStream {
+
+namespace {
+
+typedef enum {
+  STAGE_DETECT = 0,   // Waiting for the first byte to pick a format
+  STAGE_RAW,          // Plain ESP32 image, passed through
+  STAGE_GZIP_HEADER,  // Parsing the gzip member header
+  STAGE_INFLATE,      // Raw deflate body
+  STAGE_GZIP_TRAILER, // CRC32 + ISIZE
+  STAGE_DONE
+} Stage;
+
+// What the (decompressed) stream turned out to contain
+typedef enum {
+  IMAGE_DETECT = 0,
+  IMAGE_FULL,  // ESP32 app image, written as is
+  IMAGE_DELTA  // Patch against the running firmware
+} ImageKind;
+
+// gzip header flags (RFC 1952)
+const uint8_t GZ_FHCRC = 0x02;
+const uint8_t GZ_FEXTRA = 0x04;
+const uint8_t GZ_FNAME = 0x08;
+const uint8_t GZ_FCOMMENT = 0x10;
+
+bool running = false;
+bool failed = false;
+char lastError[96] = "";
+
+Stage stage = STAGE_DETECT;
+ImageKind imageKind = IMAGE_DETECT;
+Stats stats = {};
+uint32_t startMillis = 0;
+
+// Manifest
+uint32_t manifestSize = 0;
+uint8_t manifestHash[32];
+
+mbedtls_sha256_context sha;
+uint32_t crc = 0;
+
+// Inflate state, heap allocated only while an update is running
+tinfl_decompressor *inflator = nullptr;
+uint8_t *window = nullptr;
+size_t windowOfs = 0;
+
+// gzip header / trailer parser
+uint8_t gzHeader[10];
+uint8_t gzHeaderPos = 0;
+uint8_t gzFlags = 0;
+typedef enum {
+  GZH_FIXED = 0,
+  GZH_XLEN,
+  GZH_EXTRA,
+  GZH_NAME,
+  GZH_COMMENT,
+  GZH_HCRC
+} GzipField;
+GzipField gzField = GZH_FIXED;
+uint16_t gzFieldLen = 0;
+uint8_t gzTrailer[8];
+uint8_t gzTrailerPos = 0;
+
+bool fail(const char *msg) {
+  strlcpy(lastError, msg, sizeof(lastError));
+  failed = true;
+  LOG_E("OTA", "%s", msg);
+  return false;
+}
+
+void releaseBuffers() {
+  free(inflator);
+  inflator = nullptr;
+  free(window);
+  window = nullptr;
+}
+
+bool hexToBytes(const char *hex, uint8_t *out, size_t outLen) {
+  if (!hex || strlen(hex) != outLen * 2) {
+    return false;
+  }
+  for (size_t i = 0; i < outLen; i++) {
+    char byteStr[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+    char *endPtr;
+    out[i] = (uint8_t)strtoul(byteStr, &endPtr, 16);
+    if (*endPtr != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool verifySignature(const char *sigBase64) {
+#ifdef OTA_PUBKEY_PEM
+  if (!sigBase64 || !*sigBase64) {
+    return fail("Manifest is not signed");
+  }
+
+  uint8_t sig[MBEDTLS_ECDSA_MAX_LEN];
+  size_t sigLen = 0;
+  if (mbedtls_base64_decode(sig, sizeof(sig), &sigLen,
+                            (const uint8_t *)sigBase64, strlen(sigBase64)) != 0) {
+    return fail("Manifest signature is not valid base64");
+  }
+
+  mbedtls_pk_context pk;
+  mbedtls_pk_init(&pk);
+  int ret = mbedtls_pk_parse_public_key(&pk, (const uint8_t *)OTA_PUBKEY_PEM,
+                                        strlen(OTA_PUBKEY_PEM) + 1);
+  if (ret == 0) {
+    ret = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, manifestHash,
+                            sizeof(manifestHash), sig, sigLen);
+  }
+  mbedtls_pk_free(&pk);
+
+  if (ret != 0) {
+    return fail("Manifest signature verification failed");
+  }
+  LOG_I("OTA", "Manifest signature OK");
+  return true;
+#else
+  if (sigBase64 && *sigBase64) {
+    LOG_W("OTA", "Manifest is signed but no public key is compiled in, "
+                 "checking hash only");
+  }
+  return true;
+#endif
+}
+
+// Every update needs a manifest: the image is only committed when its size
+// and SHA-256 match. With a public key compiled in it must also be signed.
+bool parseManifest(const char *json) {
+  if (!json || !*json) {
+    return fail("Manifest required (size and sha256)");
+  }
+
+  JsonDocument doc;
+  if (deserializeJson(doc, json)) {
+    return fail("Manifest is not valid JSON");
+  }
+
+  manifestSize = doc["size"] | 0;
+  if (manifestSize == 0) {
+    return fail("Manifest has no size");
+  }
+  if (!hexToBytes(doc["sha256"] | "", manifestHash, sizeof(manifestHash))) {
+    return fail("Manifest has no valid sha256");
+  }
+  if (!verifySignature(doc["sig"] | "")) {
+    return false;
+  }
+
+  LOG_I("OTA", "Manifest: %lu bytes, version %s", manifestSize,
+        doc["version"] | "?");
+  return true;
+}
+
+// Final stage: everything that reaches flash goes through here
+bool flashWrite(const uint8_t *data, size_t len) {
+  if (stats.imageBytes + len > manifestSize) {
+    return fail("Image is larger than the manifest size");
+  }
+
+  mbedtls_sha256_update(&sha, data, len);
+
+  uint32_t t0 = micros();
+  size_t written = Update.write((uint8_t *)data, len);
+  stats.flashUs += micros() - t0;
+
+  if (written != len) {
+    return fail(Update.errorString());
+  }
+  stats.imageBytes += len;
+  return true;
+}
+
+// Output of the transport stage (raw or inflated): a full image or a delta
+bool emit(const uint8_t *data, size_t len) {
+  if (imageKind == IMAGE_DETECT) {
+    if (data[0] == OtaDelta::MAGIC_FIRST_BYTE) {
+      imageKind = IMAGE_DELTA;
+      stats.delta = true;
+      OtaDelta::begin(flashWrite);
+      LOG_I("OTA", "Delta image detected, patching the running firmware");
+    } else {
+      imageKind = IMAGE_FULL;
+    }
+  }
+
+  if (imageKind == IMAGE_FULL) {
+    return flashWrite(data, len);
+  }
+
+  if (!OtaDelta::write(data, len)) {
+    // flashWrite() failures are already recorded
+    return failed ? false : fail(OtaDelta::errorString());
+  }
+  return true;
+}
+
+bool inflate(const uint8_t *data, size_t len, size_t *consumed) {
+  size_t ofs = 0;
+
+  while (true) {
+    size_t inSize = len - ofs;
+    size_t outSize = TINFL_LZ_DICT_SIZE - windowOfs;
+
+    uint32_t t0 = micros();
+    tinfl_status status = tinfl_decompress(
+        inflator, data + ofs, &inSize, window, window + windowOfs, &outSize,
+        TINFL_FLAG_HAS_MORE_INPUT);
+    stats.inflateUs += micros() - t0;
+
+    ofs += inSize;
+
+    if (outSize) {
+      crc = esp_rom_crc32_le(crc, window + windowOfs, outSize);
+      stats.transportBytes += outSize;
+      if (!emit(window + windowOfs, outSize)) {
+        return false;
+      }
+      windowOfs = (windowOfs + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+
+    if (status == TINFL_STATUS_DONE) {
+      stage = STAGE_GZIP_TRAILER;
+      break;
+    }
+    if (status < TINFL_STATUS_DONE) {
+      return fail("Corrupt deflate stream");
+    }
+    if (status == TINFL_STATUS_NEEDS_MORE_INPUT && ofs == len) {
+      break;
+    }
+  }
+
+  *consumed = ofs;
+  return true;
+}
+
+// Select the next optional header field present in the member
+void nextHeaderField() {
+  while (true) {
+    switch (gzField) {
+    case GZH_FIXED:
+      gzField = GZH_XLEN;
+      gzFieldLen = 0;
+      if (gzFlags & GZ_FEXTRA) return;
+      break;
+    case GZH_XLEN:
+      gzField = GZH_EXTRA;
+      if (gzFieldLen > 0) return;
+      break;
+    case GZH_EXTRA:
+      gzField = GZH_NAME;
+      if (gzFlags & GZ_FNAME) return;
+      break;
+    case GZH_NAME:
+      gzField = GZH_COMMENT;
+      if (gzFlags & GZ_FCOMMENT) return;
+      break;
+    case GZH_COMMENT:
+      gzField = GZH_HCRC;
+      gzFieldLen = 2;
+      if (gzFlags & GZ_FHCRC) return;
+      break;
+    case GZH_HCRC:
+      stage = STAGE_INFLATE;
+      return;
+    }
+  }
+}
+
+// Returns the number of header bytes consumed from data
+size_t parseGzipHeader(const uint8_t *data, size_t len) {
+  size_t i = 0;
+  while (i < len && stage == STAGE_GZIP_HEADER) {
+    uint8_t b = data[i++];
+    switch (gzField) {
+    case GZH_FIXED:
+      gzHeader[gzHeaderPos++] = b;
+      if (gzHeaderPos == sizeof(gzHeader)) {
+        if (gzHeader[0] != 0x1f || gzHeader[1] != 0x8b || gzHeader[2] != 8) {
+          fail("Not a deflate gzip stream");
+          return i;
+        }
+        gzFlags = gzHeader[3];
+        nextHeaderField();
+      }
+      break;
+    case GZH_XLEN: // Little endian, two bytes
+      gzFieldLen |= (gzHeaderPos++ == sizeof(gzHeader)) ? b : (b << 8);
+      if (gzHeaderPos == sizeof(gzHeader) + 2) {
+        nextHeaderField();
+      }
+      break;
+    case GZH_EXTRA:
+    case GZH_HCRC:
+      if (--gzFieldLen == 0) {
+        nextHeaderField();
+      }
+      break;
+    case GZH_NAME:
+    case GZH_COMMENT:
+      if (b == 0) {
+        nextHeaderField();
+      }
+      break;
+    }
+  }
+  return i;
+}
+
+bool checkGzipTrailer() {
+  uint32_t expectedCrc = gzTrailer[0] | (gzTrailer[1] << 8) |
+                         (gzTrailer[2] << 16) | ((uint32_t)gzTrailer[3] << 24);
+  uint32_t expectedSize = gzTrailer[4] | (gzTrailer[5] << 8) |
+                          (gzTrailer[6] << 16) | ((uint32_t)gzTrailer[7] << 24);
+  if (expectedCrc != crc) {
+    return fail("gzip CRC32 mismatch");
+  }
+  if (expectedSize != stats.transportBytes) {
+    return fail("gzip size mismatch");
+  }
+  return true;
+}
+
+} // namespace
+
+bool begin(const char *manifestJson) {
+  if (running) {
+    abort();
+  }
+
+  failed = false;
+  lastError[0] = '\0';
+  stage = STAGE_DETECT;
+  imageKind = IMAGE_DETECT;
+  stats = {};
+  startMillis = millis();
+  Trace::mark(Trace::MARK_OTA, 1);
+  crc = 0;
+  windowOfs = 0;
+  gzHeaderPos = 0;
+  gzField = GZH_FIXED;
+  gzTrailerPos = 0;
+
+  if (!parseManifest(manifestJson)) {
+    return false;
+  }
+
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+
+  if (!Update.begin(manifestSize)) {
+    mbedtls_sha256_free(&sha);
+    return fail(Update.errorString());
+  }
+
+  running = true;
+  return true;
+}
+
+bool write(const uint8_t *data, size_t len) {
+  if (!running || failed) {
+    return false;
+  }
+  stats.inputBytes += len;
+
+  size_t ofs = 0;
+  while (ofs < len && !failed) {
+    switch (stage) {
+    case STAGE_DETECT:
+      if (data[ofs] == 0x1f) {
+        stats.compressed = true;
+        inflator = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+        window = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+        if (!inflator || !window) {
+          releaseBuffers();
+          return fail("Not enough memory for the inflate window");
+        }
+        tinfl_init(inflator);
+        stage = STAGE_GZIP_HEADER;
+        LOG_I("OTA", "gzip image detected, inflating on the fly");
+      } else {
+        stage = STAGE_RAW;
+      }
+      break;
+
+    case STAGE_RAW:
+      stats.transportBytes += len - ofs;
+      if (!emit(data + ofs, len - ofs)) {
+        return false;
+      }
+      ofs = len;
+      break;
+
+    case STAGE_GZIP_HEADER:
+      ofs += parseGzipHeader(data + ofs, len - ofs);
+      break;
+
+    case STAGE_INFLATE: {
+      size_t consumed = 0;
+      if (!inflate(data + ofs, len - ofs, &consumed)) {
+        return false;
+      }
+      ofs += consumed;
+      break;
+    }
+
+    case STAGE_GZIP_TRAILER:
+      while (ofs < len && gzTrailerPos < sizeof(gzTrailer)) {
+        gzTrailer[gzTrailerPos++] = data[ofs++];
+      }
+      if (gzTrailerPos == sizeof(gzTrailer)) {
+        stage = STAGE_DONE;
+      }
+      break;
+
+    case STAGE_DONE:
+      // Ignore padding after the gzip member
+      ofs = len;
+      break;
+    }
+  }
+
+  return !failed;
+}
+
+bool end() {
+  if (!running) {
+    return fail("No update in progress");
+  }
+
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+  releaseBuffers();
+  running = false;
+  stats.elapsedMs = millis() - startMillis;
+
+  if (!failed && stats.compressed) {
+    if (stage != STAGE_DONE) {
+      fail("Truncated gzip stream");
+    } else {
+      checkGzipTrailer();
+    }
+  }
+
+  if (!failed && imageKind == IMAGE_DELTA && !OtaDelta::isComplete()) {
+    fail("Truncated delta patch");
+  }
+
+  if (!failed) {
+    if (stats.imageBytes != manifestSize) {
+      fail("Image size does not match the manifest");
+    } else if (memcmp(digest, manifestHash, sizeof(digest)) != 0) {
+      fail("SHA-256 does not match the manifest");
+    } else {
+      LOG_I("OTA", "SHA-256 verified");
+    }
+  }
+
+  if (failed) {
+    Update.abort();
+    return false;
+  }
+
+  if (!Update.end(true)) {
+    return fail(Update.errorString());
+  }
+
+  char summary[160];
+  formatSummary(summary, sizeof(summary));
+  LOG_I("OTA", "%s", summary);
+  Trace::mark(Trace::MARK_OTA, 0);
+  return true;
+}
+
+void abort() {
+  if (running) {
+    mbedtls_sha256_free(&sha);
+    Update.abort();
+  }
+  releaseBuffers();
+  running = false;
+}
+
+bool isRunning() {
+  return running;
+}
+
+bool hasError() {
+  return failed;
+}
+
+bool isBaseMismatch() {
+  return imageKind == IMAGE_DELTA && OtaDelta::isBaseMismatch();
+}
+
+const char *errorString() {
+  return lastError;
+}
+
+Stats getStats() {
+  return stats;
+}
+
+void formatSummary(char *buf, size_t len) {
+  const char *kind = stats.delta ? "delta" : "image";
+  float seconds = stats.elapsedMs / 1000.0f;
+  float uploadKBs = seconds > 0 ? stats.inputBytes / 1024.0f / seconds : 0;
+
+  if (stats.compressed) {
+    float inflateMBs = stats.inflateUs > 0
+                           ? stats.transportBytes / (float)stats.inflateUs
+                           : 0; // bytes/us == MB/s
+    snprintf(buf, len,
+             "%lu bytes (%lu gz %s) in %.1f s, upload %.1f KB/s, "
+             "inflate %.2f MB/s, flash %.1f s",
+             stats.imageBytes, stats.inputBytes, kind, seconds, uploadKBs,
+             inflateMBs, stats.flashUs / 1000000.0f);
+  } else {
+    snprintf(buf, len, "%lu bytes (%lu %s) in %.1f s, upload %.1f KB/s, flash %.1f s",
+             stats.imageBytes, stats.inputBytes, kind, seconds, uploadKBs,
+             stats.flashUs / 1000000.0f);
+  }
+}
+
+} // namespace OtaStream
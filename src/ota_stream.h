@@ -0,0 +1,53 @@
+#ifndef _OTA_STREAM_H_
+#define _OTA_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace OtaStream {
+
+// Streaming firmware writer shared by all OTA entry points.
+// Accepts a plain ESP32 image, a delta patch against the running firmware
+// (see ota_delta.h), or either of them gzip-compressed (detected from the
+// first bytes). gzip is inflated through a fixed 32 KB window, the resulting
+// image is hashed with SHA-256 and the new partition is only committed when
+// the hash matches the manifest.
+
+typedef struct Stats {
+  uint32_t inputBytes;     // Bytes received (compressed size for .gz)
+  uint32_t transportBytes; // Bytes after inflate (patch size for deltas)
+  uint32_t imageBytes;     // Bytes written to flash
+  uint32_t elapsedMs;      // First chunk to end()
+  uint32_t inflateUs;      // Time spent inside the decompressor
+  uint32_t flashUs;        // Time spent in Update.write()
+  bool compressed;
+  bool delta;
+} Stats;
+
+// Start a new update. A manifest with the image size and SHA-256 is required:
+//   {"size":1135488,"sha256":"<hex>","sig":"<base64 DER ECDSA>"}
+// When a public key is compiled in (ota_pubkey.h), it must also be signed.
+bool begin(const char *manifestJson);
+
+// Feed the next chunk of the upload
+bool write(const uint8_t *data, size_t len);
+
+// Finish: verify size/hash/signature and commit the new partition
+bool end();
+
+// Abort an update in progress
+void abort();
+
+bool isRunning();
+bool hasError();
+// The delta was built against another firmware, a full image is needed
+bool isBaseMismatch();
+const char *errorString();
+Stats getStats();
+
+// Human readable summary (throughput / inflate speed), valid after end()
+void formatSummary(char *buf, size_t len);
+
+} // namespace OtaStream
+
+#endif
@@ -1,7 +1,6 @@
 #include "runtime_cache.h"
 
 #include <Arduino.h>
-#include <WiFi.h>
 #include <stdio.h>
 #include <string.h>
 #include <freertos/FreeRTOS.h>
@@ -12,49 +11,35 @@ namespace RuntimeCache {
 namespace {
   portMUX_TYPE runtimeMux = portMUX_INITIALIZER_UNLOCKED;
   RuntimeStatus cachedStatus;
-  bool statusInitialized = false;
-  bool lastWifiConnected = false;
-  uint32_t lastUpdateMillis = 0;
-
-  void setStatus(const RuntimeStatus &status) {
-    portENTER_CRITICAL(&runtimeMux);
-    cachedStatus = status;
-    portEXIT_CRITICAL(&runtimeMux);
-    lastWifiConnected = status.wifiConnected;
-    statusInitialized = true;
-  }
 }
 
-void updateFromWiFi() {
-  bool connected = (WiFi.status() == WL_CONNECTED);
-  uint32_t now = millis();
-
-  // Throttle updates to once per second unless the connection state changes.
-  if (statusInitialized && connected == lastWifiConnected &&
-      (now - lastUpdateMillis) < 1000) {
-    return;
-  }
-
+void setConnected(uint32_t ip, const char *ssid, int32_t rssi) {
   RuntimeStatus updated = {};
-  updated.wifiConnected = connected;
+  updated.wifiConnected = true;
+  // lwIP keeps the address in network order, first octet lowest
+  snprintf(updated.cachedIP, sizeof(updated.cachedIP), "%u.%u.%u.%u", ip & 0xFF,
+           (ip >> 8) & 0xFF, (ip >> 16) & 0xFF, ip >> 24);
+  strlcpy(updated.cachedSSID, ssid, sizeof(updated.cachedSSID));
+  updated.wifiRSSI = rssi;
 
-  if (connected) {
-    IPAddress ip = WiFi.localIP();
-    snprintf(updated.cachedIP, sizeof(updated.cachedIP), "%u.%u.%u.%u",
-             ip[0], ip[1], ip[2], ip[3]);
+  portENTER_CRITICAL(&runtimeMux);
+  cachedStatus = updated;
+  portEXIT_CRITICAL(&runtimeMux);
+}
 
-    String ssid = WiFi.SSID();
-    strlcpy(updated.cachedSSID, ssid.c_str(), sizeof(updated.cachedSSID));
+void setDisconnected() {
+  RuntimeStatus updated = {};
+  strlcpy(updated.cachedIP, "0.0.0.0", sizeof(updated.cachedIP));
 
-    updated.wifiRSSI = WiFi.RSSI();
-  } else {
-    strlcpy(updated.cachedIP, "0.0.0.0", sizeof(updated.cachedIP));
-    updated.cachedSSID[0] = '\0';
-    updated.wifiRSSI = 0;
-  }
+  portENTER_CRITICAL(&runtimeMux);
+  cachedStatus = updated;
+  portEXIT_CRITICAL(&runtimeMux);
+}
 
-  setStatus(updated);
-  lastUpdateMillis = now;
+void setRSSI(int32_t rssi) {
+  portENTER_CRITICAL(&runtimeMux);
+  cachedStatus.wifiRSSI = rssi;
+  portEXIT_CRITICAL(&runtimeMux);
 }
 
 RuntimeStatus getSnapshot() {
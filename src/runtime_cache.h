@@ -5,8 +5,10 @@
 
 namespace RuntimeCache {
 
-// Update cached WiFi status from the main loop (Core 0)
-void updateFromWiFi();
+// Fed by the WiFi supervisor's events (and its RSSI sampling), not polled
+void setConnected(uint32_t ip, const char *ssid, int32_t rssi);
+void setDisconnected();
+void setRSSI(int32_t rssi);
 
 // Return a snapshot of the cached runtime status (thread-safe)
 RuntimeStatus getSnapshot();
@@ -0,0 +1,209 @@
+#include "sched.h"
+#include "logger.h"
+#include "types.h"
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_task_wdt.h>
+
+extern Config Cfg;
+
+namespace Sched {
+
+namespace {
+
+typedef struct Entry {
+  Trace::Task trace;
+  Setup setup;
+  Step step;
+  uint32_t dueTick;
+  uint32_t dueUs;
+  int8_t next; // Next entry in the same wheel slot, -1 for none
+  Job stats;
+} Entry;
+
+portMUX_TYPE addMux = portMUX_INITIALIZER_UNLOCKED;
+Entry entries[MAX_JOBS];
+volatile uint8_t entryCount = 0; // Added
+uint8_t started = 0;             // Set up and in the wheel, loop task only
+int8_t wheel[WHEEL_SLOTS]; // First entry per slot, -1 for none
+TaskHandle_t loopTask = nullptr;
+volatile uint32_t wakeCount = 0;
+volatile uint32_t notifyCount = 0;
+
+// A slot holds every entry whose due tick maps to it, whatever the turn;
+// entries due in a later turn are left where they are
+void insert(uint8_t id, uint32_t nowMs, uint32_t waitMs) {
+  Entry &e = entries[id];
+  // Rounded up, a step never runs early; "now" stays in the current slot
+  e.dueTick = waitMs ? (nowMs + waitMs + TICK_MS - 1) / TICK_MS : nowMs / TICK_MS;
+  e.dueUs = micros() + waitMs * 1000;
+  int8_t &head = wheel[e.dueTick % WHEEL_SLOTS];
+  e.next = head;
+  head = id;
+}
+
+void unlink(uint8_t id) {
+  int8_t *link = &wheel[entries[id].dueTick % WHEEL_SLOTS];
+  while (*link != id) {
+    link = &entries[*link].next;
+  }
+  *link = entries[id].next;
+}
+
+void run(uint8_t id) {
+  Entry &e = entries[id];
+  uint32_t startUs = micros();
+  int32_t late = (int32_t)(startUs - e.dueUs);
+  uint32_t wait = e.step(millis());
+  uint32_t runUs = micros() - startUs;
+
+  e.stats.runs++;
+  e.stats.latencyUsLast = late > 0 ? late : 0;
+  if (e.stats.latencyUsLast > e.stats.latencyUsMax) {
+    e.stats.latencyUsMax = e.stats.latencyUsLast;
+  }
+  e.stats.runUsLast = runUs;
+  if (runUs > e.stats.runUsMax) {
+    e.stats.runUsMax = runUs;
+  }
+  Trace::alive(e.trace);
+
+  unlink(id);
+  insert(id, millis(), wait > TICK_MS ? wait : TICK_MS);
+}
+
+// Runs what is due in the slots passed since the last call. After a long
+// step (more than a turn) every slot is looked at once.
+void expire(uint32_t *cursor) {
+  uint32_t nowTick = millis() / TICK_MS;
+  uint32_t span = nowTick - *cursor + 1;
+  if (span > WHEEL_SLOTS) {
+    span = WHEEL_SLOTS;
+  }
+  for (uint32_t t = nowTick - span + 1; t != nowTick + 1; t++) {
+    uint8_t due[MAX_JOBS];
+    uint8_t count = 0;
+    for (int8_t id = wheel[t % WHEEL_SLOTS]; id >= 0; id = entries[id].next) {
+      if ((int32_t)(entries[id].dueTick - nowTick) <= 0) {
+        due[count++] = id;
+      }
+    }
+    for (uint8_t i = 0; i < count; i++) {
+      run(due[i]);
+    }
+  }
+  *cursor = nowTick + 1;
+}
+
+// Until the next occupied slot, at most a turn
+uint32_t nextWait(uint32_t cursor) {
+  uint32_t now = millis();
+  for (uint32_t t = cursor; t != cursor + WHEEL_SLOTS; t++) {
+    if (wheel[t % WHEEL_SLOTS] >= 0) {
+      uint32_t dueMs = t * TICK_MS;
+      return (int32_t)(dueMs - now) > 0 ? dueMs - now : 0;
+    }
+  }
+  return WHEEL_SLOTS * TICK_MS;
+}
+
+// Jobs added since the last pass, due right away
+void startAdded(uint32_t *cursor) {
+  while (started < entryCount) {
+    entries[started].setup();
+    insert(started, millis(), 0);
+    started++;
+    *cursor = millis() / TICK_MS;
+  }
+}
+
+void task(void *pvParameters) {
+  Serial.printf("[SCHED] Task running in core %d.\n", (uint32_t)xPortGetCoreID());
+
+  uint32_t cursor = millis() / TICK_MS;
+
+  while (1) {
+    startAdded(&cursor);
+    expire(&cursor);
+
+    // Reset watchdog timer to prevent device reboot
+    if (Cfg.watchdogEnabled) {
+      esp_task_wdt_reset();
+    }
+
+    uint32_t wait = nextWait(cursor);
+    bool notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait)) > 0;
+    wakeCount++;
+    if (notified) {
+      // Whoever was meant, every step checks for itself
+      notifyCount++;
+      uint32_t now = millis();
+      for (uint8_t i = 0; i < started; i++) {
+        unlink(i);
+        insert(i, now, 0);
+      }
+      cursor = now / TICK_MS; // Back to the slot they went into
+    }
+  }
+
+  Serial.println("[SCHED] Task exited.");
+  vTaskDelete(NULL);
+}
+
+} // namespace
+
+bool add(const char *name, Trace::Task trace, Setup setup, Step step, uint32_t stackBytes) {
+  bool added = false;
+  portENTER_CRITICAL(&addMux);
+  if (entryCount < MAX_JOBS) {
+    Entry &e = entries[entryCount];
+    e.trace = trace;
+    e.setup = setup;
+    e.step = step;
+    e.stats = {};
+    e.stats.name = name;
+    e.stats.stackBytes = stackBytes;
+    entryCount++; // Filled in first, the loop task may be looking
+    added = true;
+  }
+  portEXIT_CRITICAL(&addMux);
+
+  if (!added) {
+    LOG_E("SCHED", "Cannot add %s, %u jobs at most", name, MAX_JOBS);
+  } else if (loopTask) {
+    xTaskNotifyGive(loopTask);
+  }
+  return added;
+}
+
+void begin(uint8_t core, uint8_t priority) {
+  for (uint16_t i = 0; i < WHEEL_SLOTS; i++) {
+    wheel[i] = -1;
+  }
+  xTaskCreatePinnedToCore(task, "sched_task", STACK_BYTES, NULL, priority, &loopTask, core);
+}
+
+bool getJob(uint8_t index, Job *job) {
+  if (index >= entryCount) {
+    return false;
+  }
+  *job = entries[index].stats;
+  return true;
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.running = loopTask != nullptr;
+  stats.jobs = entryCount;
+  stats.stackSaved = -(int32_t)STACK_BYTES;
+  for (uint8_t i = 0; i < entryCount; i++) {
+    stats.stackSaved += entries[i].stats.stackBytes;
+  }
+  stats.stackFreeMin = loopTask ? uxTaskGetStackHighWaterMark(loopTask) : 0;
+  stats.wakeups = wakeCount;
+  stats.notifications = notifyCount;
+  return stats;
+}
+
+} // namespace Sched
@@ -0,0 +1,55 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "trace.h"
+#include <stdint.h>
+
+namespace Sched {
+
+// Optional cooperative mode (Cfg.eventLoop). The LCD and Home Assistant
+// steps run one after another on a single task, instead of each having a
+// task and a 20 KB stack. A step returns how long it wants
+// to sleep, and a timer wheel finds the next step that is due. A task
+// notification (telemetry bus, MQTT client) runs every step right away;
+// steps that have nothing to do return quickly. A step that blocks holds
+// up the others, and the latency stats show it. CAN and Telegram, whose
+// polling blocks in HTTPS requests, keep their own tasks.
+
+typedef void (*Setup)();
+typedef uint32_t (*Step)(uint32_t now); // ms until the next run
+
+const uint8_t MAX_JOBS = 4;
+const uint32_t TICK_MS = 10;
+const uint16_t WHEEL_SLOTS = 128; // 1.28 s per turn
+const uint32_t STACK_BYTES = 20000;
+
+typedef struct Job {
+  const char *name;
+  uint32_t stackBytes;    // Of the task it replaces
+  uint32_t runs;
+  uint32_t latencyUsLast; // Due to started
+  uint32_t latencyUsMax;
+  uint32_t runUsLast;
+  uint32_t runUsMax;
+} Job;
+
+typedef struct Stats {
+  bool running;
+  uint8_t jobs;
+  int32_t stackSaved;     // Stacks of the replaced tasks minus STACK_BYTES
+  uint32_t stackFreeMin;  // Bytes of STACK_BYTES never used
+  uint32_t wakeups;
+  uint32_t notifications; // Wakeups that ran every step
+} Stats;
+
+// Before or after begin(); setup runs on the loop task, before the first
+// step
+bool add(const char *name, Trace::Task trace, Setup setup, Step step, uint32_t stackBytes);
+void begin(uint8_t core, uint8_t priority);
+
+bool getJob(uint8_t index, Job *job);
+Stats getStats();
+
+} // namespace Sched
+
+#endif
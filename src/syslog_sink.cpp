@@ -0,0 +1,184 @@
+#include "syslog_sink.h"
+#include "types.h"
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <sys/time.h>
+
+extern Config Cfg;
+
+namespace SyslogSink {
+
+namespace {
+
+const uint8_t FACILITY = 16;          // local0
+const size_t DATAGRAM_SIZE = 1200;    // Stays below the Ethernet MTU
+const uint32_t RESOLVE_RETRY_MS = 30000;
+
+// Token bucket per tag: RATE messages per second, bursts up to BURST
+const float RATE = 10.0f;
+const float BURST = 30.0f;
+const uint8_t MAX_TAGS = 12;
+
+typedef struct Bucket {
+  const char *tag;
+  float tokens;
+  uint32_t lastMs;
+} Bucket;
+
+Bucket buckets[MAX_TAGS];
+uint8_t bucketCount = 0;
+
+WiFiUDP udp;
+IPAddress serverIp;
+bool resolved = false;
+uint32_t lastResolveMs = 0;
+
+char datagram[DATAGRAM_SIZE];
+size_t datagramLen = 0;
+uint8_t datagramCount = 0;
+
+// Written by the drain task only, read by anyone
+volatile uint32_t sentCount = 0;
+volatile uint32_t droppedCount = 0;
+volatile uint32_t batchedCount = 0;
+volatile uint32_t datagramsCount = 0;
+
+bool allow(const char *tag, uint32_t now) {
+  Bucket *bucket = nullptr;
+  for (uint8_t i = 0; i < bucketCount; i++) {
+    if (buckets[i].tag == tag || strcmp(buckets[i].tag, tag) == 0) {
+      bucket = &buckets[i];
+      break;
+    }
+  }
+  if (!bucket) {
+    // Tags beyond the table share the last bucket
+    bucket = &buckets[bucketCount < MAX_TAGS ? bucketCount++ : MAX_TAGS - 1];
+    if (!bucket->tag) {
+      bucket->tag = tag;
+      bucket->tokens = BURST;
+      bucket->lastMs = now;
+    }
+  }
+
+  bucket->tokens += (now - bucket->lastMs) * (RATE / 1000.0f);
+  if (bucket->tokens > BURST) {
+    bucket->tokens = BURST;
+  }
+  bucket->lastMs = now;
+
+  if (bucket->tokens < 1.0f) {
+    return false;
+  }
+  bucket->tokens -= 1.0f;
+  return true;
+}
+
+bool ensureServer() {
+  if (resolved) {
+    return true;
+  }
+  if (Cfg.syslogServer[0] == '\0' || !WiFi.isConnected()) {
+    return false;
+  }
+  uint32_t now = millis();
+  if (lastResolveMs != 0 && now - lastResolveMs < RESOLVE_RETRY_MS) {
+    return false;
+  }
+  lastResolveMs = now;
+  // May block on DNS, but only the drain task waits
+  resolved = serverIp.fromString(Cfg.syslogServer) ||
+             WiFi.hostByName(Cfg.syslogServer, serverIp) == 1;
+  if (!resolved) {
+    Serial.printf("[SYSLOG] Cannot resolve %s\n", Cfg.syslogServer);
+  }
+  return resolved;
+}
+
+void send() {
+  if (datagramLen == 0) {
+    return;
+  }
+  bool ok = udp.beginPacket(serverIp, Cfg.syslogPort) &&
+            udp.write((const uint8_t *)datagram, datagramLen) == datagramLen &&
+            udp.endPacket();
+  if (ok) {
+    sentCount += datagramCount;
+    datagramsCount++;
+  } else {
+    droppedCount += datagramCount;
+  }
+  datagramLen = 0;
+  datagramCount = 0;
+}
+
+// RFC 5424 header with a UTC timestamp, or NILVALUE before the clock is set
+size_t formatHeader(char *out, size_t size, uint8_t level, const char *tag,
+                    uint32_t timestamp) {
+  char stamp[32] = "-";
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (tv.tv_sec > 1600000000) {
+    int64_t ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - (millis() - timestamp);
+    time_t secs = ms / 1000;
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    snprintf(stamp, sizeof(stamp), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+             tm.tm_min, tm.tm_sec, (int)(ms % 1000));
+  }
+  int n = snprintf(out, size, "<%u>1 %s %s ess-monitor - %s - ",
+                   FACILITY * 8 + (level & 7), stamp, Cfg.hostname, tag);
+  return n < 0 ? 0 : ((size_t)n < size ? n : size - 1);
+}
+
+} // namespace
+
+void write(uint8_t level, const char *tag, uint32_t timestamp, const char *message) {
+  if (!Cfg.syslogEnabled || level > Cfg.syslogLevel) {
+    return;
+  }
+  // Server first: no tokens spent while its name does not resolve
+  if (!ensureServer() || !allow(tag, millis())) {
+    droppedCount++;
+    return;
+  }
+
+  char line[320];
+  size_t len = formatHeader(line, sizeof(line), level, tag, timestamp);
+  len += strlcpy(line + len, message, sizeof(line) - len);
+  if (len >= sizeof(line)) {
+    len = sizeof(line) - 1;
+  }
+
+  // One line per message; a batch is flushed when the next line won't fit
+  if (datagramLen > 0 && datagramLen + 1 + len > sizeof(datagram)) {
+    send();
+  }
+  if (datagramLen > 0) {
+    datagram[datagramLen++] = '\n';
+    batchedCount++;
+  }
+  memcpy(datagram + datagramLen, line, len);
+  datagramLen += len;
+  datagramCount++;
+
+  if (!Cfg.syslogBatch) {
+    send();
+  }
+}
+
+void flush() {
+  send();
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.sent = sentCount;
+  stats.dropped = droppedCount;
+  stats.batched = batchedCount;
+  stats.datagrams = datagramsCount;
+  return stats;
+}
+
+} // namespace SyslogSink
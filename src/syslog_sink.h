@@ -0,0 +1,30 @@
+#ifndef _SYSLOG_SINK_H_
+#define _SYSLOG_SINK_H_
+
+#include <stdint.h>
+
+namespace SyslogSink {
+
+// RFC 5424 over UDP, fed by the logger drain task only, so a slow network
+// never stalls the task that logged. Messages of one drain pass are packed
+// into one datagram (one message per line) when Cfg.syslogBatch is set,
+// otherwise every message is its own datagram. Each tag has a token bucket
+// so a chatty module cannot flood the collector.
+
+typedef struct Stats {
+  uint32_t sent;      // Messages handed to the network
+  uint32_t dropped;   // Rate limited, no network or send failed
+  uint32_t batched;   // Messages that shared a datagram with an earlier one
+  uint32_t datagrams; // UDP packets sent
+} Stats;
+
+// Drain task only. timestamp is millis() of the original log call.
+void write(uint8_t level, const char *tag, uint32_t timestamp, const char *message);
+// Drain task only, sends a pending batch
+void flush();
+
+Stats getStats();
+
+} // namespace SyslogSink
+
+#endif
@@ -0,0 +1,181 @@
+#include "telemetry.h"
+#include <Arduino.h>
+
+namespace Telemetry {
+
+namespace {
+
+typedef struct Slot {
+  const char *name;
+  TaskHandle_t task;
+  uint32_t mask;
+  uint32_t intervalMs;
+  uint32_t pending;  // Fields changed since the last take()
+  uint32_t lastMs;   // Last wakeup or delivery
+  bool woken;        // Notified, take() not called yet
+  uint32_t delivered;
+  uint32_t merged;
+} Slot;
+
+portMUX_TYPE busMux = portMUX_INITIALIZER_UNLOCKED;
+Slot slots[MAX_SUBSCRIBERS];
+volatile uint8_t slotCount = 0;
+volatile uint32_t published = 0;
+
+// Called with busMux held; the notification is given after it is released
+bool wake(Slot &slot, uint32_t now) {
+  if (!slot.task || slot.woken || !slot.pending || now - slot.lastMs < slot.intervalMs) {
+    return false;
+  }
+  slot.woken = true;
+  slot.lastMs = now;
+  return true;
+}
+
+void notifyAll(TaskHandle_t *tasks, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    xTaskNotifyGive(tasks[i]);
+  }
+}
+
+} // namespace
+
+uint32_t diff(const EssStatus &before, const EssStatus &after) {
+  uint32_t fields = 0;
+  if (before.charge != after.charge) {
+    fields |= 1UL << FIELD_CHARGE;
+  }
+  if (before.health != after.health) {
+    fields |= 1UL << FIELD_HEALTH;
+  }
+  if (before.voltage != after.voltage) {
+    fields |= 1UL << FIELD_VOLTAGE;
+  }
+  if (before.current != after.current) {
+    fields |= 1UL << FIELD_CURRENT;
+  }
+  if (before.temperature != after.temperature) {
+    fields |= 1UL << FIELD_TEMPERATURE;
+  }
+  if (before.ratedVoltage != after.ratedVoltage ||
+      before.ratedChargeCurrent != after.ratedChargeCurrent ||
+      before.ratedDischargeCurrent != after.ratedDischargeCurrent) {
+    fields |= 1UL << FIELD_LIMITS;
+  }
+  if (before.bmsWarning != after.bmsWarning || before.bmsError != after.bmsError) {
+    fields |= 1UL << FIELD_BMS;
+  }
+  return fields;
+}
+
+void publish(uint32_t fields, uint32_t now) {
+  TaskHandle_t tasks[MAX_SUBSCRIBERS];
+  uint8_t count = 0;
+
+  portENTER_CRITICAL(&busMux);
+  published++;
+  for (uint8_t i = 0; i < slotCount; i++) {
+    Slot &slot = slots[i];
+    uint32_t bits = fields & slot.mask;
+    if (!bits) {
+      continue;
+    }
+    if (slot.pending) {
+      slot.merged++;
+    }
+    slot.pending |= bits;
+    if (wake(slot, now)) {
+      tasks[count++] = slot.task;
+    }
+  }
+  portEXIT_CRITICAL(&busMux);
+
+  notifyAll(tasks, count);
+}
+
+// Changes held back by an interval would otherwise wait for the next frame
+void flush(uint32_t now) {
+  TaskHandle_t tasks[MAX_SUBSCRIBERS];
+  uint8_t count = 0;
+
+  portENTER_CRITICAL(&busMux);
+  for (uint8_t i = 0; i < slotCount; i++) {
+    if (wake(slots[i], now)) {
+      tasks[count++] = slots[i].task;
+    }
+  }
+  portEXIT_CRITICAL(&busMux);
+
+  notifyAll(tasks, count);
+}
+
+int8_t subscribe(const char *name, TaskHandle_t task, uint32_t mask, uint32_t intervalMs) {
+  int8_t id = NO_SUBSCRIBER;
+  portENTER_CRITICAL(&busMux);
+  if (slotCount < MAX_SUBSCRIBERS) {
+    id = slotCount;
+    Slot &slot = slots[id];
+    slot.name = name;
+    slot.task = task;
+    slot.mask = mask;
+    slot.intervalMs = intervalMs;
+    slot.pending = 0;
+    slot.lastMs = millis() - intervalMs; // First change goes out right away
+    slot.woken = false;
+    slot.delivered = 0;
+    slot.merged = 0;
+    slotCount++;
+  }
+  portEXIT_CRITICAL(&busMux);
+  return id;
+}
+
+uint32_t take(int8_t id, uint32_t now) {
+  if (id < 0 || id >= slotCount) {
+    return 0;
+  }
+  uint32_t fields = 0;
+  portENTER_CRITICAL(&busMux);
+  Slot &slot = slots[id];
+  // A task that woke up for something else still keeps to its interval
+  if (slot.pending && (slot.woken || now - slot.lastMs >= slot.intervalMs)) {
+    fields = slot.pending;
+    slot.pending = 0;
+    if (!slot.woken) {
+      slot.lastMs = now;
+    }
+    slot.woken = false;
+    slot.delivered++;
+  }
+  portEXIT_CRITICAL(&busMux);
+  return fields;
+}
+
+uint32_t version() {
+  return published;
+}
+
+bool getSubscriber(uint8_t index, Subscriber *subscriber) {
+  bool found = false;
+  portENTER_CRITICAL(&busMux);
+  if (index < slotCount) {
+    const Slot &slot = slots[index];
+    subscriber->name = slot.name;
+    subscriber->mask = slot.mask;
+    subscriber->intervalMs = slot.intervalMs;
+    subscriber->delivered = slot.delivered;
+    subscriber->merged = slot.merged;
+    found = true;
+  }
+  portEXIT_CRITICAL(&busMux);
+  return found;
+}
+
+Stats getStats() {
+  Stats stats;
+  stats.version = published;
+  stats.subscribers = slotCount;
+  return stats;
+}
+
+} // namespace Telemetry
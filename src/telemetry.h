@@ -0,0 +1,67 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include "types.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace Telemetry {
+
+// Change notifications for the battery status. The CAN task publishes the
+// fields a frame changed; each subscriber is woken through its task
+// notification (xTaskNotifyGive) only for fields in its mask and no more
+// often than its own interval. Changes in between are merged and handed
+// over by take(). The values themselves still come from
+// CAN::getEssStatus().
+
+typedef enum : uint8_t {
+  FIELD_CHARGE = 0,
+  FIELD_HEALTH,
+  FIELD_VOLTAGE,
+  FIELD_CURRENT,
+  FIELD_TEMPERATURE,
+  FIELD_LIMITS, // Rated voltage and currents
+  FIELD_BMS,    // Warning and error codes
+  FIELD_ALERTS, // An alert event was raised or cleared
+  FIELD_COUNT
+} Field;
+
+const uint32_t FIELDS_ALL = (1UL << FIELD_COUNT) - 1;
+const uint8_t MAX_SUBSCRIBERS = 6;
+const int8_t NO_SUBSCRIBER = -1;
+
+typedef struct Subscriber {
+  const char *name;
+  uint32_t mask;
+  uint32_t intervalMs;
+  uint32_t delivered; // take() calls that returned fields
+  uint32_t merged;    // Publishes that found a change already pending
+} Subscriber;
+
+typedef struct Stats {
+  uint32_t version; // Publishes since boot
+  uint8_t subscribers;
+} Stats;
+
+// Fields that differ between two statuses
+uint32_t diff(const EssStatus &before, const EssStatus &after);
+
+// CAN task: fields a frame changed, and the rate limited wakeups that are
+// due by now
+void publish(uint32_t fields, uint32_t now);
+void flush(uint32_t now);
+
+// task nullptr: polled with take() instead of woken. NO_SUBSCRIBER when all
+// MAX_SUBSCRIBERS slots are taken.
+int8_t subscribe(const char *name, TaskHandle_t task, uint32_t mask, uint32_t intervalMs);
+// Fields changed since the last take(), or 0 while the interval since the
+// last delivery has not passed
+uint32_t take(int8_t id, uint32_t now);
+
+uint32_t version();
+bool getSubscriber(uint8_t index, Subscriber *subscriber);
+Stats getStats();
+
+} // namespace Telemetry
+
+#endif
@@ -1,10 +1,16 @@
 #include "tg.h"
+#include "alerts.h"
 #include "can.h"
+#include "chart.h"
 #include "types.h"
 #include "logger.h"
+#include "tg_text.h"
+#include "trace.h"
 #include <FastBot.h>
 #include <HardwareSerial.h>
+#include <WiFiClientSecure.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <esp_task_wdt.h>
 
@@ -20,129 +26,266 @@ typedef enum State : int {
   Balance = 3
 } State;
 
+// Message templates, placeholders are listed in tg_text.h
+const char TPL_BMS_ERROR[] PROGMEM = "🚨 *КРИТИЧНА ПОМИЛКА БАТАРЕЇ!*\n\n"
+                                     "⚠️ Код помилки: *{code}*\n"
+                                     "Батарея може вимкнутися!\n\n";
+const char TPL_BMS_ERROR_CLEARED[] PROGMEM = "✅ *Критична помилка батареї усунена.*\n\n"
+                                             "Код помилки: {previous} → 0";
+const char TPL_BMS_WARNING[] PROGMEM =
+    "⚠️ *ПОПЕРЕДЖЕННЯ БАТАРЕЇ*\n\n"
+    "Код попередження: *{code}*\n"
+    "Можливі причини: висока температура, напруга або розбалансування.\n\n";
+const char TPL_BMS_WARNING_CLEARED[] PROGMEM = "✅ *Попередження батареї усунене.*\n\n"
+                                               "Код попередження: {previous} → 0";
+const char TPL_ALERT_STATE[] PROGMEM = "Поточний стан:\n"
+                                       "🔋 Заряд: *{charge}%*\n"
+                                       "⚡️ Напруга: *{voltage}V*\n"
+                                       "🔌 Струм: *{current}A*\n"
+                                       "🌡️ Температура: *{temperature}°C*\n";
+
+const char TPL_ON_BATTERY[] PROGMEM =
+    "🕯️ *Переключено на живлення від батарейки.* Грилі не смажимо.\n\n";
+const char TPL_POWER_RESTORED[] PROGMEM = "💡 *Електрохарчування відновлено.*\n\n";
+
+const char TPL_LOW_CHARGE[] PROGMEM = "🪫 *Низький заряд батареї: {charge}%*\n\n";
+const char TPL_LOW_CHARGE_CLEARED[] PROGMEM = "🔋 Заряд батареї знову *{charge}%*.";
+const char TPL_HIGH_TEMPERATURE[] PROGMEM = "🔥 *Висока температура батареї: {temperature}°C*\n\n";
+const char TPL_HIGH_TEMPERATURE_CLEARED[] PROGMEM =
+    "🌡️ Температура батареї знизилась до *{temperature}°C*.";
+const char TPL_CURRENT_STEP[] PROGMEM = "📈 *Різка зміна струму: {value} A/с*\n\n";
+const char TPL_CURRENT_STEP_CLEARED[] PROGMEM = "📉 Струм стабілізувався: *{current}A*.";
+
+const char TPL_STATE_IDLE[] PROGMEM = "⚪️ Статус: *простій*.\n\n";
+const char TPL_STATE_CHARGING[] PROGMEM = "🟢 Статус: *заряджання*.\n\n";
+const char TPL_STATE_DISCHARGING[] PROGMEM = "🔴 Статус: *розряджання*.\n\n";
+const char TPL_STATE_UNKNOWN[] PROGMEM = "🟡 Статус: *невизначений*.\n\n";
+const char TPL_BAR_4[] PROGMEM = "🟩🟩🟩🟩";
+const char TPL_BAR_3[] PROGMEM = "🟩🟩🟩🟦";
+const char TPL_BAR_2[] PROGMEM = "🟩🟩🟦🟦";
+const char TPL_BAR_1[] PROGMEM = "🟩🟦🟦🟦";
+const char TPL_STATUS[] PROGMEM =
+    " Заряд: *{charge}%*\n"
+    "🔌 Навантаження: *{current}A*\n"
+    "⚡️ Напруга: *{voltage}V*, номінальна: *{rated_voltage}V*\n"
+    "🌡️ Температура батареї: *{temperature}°C*\n"
+    "🍀 Здоров'я батареї: *{health}%*\n";
+const char TPL_STATUS_ATTENTION[] PROGMEM = "\n⚠️ *УВАГА!*\n";
+const char TPL_STATUS_BMS_ERROR[] PROGMEM = "🚨 Критична помилка: *{bms_error}*\n";
+const char TPL_STATUS_BMS_WARNING[] PROGMEM = "⚠️ Попередження: *{bms_warning}*\n";
+const char TPL_STATUS_NO_ERRORS[] PROGMEM = "\n✅ Помилок немає\n";
+
+const char TPL_CAN_STATUS[] PROGMEM = "📡 *Статус CAN шини*\n\n"
+                                      "✅ Keep-alive відправлено: *{count}*\n"
+                                      "❌ Помилок відправки: *{failures}*\n"
+                                      "⏱️ Останній keep-alive: *{age}с* тому\n\n";
+const char TPL_CAN_KEEPALIVE_LOST[] PROGMEM =
+    "🚨 *УВАГА!* Давно не було keep-alive!\n"
+    "Батарея може відключитися через 20 хв без keep-alive.\n";
+const char TPL_CAN_KEEPALIVE_LATE[] PROGMEM = "⚠️ Затримка з відправкою keep-alive.\n";
+const char TPL_CAN_KEEPALIVE_OK[] PROGMEM = "🟢 Keep-alive працює нормально.\n";
+const char HISTORY_CAPTION[] PROGMEM =
+    "📈 Останні %u год: заряд %.0f–%.0f%%, струм %.1f…%.1f A, напруга %.2f…%.2f V";
+const char HISTORY_CAPTION_EMPTY[] PROGMEM = "📈 Останні %u год: даних ще немає";
+
+const char TPL_CAN_FAILURES[] PROGMEM = "\n⚠️ Виявлено {failures} помилок відправки!\n"
+                                        "Можливо проблема з CAN шиною або MCP2515.\n";
+
 FastBot bot;
-State state = State::Undef;
+uint32_t alertCursor = 0; // TG task only
+
+// What to say and the values at the time it happened. Rendered and sent
+// later by the sender task, so a slow HTTPS request never holds up state
+// detection or polling.
+typedef enum : uint8_t {
+  MSG_BMS_ERROR = 0,
+  MSG_BMS_ERROR_CLEARED,
+  MSG_BMS_WARNING,
+  MSG_BMS_WARNING_CLEARED,
+  MSG_ON_BATTERY,
+  MSG_POWER_RESTORED,
+  MSG_LOW_CHARGE,
+  MSG_LOW_CHARGE_CLEARED,
+  MSG_HIGH_TEMPERATURE,
+  MSG_HIGH_TEMPERATURE_CLEARED,
+  MSG_CURRENT_STEP,
+  MSG_CURRENT_STEP_CLEARED,
+  MSG_STATUS,    // /status reply
+  MSG_HISTORY,   // /history reply, a chart instead of text
+  MSG_CAN_STATUS // /canstatus reply
+} MessageKind;
+
+typedef struct Outbound {
+  MessageKind kind;
+  State state;     // For the status part
+  uint8_t attempts;
+  uint32_t eventMs; // For event-to-delivery latency
+  char chatID[24];  // Empty: the configured chat
+  TgText::Values values;
+} Outbound;
+
+const uint8_t QUEUE_SIZE = 8;
+const uint8_t SEND_ATTEMPTS = 3;
+// Token bucket: a burst of 3, then one message every 3 s, inside
+// Telegram's limit of 20 per minute for a group
+const float SEND_BURST = 3;
+const uint32_t SEND_REFILL_MS = 3000;
+
+Outbound queue[QUEUE_SIZE];
+uint8_t queueFirst = 0;
+uint8_t queueCount = 0;
+portMUX_TYPE queueMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t senderHandle = nullptr;
+// FastBot is not thread-safe: tick() in the TG task, sendMessage() in
+// the sender
+SemaphoreHandle_t botMutex = nullptr;
+
+// Rendered here, sender task only
+char messageText[1024];
+Chart::Renderer chart;
+volatile uint32_t sentCount = 0;
+volatile uint32_t failedCount = 0;
+volatile uint32_t coalescedCount = 0;
+volatile uint32_t droppedCount = 0;
+volatile uint32_t truncatedCount = 0;
+volatile uint32_t longestMessage = 0;
+volatile uint32_t latencySumMs = 0;
+volatile uint32_t latencyMaxMs = 0;
 
 void begin(uint8_t core, uint8_t priority);
 void task(void *pvParameters);
+void senderTask(void *pvParameters);
+void setup();
+uint32_t step(uint32_t now);
 void loop();
 void onMessage(FB_msg &msg);
-String getStatusMsg();
-
+void onAlert(const Alerts::Event &event);
+State currentState();
+void enqueue(MessageKind kind, const TgText::Values &values, const char *chatID = nullptr,
+             uint32_t eventMs = 0);
+bool deliver(const Outbound &msg);
+bool sendChart(const Outbound &msg);
+void appendStatus(TgText::Buffer &buf, State status, const TgText::Values &values);
+
+const uint32_t TASK_STACK = 20000;
+const uint32_t START_DELAY_MS = 30000;
+const uint32_t STEP_MS = 100; // Small delay to prevent task starvation and WDT
+uint32_t startMs = 0;
+
+// Not on the Sched event loop, even with Cfg.eventLoop: bot.tick() and
+// the sender block for a whole HTTPS request
 void begin(uint8_t core, uint8_t priority) {
-  xTaskCreatePinnedToCore(task, "tg_task", 20000, NULL, priority, NULL, core);
+  botMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(senderTask, "tg_send", 16000, NULL, priority, &senderHandle, core);
+  xTaskCreatePinnedToCore(task, "tg_task", TASK_STACK, NULL, priority, NULL, core);
 }
 
 void task(void *pvParameters) {
   Serial.printf("[TG] Task running in core %d.\n", (uint32_t)xPortGetCoreID());
 
-  bot.setToken(Cfg.tgBotToken);
-  bot.setChatID(Cfg.tgChatID);
-  bot.setTextMode(FB_MARKDOWN);
-  bot.attach(onMessage);
-
-  vTaskDelay(1000 * 30 / portTICK_PERIOD_MS);
+  setup();
 
   while (1) {
-    loop();
+    uint32_t wait = step(millis());
 
     // Reset watchdog timer to prevent device reboot
     if (Cfg.watchdogEnabled) {
       esp_task_wdt_reset();
     }
+    Trace::alive(Trace::TASK_TG);
 
-    vTaskDelay(100 / portTICK_PERIOD_MS); // Small delay to prevent task starvation and WDT
+    vTaskDelay(pdMS_TO_TICKS(wait));
   }
 
   Serial.println("[TG] Task exited.");
   vTaskDelete(NULL);
 }
 
+void setup() {
+  bot.setToken(Cfg.tgBotToken);
+  bot.setChatID(Cfg.tgChatID);
+  bot.setTextMode(FB_MARKDOWN);
+  bot.attach(onMessage);
+  startMs = millis();
+  // From now on, as before the alert log: nothing raised during boot is
+  // sent as if new
+  alertCursor = Alerts::head();
+}
+
+// Nothing for the first START_DELAY_MS
+uint32_t step(uint32_t now) {
+  if (now - startMs < START_DELAY_MS) {
+    return START_DELAY_MS - (now - startMs);
+  }
+  loop();
+  return STEP_MS;
+}
+
 void loop() {
-  static int16_t previousCurrent = 0;
-  static State previousState = State::Undef;
-  static uint8_t previousBmsError = 0;
-  static uint8_t previousBmsWarning = 0;
-  static uint32_t previousMillis;
-  uint32_t currentMillis = millis();
-
-  // Every 5 seconds
-  if (currentMillis - previousMillis >= 1000 * 5) {
-    previousMillis = currentMillis;
-
-    // Get thread-safe copy of battery status
-    EssStatus ess = CAN::getEssStatus();
-
-    // Check for BMS errors and warnings
-    if (ess.bmsError != previousBmsError) {
-      if (ess.bmsError > 0) {
-        String errorMsg = "🚨 *КРИТИЧНА ПОМИЛКА БАТАРЕЇ!*\n\n";
-        errorMsg += "⚠️ Код помилки: *" + String(ess.bmsError) + "*\n";
-        errorMsg += "Батарея може вимкнутися!\n\n";
-        errorMsg += "Поточний стан:\n";
-        errorMsg += "🔋 Заряд: *" + String(ess.charge) + "%*\n";
-        errorMsg += "⚡️ Напруга: *" + String(ess.voltage, 2) + "V*\n";
-        errorMsg += "🔌 Струм: *" + String(ess.current, 1) + "A*\n";
-        errorMsg += "🌡️ Температура: *" + String(ess.temperature, 1) + "°C*\n";
-        bot.sendMessage(errorMsg);
-      } else if (previousBmsError > 0) {
-        // Error cleared
-        bot.sendMessage("✅ *Критична помилка батареї усунена.*\n\nКод помилки: " +
-                        String(previousBmsError) + " → 0");
-      }
-      previousBmsError = ess.bmsError;
-    }
+  // Alert events since the last pass; the CAN task raises them as frames
+  // arrive, so nothing here polls the status
+  Alerts::Event event;
+  while (Alerts::next(&alertCursor, &event)) {
+    onAlert(event);
+  }
 
-    if (ess.bmsWarning != previousBmsWarning) {
-      if (ess.bmsWarning > 0) {
-        String warningMsg = "⚠️ *ПОПЕРЕДЖЕННЯ БАТАРЕЇ*\n\n";
-        warningMsg += "Код попередження: *" + String(ess.bmsWarning) + "*\n";
-        warningMsg += "Можливі причини: висока температура, напруга або розбалансування.\n\n";
-        warningMsg += "Поточний стан:\n";
-        warningMsg += "🔋 Заряд: *" + String(ess.charge) + "%*\n";
-        warningMsg += "⚡️ Напруга: *" + String(ess.voltage, 2) + "V*\n";
-        warningMsg += "🔌 Струм: *" + String(ess.current, 1) + "A*\n";
-        warningMsg += "🌡️ Температура: *" + String(ess.temperature, 1) + "°C*\n";
-        bot.sendMessage(warningMsg);
-      } else if (previousBmsWarning > 0) {
-        // Warning cleared
-        bot.sendMessage("✅ *Попередження батареї усунене.*\n\nКод попередження: " +
-                        String(previousBmsWarning) + " → 0");
-      }
-      previousBmsWarning = ess.bmsWarning;
-    }
+  // Skipped while the sender is in a request; polling can wait a cycle
+  if (xSemaphoreTake(botMutex, 0) == pdTRUE) {
+    bot.tick();
+    xSemaphoreGive(botMutex);
+  }
+}
 
-    // Check for state changes
-    if (ess.current > (int)Cfg.tgCurrentThreshold) {
-      state = State::Charging;
-    } else if (ess.current < -(int)Cfg.tgCurrentThreshold) {
-      state = State::Discharging;
-    } else {
-      // Let's count current deviations in a tgCurrentThreshold range as a balanced state
-      state = State::Balance;
-    }
+void onAlert(const Alerts::Event &event) {
+  TgText::Values values = {};
+  values.ess = event.ess;
+  values.value = event.value;
+  values.code = (uint32_t)event.value;
+  values.previous = (uint32_t)event.previous;
 
-    if (state != previousState && previousState != State::Undef) {
-      // The state has changed from one known value to another
-      switch (state) {
-      case State::Discharging:
-        bot.sendMessage("🕯️ *Переключено на живлення від батарейки.* Грилі не "
-                        "смажимо.\n\n||" +
-                        getStatusMsg() + "||");
-        break;
-      case State::Charging:
-        bot.sendMessage("💡 *Електрохарчування відновлено.*\n\n||" +
-                        getStatusMsg() + "||");
-        break;
-      default:
-        break;
-      }
+  switch (event.rule) {
+  case Alerts::RULE_BMS_ERROR:
+    enqueue(event.active ? MSG_BMS_ERROR : MSG_BMS_ERROR_CLEARED, values, nullptr, event.ms);
+    break;
+  case Alerts::RULE_BMS_WARNING:
+    enqueue(event.active ? MSG_BMS_WARNING : MSG_BMS_WARNING_CLEARED, values, nullptr, event.ms);
+    break;
+  case Alerts::RULE_DISCHARGING:
+    if (event.active) {
+      enqueue(MSG_ON_BATTERY, values, nullptr, event.ms);
     }
-
-    previousState = state;
+    break;
+  case Alerts::RULE_CHARGING:
+    if (event.active) {
+      enqueue(MSG_POWER_RESTORED, values, nullptr, event.ms);
+    }
+    break;
+  case Alerts::RULE_LOW_CHARGE:
+    enqueue(event.active ? MSG_LOW_CHARGE : MSG_LOW_CHARGE_CLEARED, values, nullptr, event.ms);
+    break;
+  case Alerts::RULE_HIGH_TEMPERATURE:
+    enqueue(event.active ? MSG_HIGH_TEMPERATURE : MSG_HIGH_TEMPERATURE_CLEARED, values, nullptr,
+            event.ms);
+    break;
+  case Alerts::RULE_CURRENT_STEP:
+    enqueue(event.active ? MSG_CURRENT_STEP : MSG_CURRENT_STEP_CLEARED, values, nullptr,
+            event.ms);
+    break;
+  default:
+    break;
   }
+}
 
-  bot.tick();
+// Currents within tgCurrentThreshold of zero count as a balanced state
+State currentState() {
+  if (!Alerts::isPrimed()) {
+    return State::Undef;
+  } else if (Alerts::isActive(Alerts::RULE_CHARGING)) {
+    return State::Charging;
+  } else if (Alerts::isActive(Alerts::RULE_DISCHARGING)) {
+    return State::Discharging;
+  }
+  return State::Balance;
 }
 
 void onMessage(FB_msg &msg) {
@@ -152,92 +295,405 @@ void onMessage(FB_msg &msg) {
 
   if (msg.text == "/status" || msg.text.startsWith("/status@")) {
     LOG_D("TG", "Received /status command from chat %s", msg.chatID.c_str());
-    bot.sendMessage(getStatusMsg(), msg.chatID);
+    TgText::Values values = {};
+    values.ess = CAN::getEssStatus();
+    enqueue(MSG_STATUS, values, msg.chatID.c_str());
+  } else if (msg.text.startsWith("/history")) {
+    // /history [hours], also /history@bot [hours]
+    int space = msg.text.indexOf(' ');
+    int hours = space > 0 ? msg.text.substring(space + 1).toInt() : 0;
+    TgText::Values values = {};
+    values.count = hours > 0 ? hours : Chart::MAX_HOURS;
+    LOG_D("TG", "Received /history %lu from chat %s", values.count, msg.chatID.c_str());
+    enqueue(MSG_HISTORY, values, msg.chatID.c_str());
   } else if (msg.text == "/canstatus" || msg.text.startsWith("/canstatus@")) {
     LOG_D("TG", "Received /canstatus command from chat %s", msg.chatID.c_str());
-    uint32_t keepAliveCount = CAN::getKeepAliveCounter();
-    uint32_t keepAliveFailures = CAN::getKeepAliveFailures();
+    TgText::Values values = {};
+    values.count = CAN::getKeepAliveCounter();
+    values.failures = CAN::getKeepAliveFailures();
     uint32_t timeSinceLast = CAN::getTimeSinceLastKeepAlive();
+    values.age = timeSinceLast / 1000.0f;
 
     LOG_D("TG", "CAN stats: count=%lu, failures=%lu, lastTime=%lu ms",
-          keepAliveCount, keepAliveFailures, timeSinceLast);
-
-    String canMsg = "📡 *Статус CAN шини*\n\n";
-    canMsg += "✅ Keep-alive відправлено: *" + String(keepAliveCount) + "*\n";
-    canMsg += "❌ Помилок відправки: *" + String(keepAliveFailures) + "*\n";
-    canMsg += "⏱️ Останній keep-alive: *" + String(timeSinceLast / 1000.0, 1) + "с* тому\n\n";
-
-    if (timeSinceLast > 5000) {
-      canMsg += "🚨 *УВАГА!* Давно не було keep-alive!\n";
-      canMsg += "Батарея може відключитися через 20 хв без keep-alive.\n";
-    } else if (timeSinceLast > 2000) {
-      canMsg += "⚠️ Затримка з відправкою keep-alive.\n";
+          values.count, values.failures, timeSinceLast);
+    enqueue(MSG_CAN_STATUS, values, msg.chatID.c_str());
+  }
+}
+
+// Messages with the same key replace each other while they wait: after a
+// flapping grid only the latest power change is sent. See replaceable().
+uint8_t coalesceKey(MessageKind kind) {
+  switch (kind) {
+  case MSG_BMS_ERROR:
+  case MSG_BMS_ERROR_CLEARED:
+    return 0;
+  case MSG_BMS_WARNING:
+  case MSG_BMS_WARNING_CLEARED:
+    return 1;
+  case MSG_ON_BATTERY:
+  case MSG_POWER_RESTORED:
+    return 2;
+  case MSG_LOW_CHARGE:
+  case MSG_LOW_CHARGE_CLEARED:
+    return 3;
+  case MSG_HIGH_TEMPERATURE:
+  case MSG_HIGH_TEMPERATURE_CLEARED:
+    return 4;
+  case MSG_CURRENT_STEP:
+  case MSG_CURRENT_STEP_CLEARED:
+    return 5;
+  case MSG_STATUS:
+    return 6;
+  case MSG_HISTORY:
+    return 7;
+  default:
+    return 8;
+  }
+}
+
+// A raised alert is always delivered, never merged with its clear or a
+// later raise; only status toggles and replies are superseded
+bool replaceable(MessageKind kind) {
+  switch (kind) {
+  case MSG_BMS_ERROR:
+  case MSG_BMS_WARNING:
+  case MSG_LOW_CHARGE:
+  case MSG_HIGH_TEMPERATURE:
+  case MSG_CURRENT_STEP:
+    return false;
+  default:
+    return true;
+  }
+}
+
+void enqueue(MessageKind kind, const TgText::Values &values, const char *chatID,
+             uint32_t eventMs) {
+  Outbound msg;
+  msg.kind = kind;
+  msg.state = currentState();
+  msg.attempts = 0;
+  msg.eventMs = eventMs ? eventMs : millis();
+  strlcpy(msg.chatID, chatID ? chatID : "", sizeof(msg.chatID));
+  msg.values = values;
+
+  bool coalesced = false;
+  bool dropped = false;
+  portENTER_CRITICAL(&queueMux);
+  // The latest one with the same key; a raise behind it stays
+  Outbound *latest = nullptr;
+  for (uint8_t i = 0; i < queueCount; i++) {
+    Outbound &queued = queue[(queueFirst + i) % QUEUE_SIZE];
+    if (coalesceKey(queued.kind) == coalesceKey(kind) &&
+        strcmp(queued.chatID, msg.chatID) == 0) {
+      latest = &queued;
+    }
+  }
+  if (latest && replaceable(latest->kind)) {
+    *latest = msg;
+    coalesced = true;
+  }
+  if (!coalesced) {
+    if (queueCount < QUEUE_SIZE) {
+      queue[(queueFirst + queueCount) % QUEUE_SIZE] = msg;
+      queueCount++;
+    } else {
+      dropped = true;
+    }
+  }
+  portEXIT_CRITICAL(&queueMux);
+
+  if (coalesced) {
+    coalescedCount++;
+  } else if (dropped) {
+    droppedCount++;
+    LOG_W("TG", "Outbound queue full, message %u dropped", kind);
+  }
+  xTaskNotifyGive(senderHandle);
+}
+
+bool dequeue(Outbound *msg) {
+  bool found = false;
+  portENTER_CRITICAL(&queueMux);
+  if (queueCount > 0) {
+    *msg = queue[queueFirst];
+    queueFirst = (queueFirst + 1) % QUEUE_SIZE;
+    queueCount--;
+    found = true;
+  }
+  portEXIT_CRITICAL(&queueMux);
+  return found;
+}
+
+// Back at the front for another attempt, unless something newer with the
+// same key arrived meanwhile (raises never count as superseded) or the
+// queue filled up
+void requeue(const Outbound &msg) {
+  bool kept = false;
+  bool superseded = false;
+  portENTER_CRITICAL(&queueMux);
+  for (uint8_t i = 0; i < queueCount && !superseded && replaceable(msg.kind); i++) {
+    const Outbound &queued = queue[(queueFirst + i) % QUEUE_SIZE];
+    superseded = coalesceKey(queued.kind) == coalesceKey(msg.kind) &&
+                 strcmp(queued.chatID, msg.chatID) == 0;
+  }
+  if (!superseded && queueCount < QUEUE_SIZE) {
+    queueFirst = (queueFirst + QUEUE_SIZE - 1) % QUEUE_SIZE;
+    queue[queueFirst] = msg;
+    queueCount++;
+    kept = true;
+  }
+  portEXIT_CRITICAL(&queueMux);
+  if (superseded) {
+    coalescedCount++;
+  } else if (!kept) {
+    droppedCount++;
+  }
+}
+
+void senderTask(void *pvParameters) {
+  float tokens = SEND_BURST;
+  uint32_t refillMs = millis();
+
+  while (1) {
+    uint32_t now = millis();
+    tokens += (float)(now - refillMs) / SEND_REFILL_MS;
+    if (tokens > SEND_BURST) {
+      tokens = SEND_BURST;
+    }
+    refillMs = now;
+    if (tokens < 1) {
+      // Waiting lets newer messages replace queued ones
+      vTaskDelay(pdMS_TO_TICKS((uint32_t)((1 - tokens) * SEND_REFILL_MS) + 1));
+      continue;
+    }
+
+    Outbound msg;
+    if (!dequeue(&msg)) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    tokens -= 1;
+
+    if (deliver(msg)) {
+      uint32_t latency = millis() - msg.eventMs;
+      sentCount++;
+      latencySumMs += latency;
+      if (latency > latencyMaxMs) {
+        latencyMaxMs = latency;
+      }
+    } else if (++msg.attempts < SEND_ATTEMPTS) {
+      requeue(msg);
     } else {
-      canMsg += "🟢 Keep-alive працює нормально.\n";
+      failedCount++;
+      LOG_W("TG", "Message %u not delivered after %u attempts", msg.kind, msg.attempts);
     }
+  }
+}
+
+bool deliver(const Outbound &msg) {
+  if (msg.kind == MSG_HISTORY) {
+    return sendChart(msg);
+  }
 
-    if (keepAliveFailures > 0) {
-      canMsg += "\n⚠️ Виявлено " + String(keepAliveFailures) + " помилок відправки!\n";
-      canMsg += "Можливо проблема з CAN шиною або MCP2515.\n";
+  TgText::Buffer buf;
+  TgText::init(buf, messageText, sizeof(messageText));
+  const TgText::Values &values = msg.values;
+  switch (msg.kind) {
+  case MSG_BMS_ERROR:
+    TgText::append(buf, TPL_BMS_ERROR, values);
+    TgText::append(buf, TPL_ALERT_STATE, values);
+    break;
+  case MSG_BMS_ERROR_CLEARED:
+    TgText::append(buf, TPL_BMS_ERROR_CLEARED, values);
+    break;
+  case MSG_BMS_WARNING:
+    TgText::append(buf, TPL_BMS_WARNING, values);
+    TgText::append(buf, TPL_ALERT_STATE, values);
+    break;
+  case MSG_BMS_WARNING_CLEARED:
+    TgText::append(buf, TPL_BMS_WARNING_CLEARED, values);
+    break;
+  case MSG_ON_BATTERY:
+  case MSG_POWER_RESTORED:
+    TgText::append(buf, msg.kind == MSG_ON_BATTERY ? TPL_ON_BATTERY : TPL_POWER_RESTORED,
+                   values);
+    TgText::append(buf, "||", values);
+    appendStatus(buf, msg.state, values);
+    TgText::append(buf, "||", values);
+    break;
+  case MSG_LOW_CHARGE:
+    TgText::append(buf, TPL_LOW_CHARGE, values);
+    TgText::append(buf, TPL_ALERT_STATE, values);
+    break;
+  case MSG_LOW_CHARGE_CLEARED:
+    TgText::append(buf, TPL_LOW_CHARGE_CLEARED, values);
+    break;
+  case MSG_HIGH_TEMPERATURE:
+    TgText::append(buf, TPL_HIGH_TEMPERATURE, values);
+    TgText::append(buf, TPL_ALERT_STATE, values);
+    break;
+  case MSG_HIGH_TEMPERATURE_CLEARED:
+    TgText::append(buf, TPL_HIGH_TEMPERATURE_CLEARED, values);
+    break;
+  case MSG_CURRENT_STEP:
+    TgText::append(buf, TPL_CURRENT_STEP, values);
+    TgText::append(buf, TPL_ALERT_STATE, values);
+    break;
+  case MSG_CURRENT_STEP_CLEARED:
+    TgText::append(buf, TPL_CURRENT_STEP_CLEARED, values);
+    break;
+  case MSG_STATUS:
+    appendStatus(buf, msg.state, values);
+    break;
+  case MSG_HISTORY:
+    break; // Sent above
+  case MSG_CAN_STATUS:
+    TgText::append(buf, TPL_CAN_STATUS, values);
+    if (values.age > 5) {
+      TgText::append(buf, TPL_CAN_KEEPALIVE_LOST, values);
+    } else if (values.age > 2) {
+      TgText::append(buf, TPL_CAN_KEEPALIVE_LATE, values);
+    } else {
+      TgText::append(buf, TPL_CAN_KEEPALIVE_OK, values);
+    }
+    if (values.failures > 0) {
+      TgText::append(buf, TPL_CAN_FAILURES, values);
     }
+    break;
+  }
 
-    bot.sendMessage(canMsg, msg.chatID);
+  if (buf.truncated && msg.attempts == 0) {
+    truncatedCount++;
+    LOG_W("TG", "Message cut off at %u bytes", buf.len);
   }
+  if (buf.len > longestMessage) {
+    longestMessage = buf.len;
+  }
+#ifdef DEBUG
+  Serial.println(buf.data);
+#endif
+
+  // FastBot takes a String: one allocation for the whole text. 1 is FastBot's OK.
+  xSemaphoreTake(botMutex, portMAX_DELAY);
+  uint8_t result = msg.chatID[0] ? bot.sendMessage(buf.data, msg.chatID)
+                                 : bot.sendMessage(buf.data);
+  xSemaphoreGive(botMutex);
+  return result == 1;
 }
 
-String getStatusMsg() {
-  // Get thread-safe copy of battery status
-  EssStatus ess = CAN::getEssStatus();
+// sendPhoto as multipart/form-data. The PNG is produced while it is
+// written to the socket, so only one chunk of it is ever in memory; its
+// size is fixed, which gives the Content-Length up front.
+bool sendChart(const Outbound &msg) {
+  static const char BOUNDARY[] = "essMonitorChart";
+  static const char HOST[] = "api.telegram.org";
+  uint32_t startMs = millis();
+  Chart::begin(chart, msg.values.count);
+
+  char caption[192];
+  const Chart::Range *d = chart.data;
+  if (d[Chart::SERIES_CHARGE].valid) {
+    snprintf(caption, sizeof(caption), HISTORY_CAPTION, chart.hours,
+             d[Chart::SERIES_CHARGE].min, d[Chart::SERIES_CHARGE].max,
+             d[Chart::SERIES_CURRENT].min, d[Chart::SERIES_CURRENT].max,
+             d[Chart::SERIES_VOLTAGE].min, d[Chart::SERIES_VOLTAGE].max);
+  } else {
+    snprintf(caption, sizeof(caption), HISTORY_CAPTION_EMPTY, chart.hours);
+  }
+
+  char head[512];
+  int headLen = snprintf(head, sizeof(head),
+                         "--%s\r\nContent-Disposition: form-data; name=\"chat_id\"\r\n\r\n%s\r\n"
+                         "--%s\r\nContent-Disposition: form-data; name=\"caption\"\r\n\r\n%s\r\n"
+                         "--%s\r\nContent-Disposition: form-data; name=\"photo\"; "
+                         "filename=\"history.png\"\r\nContent-Type: image/png\r\n\r\n",
+                         BOUNDARY, msg.chatID[0] ? msg.chatID : Cfg.tgChatID, BOUNDARY, caption,
+                         BOUNDARY);
+  char tail[32];
+  int tailLen = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", BOUNDARY);
+
+  // Same mutex as FastBot: one TLS session at a time
+  xSemaphoreTake(botMutex, portMAX_DELAY);
+  WiFiClientSecure client;
+  client.setInsecure();
+  client.setTimeout(10);
+  bool ok = client.connect(HOST, 443);
+  if (ok) {
+    client.printf("POST /bot%s/sendPhoto HTTP/1.1\r\nHost: %s\r\n"
+                  "Content-Type: multipart/form-data; boundary=%s\r\n"
+                  "Content-Length: %u\r\nConnection: close\r\n\r\n",
+                  Cfg.tgBotToken, HOST, BOUNDARY, headLen + Chart::size() + tailLen);
+    ok = client.write((const uint8_t *)head, headLen) == (size_t)headLen;
+    uint8_t buf[1024];
+    size_t n;
+    while (ok && (n = Chart::read(chart, buf, sizeof(buf))) > 0) {
+      ok = client.write(buf, n) == n;
+    }
+    ok = ok && client.write((const uint8_t *)tail, tailLen) == (size_t)tailLen;
+    // "HTTP/1.1 200 OK"; the JSON body is not needed
+    ok = ok && client.readStringUntil('\n').startsWith("HTTP/1.1 200");
+  }
+  client.stop();
+  xSemaphoreGive(botMutex);
+
+  if (ok) {
+    LOG_I("TG", "History chart, %u h, %u bytes sent in %lu ms", chart.hours, Chart::size(),
+          millis() - startMs);
+  } else {
+    LOG_W("TG", "History chart upload failed after %lu ms", millis() - startMs);
+  }
+  return ok;
+}
 
-  String s;
-  switch (state) {
+void appendStatus(TgText::Buffer &buf, State status, const TgText::Values &values) {
+  const EssStatus &ess = values.ess;
+  switch (status) {
   case State::Balance:
-    s = "⚪️ Статус: *простій*.\n\n";
+    TgText::append(buf, TPL_STATE_IDLE, values);
     break;
   case State::Charging:
-    s = "🟢 Статус: *заряджання*.\n\n";
+    TgText::append(buf, TPL_STATE_CHARGING, values);
     break;
   case State::Discharging:
-    s = "🔴 Статус: *розряджання*.\n\n";
+    TgText::append(buf, TPL_STATE_DISCHARGING, values);
     break;
   default:
-    s = "🟡 Статус: *невизначений*.\n\n";
+    TgText::append(buf, TPL_STATE_UNKNOWN, values);
     break;
   }
-  if (ess.charge > 75) {
-    s += "🟩🟩🟩🟩";
-  } else if (ess.charge > 50) {
-    s += "🟩🟩🟩🟦";
-  } else if (ess.charge > 25) {
-    s += "🟩🟩🟦🟦";
-  } else {
-    s += "🟩🟦🟦🟦";
-  }
-  s += " Заряд: *" + String(ess.charge) + "%*\n";
-  s += "🔌 Навантаження: *" + String(ess.current, 1) + "A*\n";
-  s += "⚡️ Напруга: *" + String(ess.voltage, 2) + "V*, номінальна: *" +
-       String(ess.ratedVoltage, 2) + "V*\n";
-  s += "🌡️ Температура батареї: *" + String(ess.temperature, 1) + "°C*\n";
-  s += "🍀 Здоров'я батареї: *" + String(ess.health) + "%*\n";
+  TgText::append(buf, ess.charge > 75 ? TPL_BAR_4 : ess.charge > 50 ? TPL_BAR_3 :
+                      ess.charge > 25 ? TPL_BAR_2 : TPL_BAR_1, values);
+  TgText::append(buf, TPL_STATUS, values);
 
   // BMS errors and warnings
   if (ess.bmsError > 0 || ess.bmsWarning > 0) {
-    s += "\n⚠️ *УВАГА!*\n";
+    TgText::append(buf, TPL_STATUS_ATTENTION, values);
     if (ess.bmsError > 0) {
-      s += "🚨 Критична помилка: *" + String(ess.bmsError) + "*\n";
+      TgText::append(buf, TPL_STATUS_BMS_ERROR, values);
     }
     if (ess.bmsWarning > 0) {
-      s += "⚠️ Попередження: *" + String(ess.bmsWarning) + "*\n";
+      TgText::append(buf, TPL_STATUS_BMS_WARNING, values);
     }
   } else {
-    s += "\n✅ Помилок немає\n";
+    TgText::append(buf, TPL_STATUS_NO_ERRORS, values);
   }
+}
 
-#ifdef DEBUG
-  Serial.println(s);
-#endif
-
-  return s;
+Stats getStats() {
+  Stats stats;
+  portENTER_CRITICAL(&queueMux);
+  stats.queued = queueCount;
+  portEXIT_CRITICAL(&queueMux);
+  stats.sent = sentCount;
+  stats.failed = failedCount;
+  stats.coalesced = coalescedCount;
+  stats.dropped = droppedCount;
+  stats.truncated = truncatedCount;
+  stats.longest = longestMessage;
+  stats.capacity = sizeof(messageText);
+  stats.latencyAvgMs = sentCount ? latencySumMs / sentCount : 0;
+  stats.latencyMaxMs = latencyMaxMs;
+  return stats;
 }
 
 } // namespace TG
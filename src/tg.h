@@ -5,7 +5,21 @@
 
 namespace TG {
 
+typedef struct Stats {
+  uint32_t queued;       // Waiting for the sender now
+  uint32_t sent;         // Accepted by Telegram
+  uint32_t failed;       // Given up after retries
+  uint32_t coalesced;    // Replaced by a newer message of the same kind
+  uint32_t dropped;      // Queue full
+  uint32_t truncated;    // Cut off at the buffer size
+  uint32_t longest;      // Bytes
+  uint32_t capacity;     // Render buffer size
+  uint32_t latencyAvgMs; // Event to delivery
+  uint32_t latencyMaxMs;
+} Stats;
+
 void begin(uint8_t core, uint8_t priority);
+Stats getStats();
 
 } // namespace TG
 
@@ -0,0 +1,100 @@
+#include "tg_text.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace TgText {
+
+namespace {
+
+bool is(const char *name, size_t len, const char *field) {
+  return strlen(field) == len && memcmp(name, field, len) == 0;
+}
+
+// Formats one placeholder into out; -1 for unknown names
+int formatField(char *out, size_t size, const char *name, size_t len, const Values &v) {
+  if (is(name, len, "charge")) {
+    return snprintf(out, size, "%d", v.ess.charge);
+  } else if (is(name, len, "health")) {
+    return snprintf(out, size, "%d", v.ess.health);
+  } else if (is(name, len, "voltage")) {
+    return snprintf(out, size, "%.2f", v.ess.voltage);
+  } else if (is(name, len, "rated_voltage")) {
+    return snprintf(out, size, "%.2f", v.ess.ratedVoltage);
+  } else if (is(name, len, "current")) {
+    return snprintf(out, size, "%.1f", v.ess.current);
+  } else if (is(name, len, "temperature")) {
+    return snprintf(out, size, "%.1f", v.ess.temperature);
+  } else if (is(name, len, "bms_error")) {
+    return snprintf(out, size, "%u", v.ess.bmsError);
+  } else if (is(name, len, "bms_warning")) {
+    return snprintf(out, size, "%u", v.ess.bmsWarning);
+  } else if (is(name, len, "code")) {
+    return snprintf(out, size, "%lu", v.code);
+  } else if (is(name, len, "previous")) {
+    return snprintf(out, size, "%lu", v.previous);
+  } else if (is(name, len, "value")) {
+    return snprintf(out, size, "%.1f", v.value);
+  } else if (is(name, len, "count")) {
+    return snprintf(out, size, "%lu", v.count);
+  } else if (is(name, len, "failures")) {
+    return snprintf(out, size, "%lu", v.failures);
+  } else if (is(name, len, "age")) {
+    return snprintf(out, size, "%.1f", v.age);
+  }
+  return -1;
+}
+
+void put(Buffer &buf, const char *s, size_t n) {
+  if (buf.truncated) {
+    return; // Nothing after a cut, the message would not make sense
+  }
+  size_t room = buf.size - 1 - buf.len;
+  if (n > room) {
+    n = room;
+    while (n > 0 && ((uint8_t)s[n] & 0xC0) == 0x80) {
+      n--; // Never split a UTF-8 sequence, Telegram rejects the message
+    }
+    buf.truncated = true;
+  }
+  memcpy(buf.data + buf.len, s, n);
+  buf.len += n;
+  buf.data[buf.len] = '\0';
+}
+
+} // namespace
+
+void init(Buffer &buf, char *data, size_t size) {
+  buf.data = data;
+  buf.size = size;
+  buf.len = 0;
+  buf.truncated = false;
+  data[0] = '\0';
+}
+
+void append(Buffer &buf, const char *tpl, const Values &values) {
+  const char *p = tpl;
+  while (*p) {
+    const char *open = strchr(p, '{');
+    if (!open) {
+      put(buf, p, strlen(p));
+      return;
+    }
+    put(buf, p, open - p);
+    const char *close = strchr(open + 1, '}');
+    if (!close) {
+      put(buf, open, strlen(open));
+      return;
+    }
+
+    char field[24];
+    int n = formatField(field, sizeof(field), open + 1, close - open - 1, values);
+    if (n < 0) {
+      put(buf, open, close + 1 - open); // Not ours, keep it
+    } else {
+      put(buf, field, (size_t)n < sizeof(field) ? n : sizeof(field) - 1);
+    }
+    p = close + 1;
+  }
+}
+
+} // namespace TgText
@@ -0,0 +1,40 @@
+#ifndef _TG_TEXT_H_
+#define _TG_TEXT_H_
+
+#include "types.h"
+#include <stddef.h>
+
+namespace TgText {
+
+// Renders message templates (constant strings in flash) into a caller-owned
+// buffer, no heap. Placeholders:
+//   {charge} {health} {voltage} {rated_voltage} {current} {temperature}
+//   {bms_error} {bms_warning}    battery status
+//   {code} {previous}            alert code and the one before it
+//   {value}                      value that raised or cleared an alert
+//   {count} {failures} {age}     CAN keep-alive (age in seconds)
+// Unknown placeholders are copied unchanged.
+
+typedef struct Values {
+  EssStatus ess;
+  uint32_t code;
+  uint32_t previous;
+  float value;
+  uint32_t count;
+  uint32_t failures;
+  float age;
+} Values;
+
+typedef struct Buffer {
+  char *data;
+  size_t size;
+  size_t len;
+  bool truncated; // Something did not fit and was cut off
+} Buffer;
+
+void init(Buffer &buf, char *data, size_t size);
+void append(Buffer &buf, const char *tpl, const Values &values);
+
+} // namespace TgText
+
+#endif
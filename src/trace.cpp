@@ -0,0 +1,256 @@
+#include "trace.h"
+#include "logger.h"
+#include <atomic>
+#include <esp_attr.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <soc/soc_memory_layout.h>
+
+namespace Trace {
+
+namespace {
+
+const uint32_t MAGIC = 0x31435254; // "TRC1"
+const uint32_t ENTRIES = 128;      // Power of two
+const uint32_t KEEPALIVES = 16;
+
+const char *TASK_NAMES[TASK_COUNT] = {"main", "can", "hass", "tg", "lcd"};
+
+typedef enum { KIND_LOG = 1, KIND_MARK } Kind;
+
+typedef struct Entry {
+  uint32_t seq;  // 0: never written
+  uint32_t tick; // xTaskGetTickCount(), ms
+  uint8_t kind;
+  uint8_t level;
+  uint16_t marker;
+  uint32_t a; // Log: format pointer; mark: value
+  uint32_t b; // Log: tag pointer; mark: first 4 chars of the task name
+  uint32_t c; // Log: first argument word of a deferred record
+} Entry;
+
+typedef struct Area {
+  uint32_t magic;
+  uint32_t check; // ~magic ^ bootCount, rejects random power-on contents
+  uint32_t bootCount;
+  uint8_t firmware[8]; // ELF SHA-256 prefix; pointers only resolve against the same build
+  uint32_t keepAlive[KEEPALIVES];
+  uint32_t keepAliveCount;
+  uint32_t keepAliveFailures;
+  uint32_t alive[TASK_COUNT];
+  Entry entries[ENTRIES];
+} Area;
+
+RTC_NOINIT_ATTR Area area;
+
+Area *previous = nullptr; // Heap copy of the previous boot's area
+esp_reset_reason_t previousReason = ESP_RST_UNKNOWN;
+bool sameFirmware = false;
+
+// Kept in DRAM: atomics are not safe on RTC slow memory
+std::atomic<uint32_t> nextSeq{1};
+
+inline Entry *claim(Kind kind) {
+  uint32_t seq = nextSeq.fetch_add(1, std::memory_order_relaxed);
+  Entry *entry = &area.entries[seq & (ENTRIES - 1)];
+  entry->seq = seq;
+  entry->tick = xTaskGetTickCount();
+  entry->kind = kind;
+  return entry;
+}
+
+bool isAbnormal(esp_reset_reason_t reason) {
+  return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT ||
+         reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT ||
+         reason == ESP_RST_BROWNOUT;
+}
+
+// Strings from the previous boot are only trusted when they point into
+// flash rodata of the same build
+const char *resolve(uint32_t ptr) {
+  const void *p = (const void *)ptr;
+  return sameFirmware && esp_ptr_in_drom(p) ? (const char *)p : nullptr;
+}
+
+} // namespace
+
+const char *resetReasonToString(esp_reset_reason_t reason) {
+  switch (reason) {
+  case ESP_RST_UNKNOWN:
+    return "Unknown";
+  case ESP_RST_POWERON:
+    return "Power-on";
+  case ESP_RST_EXT:
+    return "External pin";
+  case ESP_RST_SW:
+    return "Software";
+  case ESP_RST_PANIC:
+    return "Software panic";
+  case ESP_RST_INT_WDT:
+    return "Interrupt watchdog";
+  case ESP_RST_TASK_WDT:
+    return "Task watchdog";
+  case ESP_RST_WDT:
+    return "Other watchdog";
+  case ESP_RST_DEEPSLEEP:
+    return "Deep sleep";
+  case ESP_RST_BROWNOUT:
+    return "Brownout";
+  case ESP_RST_SDIO:
+    return "SDIO";
+#ifdef ESP_RST_USB
+  case ESP_RST_USB:
+    return "USB";
+#endif
+#ifdef ESP_RST_JTAG
+  case ESP_RST_JTAG:
+    return "JTAG";
+#endif
+#ifdef ESP_RST_TIMEWDT
+  case ESP_RST_TIMEWDT:
+    return "Time watchdog";
+#endif
+#ifdef ESP_RST_RTCWDT
+  case ESP_RST_RTCWDT:
+    return "RTC watchdog";
+#endif
+  default:
+    return "Other";
+  }
+}
+
+void begin() {
+  previousReason = esp_reset_reason();
+  const uint8_t *firmware = esp_ota_get_app_description()->app_elf_sha256;
+
+  bool valid = previousReason != ESP_RST_POWERON && area.magic == MAGIC &&
+               area.check == (~MAGIC ^ area.bootCount);
+  uint32_t bootCount = valid ? area.bootCount + 1 : 1;
+  if (valid) {
+    previous = (Area *)malloc(sizeof(Area));
+    if (previous) {
+      memcpy(previous, &area, sizeof(Area));
+      sameFirmware = memcmp(previous->firmware, firmware, sizeof(area.firmware)) == 0;
+    }
+  }
+
+  memset(&area, 0, sizeof(area));
+  area.bootCount = bootCount;
+  memcpy(area.firmware, firmware, sizeof(area.firmware));
+  area.check = ~MAGIC ^ bootCount;
+  area.magic = MAGIC;
+}
+
+bool hasPrevious() {
+  return previous != nullptr;
+}
+
+void report() {
+  if (!previous) {
+    return;
+  }
+
+  uint32_t entries = 0;
+  for (uint32_t i = 0; i < ENTRIES; i++) {
+    entries += previous->entries[i].seq != 0;
+  }
+  LOG_W("TRACE", "Boot #%lu ended by: %s, %lu trace entries kept (GET /api/crashlog)",
+        previous->bootCount, resetReasonToString(previousReason), entries);
+
+  // Full dump on the serial console only after a crash, it takes a while
+  if (isAbnormal(previousReason)) {
+    print(Serial);
+  }
+}
+
+void print(Print &out) {
+  if (!previous) {
+    out.println("No trace from the previous boot (power-on or first start)");
+    return;
+  }
+
+  out.printf("Boot #%lu, reset reason: %s (code=%d)\n", previous->bootCount,
+             resetReasonToString(previousReason), (int)previousReason);
+  if (!sameFirmware) {
+    out.println("Firmware changed since, strings shown as addresses");
+  }
+
+  out.println("\nTask last seen (ms since boot):");
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    if (previous->alive[i]) {
+      out.printf("  %-5s %lu\n", TASK_NAMES[i], previous->alive[i]);
+    }
+  }
+
+  uint32_t count = previous->keepAliveCount;
+  out.printf("\nCAN keep-alives: %lu sent, %lu failed, last at:", count,
+             previous->keepAliveFailures);
+  uint32_t first = count > KEEPALIVES ? count - KEEPALIVES : 0;
+  for (uint32_t i = first; i < count; i++) {
+    out.printf(" %lu", previous->keepAlive[i % KEEPALIVES]);
+  }
+
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < ENTRIES; i++) {
+    if (previous->entries[i].seq > last) {
+      last = previous->entries[i].seq;
+    }
+  }
+  out.println("\n\nLast events (ms since boot):");
+  for (uint32_t seq = last > ENTRIES ? last - ENTRIES + 1 : 1; seq <= last; seq++) {
+    const Entry &e = previous->entries[seq & (ENTRIES - 1)];
+    if (e.seq != seq) {
+      continue; // Torn or never written
+    }
+    if (e.kind == KIND_LOG) {
+      const char *tag = resolve(e.b);
+      const char *format = resolve(e.a);
+      out.printf("%10lu [%s][%s] ", e.tick, Logger::levelToString(e.level),
+                 tag ? tag : "?");
+      if (format) {
+        out.printf("%s (arg0=0x%08lx)\n", format, e.c);
+      } else {
+        out.printf("format@0x%08lx tag@0x%08lx arg0=0x%08lx\n", e.a, e.b, e.c);
+      }
+    } else if (e.kind == KIND_MARK) {
+      char task[5] = {0};
+      memcpy(task, &e.b, 4);
+      out.printf("%10lu <%s> mark %u value %lu\n", e.tick, task, e.marker, e.a);
+    }
+  }
+}
+
+void log(uint8_t level, const char *tag, const char *format, uint32_t arg) {
+  Entry *entry = claim(KIND_LOG);
+  entry->level = level;
+  entry->a = (uint32_t)format;
+  entry->b = (uint32_t)tag;
+  entry->c = arg;
+}
+
+void mark(Marker marker, uint32_t value) {
+  Entry *entry = claim(KIND_MARK);
+  entry->marker = marker;
+  entry->a = value;
+  entry->b = 0;
+  strncpy((char *)&entry->b, pcTaskGetTaskName(NULL), 4);
+}
+
+void keepAlive(bool ok) {
+  // CAN task only
+  if (ok) {
+    area.keepAlive[area.keepAliveCount % KEEPALIVES] = xTaskGetTickCount();
+    area.keepAliveCount++;
+  } else {
+    area.keepAliveFailures++;
+    mark(MARK_KEEPALIVE_FAIL, area.keepAliveFailures);
+  }
+}
+
+void alive(Task task) {
+  area.alive[task] = xTaskGetTickCount();
+}
+
+} // namespace Trace
@@ -0,0 +1,52 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <Arduino.h>
+#include <esp_system.h>
+
+namespace Trace {
+
+// Post-mortem trace kept in RTC_NOINIT memory, which survives panics,
+// watchdog and software resets (not power loss). Holds the last log calls
+// (format/tag pointers only, nothing is formatted), CAN keep-alive
+// timestamps, a last-seen tick per task and a few explicit markers.
+// Appending is a handful of stores plus one atomic increment.
+
+typedef enum {
+  TASK_MAIN = 0,
+  TASK_CAN,
+  TASK_HASS,
+  TASK_TG,
+  TASK_LCD,
+  TASK_COUNT
+} Task;
+
+typedef enum {
+  MARK_BOOT = 1,       // value: setup stage
+  MARK_RESTART,        // Software restart requested
+  MARK_KEEPALIVE_FAIL, // value: failure count
+  MARK_MQTT,           // value: 1 connected, 0 disconnected
+  MARK_OTA,            // value: 1 started, 0 finished
+} Marker;
+
+// Call first thing in setup(): keeps the previous boot's trace for
+// report() and /api/crashlog, then starts a fresh one
+void begin();
+
+// Logs a summary of the previous boot's trace (after Logger::begin())
+void report();
+
+// Writes the previous boot's trace as text
+void print(Print &out);
+bool hasPrevious();
+
+const char *resetReasonToString(esp_reset_reason_t reason);
+
+void log(uint8_t level, const char *tag, const char *format, uint32_t arg);
+void mark(Marker marker, uint32_t value);
+void keepAlive(bool ok);
+void alive(Task task);
+
+} // namespace Trace
+
+#endif
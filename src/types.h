@@ -10,6 +10,10 @@
 #define CFG_WIFI_STA "wifi.sta"
 #define CFG_WIFI_SSID "wifi.ssid"
 #define CFG_WIFI_PASS "wifi.pass"
+#define CFG_WIFI_STATIC_IP "wifi.ip"
+#define CFG_WIFI_GATEWAY "wifi.gw"
+#define CFG_WIFI_SUBNET "wifi.mask"
+#define CFG_WIFI_DNS "wifi.dns"
 #define CFG_HOSTNAME "hostname"
 #define CFG_INVERTER_CHARGE_LIMIT "inverter.charge_limit"
 #define CFG_INVERTER_DISCHARGE_LIMIT "inverter.discharge_limit"
@@ -18,17 +22,37 @@
 #define CFG_MQQTT_PORT "mqtt.port"
 #define CFG_MQQTT_USERNAME "mqtt.username"
 #define CFG_MQQTT_PASSWORD "mqtt.password"
+#define CFG_HASS_MIN_INTERVAL "hass.min_int"
+#define CFG_HASS_HEARTBEAT "hass.heartbeat"
+#define CFG_HASS_DB_VOLTAGE "hass.db_volt"
+#define CFG_HASS_DB_CURRENT "hass.db_curr"
+#define CFG_HASS_DB_TEMPERATURE "hass.db_temp"
+#define CFG_HASS_DB_CHARGE "hass.db_soc"
+#define CFG_HASS_JSON_STATE "hass.json"
+#define CFG_HASS_BUFFER_KB "hass.buf_kb"
+#define CFG_HASS_BUFFER_INTERVAL "hass.buf_int"
+#define CFG_HASS_AGGREGATE "hass.agg"
+#define CFG_HASS_DISCOVERY_HASH "hass.disc_hash" // Written by the HASS task, not a setting
 #define CFG_TG_ENABLED "tg.enabled"
 #define CFG_TG_BOT_TOKEN "tg.bot_token"
 #define CFG_TG_CHAT_ID "tg.chat_id"
 #define CFG_TG_CURRENT_THRESHOLD "tg.amps"
+#define CFG_ALERT_LOW_CHARGE "alert.low_soc"
+#define CFG_ALERT_HIGH_TEMP "alert.high_t"
+#define CFG_ALERT_CURRENT_RATE "alert.rate"
+#define CFG_ALERT_HOLD "alert.hold"
 #define CFG_WATCHDOG_ENABLED "watchdog.enabled"
 #define CFG_WATCHDOG_TIMEOUT "watchdog.timeout"
+#define CFG_EVENT_LOOP "event_loop"
 #define CFG_SYSLOG_ENABLED "syslog.enabled"
 #define CFG_SYSLOG_SERVER "syslog.server"
 #define CFG_SYSLOG_PORT "syslog.port"
 #define CFG_SYSLOG_LEVEL "syslog.level"
+#define CFG_SYSLOG_BATCH "syslog.batch"
 #define CFG_CAN_KEEPALIVE_INTERVAL "can.keepalive_interval"
+#define CFG_LCD_DIM_TIMEOUT "lcd.dim"
+#define CFG_LCD_OFF_TIMEOUT "lcd.off"
+#define CFG_OTA_URL "ota.url"
 
 extern bool needRestart;
 
@@ -40,10 +64,20 @@ struct RuntimeStatus {
   int32_t wifiRSSI = 0;
 };
 
+// Lowest hassHeartbeat in seconds, as in the web form. With 0 every value
+// was due on every pass.
+#define HASS_HEARTBEAT_MIN 10
+
 typedef struct Config {
   bool wifiSTA = false;
   char wifiSSID[128];
   char wifiPass[128];
+  // Static IP instead of DHCP when wifiStaticIP is set; DNS defaults to
+  // the gateway
+  char wifiStaticIP[16] = "";
+  char wifiGateway[16] = "";
+  char wifiSubnet[16] = "255.255.255.0";
+  char wifiDNS[16] = "";
 
   char hostname[32] = "ess-monitor";
 
@@ -56,21 +90,57 @@ typedef struct Config {
   char mqttUsername[64] = "";
   char mqttPassword[64] = "";
 
+  // Home Assistant publish-on-change: a sensor is sent when it moved by its
+  // deadband (0 = any change), at most every hassMinInterval seconds, and
+  // at least every hassHeartbeat seconds even if unchanged
+  uint16_t hassMinInterval = 5;
+  uint16_t hassHeartbeat = 300;
+  float hassDbVoltage = 0.1f;
+  float hassDbCurrent = 0.5f;
+  float hassDbTemperature = 0.5f;
+  uint8_t hassDbCharge = 1;
+  // One JSON state document per cycle on a single topic instead of one
+  // topic per sensor; discovery then points every entity at it with a
+  // value_template
+  bool hassJsonState = false;
+  // Offline buffer: while the broker is unreachable a sample is kept every
+  // hassBufferInterval seconds in up to hassBufferKb of RAM (0 = off), and
+  // sent to the history topic after reconnecting
+  uint16_t hassBufferKb = 16;
+  uint16_t hassBufferInterval = 10;
+  // Seconds; when set, voltage, current and temperature are sent as mean,
+  // min and max over every CAN frame of the interval instead of on change
+  uint16_t hassAggregate = 0;
+
   bool tgEnabled = false;
   char tgBotToken[64];
   char tgChatID[32];
   uint8_t tgCurrentThreshold = 2;
 
+  // Alert rules shared by Telegram, MQTT, web and LCD; 0 turns a rule off
+  uint8_t alertLowCharge = 20;  // %
+  uint8_t alertHighTemp = 45;   // °C
+  uint8_t alertCurrentRate = 0; // A/s
+  uint8_t alertHold = 0;        // Seconds a threshold change must last
+
   bool watchdogEnabled = true;    // Watchdog enabled by default to prevent device freezing
   uint8_t watchdogTimeout = 60;   // Watchdog timeout in seconds (default: 60s)
 
+  bool eventLoop = false;         // LCD and HASS on one task (Sched)
+
   bool syslogEnabled = false;     // Syslog disabled by default
   char syslogServer[64] = "";     // Syslog server IP or hostname
   uint16_t syslogPort = 514;      // Syslog port (default: 514)
   uint8_t syslogLevel = 6;        // Syslog level (default: INFO=6)
+  bool syslogBatch = false;       // Several messages per datagram, one per line
 
   uint16_t canKeepAliveInterval = 3000;  // CAN keep-alive interval in milliseconds (default: 3000ms = 3 seconds)
 
+  uint16_t lcdDimTimeout = 300;   // Seconds without an alert change before the LCD dims, 0 = never
+  uint16_t lcdOffTimeout = 0;     // Seconds before it switches off, 0 = never
+
+  char otaUrl[128] = "";          // Firmware URL for pull updates, e.g. http://192.168.0.10:8000/firmware.bin.gz
+
 } Config;
 
 typedef struct EssStatus {
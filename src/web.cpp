@@ -1,15 +1,30 @@
 #include "web.h"
+#include "alerts.h"
+#include "backlog.h"
+#include "boot.h"
 #include "can.h"
+#include "chart.h"
+#include "hass.h"
+#include "lcd.h"
+#include "mqtt_client.h"
+#include "logger.h"
 #include "types.h"
 #include "runtime_cache.h"
+#include "sched.h"
 #include "web_html.h"
 #include "ota_html.h"
+#include "ota_pull.h"
+#include "ota_stream.h"
+#include "syslog_sink.h"
+#include "telemetry.h"
+#include "tg.h"
+#include "trace.h"
+#include "wifi_manager.h"
 #include <ArduinoJson.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <WebSerialLite.h>
 #include <Preferences.h>
-#include <Update.h>
 
 extern Config Cfg;
 extern Preferences Pref;
@@ -20,6 +35,10 @@ namespace WEB {
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 
+// The browser upload that owns OtaStream; async_tcp only. Other uploads,
+// and uploads during a pull update, get 409.
+AsyncWebServerRequest *otaUpload = nullptr;
+
 // WebSocket event handler
 void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
                AwsEventType type, void *arg, uint8_t *data, size_t len) {
@@ -37,6 +56,104 @@ void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
   }
 }
 
+// Alert rules, shared by /api/settings/telegram and /all. Caller has Pref open.
+void saveAlerts(JsonVariantConst src) {
+  if (src["alertLowCharge"].is<int>()) {
+    Cfg.alertLowCharge = src["alertLowCharge"].as<uint8_t>();
+    Pref.putUChar(CFG_ALERT_LOW_CHARGE, Cfg.alertLowCharge);
+  }
+  if (src["alertHighTemp"].is<int>()) {
+    Cfg.alertHighTemp = src["alertHighTemp"].as<uint8_t>();
+    Pref.putUChar(CFG_ALERT_HIGH_TEMP, Cfg.alertHighTemp);
+  }
+  if (src["alertCurrentRate"].is<int>()) {
+    Cfg.alertCurrentRate = src["alertCurrentRate"].as<uint8_t>();
+    Pref.putUChar(CFG_ALERT_CURRENT_RATE, Cfg.alertCurrentRate);
+  }
+  if (src["alertHold"].is<int>()) {
+    Cfg.alertHold = src["alertHold"].as<uint8_t>();
+    Pref.putUChar(CFG_ALERT_HOLD, Cfg.alertHold);
+  }
+}
+
+// Static IP settings, shared by /api/settings/wifi and /all. Caller has
+// Pref open.
+void saveStaticIP(JsonVariantConst src) {
+  if (src["wifiStaticIP"].is<const char *>()) {
+    strlcpy(Cfg.wifiStaticIP, src["wifiStaticIP"].as<const char *>(), sizeof(Cfg.wifiStaticIP));
+    Pref.putString(CFG_WIFI_STATIC_IP, Cfg.wifiStaticIP);
+  }
+  if (src["wifiGateway"].is<const char *>()) {
+    strlcpy(Cfg.wifiGateway, src["wifiGateway"].as<const char *>(), sizeof(Cfg.wifiGateway));
+    Pref.putString(CFG_WIFI_GATEWAY, Cfg.wifiGateway);
+  }
+  if (src["wifiSubnet"].is<const char *>()) {
+    strlcpy(Cfg.wifiSubnet, src["wifiSubnet"].as<const char *>(), sizeof(Cfg.wifiSubnet));
+    Pref.putString(CFG_WIFI_SUBNET, Cfg.wifiSubnet);
+  }
+  if (src["wifiDNS"].is<const char *>()) {
+    strlcpy(Cfg.wifiDNS, src["wifiDNS"].as<const char *>(), sizeof(Cfg.wifiDNS));
+    Pref.putString(CFG_WIFI_DNS, Cfg.wifiDNS);
+  }
+}
+
+// Active alerts by label, for /api/data and the websocket
+void addActiveAlerts(JsonDocument &doc) {
+  JsonArray alerts = doc["alerts"].to<JsonArray>();
+  uint32_t active = Alerts::getActive() & Alerts::ALERT_RULES;
+  for (uint8_t i = 0; i < Alerts::RULE_COUNT; i++) {
+    if (active & 1UL << i) {
+      alerts.add(Alerts::ruleLabel((Alerts::Rule)i));
+    }
+  }
+}
+
+// Home Assistant publish settings, shared by /api/settings/mqtt and /all.
+// Caller has Pref open.
+void saveHassPublishing(JsonVariantConst src) {
+  if (src["hassMinInterval"].is<int>()) {
+    Cfg.hassMinInterval = src["hassMinInterval"].as<uint16_t>();
+    Pref.putUShort(CFG_HASS_MIN_INTERVAL, Cfg.hassMinInterval);
+  }
+  if (src["hassHeartbeat"].is<int>()) {
+    uint16_t heartbeat = src["hassHeartbeat"].as<uint16_t>();
+    Cfg.hassHeartbeat = heartbeat < HASS_HEARTBEAT_MIN ? HASS_HEARTBEAT_MIN : heartbeat;
+    Pref.putUShort(CFG_HASS_HEARTBEAT, Cfg.hassHeartbeat);
+  }
+  if (src["hassDbVoltage"].is<float>()) {
+    Cfg.hassDbVoltage = src["hassDbVoltage"].as<float>();
+    Pref.putFloat(CFG_HASS_DB_VOLTAGE, Cfg.hassDbVoltage);
+  }
+  if (src["hassDbCurrent"].is<float>()) {
+    Cfg.hassDbCurrent = src["hassDbCurrent"].as<float>();
+    Pref.putFloat(CFG_HASS_DB_CURRENT, Cfg.hassDbCurrent);
+  }
+  if (src["hassDbTemperature"].is<float>()) {
+    Cfg.hassDbTemperature = src["hassDbTemperature"].as<float>();
+    Pref.putFloat(CFG_HASS_DB_TEMPERATURE, Cfg.hassDbTemperature);
+  }
+  if (src["hassDbCharge"].is<int>()) {
+    Cfg.hassDbCharge = src["hassDbCharge"].as<uint8_t>();
+    Pref.putUChar(CFG_HASS_DB_CHARGE, Cfg.hassDbCharge);
+  }
+  if (src["hassBufferKb"].is<int>()) {
+    Cfg.hassBufferKb = src["hassBufferKb"].as<uint16_t>();
+    Pref.putUShort(CFG_HASS_BUFFER_KB, Cfg.hassBufferKb);
+  }
+  if (src["hassBufferInterval"].is<int>()) {
+    Cfg.hassBufferInterval = src["hassBufferInterval"].as<uint16_t>();
+    Pref.putUShort(CFG_HASS_BUFFER_INTERVAL, Cfg.hassBufferInterval);
+  }
+  if (src["hassAggregate"].is<int>()) {
+    Cfg.hassAggregate = src["hassAggregate"].as<uint16_t>();
+    Pref.putUShort(CFG_HASS_AGGREGATE, Cfg.hassAggregate);
+  }
+  if (src["hassJsonState"].is<bool>()) {
+    Cfg.hassJsonState = src["hassJsonState"].as<bool>();
+    Pref.putBool(CFG_HASS_JSON_STATE, Cfg.hassJsonState);
+  }
+}
+
 // Initialize web server
 void begin() {
   Serial.println("[WEB] Initializing async web server...");
@@ -63,10 +180,175 @@ void begin() {
         WebSerial.println("  IP: " + String(runtime.cachedIP));
         WebSerial.println("  Signal: " + String(runtime.wifiRSSI) + " dBm");
       }
+      WiFiMgr::Stats wifi = WiFiMgr::getStats();
+      if (wifi.supervising) {
+        WebSerial.printf("  Channel %u, BSSID %02X:%02X:%02X:%02X:%02X:%02X, %s\n", wifi.channel,
+                         wifi.bssid[0], wifi.bssid[1], wifi.bssid[2], wifi.bssid[3],
+                         wifi.bssid[4], wifi.bssid[5], wifi.staticIP ? "static IP" : "DHCP");
+        WebSerial.printf("  %lu disconnects (last reason %u), %lu reconnects (%lu fast) in %lu "
+                         "attempts, %lu ms last, %lu max\n",
+                         wifi.disconnects, wifi.lastReason, wifi.reconnects, wifi.fastReconnects,
+                         wifi.attempts, wifi.lastReconnectMs, wifi.maxReconnectMs);
+        int8_t rssi[WiFiMgr::RSSI_HISTORY];
+        uint8_t count = WiFiMgr::getRssiHistory(rssi, WiFiMgr::RSSI_HISTORY);
+        if (count) {
+          String line = "  RSSI history:";
+          for (uint8_t i = 0; i < count; i++) {
+            line += " " + String(rssi[i]);
+          }
+          WebSerial.println(line);
+        }
+      }
       WebSerial.println(String("CAN: ") + (CAN::isInitialized() ? "OK" : "ERROR - Module not detected"));
       WebSerial.println("Uptime: " + String(millis() / 1000) + " seconds");
-      WebSerial.println("Free Heap: " + String(ESP.getFreeHeap() / 1024) + " KB");
+      WebSerial.print("Boot:");
+      for (uint8_t i = 0; i < Boot::PHASE_COUNT; i++) {
+        Boot::Phase phase = (Boot::Phase)i;
+        if (Boot::reached(phase)) {
+          WebSerial.printf(" %s %lu ms", Boot::phaseName(phase), Boot::at(phase));
+        }
+      }
+      WebSerial.println();
+      WebSerial.printf("Free Heap: %lu KB, largest block %lu KB, lowest %lu KB\n",
+                       ESP.getFreeHeap() / 1024, ESP.getMaxAllocHeap() / 1024,
+                       ESP.getMinFreeHeap() / 1024);
+      Alerts::Stats alertStats = Alerts::getStats();
+      WebSerial.printf("Alerts: active mask 0x%02lx, %lu events from %lu frames\n",
+                       alertStats.active, alertStats.events, alertStats.evaluations);
+      LCD::Stats lcdStats = LCD::getStats();
+      static const char *LCD_POWER[] = {"on", "dimmed", "off"};
+      WebSerial.printf("LCD: %s, %lu wakeups, %lu frames, %lu updated, %lu tiles sent, "
+                       "I2C %lu us last, %lu avg, %lu max\n",
+                       LCD_POWER[lcdStats.power], lcdStats.wakeups, lcdStats.frames,
+                       lcdStats.updated, lcdStats.tiles, lcdStats.busUsLast, lcdStats.busUsAvg,
+                       lcdStats.busUsMax);
+      Sched::Stats sched = Sched::getStats();
+      if (sched.running) {
+        WebSerial.printf("Event loop: %u jobs, %ld B of stack saved, %lu B never used, "
+                         "%lu wakeups (%lu notified)\n",
+                         sched.jobs, sched.stackSaved, sched.stackFreeMin, sched.wakeups,
+                         sched.notifications);
+        Sched::Job job;
+        for (uint8_t i = 0; Sched::getJob(i, &job); i++) {
+          WebSerial.printf("  %s: %lu runs, latency %lu us last, %lu max, run %lu us last, "
+                           "%lu max\n",
+                           job.name, job.runs, job.latencyUsLast, job.latencyUsMax, job.runUsLast,
+                           job.runUsMax);
+        }
+      }
+      Telemetry::Stats busStats = Telemetry::getStats();
+      WebSerial.printf("Telemetry: version %lu, %u subscribers\n", busStats.version,
+                       busStats.subscribers);
+      Telemetry::Subscriber sub;
+      for (uint8_t i = 0; Telemetry::getSubscriber(i, &sub); i++) {
+        WebSerial.printf("  %s: mask 0x%02lx, every %lu ms, %lu delivered, %lu merged\n",
+                         sub.name, sub.mask, sub.intervalMs, sub.delivered, sub.merged);
+      }
+      Logger::Stats logStats = Logger::getStats();
+      WebSerial.printf("Log ring: %lu queued, %lu dropped, peak %lu/%lu, %lu deferred\n",
+                       logStats.queued, logStats.dropped, logStats.highWater, logStats.capacity,
+                       logStats.deferred);
+      if (Cfg.tgEnabled) {
+        TG::Stats tg = TG::getStats();
+        WebSerial.printf("Telegram: %lu sent, %lu queued, %lu coalesced, %lu dropped, %lu failed\n",
+                         tg.sent, tg.queued, tg.coalesced, tg.dropped, tg.failed);
+        WebSerial.printf("  Delivery latency avg %lu ms, max %lu ms; longest %lu/%lu bytes, "
+                         "%lu truncated\n",
+                         tg.latencyAvgMs, tg.latencyMaxMs, tg.longest, tg.capacity, tg.truncated);
+      }
+      if (Cfg.mqttEnabled) {
+        HASS::Stats hass = HASS::getStats();
+        WebSerial.printf("MQTT: %s, %lu connects, %lu failed attempts, reconnect %lu ms (max %lu)\n",
+                         HASS::stateToString(hass.state), hass.connects, hass.failedAttempts,
+                         hass.lastReconnectMs, hass.maxReconnectMs);
+        WebSerial.printf("  %lu values published in %lu messages%s, %lu suppressed by deadband/interval\n",
+                         hass.published, hass.messages, Cfg.hassJsonState ? " (JSON state)" : "",
+                         hass.suppressed);
+        WebSerial.printf("  Discovery: %lu full, %lu skipped (broker had it)\n",
+                         hass.discoverySent, hass.discoverySkipped);
+        Backlog::Stats backlog = Backlog::getStats();
+        WebSerial.printf("  Offline buffer: %lu/%lu samples, %lu taken, %lu sent, %lu dropped\n",
+                         backlog.stored, backlog.capacity, backlog.taken, backlog.sent,
+                         backlog.dropped);
+        MqttClient::Stats client = MqttClient::getStats();
+        WebSerial.printf("  Queue %lu/%lu bytes (peak %lu), %u in flight, %lu sent, %lu acked, "
+                         "%lu resent, %lu dropped, PUBACK avg %lu us (max %lu)\n",
+                         client.queued, client.capacity, client.peakQueued, client.inflight,
+                         client.published, client.acked, client.retransmits, client.dropped,
+                         client.ackLatencyAvgUs, client.ackLatencyMaxUs);
+      }
+      if (Cfg.syslogEnabled) {
+        SyslogSink::Stats sys = SyslogSink::getStats();
+        WebSerial.printf("Syslog %s:%u: %lu sent in %lu datagrams (%lu batched), %lu dropped\n",
+                         Cfg.syslogServer, Cfg.syslogPort, sys.sent, sys.datagrams,
+                         sys.batched, sys.dropped);
+      }
       WebSerial.println("========================================\n");
+    } else if (msg == "logbench") {
+      uint32_t textNs, deferredNs;
+      Logger::benchmark(&textNs, &deferredNs);
+      WebSerial.printf("Logger::debug: %lu ns/call, deferred record: %lu ns/call\n",
+                       textNs, deferredNs);
+    } else if (msg == "mqttbench" || msg.startsWith("mqttbench ")) {
+      // mqttbench [count] [window]
+      int count = 200;
+      int window = 0;
+      sscanf(msg.c_str() + 9, "%d %d", &count, &window);
+      if (!Cfg.mqttEnabled || HASS::getStats().state != HASS::STATE_ONLINE) {
+        WebSerial.println("MQTT is not connected");
+      } else if (count < 1 || count > 10000 || window < 0 || window > 8) {
+        WebSerial.println("Usage: mqttbench [count 1-10000] [window 1-8]");
+      } else {
+        HASS::benchmark(count, window);
+        WebSerial.printf("Publishing %d messages, result follows in the log\n", count);
+      }
+    } else if (msg == "chartbench" || msg.startsWith("chartbench ")) {
+      // chartbench [hours]
+      int hours = Chart::MAX_HOURS;
+      sscanf(msg.c_str() + 10, "%d", &hours);
+      Chart::Renderer *chart = new (std::nothrow) Chart::Renderer;
+      if (!chart) {
+        WebSerial.println("Out of memory");
+        return;
+      }
+      uint8_t buf[512];
+      size_t total = 0;
+      size_t n;
+      uint32_t startUs = micros();
+      Chart::begin(*chart, hours);
+      uint32_t sampledUs = micros();
+      while ((n = Chart::read(*chart, buf, sizeof(buf))) > 0) {
+        total += n;
+      }
+      uint32_t doneUs = micros();
+      WebSerial.printf("Chart %u h: sampled in %lu us, %u byte PNG encoded in %lu us, "
+                       "%u bytes of state\n",
+                       chart->hours, sampledUs - startUs, total, doneUs - sampledUs,
+                       sizeof(Chart::Renderer));
+      delete chart;
+    } else if (msg == "loglevel" || msg.startsWith("loglevel ")) {
+      // loglevel | loglevel <level> | loglevel <TAG> <level|global>
+      String args = msg.substring(8);
+      args.trim();
+      int space = args.indexOf(' ');
+      String tag = space > 0 ? args.substring(0, space) : "";
+      String value = space > 0 ? args.substring(space + 1) : args;
+      value.trim();
+      Logger::Level level;
+      if (value.isEmpty()) {
+        // Just list
+      } else if (!tag.isEmpty() && value == "global") {
+        if (!Logger::clearTagLevel(tag.c_str())) {
+          WebSerial.println("Unknown tag: " + tag);
+        }
+      } else if (!Logger::parseLevel(value.c_str(), &level)) {
+        WebSerial.println("Unknown level: " + value + " (error, warn, notice, info, debug or 0-7)");
+      } else if (tag.isEmpty()) {
+        Logger::setLevel(level);
+      } else if (!Logger::setTagLevel(tag.c_str(), level)) {
+        WebSerial.println("Tag table full");
+      }
+      Logger::printLevels(WebSerial);
     } else if (msg == "help") {
       WebSerial.println("\n========================================");
       WebSerial.println("   ESS Monitor - WebSerial Console");
@@ -77,6 +359,10 @@ void begin() {
       WebSerial.println("Available commands:");
       WebSerial.println("  status - Show detailed system status");
       WebSerial.println("  info   - Same as status");
+      WebSerial.println("  logbench - Time a log call, formatted vs deferred");
+      WebSerial.println("  chartbench [hours] - Time rendering the history chart");
+      WebSerial.println("  loglevel [TAG] [level|global] - Show or set log levels");
+      WebSerial.println("  mqttbench [count] [window] - Time QoS 1 publishes to the broker");
       WebSerial.println("  help   - Show this help message");
       WebSerial.println("----------------------------------------");
       WebSerial.println("All system logs appear here in real-time.");
@@ -140,9 +426,27 @@ void begin() {
   server.on("/ota_update", HTTP_POST,
     [](AsyncWebServerRequest *request) {
       // Final response after upload completes
-      bool updateSuccessful = !Update.hasError();
-      AsyncWebServerResponse *response = request->beginResponse(200, "text/plain",
-        updateSuccessful ? "Update Success! Rebooting..." : "Update Failed!");
+      if (request != otaUpload) {
+        AsyncWebServerResponse *response =
+            request->beginResponse(409, "text/plain", "Busy: another update is running");
+        response->addHeader("Connection", "close");
+        request->send(response);
+        return;
+      }
+      otaUpload = nullptr;
+
+      bool updateSuccessful = !OtaStream::isRunning() && !OtaStream::hasError();
+      char msg[192];
+      if (updateSuccessful) {
+        char summary[160];
+        OtaStream::formatSummary(summary, sizeof(summary));
+        snprintf(msg, sizeof(msg), "Update Success! %s. Rebooting...", summary);
+      } else {
+        snprintf(msg, sizeof(msg), "Update Failed! %s", OtaStream::errorString());
+      }
+      // 409 tells the page that a delta does not fit the running firmware
+      int code = updateSuccessful ? 200 : (OtaStream::isBaseMismatch() ? 409 : 500);
+      AsyncWebServerResponse *response = request->beginResponse(code, "text/plain", msg);
       response->addHeader("Connection", "close");
       request->send(response);
 
@@ -151,59 +455,141 @@ void begin() {
         delay(1000);
         ESP.restart();
       } else {
-        Serial.printf("[WEB] OTA Update failed, error: %s\n", Update.errorString());
+        OtaStream::abort();
+        Serial.printf("[WEB] OTA Update failed, error: %s\n", OtaStream::errorString());
       }
     },
     [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
-      // Upload handler - called multiple times with chunks of data
+      // Upload handler - called multiple times with chunks of data.
+      // Accepts firmware.bin, firmware.patch (delta) or either gzipped; the required "manifest" form
+      // field (sent before the file) carries the expected size and SHA-256.
       if (index == 0) {
-        Serial.printf("[WEB] OTA Update started: %s\n", filename.c_str());
-        if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
-          Update.printError(Serial);
+        if (otaUpload || OtaPull::isRunning() || OtaStream::isRunning()) {
+          Serial.printf("[WEB] OTA upload %s rejected, another update is running\n", filename.c_str());
+          return;
         }
+        Serial.printf("[WEB] OTA Update started: %s\n", filename.c_str());
+        otaUpload = request;
+        // A dropped upload frees OtaStream for the next one
+        request->onDisconnect([request]() {
+          if (otaUpload == request) {
+            otaUpload = nullptr;
+            OtaStream::abort();
+          }
+        });
+        const AsyncWebParameter *manifest = request->getParam("manifest", true);
+        OtaStream::begin(manifest ? manifest->value().c_str() : nullptr);
+      }
+      if (request != otaUpload) {
+        return;
       }
 
-      if (len) {
-        if (Update.write(data, len) != len) {
-          Update.printError(Serial);
-        } else {
-          // Progress reporting
-          static size_t lastPercent = 0;
-          size_t percent = (Update.progress() * 100) / Update.size();
-          if (percent != lastPercent && percent % 10 == 0) {
-            Serial.printf("[WEB] OTA Progress: %d%%\n", percent);
-            lastPercent = percent;
-          }
+      if (len && OtaStream::isRunning() && OtaStream::write(data, len)) {
+        // Progress reporting (input bytes, total is known for multipart uploads)
+        static size_t lastPercent = 0;
+        size_t total = request->contentLength();
+        size_t percent = total ? ((index + len) * 100) / total : 0;
+        if (percent != lastPercent && percent % 10 == 0) {
+          Serial.printf("[WEB] OTA Progress: %d%%\n", percent);
+          lastPercent = percent;
         }
       }
 
-      if (final) {
-        if (Update.end(true)) {
-          Serial.printf("[WEB] OTA Update Success: %u bytes\n", index + len);
-        } else {
-          Update.printError(Serial);
+      if (final && OtaStream::isRunning()) {
+        if (OtaStream::end()) {
+          Serial.printf("[WEB] OTA Update Success: %u bytes received\n", index + len);
         }
       }
     }
   );
 
+  // API: Pull update status
+  server.on("/api/ota/pull", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    OtaPull::Status status = OtaPull::getStatus();
+
+    doc["state"] = OtaPull::stateToString(status.state);
+    doc["url"] = status.url;
+    doc["received"] = status.received;
+    doc["total"] = status.total;
+    doc["resumes"] = status.resumes;
+    doc["elapsedMs"] = status.elapsedMs;
+    doc["error"] = status.error;
+
+    String json;
+    serializeJson(doc, json);
+    request->send(200, "application/json", json);
+  });
+
+  // API: Start a pull update ({"url": "..."}; saved as the new default)
+  server.on("/api/ota/pull", HTTP_POST, [](AsyncWebServerRequest *request){}, NULL,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      JsonDocument doc;
+      DeserializationError error = deserializeJson(doc, data, len);
+
+      if (error) {
+        request->send(400, "application/json", "{\"success\":false,\"error\":\"Invalid JSON\"}");
+        return;
+      }
+
+      if (doc["url"].is<const char*>() && strcmp(doc["url"].as<const char*>(), Cfg.otaUrl) != 0) {
+        strlcpy(Cfg.otaUrl, doc["url"].as<const char*>(), sizeof(Cfg.otaUrl));
+        Pref.begin("ess");
+        Pref.putString(CFG_OTA_URL, Cfg.otaUrl);
+        Pref.end();
+      }
+
+      if (!OtaPull::start(Cfg.otaUrl)) {
+        request->send(409, "application/json", "{\"success\":false,\"error\":\"Update already running or no URL\"}");
+        return;
+      }
+      request->send(200, "application/json", "{\"success\":true}");
+    });
+
   // API: Get all settings
   server.on("/api/settings", HTTP_GET, [](AsyncWebServerRequest *request) {
     JsonDocument doc;
 
     doc["wifiSTA"] = Cfg.wifiSTA;
     doc["wifiSSID"] = Cfg.wifiSSID;
+    doc["wifiStaticIP"] = Cfg.wifiStaticIP;
+    doc["wifiGateway"] = Cfg.wifiGateway;
+    doc["wifiSubnet"] = Cfg.wifiSubnet;
+    doc["wifiDNS"] = Cfg.wifiDNS;
     doc["tgEnabled"] = Cfg.tgEnabled;
     doc["tgBotToken"] = Cfg.tgBotToken;
     doc["tgChatID"] = Cfg.tgChatID;
     doc["tgThreshold"] = Cfg.tgCurrentThreshold;
+    doc["alertLowCharge"] = Cfg.alertLowCharge;
+    doc["alertHighTemp"] = Cfg.alertHighTemp;
+    doc["alertCurrentRate"] = Cfg.alertCurrentRate;
+    doc["alertHold"] = Cfg.alertHold;
     doc["mqttEnabled"] = Cfg.mqttEnabled;
     doc["mqttBroker"] = Cfg.mqttBrokerIp;
     doc["mqttPort"] = Cfg.mqttPort;
     doc["mqttUser"] = Cfg.mqttUsername;
+    doc["hassMinInterval"] = Cfg.hassMinInterval;
+    doc["hassHeartbeat"] = Cfg.hassHeartbeat;
+    doc["hassDbVoltage"] = Cfg.hassDbVoltage;
+    doc["hassDbCurrent"] = Cfg.hassDbCurrent;
+    doc["hassDbTemperature"] = Cfg.hassDbTemperature;
+    doc["hassDbCharge"] = Cfg.hassDbCharge;
+    doc["hassJsonState"] = Cfg.hassJsonState;
+    doc["hassBufferKb"] = Cfg.hassBufferKb;
+    doc["hassBufferInterval"] = Cfg.hassBufferInterval;
+    doc["hassAggregate"] = Cfg.hassAggregate;
     doc["canKeepAlive"] = Cfg.canKeepAliveInterval;
+    doc["lcdDim"] = Cfg.lcdDimTimeout;
+    doc["lcdOff"] = Cfg.lcdOffTimeout;
     doc["wdEnabled"] = Cfg.watchdogEnabled;
     doc["wdTimeout"] = Cfg.watchdogTimeout;
+    doc["eventLoop"] = Cfg.eventLoop;
+    doc["otaUrl"] = Cfg.otaUrl;
+    doc["syslogEnabled"] = Cfg.syslogEnabled;
+    doc["syslogServer"] = Cfg.syslogServer;
+    doc["syslogPort"] = Cfg.syslogPort;
+    doc["syslogLevel"] = Cfg.syslogLevel;
+    doc["syslogBatch"] = Cfg.syslogBatch;
 
     String json;
     serializeJson(doc, json);
@@ -234,6 +620,7 @@ void begin() {
         strlcpy(Cfg.wifiPass, doc["wifiPass"].as<const char*>(), sizeof(Cfg.wifiPass));
         Pref.putString(CFG_WIFI_PASS, Cfg.wifiPass);
       }
+      saveStaticIP(doc.as<JsonVariantConst>());
       Pref.end();
 
       request->send(200, "application/json", "{\"success\":true}");
@@ -268,6 +655,7 @@ void begin() {
         Cfg.tgCurrentThreshold = doc["tgThreshold"].as<uint8_t>();
         Pref.putUChar(CFG_TG_CURRENT_THRESHOLD, Cfg.tgCurrentThreshold);
       }
+      saveAlerts(doc.as<JsonVariantConst>());
       Pref.end();
 
       request->send(200, "application/json", "{\"success\":true}");
@@ -306,6 +694,7 @@ void begin() {
         strlcpy(Cfg.mqttPassword, doc["mqttPass"].as<const char*>(), sizeof(Cfg.mqttPassword));
         Pref.putString(CFG_MQQTT_PASSWORD, Cfg.mqttPassword);
       }
+      saveHassPublishing(doc.as<JsonVariantConst>());
       Pref.end();
 
       request->send(200, "application/json", "{\"success\":true}");
@@ -332,6 +721,10 @@ void begin() {
         Cfg.watchdogTimeout = doc["wdTimeout"].as<uint8_t>();
         Pref.putUChar(CFG_WATCHDOG_TIMEOUT, Cfg.watchdogTimeout);
       }
+      if (doc["eventLoop"].is<bool>()) {
+        Cfg.eventLoop = doc["eventLoop"].as<bool>();
+        Pref.putBool(CFG_EVENT_LOOP, Cfg.eventLoop);
+      }
       Pref.end();
 
       request->send(200, "application/json", "{\"success\":true}");
@@ -364,6 +757,7 @@ void begin() {
         strlcpy(Cfg.wifiPass, doc["wifi"]["wifiPass"].as<const char*>(), sizeof(Cfg.wifiPass));
         Pref.putString(CFG_WIFI_PASS, Cfg.wifiPass);
       }
+      saveStaticIP(doc["wifi"]);
 
       // Telegram settings
       if (doc["telegram"]["tgEnabled"].is<bool>()) {
@@ -382,6 +776,7 @@ void begin() {
         Cfg.tgCurrentThreshold = doc["telegram"]["tgThreshold"].as<uint8_t>();
         Pref.putUChar(CFG_TG_CURRENT_THRESHOLD, Cfg.tgCurrentThreshold);
       }
+      saveAlerts(doc["telegram"]);
 
       // MQTT settings
       if (doc["mqtt"]["mqttEnabled"].is<bool>()) {
@@ -404,6 +799,7 @@ void begin() {
         strlcpy(Cfg.mqttPassword, doc["mqtt"]["mqttPass"].as<const char*>(), sizeof(Cfg.mqttPassword));
         Pref.putString(CFG_MQQTT_PASSWORD, Cfg.mqttPassword);
       }
+      saveHassPublishing(doc["mqtt"]);
 
       // CAN settings
       if (doc["can"]["canKeepAlive"].is<int>()) {
@@ -411,6 +807,16 @@ void begin() {
         Pref.putUShort(CFG_CAN_KEEPALIVE_INTERVAL, Cfg.canKeepAliveInterval);
       }
 
+      // LCD settings
+      if (doc["lcd"]["lcdDim"].is<int>()) {
+        Cfg.lcdDimTimeout = doc["lcd"]["lcdDim"].as<uint16_t>();
+        Pref.putUShort(CFG_LCD_DIM_TIMEOUT, Cfg.lcdDimTimeout);
+      }
+      if (doc["lcd"]["lcdOff"].is<int>()) {
+        Cfg.lcdOffTimeout = doc["lcd"]["lcdOff"].as<uint16_t>();
+        Pref.putUShort(CFG_LCD_OFF_TIMEOUT, Cfg.lcdOffTimeout);
+      }
+
       // Watchdog settings
       if (doc["watchdog"]["wdEnabled"].is<bool>()) {
         Cfg.watchdogEnabled = doc["watchdog"]["wdEnabled"].as<bool>();
@@ -420,6 +826,32 @@ void begin() {
         Cfg.watchdogTimeout = doc["watchdog"]["wdTimeout"].as<uint8_t>();
         Pref.putUChar(CFG_WATCHDOG_TIMEOUT, Cfg.watchdogTimeout);
       }
+      if (doc["watchdog"]["eventLoop"].is<bool>()) {
+        Cfg.eventLoop = doc["watchdog"]["eventLoop"].as<bool>();
+        Pref.putBool(CFG_EVENT_LOOP, Cfg.eventLoop);
+      }
+
+      // Syslog settings
+      if (doc["syslog"]["syslogEnabled"].is<bool>()) {
+        Cfg.syslogEnabled = doc["syslog"]["syslogEnabled"].as<bool>();
+        Pref.putBool(CFG_SYSLOG_ENABLED, Cfg.syslogEnabled);
+      }
+      if (doc["syslog"]["syslogServer"].is<const char*>()) {
+        strlcpy(Cfg.syslogServer, doc["syslog"]["syslogServer"].as<const char*>(), sizeof(Cfg.syslogServer));
+        Pref.putString(CFG_SYSLOG_SERVER, Cfg.syslogServer);
+      }
+      if (doc["syslog"]["syslogPort"].is<int>()) {
+        Cfg.syslogPort = doc["syslog"]["syslogPort"].as<uint16_t>();
+        Pref.putUShort(CFG_SYSLOG_PORT, Cfg.syslogPort);
+      }
+      if (doc["syslog"]["syslogLevel"].is<int>()) {
+        Cfg.syslogLevel = doc["syslog"]["syslogLevel"].as<uint8_t>();
+        Pref.putUChar(CFG_SYSLOG_LEVEL, Cfg.syslogLevel);
+      }
+      if (doc["syslog"]["syslogBatch"].is<bool>()) {
+        Cfg.syslogBatch = doc["syslog"]["syslogBatch"].as<bool>();
+        Pref.putBool(CFG_SYSLOG_BATCH, Cfg.syslogBatch);
+      }
 
       Pref.end();
 
@@ -427,12 +859,107 @@ void begin() {
       needRestart = true;
     });
 
+  // API: Recent deferred log records, decode with tools/log_decode.py
+  server.on("/api/logdump", HTTP_GET, [](AsyncWebServerRequest *request) {
+    uint8_t *buf = (uint8_t *)malloc(Logger::dumpSize());
+    if (!buf) {
+      request->send(500, "text/plain", "Out of memory");
+      return;
+    }
+    size_t len = Logger::dumpRecords(buf, Logger::dumpSize());
+    AsyncResponseStream *response = request->beginResponseStream("application/octet-stream");
+    response->addHeader("Content-Disposition", "attachment; filename=esslog.bin");
+    response->write(buf, len);
+    free(buf);
+    request->send(response);
+  });
+
+  // API: Trace of the boot before this one (survives panics and watchdog resets)
+  server.on("/api/crashlog", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncResponseStream *response = request->beginResponseStream("text/plain");
+    Trace::print(*response);
+    request->send(response);
+  });
+
+  // API: Boot timeline, ms since reset per phase, null when not reached
+  server.on("/api/boot", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    JsonObject phases = doc["phases"].to<JsonObject>();
+    for (uint8_t i = 0; i < Boot::PHASE_COUNT; i++) {
+      Boot::Phase phase = (Boot::Phase)i;
+      if (Boot::reached(phase)) {
+        phases[Boot::phaseName(phase)] = Boot::at(phase);
+      } else {
+        phases[Boot::phaseName(phase)] = nullptr;
+      }
+    }
+    doc["uptime"] = millis();
+
+    String json;
+    serializeJson(doc, json);
+    request->send(200, "application/json", json);
+  });
+
+  // API: WiFi supervisor, with the RSSI history oldest first
+  server.on("/api/wifi", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    WiFiMgr::Stats wifi = WiFiMgr::getStats();
+    char bssid[18];
+    snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X", wifi.bssid[0],
+             wifi.bssid[1], wifi.bssid[2], wifi.bssid[3], wifi.bssid[4], wifi.bssid[5]);
+    doc["supervising"] = wifi.supervising;
+    doc["connected"] = wifi.connected;
+    doc["bssid"] = bssid;
+    doc["channel"] = wifi.channel;
+    doc["staticIP"] = wifi.staticIP;
+    doc["disconnects"] = wifi.disconnects;
+    doc["lastReason"] = wifi.lastReason;
+    doc["reconnects"] = wifi.reconnects;
+    doc["fastReconnects"] = wifi.fastReconnects;
+    doc["attempts"] = wifi.attempts;
+    doc["lastReconnectMs"] = wifi.lastReconnectMs;
+    doc["maxReconnectMs"] = wifi.maxReconnectMs;
+    doc["rssiIntervalMs"] = WiFiMgr::RSSI_INTERVAL_MS;
+    int8_t rssi[WiFiMgr::RSSI_HISTORY];
+    uint8_t count = WiFiMgr::getRssiHistory(rssi, WiFiMgr::RSSI_HISTORY);
+    JsonArray history = doc["rssi"].to<JsonArray>();
+    for (uint8_t i = 0; i < count; i++) {
+      history.add(rssi[i]);
+    }
+
+    String json;
+    serializeJson(doc, json);
+    request->send(200, "application/json", json);
+  });
+
   // API: Reboot
   server.on("/api/reboot", HTTP_POST, [](AsyncWebServerRequest *request) {
     request->send(200, "text/plain", "Rebooting...");
     needRestart = true;
   });
 
+  // API: History chart, the PNG Telegram's /history sends, produced while
+  // it is sent
+  server.on("/api/history.png", HTTP_GET, [](AsyncWebServerRequest *request) {
+    int hours = Chart::MAX_HOURS;
+    if (request->hasParam("hours")) {
+      hours = request->getParam("hours")->value().toInt();
+    }
+    if (ESP.getMaxAllocHeap() < sizeof(Chart::Renderer) + 4096) {
+      request->send(503, "text/plain", "Out of memory");
+      return;
+    }
+    // Freed with the response, also when the client goes away early
+    std::shared_ptr<Chart::Renderer> chart = std::make_shared<Chart::Renderer>();
+    Chart::begin(*chart, hours);
+    AsyncWebServerResponse *response = request->beginResponse(
+        "image/png", Chart::size(), [chart](uint8_t *buf, size_t maxLen, size_t index) {
+          return Chart::read(*chart, buf, maxLen);
+        });
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+  });
+
   // API: Live data
   server.on("/api/data", HTTP_GET, [](AsyncWebServerRequest *request) {
     JsonDocument doc;
@@ -444,6 +971,7 @@ void begin() {
     doc["current"] = ess.current;
     doc["temperature"] = ess.temperature;
     doc["canStatus"] = CAN::isInitialized() ? "OK" : "ERROR";
+    addActiveAlerts(doc);
     RuntimeStatus runtime = RuntimeCache::getSnapshot();
     doc["hostname"] = Cfg.hostname;
     doc["ip"] = runtime.cachedIP;
@@ -481,6 +1009,7 @@ void updateLiveData() {
   doc["current"] = ess.current;
   doc["temperature"] = ess.temperature;
   doc["canStatus"] = CAN::isInitialized() ? "OK" : "ERROR";
+  addActiveAlerts(doc);
   doc["hostname"] = Cfg.hostname;
 
   RuntimeStatus runtime = RuntimeCache::getSnapshot();
@@ -80,7 +80,8 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
     }
     .form-group input[type="text"],
     .form-group input[type="password"],
-    .form-group input[type="number"] {
+    .form-group input[type="number"],
+    .form-group select {
       width: 100%;
       padding: 10px;
       background: #0f0f0f;
@@ -202,6 +203,7 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
       <button onclick="showTab('mqtt')">MQTT</button>
       <button onclick="showTab('can')">CAN</button>
       <button onclick="showTab('watchdog')">Watchdog</button>
+      <button onclick="showTab('syslog')">Syslog</button>
       <button onclick="showTab('system')">System</button>
       <button onclick="window.open('/webserial', '_blank')">Console</button>
     </div>
@@ -233,6 +235,14 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
           <h3>CAN Status</h3>
           <div class="value" id="canStatus">--</div>
         </div>
+        <div class="card">
+          <h3>Alerts</h3>
+          <div class="value" id="alerts">--</div>
+        </div>
+      </div>
+      <div class="card">
+        <h3>Last 24 hours <small style="color: #888;">charge, current, voltage</small></h3>
+        <img src="/api/history.png" alt="History chart" loading="lazy" style="width: 100%; max-width: 640px; image-rendering: pixelated;">
       </div>
     </div>
 
@@ -258,6 +268,27 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
           </div>
         </div>
       </div>
+      <div class="card">
+        <h2>Static IP</h2>
+        <p style="margin-bottom:20px; color: #888;">Leave the address empty for DHCP. A static address skips DHCP on every reconnect.</p>
+        <div class="form-group">
+          <label>IP address:</label>
+          <input type="text" id="wifiStaticIP" maxlength="15" placeholder="192.168.0.50" oninput="markChanged()">
+        </div>
+        <div class="form-group">
+          <label>Gateway:</label>
+          <input type="text" id="wifiGateway" maxlength="15" placeholder="192.168.0.1" oninput="markChanged()">
+        </div>
+        <div class="form-group">
+          <label>Subnet mask:</label>
+          <input type="text" id="wifiSubnet" maxlength="15" value="255.255.255.0" oninput="markChanged()">
+        </div>
+        <div class="form-group">
+          <label>DNS:</label>
+          <input type="text" id="wifiDNS" maxlength="15" oninput="markChanged()">
+          <small>Empty: the gateway</small>
+        </div>
+      </div>
     </div>
 
     <!-- Telegram Settings Tab -->
@@ -289,6 +320,30 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
           <small>Alert if current exceeds this value</small>
         </div>
       </div>
+      <div class="card">
+        <h2>Alerts</h2>
+        <p style="margin-bottom:20px; color: #888;">Checked on every CAN frame and sent to Telegram, Home Assistant, this page and the LCD. 0 turns a rule off.</p>
+        <div class="form-group">
+          <label>Low charge (%):</label>
+          <input type="number" id="alertLowCharge" min="0" max="100" value="20" oninput="markChanged()">
+          <small>Cleared 2% above</small>
+        </div>
+        <div class="form-group">
+          <label>High temperature (°C):</label>
+          <input type="number" id="alertHighTemp" min="0" max="100" value="45" oninput="markChanged()">
+          <small>Cleared 2 °C below</small>
+        </div>
+        <div class="form-group">
+          <label>Current step (A/s):</label>
+          <input type="number" id="alertCurrentRate" min="0" max="255" value="0" oninput="markChanged()">
+          <small>Current changing faster than this, measured over one second</small>
+        </div>
+        <div class="form-group">
+          <label>Hold (seconds):</label>
+          <input type="number" id="alertHold" min="0" max="255" value="0" oninput="markChanged()">
+          <small>How long a threshold must stay crossed before an alert is raised or cleared. BMS codes are reported at once.</small>
+        </div>
+      </div>
     </div>
 
     <!-- MQTT Settings Tab -->
@@ -320,6 +375,42 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
             <button type="button" onclick="togglePassword('mqttPass')" style="position: absolute; right: 5px; top: 5px; padding: 5px 10px; background: #333; border: 1px solid #555; color: #e0e0e0; cursor: pointer; border-radius: 3px;">👁</button>
           </div>
         </div>
+        <h3 style="margin-top:20px;">Publishing</h3>
+        <p style="margin-bottom:20px; color: #888;">Values are sent only when they change by more than the deadband.</p>
+        <div class="form-group">
+          <label>Minimum interval (seconds):</label>
+          <input type="number" id="hassMinInterval" min="1" max="3600" value="5" oninput="markChanged()">
+        </div>
+        <div class="form-group">
+          <label>Heartbeat (seconds):</label>
+          <input type="number" id="hassHeartbeat" min="10" max="3600" value="300" oninput="markChanged()">
+          <small>Every value is sent at least this often, even if unchanged</small>
+        </div>
+        <div class="form-group">
+          <label>Deadband: voltage (V) / current (A) / temperature (°C) / charge (%):</label>
+          <input type="number" id="hassDbVoltage" min="0" step="0.01" value="0.1" oninput="markChanged()">
+          <input type="number" id="hassDbCurrent" min="0" step="0.1" value="0.5" oninput="markChanged()">
+          <input type="number" id="hassDbTemperature" min="0" step="0.1" value="0.5" oninput="markChanged()">
+          <input type="number" id="hassDbCharge" min="0" max="100" value="1" oninput="markChanged()">
+          <small>0 sends every change. Health, rated values and BMS codes are sent on any change.</small>
+        </div>
+        <div class="form-group">
+          <label>
+            <input type="checkbox" id="hassJsonState" onchange="markChanged()"> Single JSON state topic
+          </label>
+          <small>All values in one message per update instead of one message per sensor. Entities keep their IDs.</small>
+        </div>
+        <div class="form-group">
+          <label>Aggregate every (seconds):</label>
+          <input type="number" id="hassAggregate" min="0" max="3600" value="0" oninput="markChanged()">
+          <small>Voltage, current and temperature as mean/min/max over every CAN frame of the interval, one update per interval. Adds min/max sensors. 0 = send on change.</small>
+        </div>
+        <div class="form-group">
+          <label>Offline buffer (KB) / sample every (seconds):</label>
+          <input type="number" id="hassBufferKb" min="0" max="64" value="16" oninput="markChanged()">
+          <input type="number" id="hassBufferInterval" min="1" max="3600" value="10" oninput="markChanged()">
+          <small>Samples taken while the broker is unreachable are sent to the history topic after reconnecting (20 bytes each, oldest dropped when full). 0 KB disables.</small>
+        </div>
       </div>
     </div>
 
@@ -334,6 +425,19 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
           <small>How often to send keep-alive packets to battery (1000-10000ms). Default: 3000ms (3 seconds)</small>
         </div>
       </div>
+      <div class="card">
+        <h2>Display</h2>
+        <p style="margin-bottom:20px; color: #888;">The OLED is redrawn when battery data changes. Dimming and switching off save the panel from burn-in; an alert turns it back on and keeps it on while active.</p>
+        <div class="form-group">
+          <label>Dim after (seconds):</label>
+          <input type="number" id="lcdDim" min="0" max="65535" value="300" oninput="markChanged()">
+        </div>
+        <div class="form-group">
+          <label>Switch off after (seconds):</label>
+          <input type="number" id="lcdOff" min="0" max="65535" value="0" oninput="markChanged()">
+          <small>0 = never</small>
+        </div>
+      </div>
     </div>
 
     <!-- Watchdog Settings Tab -->
@@ -352,6 +456,53 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
           <small>Recommended: 60 seconds</small>
         </div>
       </div>
+      <div class="card">
+        <h2>Tasks</h2>
+        <p style="margin-bottom:20px; color: #888;">Runs the display and MQTT on one task instead of two, which frees about 20 KB of RAM. CAN and Telegram always have their own tasks.</p>
+        <div class="form-group">
+          <label>
+            <input type="checkbox" id="eventLoop" onchange="markChanged()"> Shared event loop
+          </label>
+          <small>Takes effect after restart. Per-job latency: "status" in the console</small>
+        </div>
+      </div>
+    </div>
+
+    <!-- Syslog Settings Tab -->
+    <div id="syslog" class="tab-content">
+      <div class="card">
+        <h2>Remote Syslog</h2>
+        <p style="margin-bottom:20px; color: #888;">Send log messages to a syslog server (RFC 5424 over UDP).</p>
+        <div class="form-group">
+          <label>
+            <input type="checkbox" id="syslogEnabled" onchange="markChanged()"> Enable Syslog
+          </label>
+        </div>
+        <div class="form-group">
+          <label>Server (IP or hostname):</label>
+          <input type="text" id="syslogServer" maxlength="63" oninput="markChanged()">
+        </div>
+        <div class="form-group">
+          <label>Port:</label>
+          <input type="number" id="syslogPort" min="1" max="65535" value="514" oninput="markChanged()">
+        </div>
+        <div class="form-group">
+          <label>Level:</label>
+          <select id="syslogLevel" onchange="markChanged()">
+            <option value="3">Error</option>
+            <option value="4">Warning</option>
+            <option value="5">Notice</option>
+            <option value="6" selected>Info</option>
+            <option value="7">Debug</option>
+          </select>
+        </div>
+        <div class="form-group">
+          <label>
+            <input type="checkbox" id="syslogBatch" onchange="markChanged()"> Batch messages
+          </label>
+          <small>Several messages per UDP packet, one per line. Only enable if your collector splits packets on newlines.</small>
+        </div>
+      </div>
     </div>
 
     <!-- System Tab -->
@@ -419,6 +570,10 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
         document.getElementById('canStatus').textContent = data.canStatus;
         document.getElementById('canStatus').className = data.canStatus === 'OK' ? 'value status-ok' : 'value status-error';
       }
+      if (data.alerts !== undefined) {
+        document.getElementById('alerts').textContent = data.alerts.length ? data.alerts.join(', ') : 'None';
+        document.getElementById('alerts').className = data.alerts.length ? 'value status-warning' : 'value status-ok';
+      }
 
       // System info
       if (data.hostname !== undefined) {
@@ -476,27 +631,57 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
         wifi: {
           wifiSTA: document.getElementById('wifiSTA').checked,
           wifiSSID: document.getElementById('wifiSSID').value,
-          wifiPass: document.getElementById('wifiPass').value
+          wifiPass: document.getElementById('wifiPass').value,
+          wifiStaticIP: document.getElementById('wifiStaticIP').value,
+          wifiGateway: document.getElementById('wifiGateway').value,
+          wifiSubnet: document.getElementById('wifiSubnet').value,
+          wifiDNS: document.getElementById('wifiDNS').value
         },
         telegram: {
           tgEnabled: document.getElementById('tgEnabled').checked,
           tgBotToken: document.getElementById('tgBotToken').value,
           tgChatID: document.getElementById('tgChatID').value,
-          tgThreshold: parseInt(document.getElementById('tgThreshold').value)
+          tgThreshold: parseInt(document.getElementById('tgThreshold').value),
+          alertLowCharge: parseInt(document.getElementById('alertLowCharge').value),
+          alertHighTemp: parseInt(document.getElementById('alertHighTemp').value),
+          alertCurrentRate: parseInt(document.getElementById('alertCurrentRate').value),
+          alertHold: parseInt(document.getElementById('alertHold').value)
         },
         mqtt: {
           mqttEnabled: document.getElementById('mqttEnabled').checked,
           mqttBroker: document.getElementById('mqttBroker').value,
           mqttPort: parseInt(document.getElementById('mqttPort').value),
           mqttUser: document.getElementById('mqttUser').value,
-          mqttPass: document.getElementById('mqttPass').value
+          mqttPass: document.getElementById('mqttPass').value,
+          hassMinInterval: parseInt(document.getElementById('hassMinInterval').value),
+          hassHeartbeat: parseInt(document.getElementById('hassHeartbeat').value),
+          hassDbVoltage: parseFloat(document.getElementById('hassDbVoltage').value),
+          hassDbCurrent: parseFloat(document.getElementById('hassDbCurrent').value),
+          hassDbTemperature: parseFloat(document.getElementById('hassDbTemperature').value),
+          hassDbCharge: parseInt(document.getElementById('hassDbCharge').value),
+          hassJsonState: document.getElementById('hassJsonState').checked,
+          hassBufferKb: parseInt(document.getElementById('hassBufferKb').value),
+          hassBufferInterval: parseInt(document.getElementById('hassBufferInterval').value),
+          hassAggregate: parseInt(document.getElementById('hassAggregate').value)
         },
         can: {
           canKeepAlive: parseInt(document.getElementById('canKeepAlive').value)
         },
+        lcd: {
+          lcdDim: parseInt(document.getElementById('lcdDim').value),
+          lcdOff: parseInt(document.getElementById('lcdOff').value)
+        },
         watchdog: {
           wdEnabled: document.getElementById('wdEnabled').checked,
-          wdTimeout: parseInt(document.getElementById('wdTimeout').value)
+          wdTimeout: parseInt(document.getElementById('wdTimeout').value),
+          eventLoop: document.getElementById('eventLoop').checked
+        },
+        syslog: {
+          syslogEnabled: document.getElementById('syslogEnabled').checked,
+          syslogServer: document.getElementById('syslogServer').value,
+          syslogPort: parseInt(document.getElementById('syslogPort').value),
+          syslogLevel: parseInt(document.getElementById('syslogLevel').value),
+          syslogBatch: document.getElementById('syslogBatch').checked
         }
       };
 
@@ -526,25 +711,46 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
           // WiFi
           if (data.wifiSTA !== undefined) document.getElementById('wifiSTA').checked = data.wifiSTA;
           if (data.wifiSSID !== undefined) document.getElementById('wifiSSID').value = data.wifiSSID;
+          if (data.wifiStaticIP !== undefined) document.getElementById('wifiStaticIP').value = data.wifiStaticIP;
+          if (data.wifiGateway !== undefined) document.getElementById('wifiGateway').value = data.wifiGateway;
+          if (data.wifiSubnet !== undefined) document.getElementById('wifiSubnet').value = data.wifiSubnet;
+          if (data.wifiDNS !== undefined) document.getElementById('wifiDNS').value = data.wifiDNS;
 
           // Telegram
           if (data.tgEnabled !== undefined) document.getElementById('tgEnabled').checked = data.tgEnabled;
           if (data.tgBotToken !== undefined) document.getElementById('tgBotToken').value = data.tgBotToken;
           if (data.tgChatID !== undefined) document.getElementById('tgChatID').value = data.tgChatID;
           if (data.tgThreshold !== undefined) document.getElementById('tgThreshold').value = data.tgThreshold;
+          ['alertLowCharge', 'alertHighTemp', 'alertCurrentRate', 'alertHold'].forEach(id => {
+            if (data[id] !== undefined) document.getElementById(id).value = data[id];
+          });
 
           // MQTT
           if (data.mqttEnabled !== undefined) document.getElementById('mqttEnabled').checked = data.mqttEnabled;
           if (data.mqttBroker !== undefined) document.getElementById('mqttBroker').value = data.mqttBroker;
           if (data.mqttPort !== undefined) document.getElementById('mqttPort').value = data.mqttPort;
           if (data.mqttUser !== undefined) document.getElementById('mqttUser').value = data.mqttUser;
+          ['hassMinInterval', 'hassHeartbeat', 'hassDbVoltage', 'hassDbCurrent', 'hassDbTemperature', 'hassDbCharge', 'hassBufferKb', 'hassBufferInterval', 'hassAggregate'].forEach(id => {
+            if (data[id] !== undefined) document.getElementById(id).value = data[id];
+          });
+          if (data.hassJsonState !== undefined) document.getElementById('hassJsonState').checked = data.hassJsonState;
 
           // CAN
           if (data.canKeepAlive !== undefined) document.getElementById('canKeepAlive').value = data.canKeepAlive;
+          if (data.lcdDim !== undefined) document.getElementById('lcdDim').value = data.lcdDim;
+          if (data.lcdOff !== undefined) document.getElementById('lcdOff').value = data.lcdOff;
 
           // Watchdog
           if (data.wdEnabled !== undefined) document.getElementById('wdEnabled').checked = data.wdEnabled;
           if (data.wdTimeout !== undefined) document.getElementById('wdTimeout').value = data.wdTimeout;
+          if (data.eventLoop !== undefined) document.getElementById('eventLoop').checked = data.eventLoop;
+
+          // Syslog
+          if (data.syslogEnabled !== undefined) document.getElementById('syslogEnabled').checked = data.syslogEnabled;
+          if (data.syslogServer !== undefined) document.getElementById('syslogServer').value = data.syslogServer;
+          if (data.syslogPort !== undefined) document.getElementById('syslogPort').value = data.syslogPort;
+          if (data.syslogLevel !== undefined) document.getElementById('syslogLevel').value = data.syslogLevel;
+          if (data.syslogBatch !== undefined) document.getElementById('syslogBatch').checked = data.syslogBatch;
         })
         .catch(err => console.error('Failed to load settings:', err));
     }
@@ -557,14 +763,22 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
         data = {
           wifiSTA: document.getElementById('wifiSTA').checked,
           wifiSSID: document.getElementById('wifiSSID').value,
-          wifiPass: document.getElementById('wifiPass').value
+          wifiPass: document.getElementById('wifiPass').value,
+          wifiStaticIP: document.getElementById('wifiStaticIP').value,
+          wifiGateway: document.getElementById('wifiGateway').value,
+          wifiSubnet: document.getElementById('wifiSubnet').value,
+          wifiDNS: document.getElementById('wifiDNS').value
         };
       } else if (section === 'telegram') {
         data = {
           tgEnabled: document.getElementById('tgEnabled').checked,
           tgBotToken: document.getElementById('tgBotToken').value,
           tgChatID: document.getElementById('tgChatID').value,
-          tgThreshold: parseInt(document.getElementById('tgThreshold').value)
+          tgThreshold: parseInt(document.getElementById('tgThreshold').value),
+          alertLowCharge: parseInt(document.getElementById('alertLowCharge').value),
+          alertHighTemp: parseInt(document.getElementById('alertHighTemp').value),
+          alertCurrentRate: parseInt(document.getElementById('alertCurrentRate').value),
+          alertHold: parseInt(document.getElementById('alertHold').value)
         };
       } else if (section === 'mqtt') {
         data = {
@@ -572,12 +786,23 @@ const char HTML_PAGE[] PROGMEM = R"rawliteral(
           mqttBroker: document.getElementById('mqttBroker').value,
           mqttPort: parseInt(document.getElementById('mqttPort').value),
           mqttUser: document.getElementById('mqttUser').value,
-          mqttPass: document.getElementById('mqttPass').value
+          mqttPass: document.getElementById('mqttPass').value,
+          hassMinInterval: parseInt(document.getElementById('hassMinInterval').value),
+          hassHeartbeat: parseInt(document.getElementById('hassHeartbeat').value),
+          hassDbVoltage: parseFloat(document.getElementById('hassDbVoltage').value),
+          hassDbCurrent: parseFloat(document.getElementById('hassDbCurrent').value),
+          hassDbTemperature: parseFloat(document.getElementById('hassDbTemperature').value),
+          hassDbCharge: parseInt(document.getElementById('hassDbCharge').value),
+          hassJsonState: document.getElementById('hassJsonState').checked,
+          hassBufferKb: parseInt(document.getElementById('hassBufferKb').value),
+          hassBufferInterval: parseInt(document.getElementById('hassBufferInterval').value),
+          hassAggregate: parseInt(document.getElementById('hassAggregate').value)
         };
       } else if (section === 'watchdog') {
         data = {
           wdEnabled: document.getElementById('wdEnabled').checked,
-          wdTimeout: parseInt(document.getElementById('wdTimeout').value)
+          wdTimeout: parseInt(document.getElementById('wdTimeout').value),
+          eventLoop: document.getElementById('eventLoop').checked
         };
       }
 
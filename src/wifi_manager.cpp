@@ -1,4 +1,6 @@
 #include "wifi_manager.h"
+#include "logger.h"
+#include "runtime_cache.h"
 #include "types.h"
 #include <ESPAsyncWiFiManager.h>
 #include <DNSServer.h>
@@ -14,6 +16,48 @@ AsyncWebServer configServer(80);  // Temporary server for WiFiManager only
 bool apMode = false;
 String apSSID = "";
 
+// Supervisor. The event handler runs in the WiFi event task, loop() in the
+// main loop; what both touch is under linkMux.
+const uint8_t FAST_ATTEMPTS = 2;          // On the cached BSSID, then with a scan
+const uint32_t BACKOFF_MIN_MS = 1000;
+const uint32_t BACKOFF_MAX_MS = 30000;
+const uint32_t ATTEMPT_TIMEOUT_MS = 15000; // No event at all: try again
+const uint32_t DHCP_WAIT_MS = 10000;       // IP lost but still associated
+
+portMUX_TYPE linkMux = portMUX_INITIALIZER_UNLOCKED;
+volatile bool supervising = false; // Set by net_boot, read by loop()
+char ssid[33] = "";
+char pass[65] = "";
+uint8_t bssid[6];
+uint8_t channel = 0;
+bool bssidValid = false;
+bool staticIP = false;
+volatile bool connected = false;
+uint32_t lostMs = 0;        // 0 while connected
+bool retryPending = false;
+uint32_t retryDueMs = 0;
+uint8_t retryCount = 0;     // Since the link was lost
+bool lastAttemptFast = false;
+bool dhcpWait = false;      // Associated without an IP address
+volatile uint32_t disconnectCount = 0;
+volatile uint32_t reconnectCount = 0;
+volatile uint32_t fastReconnectCount = 0;
+volatile uint32_t attemptCount = 0;
+volatile uint32_t lastReconnectMs = 0;
+volatile uint32_t maxReconnectMs = 0;
+volatile uint8_t lastReason = 0;
+
+int8_t rssiHistory[RSSI_HISTORY];
+uint8_t rssiNext = 0;
+uint8_t rssiStored = 0;
+uint32_t rssiMs = 0;
+
+void supervise();
+void onEvent(arduino_event_id_t event, arduino_event_info_t info);
+void scheduleRetry(uint32_t now, uint32_t delayMs);
+void reconnect(uint8_t attempt);
+bool applyStaticIP();
+
 bool begin() {
   Serial.println("\n[WiFi] Initializing WiFi Manager...");
 
@@ -32,6 +76,19 @@ bool begin() {
   // Custom AP name based on hostname
   apSSID = String(Cfg.hostname) + "-AP";
 
+  // Static address: no DHCP round trip on every (re)connect
+  staticIP = applyStaticIP();
+  if (staticIP) {
+    IPAddress ip, gateway, subnet, dns;
+    ip.fromString(Cfg.wifiStaticIP);
+    gateway.fromString(Cfg.wifiGateway);
+    subnet.fromString(Cfg.wifiSubnet);
+    if (!dns.fromString(Cfg.wifiDNS)) {
+      dns = gateway;
+    }
+    wifiManager.setSTAStaticIPConfig(ip, gateway, subnet, dns);
+  }
+
   Serial.printf("[WiFi] Starting WiFiManager with AP: %s\n", apSSID.c_str());
   Serial.println("[WiFi] If not connected, device will create Access Point");
   Serial.println("[WiFi] Connect to AP and navigate to 192.168.4.1 to configure");
@@ -68,6 +125,7 @@ bool begin() {
     // Give some time for cleanup
     delay(100);
 
+    supervise();
     return true;
   } else {
     apMode = true;
@@ -93,6 +151,224 @@ String getAPSSID() {
   return apSSID;
 }
 
+// Static IP settings, false (DHCP) when unset or not valid
+bool applyStaticIP() {
+  IPAddress ip, gateway, subnet;
+  if (!Cfg.wifiStaticIP[0]) {
+    return false;
+  }
+  if (!ip.fromString(Cfg.wifiStaticIP) || !gateway.fromString(Cfg.wifiGateway) ||
+      !subnet.fromString(Cfg.wifiSubnet)) {
+    LOG_W("WIFI", "Static IP %s/%s via %s is not valid, using DHCP", Cfg.wifiStaticIP,
+          Cfg.wifiSubnet, Cfg.wifiGateway);
+    return false;
+  }
+  return true;
+}
+
+void supervise() {
+  // What the portal or the stored config connected with
+  strlcpy(ssid, WiFi.SSID().c_str(), sizeof(ssid));
+  strlcpy(pass, WiFi.psk().c_str(), sizeof(pass));
+  uint8_t *current = WiFi.BSSID();
+  if (current) {
+    memcpy(bssid, current, sizeof(bssid));
+    bssidValid = true;
+  }
+  channel = WiFi.channel();
+  connected = true;
+
+  RuntimeCache::setConnected((uint32_t)WiFi.localIP(), ssid, WiFi.RSSI());
+
+  WiFi.setAutoReconnect(false); // Ours is faster and counts
+  WiFi.onEvent(onEvent);
+  supervising = true;
+  LOG_I("WIFI", "Supervising %s on channel %u%s", ssid, channel,
+        staticIP ? ", static IP" : "");
+}
+
+void onEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  uint32_t now = millis();
+  switch (event) {
+  case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+    // Also after roaming: the next fast reconnect goes here
+    portENTER_CRITICAL(&linkMux);
+    memcpy(bssid, info.wifi_sta_connected.bssid, sizeof(bssid));
+    channel = info.wifi_sta_connected.channel;
+    bssidValid = true;
+    portEXIT_CRITICAL(&linkMux);
+    break;
+
+  case ARDUINO_EVENT_WIFI_STA_GOT_IP: {
+    uint32_t took = 0;
+    bool fast = false;
+    portENTER_CRITICAL(&linkMux);
+    if (lostMs) {
+      took = now - lostMs;
+      fast = lastAttemptFast;
+      lostMs = 0;
+    }
+    connected = true;
+    retryPending = false;
+    dhcpWait = false;
+    retryCount = 0;
+    portEXIT_CRITICAL(&linkMux);
+
+    RuntimeCache::setConnected(info.got_ip.ip_info.ip.addr, ssid, WiFi.RSSI());
+    if (took) {
+      reconnectCount++;
+      if (fast) {
+        fastReconnectCount++;
+      }
+      lastReconnectMs = took;
+      if (took > maxReconnectMs) {
+        maxReconnectMs = took;
+      }
+      LOG_I("WIFI", "Reconnected in %lu ms%s", took, fast ? " (cached BSSID)" : "");
+    }
+    break;
+  }
+
+  case ARDUINO_EVENT_WIFI_STA_LOST_IP: {
+    // Still associated: give DHCP time to renew before a new association.
+    // A disconnect meanwhile reschedules as usual.
+    portENTER_CRITICAL(&linkMux);
+    bool wasConnected = connected;
+    if (wasConnected) {
+      lostMs = now;
+      connected = false;
+      dhcpWait = true;
+    }
+    portEXIT_CRITICAL(&linkMux);
+
+    if (wasConnected) {
+      disconnectCount++;
+      RuntimeCache::setDisconnected();
+      LOG_W("WIFI", "IP address lost, waiting %lu ms for DHCP", DHCP_WAIT_MS);
+      scheduleRetry(now, DHCP_WAIT_MS);
+    }
+    break;
+  }
+
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED: {
+    uint32_t delayMs;
+    portENTER_CRITICAL(&linkMux);
+    bool wasConnected = connected;
+    if (wasConnected) {
+      lostMs = now;
+      connected = false;
+    }
+    lastReason = info.wifi_sta_disconnected.reason;
+    dhcpWait = false;
+    // First retry right away, then doubling
+    delayMs = retryCount ? BACKOFF_MIN_MS << min(retryCount - 1, 5) : 0;
+    portEXIT_CRITICAL(&linkMux);
+
+    if (wasConnected) {
+      disconnectCount++;
+      RuntimeCache::setDisconnected();
+      LOG_W("WIFI", "Disconnected, reason %u", lastReason);
+    }
+    scheduleRetry(now, min(delayMs, BACKOFF_MAX_MS));
+    break;
+  }
+
+  default:
+    break;
+  }
+}
+
+void scheduleRetry(uint32_t now, uint32_t delayMs) {
+  portENTER_CRITICAL(&linkMux);
+  retryPending = true;
+  retryDueMs = now + delayMs;
+  portEXIT_CRITICAL(&linkMux);
+}
+
+// The first attempts skip the scan: straight to the last access point
+void reconnect(uint8_t attempt) {
+  attemptCount++;
+  lastAttemptFast = attempt < FAST_ATTEMPTS && bssidValid;
+  if (lastAttemptFast) {
+    WiFi.begin(ssid, pass, channel, bssid);
+  } else {
+    WiFi.begin(ssid, pass);
+  }
+}
+
+void loop(uint32_t now) {
+  if (!supervising) {
+    return;
+  }
+
+  bool due = false;
+  bool renew = false;
+  uint8_t attempt = 0;
+  portENTER_CRITICAL(&linkMux);
+  if (retryPending && !connected && (int32_t)(now - retryDueMs) >= 0) {
+    attempt = retryCount++;
+    renew = dhcpWait;
+    dhcpWait = false;
+    // A failed attempt reports a disconnect and reschedules with backoff;
+    // this covers the case where nothing at all is reported
+    retryDueMs = now + ATTEMPT_TIMEOUT_MS;
+    due = true;
+  }
+  portEXIT_CRITICAL(&linkMux);
+  if (due && renew) {
+    // DHCP did not renew: the same association again, which starts over
+    // with DHCP; WiFi.begin() would fail while still associated
+    attemptCount++;
+    lastAttemptFast = false;
+    WiFi.reconnect();
+  } else if (due) {
+    reconnect(attempt);
+  }
+
+  if (connected && now - rssiMs >= RSSI_INTERVAL_MS) {
+    rssiMs = now;
+    int32_t rssi = WiFi.RSSI();
+    RuntimeCache::setRSSI(rssi);
+    portENTER_CRITICAL(&linkMux);
+    rssiHistory[rssiNext] = (int8_t)rssi;
+    rssiNext = (rssiNext + 1) % RSSI_HISTORY;
+    if (rssiStored < RSSI_HISTORY) {
+      rssiStored++;
+    }
+    portEXIT_CRITICAL(&linkMux);
+  }
+}
+
+Stats getStats() {
+  Stats stats;
+  portENTER_CRITICAL(&linkMux);
+  stats.supervising = supervising;
+  stats.connected = connected;
+  stats.disconnects = disconnectCount;
+  stats.reconnects = reconnectCount;
+  stats.fastReconnects = fastReconnectCount;
+  stats.attempts = attemptCount;
+  stats.lastReconnectMs = lastReconnectMs;
+  stats.maxReconnectMs = maxReconnectMs;
+  stats.lastReason = lastReason;
+  stats.channel = channel;
+  memcpy(stats.bssid, bssid, sizeof(stats.bssid));
+  stats.staticIP = staticIP;
+  portEXIT_CRITICAL(&linkMux);
+  return stats;
+}
+
+uint8_t getRssiHistory(int8_t *out, uint8_t max) {
+  uint8_t count = 0;
+  portENTER_CRITICAL(&linkMux);
+  uint8_t first = (rssiNext + RSSI_HISTORY - rssiStored) % RSSI_HISTORY;
+  for (; count < rssiStored && count < max; count++) {
+    out[count] = rssiHistory[(first + count) % RSSI_HISTORY];
+  }
+  portEXIT_CRITICAL(&linkMux);
+  return count;
+}
+
 void reset() {
   Serial.println("[WiFi] Resetting WiFi settings...");
   WiFi.disconnect(true);
@@ -5,10 +5,40 @@
 
 namespace WiFiMgr {
 
+// After the first connect a supervisor takes over from the Arduino
+// auto-reconnect. It is driven by WiFi.onEvent, which also feeds
+// RuntimeCache, and retries the last access point by BSSID and channel
+// (no scan) before falling back to a full connect with backoff.
+
+const uint8_t RSSI_HISTORY = 30;
+const uint32_t RSSI_INTERVAL_MS = 10000; // 5 minutes of history
+
+typedef struct Stats {
+  bool supervising;
+  bool connected;
+  uint32_t disconnects;
+  uint32_t reconnects;
+  uint32_t fastReconnects;  // Made on the cached BSSID and channel
+  uint32_t attempts;        // Reconnect attempts started
+  uint32_t lastReconnectMs; // Disconnect to IP address
+  uint32_t maxReconnectMs;
+  uint8_t lastReason;       // wifi_err_reason_t of the last disconnect
+  uint8_t channel;
+  uint8_t bssid[6];
+  bool staticIP;
+} Stats;
+
 // Initialize WiFi with AsyncWiFiManager
 // Returns true if connected to WiFi, false if in AP mode
 bool begin();
 
+// Main loop: reconnect attempts when due, RSSI every RSSI_INTERVAL_MS
+void loop(uint32_t now);
+
+Stats getStats();
+// Oldest first, dBm; returns how many were written
+uint8_t getRssiHistory(int8_t *out, uint8_t max);
+
 // Check if WiFi is connected
 bool isConnected();
 
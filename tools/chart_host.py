@@ -0,0 +1,210 @@
+"""Host harness for the PNG history chart (src/chart.cpp).
+
+    python tools/chart_host.py            # render, check, compare
+    python tools/chart_host.py --update   # rewrite the reference image
+    python tools/chart_host.py out.png    # also keep the rendered PNG
+
+Builds src/chart.cpp with g++ against a History filled with a fixed day of
+samples (charge cycle, current swings, a gap with no data), renders the
+chart in several read sizes and checks that every size gives the same
+bytes, Chart::size() of them. The PNG must parse (chunk CRCs, zlib stream,
+320x240 4-bit palette) and equal tools/testdata/chart_24h.png. Prints the
+render time per image. Needs g++.
+"""
+
+import os
+import shutil
+import struct
+import sys
+import tempfile
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+
+REFERENCE = os.path.join(host_build.TESTDATA, "chart_24h.png")
+READS = (1, 13, 192, 1436, 1 << 16)
+TIMED = 200
+
+# History stand-in and the driver:
+#   driver <hours> <read size> <out>    writes the PNG
+#   driver <hours> time <count>         prints microseconds per PNG
+DRIVER = r"""
+#include "chart.h"
+#include "history.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static std::vector<History::Sample> samples;
+
+namespace History {
+void begin() {}
+void record(const EssStatus &) {}
+uint16_t count() { return samples.size(); }
+bool get(uint16_t index, Sample *sample) {
+  if (index >= samples.size()) return false;
+  *sample = samples[index];
+  return true;
+}
+}
+
+// A day at one sample a minute: solar charge by day, discharge by night,
+// noise on the current, 40 minutes without data in the afternoon
+static void fill() {
+  uint32_t seed = 1;
+  for (int i = 0; i < History::CAPACITY; i++) {
+    seed = seed * 1103515245 + 12345;
+    float hour = i / 60.0f;
+    float sun = sinf((hour - 6) * (float)M_PI / 12);
+    float current = sun > 0 ? 45 * sun : -12 - 4 * sinf(hour);
+    current += (int)((seed >> 16) % 40 - 20) / 10.0f;
+    History::Sample s;
+    s.current = (int16_t)lroundf(current * 10);
+    s.voltage = (uint16_t)lroundf((52.0f + current / 25 + hour / 24) * 100);
+    s.charge = (uint8_t)(hour < 6 ? 60 - hour * 4 : hour < 15 ? 36 + (hour - 6) * 7 : 99 - (hour - 15) * 5);
+    if (i >= 15 * 60 && i < 15 * 60 + 40) {
+      s.voltage = 0;
+      s.current = 0;
+      s.charge = History::NO_DATA;
+    }
+    samples.push_back(s);
+  }
+}
+
+static Chart::Renderer r;
+
+int main(int argc, char **argv) {
+  if (argc != 4) return 1;
+  fill();
+  uint8_t hours = atoi(argv[1]);
+  static uint8_t buf[1 << 16];
+  if (!strcmp(argv[2], "time")) {
+    int count = atoi(argv[3]);
+    auto started = std::chrono::steady_clock::now();
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+      Chart::begin(r, hours);
+      size_t n;
+      while ((n = Chart::read(r, buf, 1436)) > 0) total += n;
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+    printf("%.1f %zu\n", us / count, total / count);
+    return 0;
+  }
+  size_t chunk = strtoul(argv[2], nullptr, 10);
+  FILE *out = fopen(argv[3], "wb");
+  Chart::begin(r, hours);
+  size_t n, total = 0;
+  while ((n = Chart::read(r, buf, chunk)) > 0) {
+    fwrite(buf, 1, n, out);
+    total += n;
+  }
+  fclose(out);
+  if (total != Chart::size()) {
+    fprintf(stderr, "read %zu bytes, size() said %zu\n", total, Chart::size());
+    return 1;
+  }
+  return 0;
+}
+"""
+
+
+def check_png(data):
+    """Parses the PNG; returns None or what is wrong with it."""
+    if data[:8] != b"\x89PNG\r\n\x1a\n":
+        return "bad signature"
+    ofs, chunks, idat = 8, [], b""
+    while ofs < len(data):
+        if ofs + 12 > len(data):
+            return "truncated chunk at %d" % ofs
+        length, kind = struct.unpack(">I4s", data[ofs:ofs + 8])
+        body = data[ofs + 8:ofs + 8 + length]
+        crc, = struct.unpack(">I", data[ofs + 8 + length:ofs + 12 + length])
+        if zlib.crc32(kind + body) != crc:
+            return "bad CRC in %s at %d" % (kind.decode(), ofs)
+        chunks.append(kind)
+        if kind == b"IHDR":
+            ihdr = struct.unpack(">IIBBBBB", body)
+        elif kind == b"IDAT":
+            idat += body
+        ofs += 12 + length
+    if chunks[0] != b"IHDR" or chunks[1] != b"PLTE" or chunks[-1] != b"IEND":
+        return "chunk order %s" % [c.decode() for c in chunks]
+    if ihdr != (320, 240, 4, 3, 0, 0, 0):
+        return "IHDR %s" % (ihdr,)
+    try:
+        pixels = zlib.decompress(idat)
+    except zlib.error as e:
+        return "zlib: %s" % e
+    if len(pixels) != 240 * (1 + 160):
+        return "%d bytes of pixel data" % len(pixels)
+    if any(pixels[y * 161] != 0 for y in range(240)):
+        return "row filter other than none"
+    return None
+
+
+def main(argv):
+    update = "--update" in argv
+    args = [a for a in argv[1:] if a != "--update"]
+    if len(args) > 1:
+        sys.exit(__doc__)
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = host_build.build(workdir, ["chart.cpp"], {"driver.cpp": DRIVER})
+
+        rendered = []
+        for size in READS:
+            path = os.path.join(workdir, "chart%d.png" % size)
+            result, _ = host_build.run([exe, "24", str(size), path], text=True)
+            with open(path, "rb") as f:
+                rendered.append(f.read())
+            ok = result.returncode == 0 and rendered[-1] == rendered[0]
+            failures += not ok
+            print("read %6d: %s %d bytes %s" % (size, "OK " if ok else "FAIL",
+                                               len(rendered[-1]), result.stderr.strip()))
+        png = rendered[0]
+
+        problem = check_png(png)
+        failures += problem is not None
+        print("png:         %s %s" % ("FAIL" if problem else "OK ", problem or "320x240, 4-bit palette"))
+
+        for hours in (1, 6):
+            path = os.path.join(workdir, "chart_%dh.png" % hours)
+            result, _ = host_build.run([exe, str(hours), "1436", path], text=True)
+            with open(path, "rb") as f:
+                problem = result.stderr.strip() or check_png(f.read())
+            failures += bool(problem)
+            print("%2d hours:    %s %s" % (hours, "FAIL" if problem else "OK ", problem or ""))
+
+        if update:
+            os.makedirs(host_build.TESTDATA, exist_ok=True)
+            with open(REFERENCE, "wb") as f:
+                f.write(png)
+            print("reference:   written to %s" % os.path.relpath(REFERENCE, host_build.ROOT))
+        else:
+            try:
+                with open(REFERENCE, "rb") as f:
+                    same = f.read() == png
+            except FileNotFoundError:
+                same = False
+            failures += not same
+            print("reference:   %s" % ("OK " if same else "FAIL differs, see --update"))
+
+        if args:
+            shutil.copy(os.path.join(workdir, "chart%d.png" % READS[0]), args[0])
+
+        result, _ = host_build.run([exe, "24", "time", str(TIMED)], text=True)
+        us, size = result.stdout.split()
+        print("render:      %s us per %s byte PNG (host, -O2)" % (us, size))
+
+    print("%d failures" % failures)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
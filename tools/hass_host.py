@@ -0,0 +1,339 @@
+"""Host harness for the Home Assistant connection state machine (src/hass.cpp).
+
+    python tools/hass_host.py
+
+Builds src/hass.cpp (included by the driver, so its state is reachable)
+and src/mqtt_client.cpp with g++ against the stand-ins in host_build.py
+and the simulated network and fake broker of mqtt_broker_host.py (50 ms
+round trip). The driver runs the HASS task: step(), then sleep until the
+MQTT client notifies or STEP_MS runs out.
+
+Checks the reconnect backoff: starting at 2 s, doubling to 5 minutes, with
++-25% jitter. It is checked on every connect attempt while the broker
+refuses connections, and over many draws from scheduleRetry(). Also checks
+the reconnect-latency accounting in HASS::getStats() against the times the
+driver saw: the first connect after boot, an outage of 20 s and a dropped
+link the broker takes back at once. Needs g++.
+"""
+
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+import mqtt_broker_host  # noqa: E402
+
+STUBS = dict(mqtt_broker_host.STUBS)
+STUBS.update({
+    "esp_system.h": r"""
+#pragma once
+#include <cstdint>
+typedef enum { ESP_RST_UNKNOWN } esp_reset_reason_t;
+uint32_t esp_random();
+""",
+    "Preferences.h": r"""
+#pragma once
+#include <Arduino.h>
+#include <map>
+extern std::map<std::string, uint32_t> hostPreferences;
+class Preferences {
+public:
+  bool begin(const char *, bool = false) { return true; }
+  void end() {}
+  uint32_t getULong(const char *key, uint32_t value = 0) {
+    auto it = hostPreferences.find(key);
+    return it == hostPreferences.end() ? value : it->second;
+  }
+  size_t putULong(const char *key, uint32_t value) {
+    hostPreferences[key] = value;
+    return 4;
+  }
+};
+""",
+    "WiFi.h": r"""
+#pragma once
+#include <Arduino.h>
+struct WiFiClass {
+  void macAddress(uint8_t *mac) {
+    static const uint8_t host[6] = {0x24, 0x6f, 0x28, 0x01, 0x02, 0x03};
+    memcpy(mac, host, 6);
+  }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 20); }
+};
+extern WiFiClass WiFi;
+""",
+    # The modules hass.cpp talks to, as far as the connection needs them
+    "modules.cpp": r"""
+#include <Arduino.h>
+#include "alerts.h"
+#include "backlog.h"
+#include "boot.h"
+#include "can.h"
+#include "runtime_cache.h"
+#include "sched.h"
+#include "telemetry.h"
+#include "trace.h"
+#include <Preferences.h>
+#include <WiFi.h>
+
+Config Cfg;
+volatile EssStatus Ess;
+WiFiClass WiFi;
+std::map<std::string, uint32_t> hostPreferences;
+bool hostWifiUp = true;
+uint32_t hostRandom = 2463534242u;
+
+uint32_t esp_random() { // xorshift32
+  hostRandom ^= hostRandom << 13;
+  hostRandom ^= hostRandom >> 17;
+  hostRandom ^= hostRandom << 5;
+  return hostRandom;
+}
+
+namespace Alerts {
+bool next(uint32_t *, Event *) { return false; }
+const char *ruleName(Rule) { return "rule"; }
+}
+namespace Backlog {
+void begin(size_t) {}
+bool enabled() { return false; }
+void push(const EssStatus &) {}
+bool peek(Sample *) { return false; }
+void pop() {}
+EssStatus toStatus(const Sample &) { return EssStatus(); }
+}
+namespace Boot {
+void mark(Phase) {}
+}
+namespace CAN {
+EssStatus getEssStatus() {
+  EssStatus ess = {};
+  ess.charge = 87;
+  ess.voltage = 52.3f;
+  return ess;
+}
+Aggregates takeAggregates() { return Aggregates(); }
+}
+namespace RuntimeCache {
+bool isWifiConnected() { return hostWifiUp; }
+}
+namespace Sched {
+bool add(const char *, Trace::Task, Setup, Step, uint32_t) { return true; }
+}
+namespace Telemetry {
+int8_t subscribe(const char *, TaskHandle_t, uint32_t, uint32_t) { return 0; }
+uint32_t take(int8_t, uint32_t) { return 0; }
+}
+namespace Trace {
+void alive(Task) {}
+void mark(Marker, uint32_t) {}
+void log(uint8_t, const char *, const char *, uint32_t) {}
+}
+""",
+})
+
+DRIVER = mqtt_broker_host.NETWORK + r"""
+#include "hass.cpp"
+
+extern bool hostWifiUp;
+
+// The HASS task: step(), then ulTaskNotifyTake() for the wait it returned.
+// A notification given meanwhile ends the wait at once.
+static uint32_t seenNotifications = 0;
+static int idlePasses = 0;
+static uint32_t passMs = 0; // now of the last step()
+
+static void taskPass() {
+  int64_t before = nowUs;
+  passMs = millis();
+  uint32_t wait = HASS::step(passMs);
+  int64_t until = nowUs + wait * 1000LL;
+  while (nowUs < until && hostNotifications == seenNotifications) {
+    advance(until - nowUs);
+  }
+  seenNotifications = hostNotifications;
+  // A step that notifies itself every time would never let time pass
+  if (nowUs == before && ++idlePasses > 1000) {
+    advance(1000);
+  } else if (nowUs != before) {
+    idlePasses = 0;
+  }
+}
+
+template <typename F> static bool runUntil(F done, int64_t limitUs) {
+  int64_t end = nowUs + limitUs;
+  while (!done() && nowUs < end) {
+    taskPass();
+  }
+  return done();
+}
+
+static uint32_t baseWait(uint8_t attempt) {
+  uint64_t ms = (uint64_t)HASS::BACKOFF_MIN_MS << (attempt < 20 ? attempt : 20);
+  return ms < HASS::BACKOFF_MAX_MS ? ms : HASS::BACKOFF_MAX_MS;
+}
+
+// Many draws at every attempt count: each within +-25% of the base, the
+// whole range used, centred on the base
+static void testJitter() {
+  double lo = 2, hi = 0, sum = 0;
+  int draws = 0;
+  bool inRange = true;
+  bool seen[51] = {};
+  for (uint8_t attempt = 0; attempt < 12; attempt++) {
+    for (int i = 0; i < 2000; i++) {
+      HASS::failedAttempts = attempt;
+      HASS::scheduleRetry(1000);
+      uint32_t wait = HASS::nextAttemptMs - 1000;
+      double ratio = (double)wait / baseWait(attempt);
+      inRange &= wait >= baseWait(attempt) / 100 * 75 && wait <= baseWait(attempt) / 100 * 125;
+      seen[(int)((ratio - 0.75) * 100 + 0.5) % 51] = true;
+      lo = ratio < lo ? ratio : lo;
+      hi = ratio > hi ? ratio : hi;
+      sum += ratio;
+      draws++;
+    }
+  }
+  int buckets = 0;
+  for (bool s : seen) {
+    buckets += s;
+  }
+  double mean = sum / draws;
+  report("jitter", inRange && lo < 0.76 && hi > 1.24 && mean > 0.99 && mean < 1.01 && buckets == 51,
+         "%d draws: %.3f..%.3f of the base wait, mean %.3f, %d of 51 steps seen", draws, lo, hi,
+         mean, buckets);
+  HASS::failedAttempts = 0;
+  HASS::state = HASS::STATE_WAIT_NETWORK;
+}
+
+// Broker refuses connections from boot: every wait and the attempt after it
+static void testBackoff() {
+  broker.down = true;
+  HASS::setup();
+  std::vector<int64_t> failedAt;
+  std::vector<uint32_t> waits;
+  HASS::State last = HASS::state;
+  while (waits.size() < 14) {
+    taskPass();
+    if (HASS::state == HASS::STATE_BACKOFF && last == HASS::STATE_CONNECTING) {
+      failedAt.push_back(passMs * 1000LL);
+      waits.push_back(HASS::nextAttemptMs - passMs);
+    }
+    last = HASS::state;
+  }
+  runUntil([&] { return connectTimes.size() > waits.size(); }, 400000000LL);
+
+  bool ok = HASS::getStats().failedAttempts == waits.size();
+  char schedule[160] = "";
+  size_t len = 0;
+  for (size_t k = 0; k < waits.size(); k++) {
+    uint32_t base = baseWait(k);
+    int64_t nextAttempt = connectTimes[k + 1] - failedAt[k];
+    ok &= waits[k] >= base / 100 * 75 && waits[k] <= base / 100 * 125 &&
+          nextAttempt >= waits[k] * 1000LL && nextAttempt <= (waits[k] + HASS::STEP_MS) * 1000LL;
+    len += snprintf(schedule + len, sizeof(schedule) - len, "%s%.1f", k ? " " : "",
+                    waits[k] / 1000.0);
+  }
+  report("backoff", ok && baseWait(waits.size() - 1) == HASS::BACKOFF_MAX_MS,
+         "waits %s s", schedule);
+}
+
+// The broker comes back: the first connect counts from task start and is
+// not a reconnect
+static void testFirstConnect() {
+  broker.down = false;
+  uint32_t connects = HASS::getStats().connects;
+  runUntil([&] { return HASS::getStats().connects > connects; }, 400000000LL);
+  uint32_t want = passMs - HASS::taskStartMs;
+  HASS::Stats s = HASS::getStats();
+  report("first connect", s.lastReconnectMs == want && s.maxReconnectMs == 0,
+         "lastReconnectMs %lu = %lu ms since task start, maxReconnectMs %lu", s.lastReconnectMs,
+         want, s.maxReconnectMs);
+  runUntil([] { return HASS::state == HASS::STATE_ONLINE; }, 1000000);
+}
+
+// A dropped link: counted from when the task saw it go until connected
+static uint32_t outage(const char *name, int64_t downUs) {
+  runUntil([] { return false; }, 5000000);
+  uint32_t connects = HASS::getStats().connects;
+  size_t attempts = connectTimes.size();
+  broker.drop();
+  broker.down = downUs > 0;
+  int64_t upAt = nowUs + downUs;
+  runUntil([] { return HASS::state != HASS::STATE_ONLINE; }, 1000000);
+  uint32_t lostMs = passMs;
+  runUntil([&] {
+    if (broker.down && nowUs >= upAt) {
+      broker.down = false;
+    }
+    return HASS::getStats().connects > connects;
+  }, 1000000000LL);
+  uint32_t want = passMs - lostMs;
+  HASS::Stats s = HASS::getStats();
+
+  // Attempts: the first on the next pass, then the backoff from 2 s again
+  char retries[160] = "";
+  size_t len = 0;
+  bool ok = s.lastReconnectMs == want && connectTimes[attempts] / 1000 - lostMs <= HASS::STEP_MS;
+  for (size_t i = attempts; i < connectTimes.size(); i++) {
+    len += snprintf(retries + len, sizeof(retries) - len, " +%.1f",
+                    (connectTimes[i] / 1000 - lostMs) / 1000.0);
+  }
+  if (connectTimes.size() - attempts > 1) {
+    int64_t first = connectTimes[attempts + 1] - connectTimes[attempts];
+    ok &= first >= 1500000 - rttUs && first <= 2500000 + 2 * rttUs + HASS::STEP_MS * 1000LL;
+  }
+  report(name, ok, "attempts at%s s, connected after %lu ms = lastReconnectMs %lu", retries, want,
+         s.lastReconnectMs);
+  return want;
+}
+
+int main() {
+  setClock(1000000); // linkDownMs 0 means "never connected"
+  strcpy(Cfg.mqttBrokerIp, "192.168.1.10");
+
+  testJitter();
+  testBackoff();
+  testFirstConnect();
+  uint32_t longest = outage("outage 20 s", 20000000);
+  outage("drop", 0);
+  HASS::Stats s = HASS::getStats();
+  report("max latency", s.maxReconnectMs == longest && s.connects == 3,
+         "maxReconnectMs %lu keeps the 20 s outage, %lu connects, %lu failed attempts",
+         s.maxReconnectMs, s.connects, s.failedAttempts);
+  report("protocol", broker.protocolErrors == 0, "%d malformed packets at the broker",
+         broker.protocolErrors);
+  printf("stat\tdone\t1\n");
+  return failures ? 1 : 0;
+}
+"""
+
+
+def main(argv):
+    if len(argv) != 1:
+        sys.exit(__doc__)
+
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = host_build.build(workdir, ["mqtt_client.cpp"],
+                               dict(STUBS, **{"driver.cpp": DRIVER}), ["-DRTT_MS=50"])
+        result, _ = host_build.run([exe])
+
+    failures = 0
+    done = False
+    for line in result.stdout.decode().split("\n"):
+        fields = line.split("\t")
+        if fields[0] == "case":
+            ok = fields[2] == "1"
+            failures += not ok
+            print("%-14s %s %s" % (fields[1] + ":", "OK " if ok else "FAIL", fields[3]))
+        elif fields[0] == "stat":
+            done = True
+    if not done:
+        sys.exit("driver failed (%d): %s" % (result.returncode, result.stderr.decode()))
+    print("%d failures" % failures)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
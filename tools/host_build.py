@@ -0,0 +1,353 @@
+"""Shared pieces of the tools/*_host.py harnesses.
+
+Each harness compiles one or more files from src/ with g++ against small
+stand-ins for the Arduino and ESP-IDF headers, plus a driver of its own,
+and runs the result. Stand-ins only cover what the compiled files use.
+"""
+
+import os
+import subprocess
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SRC = os.path.join(ROOT, "src")
+TESTDATA = os.path.join(ROOT, "tools", "testdata")
+
+# Arduino core as far as the harnesses need it. millis() and micros() run
+# on a clock the driver can move (hostClockMs); delay() advances it.
+ARDUINO_H = r"""
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <ctime>
+#define PROGMEM
+using std::max;
+using std::min;
+inline size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t n = strlen(src);
+  if (size) {
+    size_t c = n < size - 1 ? n : size - 1;
+    memcpy(dst, src, c);
+    dst[c] = '\0';
+  }
+  return n;
+}
+extern uint32_t hostClockMs;
+extern uint32_t hostClockUs;
+inline uint32_t millis() { return hostClockMs; }
+inline uint32_t micros() { return hostClockMs * 1000 + hostClockUs; }
+inline void delay(uint32_t ms) { hostClockMs += ms; }
+struct Print {
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) { return 1; }
+  size_t print(const char *s) { size_t n = 0; while (*s) n += write((uint8_t)*s++); return n; }
+  size_t println(const char *s = "") { return print(s) + print("\n"); }
+  size_t printf(const char *fmt, ...) {
+    char buf[512];
+    va_list a;
+    va_start(a, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, a);
+    va_end(a);
+    return print(buf);
+  }
+};
+struct HardwareSerial : Print {};
+extern HardwareSerial Serial;
+// Cycle counter at 240 MHz from the host clock
+struct EspClass {
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getCycleCount() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)(t.tv_sec * 240000000ull + t.tv_nsec * 24 / 100);
+  }
+};
+extern EspClass ESP;
+class String : public std::string {
+public:
+  String(const char *s = "") : std::string(s ? s : "") {}
+  String(const std::string &s) : std::string(s) {}
+  String(int v) : std::string(std::to_string(v)) {}
+  String(unsigned v) : std::string(std::to_string(v)) {}
+  String(long v) : std::string(std::to_string(v)) {}
+  String(unsigned long v) : std::string(std::to_string(v)) {}
+  String(float v, int decimals = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+    assign(buf);
+  }
+  String(double v, int decimals = 2) : String((float)v, decimals) {}
+  bool isEmpty() const { return empty(); }
+  unsigned int length() const { return size(); }
+  bool startsWith(const char *prefix) const { return rfind(prefix, 0) == 0; }
+  int indexOf(char c) const { size_t i = find(c); return i == npos ? -1 : (int)i; }
+  String substring(unsigned from) const { return from < size() ? String(substr(from)) : String(); }
+  long toInt() const { return strtol(c_str(), nullptr, 10); }
+  void toCharArray(char *buf, unsigned size) const { strlcpy(buf, c_str(), size); }
+};
+inline String operator+(const String &a, const String &b) { return String(std::string(a) + std::string(b)); }
+inline String operator+(const String &a, const char *b) { return String(std::string(a) + b); }
+inline String operator+(const char *a, const String &b) { return String(a + std::string(b)); }
+class IPAddress {
+public:
+  IPAddress(uint32_t v = 0) : value(v) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : value(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+  operator uint32_t() const { return value; }
+  uint8_t operator[](int i) const { return value >> (8 * i); }
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buf);
+  }
+  bool fromString(const char *s) {
+    unsigned a, b, c, d;
+    if (sscanf(s, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || (a | b | c | d) > 255) return false;
+    *this = IPAddress(a, b, c, d);
+    return true;
+  }
+
+private:
+  uint32_t value;
+};
+"""
+
+# Clock and Serial definitions that go with ARDUINO_H
+ARDUINO_CPP = r"""
+#include <Arduino.h>
+uint32_t hostClockMs = 0;
+uint32_t hostClockUs = 0;
+HardwareSerial Serial;
+EspClass ESP;
+"""
+
+# FreeRTOS as a single task: critical sections do nothing, delays move
+# the clock, notifications are counted
+FREERTOS = {
+    "freertos/FreeRTOS.h": r"""
+#pragma once
+#include <cstdint>
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (ms)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+""",
+    "freertos/task.h": r"""
+#pragma once
+#include "FreeRTOS.h"
+extern uint32_t hostClockMs;
+extern uint32_t hostNotifications;
+typedef void (*TaskFunction_t)(void *);
+inline void vTaskDelay(uint32_t ticks) { hostClockMs += ticks; }
+inline void vTaskDelete(TaskHandle_t) {}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return (TaskHandle_t)1; }
+inline void xTaskNotifyGive(TaskHandle_t) { hostNotifications++; }
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+inline int xPortGetCoreID() { return 1; }
+// Tasks are not run; drivers call the task's functions themselves
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, int,
+                                          TaskHandle_t *handle, int) {
+  if (handle) *handle = (TaskHandle_t)1;
+  return pdPASS;
+}
+""",
+    "freertos/semphr.h": r"""
+#pragma once
+#include "FreeRTOS.h"
+typedef void *SemaphoreHandle_t;
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+""",
+    "esp_err.h": r"""
+#pragma once
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+""",
+    "esp_task_wdt.h": r"""
+#pragma once
+#include "esp_err.h"
+inline esp_err_t esp_task_wdt_status(void *) { return ESP_FAIL; }
+inline esp_err_t esp_task_wdt_reset() { return ESP_OK; }
+""",
+}
+
+FREERTOS_CPP = "#include <cstdint>\nuint32_t hostNotifications = 0;\n"
+
+# The running app partition, backed by hostPartition
+PARTITION = {
+    "esp_partition.h": r"""
+#pragma once
+#include "esp_err.h"
+#include <cstddef>
+#include <cstdint>
+typedef struct { uint32_t size; } esp_partition_t;
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t ofs, void *dst, size_t n);
+""",
+    "esp_ota_ops.h": r"""
+#pragma once
+#include "esp_partition.h"
+const esp_partition_t *esp_ota_get_running_partition();
+""",
+}
+
+PARTITION_CPP = r"""
+#include "esp_ota_ops.h"
+#include <cstring>
+#include <vector>
+std::vector<uint8_t> hostPartition;
+static esp_partition_t running;
+const esp_partition_t *esp_ota_get_running_partition() {
+  running.size = hostPartition.size();
+  return &running;
+}
+esp_err_t esp_partition_read(const esp_partition_t *, size_t ofs, void *dst, size_t n) {
+  if (ofs + n > hostPartition.size()) return ESP_FAIL;
+  memcpy(dst, hostPartition.data() + ofs, n);
+  return ESP_OK;
+}
+"""
+
+# mbedtls SHA-256 API over a plain C implementation
+SHA256_H = r"""
+#pragma once
+#include <cstddef>
+#include <cstdint>
+typedef struct { uint32_t h[8]; uint8_t buf[64]; uint64_t len; } mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context *c);
+void mbedtls_sha256_free(mbedtls_sha256_context *c);
+int mbedtls_sha256_starts(mbedtls_sha256_context *c, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context *c, const uint8_t *d, size_t n);
+int mbedtls_sha256_finish(mbedtls_sha256_context *c, uint8_t out[32]);
+"""
+
+SHA256_CPP = r"""
+#include "mbedtls/sha256.h"
+#include <cstring>
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+static uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+static void block(mbedtls_sha256_context *c, const uint8_t *p) {
+  uint32_t w[64], s[8];
+  for (int i = 0; i < 16; i++) w[i] = p[4 * i] << 24 | p[4 * i + 1] << 16 | p[4 * i + 2] << 8 | p[4 * i + 3];
+  for (int i = 16; i < 64; i++)
+    w[i] = w[i - 16] + (ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] +
+           (ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10));
+  memcpy(s, c->h, sizeof(s));
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = s[7] + (ror(s[4], 6) ^ ror(s[4], 11) ^ ror(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + K[i] + w[i];
+    uint32_t t2 = (ror(s[0], 2) ^ ror(s[0], 13) ^ ror(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(s + 1, s, 7 * sizeof(uint32_t));
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++) c->h[i] += s[i];
+}
+void mbedtls_sha256_init(mbedtls_sha256_context *c) { memset(c, 0, sizeof(*c)); }
+void mbedtls_sha256_free(mbedtls_sha256_context *) {}
+int mbedtls_sha256_starts(mbedtls_sha256_context *c, int) {
+  static const uint32_t H[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  memcpy(c->h, H, sizeof(H));
+  c->len = 0;
+  return 0;
+}
+int mbedtls_sha256_update(mbedtls_sha256_context *c, const uint8_t *d, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    c->buf[c->len++ % 64] = d[i];
+    if (c->len % 64 == 0) block(c, c->buf);
+  }
+  return 0;
+}
+int mbedtls_sha256_finish(mbedtls_sha256_context *c, uint8_t digest[32]) {
+  uint64_t bits = c->len * 8;
+  uint8_t pad = 0x80, zero = 0, len[8];
+  mbedtls_sha256_update(c, &pad, 1);
+  while (c->len % 64 != 56) mbedtls_sha256_update(c, &zero, 1);
+  for (int i = 0; i < 8; i++) len[i] = bits >> (56 - 8 * i);
+  mbedtls_sha256_update(c, len, 8);
+  for (int i = 0; i < 32; i++) digest[i] = c->h[i / 4] >> (24 - 8 * (i % 4));
+  return 0;
+}
+"""
+
+# Logger entry points for files that use LOG_x but are not about logging.
+# With HOST_LOG set in the environment, messages go to stderr (deferred
+# records as their format string).
+LOGGER_CPP = r"""
+#include "logger.h"
+#include <cstdlib>
+namespace Logger {
+uint8_t unresolvedLevel = 0xFF;
+static uint8_t level = LEVEL_DEBUG;
+const uint8_t *tagLevel(const char *) { return &level; }
+void emit(Level l, const char *tag, const char *format, ...) {
+  if (!getenv("HOST_LOG")) return;
+  va_list a;
+  va_start(a, format);
+  fprintf(stderr, "[%d][%s] ", l, tag);
+  vfprintf(stderr, format, a);
+  fputc('\n', stderr);
+  va_end(a);
+}
+void submit(Level l, const char *tag, const char *format, const uint8_t *, size_t) {
+  if (!getenv("HOST_LOG")) return;
+  fprintf(stderr, "[%d][%s] %s\n", l, tag, format);
+}
+}
+"""
+
+
+def write(workdir, files):
+    """files: {relative path: text}"""
+    for name, text in files.items():
+        path = os.path.join(workdir, name)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "w") as f:
+            f.write(text)
+
+
+def build(workdir, sources, files, flags=()):
+    """Writes the stand-ins and generated sources in files, compiles the
+    generated .cpp files plus sources (names in src/) and returns the
+    executable. workdir comes first on the include path; flags go last
+    (libraries)."""
+    write(workdir, files)
+    generated = [os.path.join(workdir, n) for n in files if n.endswith(".cpp")]
+    exe = os.path.join(workdir, "driver")
+    # uint32_t is unsigned long on the ESP32, so %lu is right there and wrong
+    # here; strnlen() bounded by MAX_STRING over a shorter buffer is fine
+    cmd = (["g++", "-std=gnu++17", "-O2", "-Wall", "-Wno-unused-function", "-Wno-format",
+            "-Wno-stringop-overread", "-I", workdir, "-I", SRC] + generated +
+           [os.path.join(SRC, s) for s in sources] + ["-o", exe] + list(flags))
+    subprocess.check_call(cmd)
+    return exe
+
+
+def run(cmd, **kwargs):
+    started = time.time()
+    result = subprocess.run(cmd, capture_output=True, **kwargs)
+    return result, time.time() - started
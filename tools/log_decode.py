@@ -0,0 +1,122 @@
+"""Decode a deferred log dump (/api/logdump) with the matching firmware ELF.
+
+    curl -o esslog.bin http://<ip>/api/logdump
+    python tools/log_decode.py .pio/build/dev/firmware.elf esslog.bin
+
+Deferred records only hold pointers to the format string and tag, so the
+ELF of the exact firmware that wrote the dump is needed to resolve them.
+The record layout is described in src/logger.cpp, the argument encoding in
+src/logger.h (Logger::Deferred).
+"""
+
+import re
+import struct
+import sys
+
+DUMP_MAGIC = b"ESLG"
+DUMP_VERSION = 1
+RECORD = struct.Struct("<BBIII")
+LEVELS = ["EMERG", "ALERT", "CRIT", "ERROR", "WARN", "NOTICE", "INFO", "DEBUG"]
+
+SPEC = re.compile(r"%([-+ #0]*)(\d*)(\.\d+)?([hlLzjt]*)([a-zA-Z%])")
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+
+class Elf:
+    """Just enough ELF32 parsing to read constant strings by address."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            raise SystemExit("%s: not a 32-bit ELF file" % path)
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            (_, sh_type, flags, addr, offset, size) = struct.unpack_from(
+                "<IIIIII", self.data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size:
+                self.sections.append((addr, offset, size))
+
+    def string(self, addr):
+        for start, offset, size in self.sections:
+            if start <= addr < start + size:
+                pos = offset + addr - start
+                end = self.data.index(b"\0", pos)
+                return self.data[pos:end].decode("utf-8", "replace")
+        return "<0x%08x>" % addr
+
+
+def format_record(fmt, args):
+    """Python version of Logger::formatRecord()."""
+    pos = 0
+    out = []
+    last = 0
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, prec, length, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        spec = "%" + flags + width + (prec or "")
+        try:
+            if conv in "diuxXoc":
+                if length.count("l") >= 2:
+                    value, = struct.unpack_from("<q" if conv in "di" else "<Q", args, pos)
+                    pos += 8
+                else:
+                    value, = struct.unpack_from("<i" if conv in "di" else "<I", args, pos)
+                    pos += 4
+                out.append((spec + ("d" if conv in "iu" else conv)) % value)
+            elif conv in "fFeEgGaA":
+                value, = struct.unpack_from("<d", args, pos)
+                pos += 8
+                out.append((spec + conv) % value if conv not in "aA" else value.hex())
+            elif conv == "s":
+                n = args[pos]
+                value = args[pos + 1:pos + 1 + n].decode("utf-8", "replace")
+                if len(value) < n:
+                    raise IndexError
+                pos += 1 + n
+                out.append((spec + "s") % value)
+            elif conv == "p":
+                value, = struct.unpack_from("<I", args, pos)
+                pos += 4
+                out.append("0x%x" % value)
+            else:
+                out.append(m.group(0))
+        except (struct.error, IndexError):
+            out.append("?")
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+def decode(elf, dump):
+    if dump[:4] != DUMP_MAGIC or dump[4] != DUMP_VERSION:
+        raise SystemExit("not a log dump (expected %r v%d)" % (DUMP_MAGIC, DUMP_VERSION))
+    pos = 8
+    while pos + RECORD.size <= len(dump):
+        level, length, timestamp, fmt, tag = RECORD.unpack_from(dump, pos)
+        pos += RECORD.size
+        args = dump[pos:pos + length]
+        pos += length
+        yield "%10.3f [%s][%s] %s" % (
+            timestamp / 1000.0, LEVELS[level & 7], elf.string(tag),
+            format_record(elf.string(fmt), args))
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.exit(__doc__)
+    elf = Elf(argv[1])
+    with open(argv[2], "rb") as f:
+        dump = f.read()
+    for line in decode(elf, dump):
+        print(line)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,316 @@
+"""Host harness for the deferred logger (src/logger.cpp, src/logger.h).
+
+    python tools/logger_host.py
+
+Collects the format string of every LOG_x call in src/, gives each
+conversion an argument of the type it has on the ESP32 (long is 32 bit
+there) and builds src/logger.cpp with g++ against the stand-ins in
+host_build.py. For every format the driver encodes the arguments through
+Deferred::encode and checks that formatRecord() prints exactly what
+snprintf() prints. The records also go through the ring and the drain
+path; the /api/logdump blob from dumpRecords() is decoded with
+tools/log_decode.py and must give the same text. Last, one LOG_x record and
+one Logger::debug() call are timed, as Logger::benchmark() does on the
+device. Needs g++.
+"""
+
+import ast
+import os
+import re
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+import log_decode  # noqa: E402
+
+CALL = re.compile(r'\bLOG_([EWID])\(\s*("(?:[^"\\]|\\.)*"|[A-Za-z_][\w:]*)\s*,\s*'
+                  r'((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL = re.compile(r'"(?:[^"\\]|\\.)*"')
+DUMP_EVERY = 12  # Records per drain pass, well below the ring size
+BENCH_BATCHES = 2000
+
+STUBS = dict(host_build.FREERTOS)
+STUBS.update({
+    "Arduino.h": host_build.ARDUINO_H,
+    "esp_system.h": "#pragma once\ntypedef enum { ESP_RST_UNKNOWN } esp_reset_reason_t;\n",
+    "WebSerialLite.h": "#pragma once\n#include <Arduino.h>\nextern Print WebSerial;\n",
+    "arduino.cpp": host_build.ARDUINO_CPP,
+    "freertos.cpp": host_build.FREERTOS_CPP,
+})
+
+# The driver includes logger.cpp for drain(); CASES is replaced by one
+# block per format. Prints "fmt|tag <address> <text>", "text <id> <text>",
+# "fail <what>", "dump <path> <records so far>" and "stat <name> <value>".
+DRIVER = r"""
+#include "logger.cpp"
+#include <chrono>
+
+Config Cfg;
+Print WebSerial;
+namespace Trace {
+void log(uint8_t, const char *, const char *, uint32_t) {}
+}
+namespace SyslogSink {
+void write(uint8_t, const char *, uint32_t, const char *) {}
+void flush() {}
+}
+
+using namespace Logger;
+
+static const char *workdir;
+static int cases = 0;
+static int failures = 0;
+static int pending = 0;
+static int dumps = 0;
+
+static void printEscaped(const char *s) {
+  for (; *s; s++) {
+    if (*s == '\n') {
+      fputs("\\n", stdout);
+    } else if (*s == '\t') {
+      fputs("\\t", stdout);
+    } else if (*s == '\\') {
+      fputs("\\\\", stdout);
+    } else {
+      fputc(*s, stdout);
+    }
+  }
+}
+
+static void dump() {
+  drain();
+  static uint8_t blob[8 + 4096];
+  size_t n = dumpRecords(blob, sizeof(blob));
+  char path[512];
+  snprintf(path, sizeof(path), "%s/dump%d.bin", workdir, dumps++);
+  FILE *f = fopen(path, "wb");
+  fwrite(blob, 1, n, f);
+  fclose(f);
+  printf("dump\t%s\t%d\n", path, cases);
+  pending = 0;
+}
+
+static void check(const char *where, const char *tag, const char *format,
+                  const Deferred::Args &args, const char *want) {
+  char got[MESSAGE_SIZE];
+  formatRecord(format, args.data, args.len, got, sizeof(got));
+  if (args.overflow || strcmp(got, want) != 0) {
+    printf("fail\t%s: formatRecord \"", where);
+    printEscaped(got);
+    printf("\", snprintf \"");
+    printEscaped(want);
+    printf("\"%s\n", args.overflow ? " (overflow)" : "");
+    failures++;
+  }
+  printf("fmt\t%u\t", (uint32_t)(uintptr_t)format);
+  printEscaped(format);
+  printf("\ntag\t%u\t%s\ntext\t%d\t", (uint32_t)(uintptr_t)tag, tag, cases);
+  printEscaped(got);
+  putchar('\n');
+  cases++;
+
+  submit(LEVEL_INFO, tag, format, args.data, args.len);
+  if (++pending == DUMP_EVERY) {
+    dump();
+  }
+}
+
+static void bench() {
+  double debugNs = 0, recordNs = 0;
+  for (int b = 0; b < BENCH_BATCHES; b++) {
+    drain();
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < 16; i++) {
+      debug(BENCH_TAG, "V %.2f I %.1f SOC %d%% T %.1f %s", 52.31, -12.5, 87, 24.5, "OK");
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    drain();
+    auto t2 = std::chrono::steady_clock::now();
+    for (int i = 0; i < 16; i++) {
+      record(LEVEL_DEBUG, BENCH_TAG, "V %.2f I %.1f SOC %d%% T %.1f %s", 52.31, -12.5, 87, 24.5, "OK");
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    debugNs += std::chrono::duration<double, std::nano>(t1 - t0).count();
+    recordNs += std::chrono::duration<double, std::nano>(t3 - t2).count();
+  }
+  printf("stat\tdebug_ns\t%.0f\n", debugNs / BENCH_BATCHES / 16);
+  printf("stat\trecord_ns\t%.0f\n", recordNs / BENCH_BATCHES / 16);
+  printf("stat\tdropped\t%u\n", getStats().dropped);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) return 1;
+  workdir = argv[1];
+  CASES
+  if (pending) {
+    dump();
+  }
+  bench();
+  printf("stat\tcases\t%d\n", cases);
+  return failures ? 1 : 0;
+}
+"""
+
+CASE = r"""
+  {
+    static const char *const F = %(format)s;
+    Deferred::Args args;
+    Deferred::encode(args%(dev)s);
+    char want[MESSAGE_SIZE];
+    snprintf(want, sizeof(want), F%(host)s);
+    check("%(where)s", %(tag)s, F, args, want);
+  }"""
+
+
+def arguments(fmt):
+    """Device-typed and host-typed argument lists for the conversions in
+    fmt: what the call site passes on the ESP32, and the same values as
+    snprintf expects them on this host. None when a conversion is not
+    supported by the deferred encoding."""
+    dev, host = [], []
+    for i, m in enumerate(log_decode.SPEC.finditer(fmt)):
+        _, _, _, length, conv = m.groups()
+        n = 1000003 * (i + 1)
+        if conv == "%":
+            continue
+        if conv in "di":
+            if length.count("l") >= 2:
+                dev.append("(int64_t)-%dLL" % (n * 100003))
+                host.append("(long long)-%dLL" % (n * 100003))
+            else:
+                v = n % 30000 if "h" in length else n
+                dev.append("(int32_t)-%d" % v)
+                host.append("(%s)-%d" % ("long" if "l" in length else "int", v))
+        elif conv in "uxXo":
+            if length.count("l") >= 2:
+                dev.append("(uint64_t)%dULL" % (n * 100003))
+                host.append("(unsigned long long)%dULL" % (n * 100003))
+            else:
+                v = n % 60000 if "h" in length else n * 3
+                dev.append("(uint32_t)%dU" % v)
+                host.append("(%s)%dU" % ("unsigned long" if "l" in length else
+                                         "size_t" if "z" in length else "unsigned", v))
+        elif conv == "c":
+            dev.append("'%s'" % chr(65 + i % 26))
+            host.append("(int)'%s'" % chr(65 + i % 26))
+        elif conv in "fFeEgG":
+            v = "%r" % (-52.3125 + 7.5 * i)
+            dev.append(v)
+            host.append(v)
+        elif conv == "s":
+            dev.append('"arg%d"' % i)
+            host.append('"arg%d"' % i)
+        elif conv == "p":
+            dev.append("(const void *)0x3ffb%04xu" % i)
+            host.append("(const void *)0x3ffb%04xu" % i)
+        else:
+            return None
+    return dev, host
+
+
+def collect():
+    """(where, tag expression, format literal, format text) per LOG_x call"""
+    calls = []
+    for name in sorted(os.listdir(host_build.SRC)):
+        if not name.endswith((".cpp", ".h")):
+            continue
+        with open(os.path.join(host_build.SRC, name), encoding="utf-8") as f:
+            text = f.read()
+        for m in CALL.finditer(text):
+            line = text.count("\n", 0, m.start()) + 1
+            literals = LITERAL.findall(m.group(3))
+            fmt = "".join(ast.literal_eval(lit) for lit in literals)
+            tag = m.group(2) if m.group(2).startswith('"') else '"HOST"'
+            calls.append(("%s:%d" % (name, line), tag, " ".join(literals), fmt))
+    return calls
+
+
+def unescape(text):
+    return re.sub(r"\\(.)", lambda m: {"n": "\n", "t": "\t"}.get(m.group(1), m.group(1)), text)
+
+
+class Strings:
+    """log_decode's ELF lookup, served from the addresses the driver printed"""
+
+    def __init__(self):
+        self.by_address = {}
+
+    def string(self, addr):
+        return self.by_address.get(addr, "<0x%08x>" % addr)
+
+
+def main(argv):
+    if len(argv) != 1:
+        sys.exit(__doc__)
+
+    calls = collect()
+    blocks, skipped = [], []
+    for where, tag, literal, fmt in calls:
+        args = arguments(fmt)
+        if args is None:
+            skipped.append(where)
+            continue
+        dev, host = args
+        blocks.append(CASE % {"format": literal, "where": where, "tag": tag,
+                              "dev": "".join(", " + a for a in dev),
+                              "host": "".join(", " + a for a in host)})
+    driver = DRIVER.replace("CASES", "".join(blocks))
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        flags = ["-no-pie", "-DDUMP_EVERY=%d" % DUMP_EVERY, "-DBENCH_BATCHES=%d" % BENCH_BATCHES]
+        exe = host_build.build(workdir, [], dict(STUBS, **{"driver.cpp": driver}), flags)
+        result, _ = host_build.run([exe, workdir])
+
+        strings, texts, stats, dumps = Strings(), [], {}, []
+        for line in result.stdout.decode("utf-8").split("\n"):
+            fields = line.split("\t")
+            if fields[0] in ("fmt", "tag"):
+                strings.by_address[int(fields[1])] = unescape(fields[2])
+            elif fields[0] == "text":
+                texts.append(unescape(fields[2]))
+            elif fields[0] == "stat":
+                stats[fields[1]] = fields[2]
+            elif fields[0] == "fail":
+                failures += 1
+                print(fields[1])
+            elif fields[0] == "dump":
+                with open(fields[1], "rb") as f:
+                    dumps.append((f.read(), int(fields[2])))
+        if "cases" not in stats:
+            sys.exit("driver failed (%d): %s" % (result.returncode, result.stderr.decode()))
+
+    # Each dump holds the most recent records that fit, oldest first
+    decoded = mismatched = 0
+    line_re = re.compile(r"^\s*[\d.]+ \[\w+\]\[[^\]]*\] (.*)$", re.S)
+    for blob, count in dumps:
+        lines = list(log_decode.decode(strings, blob))
+        expected = texts[count - len(lines):count]
+        for got, want in zip(lines, expected):
+            message = line_re.match(got).group(1)
+            decoded += 1
+            if message != want:
+                mismatched += 1
+                if mismatched <= 3:
+                    print("log_decode: %r, formatRecord %r" % (message, want))
+    failures += mismatched
+
+    print("formats:    %s %d LOG_x formats in src/, formatRecord == snprintf" % (
+        "FAIL" if failures - mismatched else "OK ", int(stats["cases"])))
+    if skipped:
+        print("skipped:    %s (conversion not supported by the deferred encoding)" %
+              ", ".join(skipped))
+    print("log_decode: %s %d records in %d dumps decode to the same text" % (
+        "FAIL" if mismatched else "OK ", decoded, len(dumps)))
+    dropped = int(stats["dropped"])
+    failures += dropped != 0
+    print("ring:       %s %d records dropped" % ("FAIL" if dropped else "OK ", dropped))
+    print("time:       LOG_x %s ns, Logger::debug() %s ns per call (host, -O2)" % (
+        stats["record_ns"], stats["debug_ns"]))
+    print("%d failures" % failures)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
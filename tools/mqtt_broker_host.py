@@ -0,0 +1,710 @@
+"""Host harness for the MQTT client (src/mqtt_client.cpp) against a fake broker.
+
+    python tools/mqtt_broker_host.py [rtt_ms]   # default 50
+
+Builds src/mqtt_client.cpp with g++ against the stand-ins in host_build.py
+and an AsyncClient that runs on a simulated network: every send() reaches
+the broker half a round trip later and is acknowledged by TCP one round
+trip later, with the 5744 byte send buffer of the Arduino core. The broker
+lives in the same process, parses what arrives and answers CONNACK,
+PUBACK, SUBACK and PINGRESP; it can hold its acks, drop the connection or
+refuse new ones. Time is simulated, so a run takes well under a second and
+gives the same numbers every time.
+
+Checks the CONNECT fields, that at most `window` QoS 1 publishes are in
+flight, that after a dropped connection exactly the unacknowledged ones are
+sent again with DUP and their old packet ids, that a packet cut in the
+middle is sent again whole, keep-alive, and a flood with acks held. Prints
+throughput and PUBACK latency at window 1 and 8 (hass.cpp's mqttbench
+command on the device). Needs g++.
+"""
+
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+
+BENCH_COUNT = 400
+
+STUBS = dict(host_build.FREERTOS)
+STUBS.update({
+    # The ESP32 core's Arduino.h brings in FreeRTOS
+    "Arduino.h": host_build.ARDUINO_H + '#include "freertos/FreeRTOS.h"\n#include "freertos/task.h"\n',
+    "esp_timer.h": r"""
+#pragma once
+#include <Arduino.h>
+inline int64_t esp_timer_get_time() { return (int64_t)hostClockMs * 1000 + hostClockUs; }
+""",
+    # The AsyncTCP API mqtt_client.cpp uses; the methods are in the driver
+    "AsyncTCP.h": r"""
+#pragma once
+#include <Arduino.h>
+class AsyncClient;
+typedef void (*AcConnectHandler)(void *arg, AsyncClient *client);
+typedef void (*AcAckHandler)(void *arg, AsyncClient *client, size_t len, uint32_t time);
+typedef void (*AcErrorHandler)(void *arg, AsyncClient *client, int8_t error);
+typedef void (*AcDataHandler)(void *arg, AsyncClient *client, void *data, size_t len);
+class AsyncClient {
+public:
+  bool connect(IPAddress ip, uint16_t port);
+  void close(bool now = false);
+  size_t space();
+  size_t add(const char *data, size_t size, uint8_t flags = 0);
+  bool send();
+  void setNoDelay(bool) {}
+  const char *errorToString(int8_t) { return "host"; }
+  void onConnect(AcConnectHandler cb, void *arg = nullptr) { connectCb = cb; connectArg = arg; }
+  void onDisconnect(AcConnectHandler cb, void *arg = nullptr) { disconnectCb = cb; disconnectArg = arg; }
+  void onAck(AcAckHandler cb, void *arg = nullptr) { ackCb = cb; ackArg = arg; }
+  void onError(AcErrorHandler cb, void *arg = nullptr) { errorCb = cb; errorArg = arg; }
+  void onData(AcDataHandler cb, void *arg = nullptr) { dataCb = cb; dataArg = arg; }
+
+  AcConnectHandler connectCb = nullptr, disconnectCb = nullptr;
+  AcAckHandler ackCb = nullptr;
+  AcErrorHandler errorCb = nullptr;
+  AcDataHandler dataCb = nullptr;
+  void *connectArg = nullptr, *disconnectArg = nullptr, *ackArg = nullptr, *errorArg = nullptr,
+       *dataArg = nullptr;
+};
+""",
+    "arduino.cpp": host_build.ARDUINO_CPP,
+    "freertos.cpp": host_build.FREERTOS_CPP,
+    "logger.cpp": host_build.LOGGER_CPP,
+})
+
+# The simulated network, the broker and the AsyncClient methods, for the
+# drivers here and in hass_host.py. report() prints "case <name> <0|1>
+# <detail>"; advance() moves the clock to the next event and delivers it.
+NETWORK = r"""
+#include <AsyncTCP.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void report(const char *name, bool ok, const char *format, ...) {
+  char detail[256];
+  va_list a;
+  va_start(a, format);
+  vsnprintf(detail, sizeof(detail), format, a);
+  va_end(a);
+  printf("case\t%s\t%d\t%s\n", name, ok ? 1 : 0, detail);
+  failures += !ok;
+}
+
+// Simulated time; the Arduino clock and esp_timer follow it
+static int64_t nowUs = 0;
+static void setClock(int64_t us) {
+  nowUs = us;
+  hostClockMs = us / 1000;
+  hostClockUs = us % 1000;
+}
+
+// ---- Network: events ordered by arrival time, FIFO at equal times
+
+static int64_t rttUs = RTT_MS * 1000;
+static size_t sendBuffer = 5744; // TCP_SND_BUF of the Arduino core
+
+enum Kind { TO_BROKER, TO_CLIENT, TCP_ACK, TCP_UP, CLIENT_CLOSED, BROKER_ACCEPT, BROKER_CLOSED };
+struct Event {
+  Kind kind;
+  uint32_t link;
+  std::vector<uint8_t> data;
+  size_t acked;
+};
+static std::multimap<int64_t, Event> events;
+
+static void schedule(int64_t delayUs, Kind kind, uint32_t link, std::vector<uint8_t> data = {},
+                     size_t acked = 0) {
+  events.emplace(nowUs + delayUs, Event{kind, link, std::move(data), acked});
+}
+
+// ---- Broker
+
+struct Received {
+  uint32_t link;
+  std::string topic;
+  uint16_t id;
+  bool qos1;
+  bool dup;
+  size_t payloadLen;
+};
+
+struct Broker {
+  uint32_t link = 0; // Open connection, 0: none
+  std::vector<uint8_t> rx;
+  bool holdAcks = false;
+  bool mute = false; // Reads but never answers
+  bool down = false; // Refuses connections
+  std::vector<uint16_t> held;
+  std::vector<Received> got;
+  std::string clientId, willTopic, willPayload, username, password;
+  uint8_t flags = 0;
+  uint16_t keepAlive = 0;
+  int connects = 0, pings = 0, disconnects = 0, subscribes = 0, protocolErrors = 0;
+
+  void reply(std::vector<uint8_t> bytes) {
+    if (link && !mute) {
+      schedule(rttUs / 2, TO_CLIENT, link, std::move(bytes));
+    }
+  }
+  void accept(uint32_t l) {
+    link = l;
+    rx.clear();
+    held.clear();
+  }
+  void closed(uint32_t l) {
+    if (l == link) {
+      link = 0;
+      rx.clear(); // A partial packet dies with the connection
+      held.clear();
+    }
+  }
+  // The broker closes; the client hears of it half a round trip later
+  void drop() {
+    schedule(rttUs / 2, CLIENT_CLOSED, link);
+    closed(link);
+  }
+  void release(size_t count) {
+    for (size_t i = 0; i < count && !held.empty(); i++) {
+      uint16_t id = held.front();
+      held.erase(held.begin());
+      reply({0x40, 2, (uint8_t)(id >> 8), (uint8_t)id});
+    }
+  }
+  static std::string str(const uint8_t *&p) {
+    size_t n = p[0] << 8 | p[1];
+    std::string s((const char *)p + 2, n);
+    p += 2 + n;
+    return s;
+  }
+  void handle(uint8_t type, const uint8_t *body, size_t len) {
+    const uint8_t *p = body;
+    switch (type & 0xF0) {
+    case 0x10: {
+      connects++;
+      if (str(p) != "MQTT" || *p++ != 4) {
+        protocolErrors++;
+      }
+      flags = *p++;
+      keepAlive = p[0] << 8 | p[1];
+      p += 2;
+      clientId = str(p);
+      willTopic = willPayload = username = password = "";
+      if (flags & 0x04) {
+        willTopic = str(p);
+        willPayload = str(p);
+      }
+      if (flags & 0x80) {
+        username = str(p);
+        password = str(p);
+      }
+      if (p != body + len) {
+        protocolErrors++;
+      }
+      reply({0x20, 2, 0, 0});
+      break;
+    }
+    case 0x30: {
+      Received r;
+      r.link = link;
+      r.topic = str(p);
+      r.qos1 = (type & 0x06) == 0x02;
+      r.dup = type & 0x08;
+      r.id = r.qos1 ? p[0] << 8 | p[1] : 0;
+      p += r.qos1 ? 2 : 0;
+      r.payloadLen = body + len - p;
+      got.push_back(r);
+      if (r.qos1) {
+        if (holdAcks) {
+          held.push_back(r.id);
+        } else {
+          reply({0x40, 2, (uint8_t)(r.id >> 8), (uint8_t)r.id});
+        }
+      }
+      break;
+    }
+    case 0x80:
+      subscribes++;
+      reply({0x90, 3, body[0], body[1], 0});
+      break;
+    case 0xA0:
+      reply({0xB0, 2, body[0], body[1]});
+      break;
+    case 0xC0:
+      pings++;
+      reply({0xD0, 0});
+      break;
+    case 0xE0:
+      disconnects++;
+      break;
+    default:
+      protocolErrors++;
+    }
+  }
+  void receive(const std::vector<uint8_t> &data) {
+    rx.insert(rx.end(), data.begin(), data.end());
+    for (;;) {
+      size_t remaining = 0, header = 1;
+      bool complete = false;
+      for (int shift = 0; header < rx.size() && header <= 4; shift += 7) {
+        uint8_t b = rx[header++];
+        remaining |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+          complete = true;
+          break;
+        }
+      }
+      if (!complete || rx.size() < header + remaining) {
+        return;
+      }
+      handle(rx[0], rx.data() + header, remaining);
+      rx.erase(rx.begin(), rx.begin() + header + remaining);
+    }
+  }
+};
+static Broker broker;
+
+// ---- AsyncClient on the simulated network
+
+static AsyncClient *self = nullptr;
+static uint32_t clientLink = 0; // 0: closed
+static uint32_t links = 0;
+static size_t unacked = 0;
+static std::vector<uint8_t> pending;
+static std::vector<int64_t> connectTimes;
+
+bool AsyncClient::connect(IPAddress, uint16_t) {
+  self = this;
+  clientLink = ++links;
+  unacked = 0;
+  pending.clear();
+  connectTimes.push_back(nowUs);
+  if (broker.down) {
+    schedule(rttUs, CLIENT_CLOSED, clientLink); // RST
+    return true;
+  }
+  schedule(rttUs / 2, BROKER_ACCEPT, clientLink);
+  schedule(rttUs, TCP_UP, clientLink);
+  return true;
+}
+
+// Like AsyncTCP: onDisconnect is reported from inside close()
+void AsyncClient::close(bool) {
+  if (!clientLink) {
+    return;
+  }
+  schedule(rttUs / 2, BROKER_CLOSED, clientLink);
+  clientLink = 0;
+  if (disconnectCb) {
+    disconnectCb(disconnectArg, this);
+  }
+}
+
+size_t AsyncClient::space() {
+  return clientLink ? sendBuffer - unacked : 0;
+}
+
+size_t AsyncClient::add(const char *data, size_t size, uint8_t) {
+  size_t n = size < space() ? size : space();
+  pending.insert(pending.end(), data, data + n);
+  unacked += n;
+  return n;
+}
+
+bool AsyncClient::send() {
+  if (!clientLink || pending.empty()) {
+    return false;
+  }
+  size_t n = pending.size();
+  schedule(rttUs / 2, TO_BROKER, clientLink, std::move(pending));
+  schedule(rttUs, TCP_ACK, clientLink, {}, n);
+  pending.clear();
+  return true;
+}
+
+static void dispatch(Event &e) {
+  bool current = e.link == clientLink;
+  switch (e.kind) {
+  case TO_BROKER:
+    if (e.link == broker.link) {
+      broker.receive(e.data);
+    }
+    break;
+  case BROKER_ACCEPT:
+    broker.accept(e.link);
+    break;
+  case BROKER_CLOSED:
+    broker.closed(e.link);
+    break;
+  case TO_CLIENT:
+    if (current) {
+      self->dataCb(self->dataArg, self, e.data.data(), e.data.size());
+    }
+    break;
+  case TCP_ACK:
+    if (current) {
+      unacked -= e.acked;
+      self->ackCb(self->ackArg, self, e.acked, rttUs / 1000);
+    }
+    break;
+  case TCP_UP:
+    if (current) {
+      self->connectCb(self->connectArg, self);
+    }
+    break;
+  case CLIENT_CLOSED:
+    if (current) {
+      clientLink = 0;
+      self->disconnectCb(self->disconnectArg, self);
+    }
+    break;
+  }
+}
+
+// Clock to the next event, at most maxUs ahead, delivering what is due
+static void advance(int64_t maxUs) {
+  int64_t until = nowUs + maxUs;
+  if (!events.empty() && events.begin()->first < until) {
+    until = events.begin()->first;
+  }
+  setClock(until);
+  while (!events.empty() && events.begin()->first <= nowUs) {
+    Event e = std::move(events.begin()->second);
+    events.erase(events.begin());
+    dispatch(e);
+  }
+}
+"""
+
+# Prints "stat <name> <value>" besides the cases
+DRIVER = NETWORK + r"""
+#include "mqtt_client.h"
+
+using namespace MqttClient;
+
+// ---- Owner task: loop() whenever woken, at the latest every 10 ms
+
+static uint8_t maxInflight = 0;
+
+static void step() {
+  loop();
+  Stats s = getStats();
+  if (s.inflight > maxInflight) {
+    maxInflight = s.inflight;
+  }
+  advance(10000);
+}
+
+template <typename F> static bool runUntil(F done, int64_t limitUs) {
+  int64_t end = nowUs + limitUs;
+  while (!done() && nowUs < end) {
+    step();
+  }
+  return done();
+}
+
+static void runFor(int64_t us) {
+  runUntil([] { return false; }, us);
+}
+
+static bool connectClient() {
+  if (!connect()) {
+    return false;
+  }
+  return runUntil([] { return isConnected(); }, 5000000);
+}
+
+static char payload[65];
+static bool publishNumbered(const char *topic, uint32_t n, uint8_t qos = 1) {
+  snprintf(payload, sizeof(payload), "%-64u", n);
+  return publish(topic, payload, false, qos);
+}
+
+// ---- Cases
+
+static void testConnect() {
+  int64_t started = nowUs;
+  bool up = connectClient();
+  report("connect", up && broker.connects == 1 && broker.clientId == "ess-host" &&
+                        broker.keepAlive == 15 && broker.flags == 0xEE &&
+                        broker.willTopic == "ess/status" && broker.willPayload == "offline" &&
+                        broker.username == "user" && broker.password == "secret" &&
+                        !broker.protocolErrors,
+         "CONNACK after %lld ms, flags 0x%02x, client id %s", (long long)(nowUs - started) / 1000,
+         broker.flags, broker.clientId.c_str());
+}
+
+static void testWindow(uint8_t window) {
+  const int count = 20;
+  char name[32];
+  snprintf(name, sizeof(name), "window %u", window);
+  setWindow(window);
+  broker.holdAcks = true;
+  size_t mark = broker.got.size();
+  Stats before = getStats();
+  maxInflight = 0;
+  for (int i = 0; i < count; i++) {
+    publishNumbered("ess/window", i);
+  }
+  runFor(500000);
+  size_t held = broker.got.size() - mark;
+  uint8_t inflightHeld = getStats().inflight;
+
+  broker.holdAcks = false;
+  broker.release(broker.held.size());
+  bool drained = runUntil([] { return idle(); }, 30000000);
+  Stats after = getStats();
+  bool dup = false;
+  for (size_t i = mark; i < broker.got.size(); i++) {
+    dup |= broker.got[i].dup || broker.got[i].id != broker.got[mark].id + (i - mark);
+  }
+  report(name, held == window && inflightHeld == window && maxInflight == window && drained &&
+                   broker.got.size() - mark == count && after.acked - before.acked == count &&
+                   !dup && after.inflight == 0,
+         "%zu sent while acks were held, %u at most in flight, then %zu acked in order",
+         held, maxInflight, broker.got.size() - mark);
+  setWindow(0);
+}
+
+// As hass.cpp runBenchmark(): 64 byte QoS 1 publishes, queue kept at most
+// half full, done when all are acknowledged
+static void benchmark(uint8_t window) {
+  setWindow(window);
+  resetLatency();
+  maxInflight = 0;
+  int64_t started = nowUs;
+  uint32_t left = BENCH_COUNT;
+  auto t0 = std::chrono::steady_clock::now();
+  while (left || !idle()) {
+    while (left) {
+      Stats s = getStats();
+      if (s.queued > s.capacity / 2 || !publishNumbered("ess/bench", BENCH_COUNT - left)) {
+        break;
+      }
+      left--;
+    }
+    step();
+    if (nowUs - started > 600000000LL) {
+      break;
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  Stats s = getStats();
+  double seconds = (nowUs - started) / 1e6;
+  printf("stat\tbench%u_rate\t%.1f\n", window, BENCH_COUNT / seconds);
+  printf("stat\tbench%u_latency_us\t%u\n", window, s.ackLatencyAvgUs);
+  printf("stat\tbench%u_inflight\t%u\n", window, maxInflight);
+  printf("stat\tbench%u_host_ns\t%.0f\n", window,
+         std::chrono::duration<double, std::nano>(t1 - t0).count() / BENCH_COUNT);
+  failures += left != 0 || !idle() || maxInflight > window;
+  setWindow(0);
+}
+
+// Drop the link with acknowledged, unacknowledged and QoS 0 packets written
+static void testRewind() {
+  broker.holdAcks = true;
+  size_t mark = broker.got.size();
+  Stats before = getStats();
+  uint16_t ids[12];
+  for (int i = 0; i < 12; i++) {
+    char topic[32];
+    snprintf(topic, sizeof(topic), "ess/rewind/%d", i);
+    publishNumbered(topic, i);
+    if (i == 2) {
+      publishNumbered("ess/rewind/q0a", 0, 0);
+    }
+  }
+  publishNumbered("ess/rewind/q0b", 0, 0);
+  runFor(300000);
+  broker.release(3); // Publishes 0..2
+  runFor(300000);    // 8..10 go out in their place
+  for (size_t i = mark; i < broker.got.size(); i++) {
+    int n;
+    if (sscanf(broker.got[i].topic.c_str(), "ess/rewind/%d", &n) == 1) {
+      ids[n] = broker.got[i].id;
+    }
+  }
+  size_t firstLink = broker.got.size() - mark;
+  uint32_t oldLink = broker.link;
+  broker.drop();
+  bool lost = runUntil([] { return getState() == STATE_DISCONNECTED; }, 1000000);
+  Stats between = getStats();
+
+  broker.holdAcks = false;
+  bool up = connectClient();
+  bool drained = runUntil([] { return idle(); }, 10000000);
+  Stats after = getStats();
+
+  // On the new link: 3..10 with DUP and their old ids, then 11 and q0b
+  std::string seen, want;
+  bool ok = true;
+  for (size_t i = mark; i < broker.got.size(); i++) {
+    const Received &r = broker.got[i];
+    if (r.link == oldLink) {
+      continue;
+    }
+    seen += r.topic.substr(11) + (r.dup ? "*" : "") + " ";
+    int n;
+    if (sscanf(r.topic.c_str(), "ess/rewind/%d", &n) == 1 && n <= 10 && r.id != ids[n]) {
+      ok = false;
+    }
+  }
+  for (int i = 3; i <= 10; i++) {
+    want += std::to_string(i) + "* ";
+  }
+  want += "11 q0b ";
+  report("rewind", ok && lost && up && drained && firstLink == 12 && seen == want &&
+                       between.inflight == 0 && after.retransmits - before.retransmits == 8 &&
+                       after.acked - before.acked == 12,
+         "%zu sent before the drop, resent: %s(* = DUP), %u retransmits", firstLink,
+         seen.c_str(), after.retransmits - before.retransmits);
+}
+
+// The connection drops halfway through a publish larger than the send buffer
+static void testCut() {
+  sendBuffer = 200;
+  broker.holdAcks = true;
+  size_t mark = broker.got.size();
+  std::string big(1000, 'x');
+  publish("ess/cut", big.c_str(), false);
+  bool partial = runUntil([] { return broker.rx.size() >= 400; }, 2000000);
+  size_t cutAt = broker.rx.size();
+  broker.drop();
+  runUntil([] { return getState() == STATE_DISCONNECTED; }, 1000000);
+  broker.holdAcks = false;
+  sendBuffer = 5744;
+  bool up = connectClient();
+  bool drained = runUntil([] { return idle(); }, 10000000);
+  size_t copies = broker.got.size() - mark;
+  const Received &r = broker.got.back();
+  report("cut packet", partial && up && drained && copies == 1 && r.payloadLen == 1000 && !r.dup,
+         "cut after %zu of %zu bytes, then %zu complete copy, DUP %d", cutAt, 1000 + 11, copies,
+         r.dup);
+}
+
+// Closing and connecting again at once: close() reports the old link
+static void testReconnect() {
+  disconnect();
+  bool up = connectClient();
+  runFor(2000000);
+  report("reconnect", up && isConnected() && broker.disconnects == 1 && broker.connects >= 2,
+         "DISCONNECT sent, connected again, still up 2 s later");
+}
+
+static void testKeepAlive() {
+  int pings = broker.pings;
+  runFor(30000000);
+  int sent = broker.pings - pings;
+  bool stillUp = isConnected();
+  broker.mute = true;
+  int64_t muted = nowUs;
+  bool closed = runUntil([] { return !isConnected(); }, 60000000);
+  int64_t after = (nowUs - muted) / 1000;
+  broker.mute = false;
+  report("keep-alive", stillUp && sent >= 3 && closed && after <= 15 * 1500 + 100,
+         "%d PINGREQ in 30 s idle (keep-alive 15 s), closed %lld ms after the broker went silent",
+         sent, (long long)after);
+  connectClient();
+}
+
+static void testFlood() {
+  broker.holdAcks = true;
+  Stats before = getStats();
+  int accepted = 0;
+  for (int i = 0; i < 2000; i++) {
+    accepted += publishNumbered("ess/flood", i);
+    if (i % 50 == 0) {
+      step();
+    }
+  }
+  Stats full = getStats();
+  broker.holdAcks = false;
+  broker.release(broker.held.size());
+  bool drained = runUntil([] { return idle(); }, 60000000);
+  Stats after = getStats();
+  report("flood", full.peakQueued <= full.capacity && full.dropped - before.dropped == 2000u - accepted &&
+                      accepted > 0 && drained && after.acked - before.acked == (uint32_t)accepted,
+         "%d of 2000 queued with acks held, peak %u of %u bytes, all acked after release",
+         accepted, full.peakQueued, full.capacity);
+}
+
+int main() {
+  Options options;
+  options.ip = IPAddress(192, 168, 1, 10);
+  options.port = 1883;
+  options.clientId = "ess-host";
+  options.username = "user";
+  options.password = "secret";
+  options.willTopic = "ess/status";
+  options.willPayload = "offline";
+  options.keepAlive = 15;
+  begin(options);
+
+  testConnect();
+  if (isConnected()) {
+    testWindow(1);
+    testWindow(2);
+    testWindow(8);
+    testRewind();
+    testCut();
+    testReconnect();
+    testKeepAlive();
+    testFlood();
+    benchmark(1);
+    benchmark(8);
+  }
+  report("protocol", broker.protocolErrors == 0, "%d malformed packets at the broker",
+         broker.protocolErrors);
+  printf("stat\tdone\t1\n");
+  return failures ? 1 : 0;
+}
+"""
+
+
+def main(argv):
+    if len(argv) > 2:
+        sys.exit(__doc__)
+    rtt = int(argv[1]) if len(argv) == 2 else 50
+
+    with tempfile.TemporaryDirectory() as workdir:
+        flags = ["-DRTT_MS=%d" % rtt, "-DBENCH_COUNT=%d" % BENCH_COUNT]
+        exe = host_build.build(workdir, ["mqtt_client.cpp"], dict(STUBS, **{"driver.cpp": DRIVER}),
+                               flags)
+        result, _ = host_build.run([exe])
+
+    failures = 0
+    stats = {}
+    for line in result.stdout.decode().split("\n"):
+        fields = line.split("\t")
+        if fields[0] == "case":
+            ok = fields[2] == "1"
+            failures += not ok
+            print("%-12s %s %s" % (fields[1] + ":", "OK " if ok else "FAIL", fields[3]))
+        elif fields[0] == "stat":
+            stats[fields[1]] = fields[2]
+    if "done" not in stats:
+        sys.exit("driver failed (%d): %s" % (result.returncode, result.stderr.decode()))
+
+    # One window of publishes per round trip is the ceiling
+    for window in (1, 8):
+        rate = float(stats["bench%d_rate" % window])
+        ceiling = window * 1000.0 / rtt
+        inflight = int(stats["bench%d_inflight" % window])
+        ok = 0.8 * ceiling <= rate <= ceiling * 1.01 and inflight == window
+        failures += not ok
+        print("%-12s %s %d x 64 B QoS 1: %.0f msg/s (ceiling %.0f), PUBACK avg %.1f ms, "
+              "%s ns host CPU per message" % (
+                  "window %d:" % window, "OK " if ok else "FAIL", BENCH_COUNT, rate, ceiling,
+                  int(stats["bench%d_latency_us" % window]) / 1000.0,
+                  stats["bench%d_host_ns" % window]))
+    print("round trip %d ms, %d failures" % (rtt, failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
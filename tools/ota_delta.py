@@ -0,0 +1,173 @@
+"""Delta OTA patches against a known base firmware (bsdiff style).
+
+    python tools/ota_delta.py diff  base.bin new.bin out.patch
+    python tools/ota_delta.py apply base.bin in.patch out.bin
+    python tools/ota_delta.py check base.bin new.bin   # diff + apply + compare
+
+The format is described in src/ota_delta.h. apply() mirrors the streaming
+applier on the device (fixed-size chunks, base read by offset) so "check" is
+the host harness for patches before they are shipped. Upload the .patch (or
+the .patch.gz written by tools/ota_pack.py) on /ota_update.
+"""
+
+import gzip
+import hashlib
+import struct
+import sys
+
+MAGIC = b"ESSD"
+VERSION = 1
+HEADER = struct.Struct("<4sB3xI32sI")
+CONTROL = struct.Struct("<IIi")
+
+SEED = 8           # Exact match length used to find alignment candidates
+INDEX_STRIDE = 4   # Index every 4th base offset; seeds >= SEED+3 still hit
+GIVE_UP = 64       # Stop extending after this many bytes without improvement
+
+
+def _extend(old, new, o, p):
+    """bsdiff style approximate forward extension.
+
+    Keeps growing while matches outnumber mismatches; the mismatching bytes
+    end up as non-zero diff bytes, which gzip compresses well.
+    """
+    limit = min(len(old) - o, len(new) - p)
+    matches = best_score = best_len = 0
+    i = 0
+    while i < limit:
+        if old[o + i] == new[p + i]:
+            matches += 1
+        i += 1
+        score = 2 * matches - i
+        if score > best_score:
+            best_score, best_len = score, i
+        elif i - best_len > GIVE_UP:
+            break
+    return best_len
+
+
+def _segments(old, new):
+    """Yield (new_start, old_start, length) matches, sorted and disjoint."""
+    index = {}
+    for i in range(0, len(old) - SEED + 1, INDEX_STRIDE):
+        index.setdefault(old[i:i + SEED], i)
+
+    pos = 0
+    last_end = 0
+    offset = 0  # old - new of the previous match, tried first
+    while pos <= len(new) - SEED:
+        key = new[pos:pos + SEED]
+        cand = pos + offset
+        if not (0 <= cand <= len(old) - SEED and old[cand:cand + SEED] == key):
+            cand = None
+            for shift in range(INDEX_STRIDE):
+                o = index.get(new[pos + shift:pos + shift + SEED]) if pos + shift + SEED <= len(new) else None
+                if o is not None and o >= shift and old[o - shift:o - shift + SEED] == key:
+                    cand = o - shift
+                    break
+        if cand is None:
+            pos += 1
+            continue
+
+        # Grow backwards over exact matches up to the previous segment
+        start_new, start_old = pos, cand
+        while start_new > last_end and start_old > 0 and new[start_new - 1] == old[start_old - 1]:
+            start_new -= 1
+            start_old -= 1
+
+        length = _extend(old, new, start_old, start_new)
+        if length < SEED:
+            pos += 1
+            continue
+
+        yield start_new, start_old, length
+        offset = start_old - start_new
+        pos = last_end = start_new + length
+
+
+def diff(old, new):
+    controls = []
+    body = []
+    new_pos = 0
+    diff_old, diff_len = 0, 0
+    for p, o, length in list(_segments(old, new)) + [(len(new), None, 0)]:
+        extra_start = new_pos + diff_len
+        seek = (o - (diff_old + diff_len)) if o is not None else 0
+        controls.append(CONTROL.pack(diff_len, p - extra_start, seek))
+        body.append(bytes((new[new_pos + i] - old[diff_old + i]) & 0xFF
+                          for i in range(diff_len)))
+        body.append(new[extra_start:p])
+        new_pos, diff_old, diff_len = p, o, length
+
+    out = [HEADER.pack(MAGIC, VERSION, len(old), hashlib.sha256(old).digest(), len(new))]
+    for i, ctrl in enumerate(controls):
+        out.append(ctrl)
+        out.append(body[2 * i])
+        out.append(body[2 * i + 1])
+    return b"".join(out)
+
+
+def apply(old, patch, chunk=1436):
+    """Stream the patch in network-sized chunks, like the device does."""
+    magic, version, base_size, base_sha, new_size = HEADER.unpack_from(patch)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("unknown delta format")
+    if base_size > len(old) or hashlib.sha256(old[:base_size]).digest() != base_sha:
+        raise ValueError("delta base mismatch")
+
+    out = bytearray()
+    stream = memoryview(patch)[HEADER.size:]
+    old_pos = 0
+    pos = 0
+    while pos < len(stream):
+        diff_len, extra_len, seek = CONTROL.unpack_from(stream, pos)
+        pos += CONTROL.size
+        for ofs in range(0, diff_len, chunk):
+            n = min(chunk, diff_len - ofs)
+            if old_pos + n > base_size:
+                raise ValueError("patch reads past the base image")
+            out += bytes((old[old_pos + i] + stream[pos + ofs + i]) & 0xFF for i in range(n))
+            old_pos += n
+        pos += diff_len
+        out += stream[pos:pos + extra_len]
+        pos += extra_len
+        old_pos += seek
+        if not 0 <= old_pos <= base_size:
+            raise ValueError("patch seeks outside the base image")
+    if len(out) != new_size:
+        raise ValueError("patch produced %d bytes, expected %d" % (len(out), new_size))
+    return bytes(out)
+
+
+def check(old, new):
+    patch = diff(old, new)
+    if apply(old, patch) != new:
+        raise SystemExit("delta check FAILED")
+    return patch
+
+
+def _read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main(argv):
+    if len(argv) == 5 and argv[1] == "diff":
+        patch = check(_read(argv[2]), _read(argv[3]))
+        with open(argv[4], "wb") as f:
+            f.write(patch)
+        print("%s: %d bytes (%d gzipped)" % (argv[4], len(patch), len(gzip.compress(patch, 9))))
+    elif len(argv) == 5 and argv[1] == "apply":
+        with open(argv[4], "wb") as f:
+            f.write(apply(_read(argv[2]), _read(argv[3])))
+    elif len(argv) == 4 and argv[1] == "check":
+        old, new = _read(argv[2]), _read(argv[3])
+        patch = check(old, new)
+        print("OK: %d -> %d bytes patch, %d gzipped" % (
+            len(new), len(patch), len(gzip.compress(patch, 9))))
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
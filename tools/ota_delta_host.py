@@ -0,0 +1,150 @@
+"""Host harness for the device's delta applier (src/ota_delta.cpp).
+
+    python tools/ota_delta_host.py                    # synthetic images
+    python tools/ota_delta_host.py base.bin new.bin   # real firmware
+
+Builds src/ota_delta.cpp with g++ against the stand-ins in host_build.py,
+makes a patch with tools/ota_delta.py and feeds it to the C++ applier in
+several chunk sizes. The output must equal the new image, and a
+patch for another base must be reported as a base mismatch. Needs g++.
+"""
+
+import hashlib
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+import ota_delta  # noqa: E402
+
+CHUNKS = (1, 7, 512, 1436, 4096, 1 << 20)
+
+STUBS = dict(host_build.FREERTOS, **host_build.PARTITION)
+STUBS.update({
+    "Arduino.h": host_build.ARDUINO_H,
+    "mbedtls/sha256.h": host_build.SHA256_H,
+    "arduino.cpp": host_build.ARDUINO_CPP,
+    "freertos.cpp": host_build.FREERTOS_CPP,
+    "partition.cpp": host_build.PARTITION_CPP,
+    "sha256.cpp": host_build.SHA256_CPP,
+    "logger_stub.cpp": host_build.LOGGER_CPP,
+})
+
+# driver <partition> <patch> <chunk> <out>
+# Exit 0 applied, 2 base mismatch, 1 other error (message on stderr).
+DRIVER = r"""
+#include "ota_delta.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+extern std::vector<uint8_t> hostPartition;
+static FILE *out;
+
+static bool sink(const uint8_t *data, size_t len) {
+  return fwrite(data, 1, len, out) == len;
+}
+
+static std::vector<uint8_t> load(const char *path) {
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path, "rb");
+  int c;
+  while (f && (c = fgetc(f)) != EOF) data.push_back(c);
+  if (f) fclose(f);
+  return data;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 5) return 1;
+  hostPartition = load(argv[1]);
+  std::vector<uint8_t> patch = load(argv[2]);
+  size_t chunk = strtoul(argv[3], nullptr, 10);
+  out = fopen(argv[4], "wb");
+
+  OtaDelta::begin(sink);
+  for (size_t ofs = 0; ofs < patch.size(); ofs += chunk) {
+    size_t n = std::min(chunk, patch.size() - ofs);
+    if (!OtaDelta::write(patch.data() + ofs, n)) {
+      fprintf(stderr, "%s\n", OtaDelta::errorString());
+      return OtaDelta::isBaseMismatch() ? 2 : 1;
+    }
+  }
+  fclose(out);
+  if (!OtaDelta::isComplete()) {
+    fprintf(stderr, "patch incomplete\n");
+    return 1;
+  }
+  return 0;
+}
+"""
+
+
+def build(workdir):
+    return host_build.build(workdir, ["ota_delta.cpp"], dict(STUBS, **{"driver.cpp": DRIVER}))
+
+
+def run(exe, workdir, partition, patch, chunk):
+    paths = [os.path.join(workdir, n) for n in ("partition.bin", "in.patch", "out.bin")]
+    for path, data in zip(paths, (partition, patch)):
+        with open(path, "wb") as f:
+            f.write(data)
+    result = subprocess.run([exe] + paths[:2] + [str(chunk), paths[2]],
+                            capture_output=True, text=True)
+    with open(paths[2], "rb") as f:
+        return result.returncode, f.read(), result.stderr.strip()
+
+
+def synthetic():
+    """A 64 KB "firmware" and a new version with inserts, deletes and edits."""
+    rng = random.Random(1)
+    words = [bytes(rng.randrange(256) for _ in range(rng.randrange(4, 40))) for _ in range(300)]
+    old = b"".join(rng.choice(words) for _ in range(4000))[:65536]
+    new = bytearray(old)
+    new[1000:1000] = bytes(rng.randrange(256) for _ in range(3000))
+    del new[20000:20500]
+    for i in range(30000, 40000, 97):
+        new[i] = (new[i] + 1) & 0xFF
+    return old, bytes(new)
+
+
+def main(argv):
+    if len(argv) == 3:
+        with open(argv[1], "rb") as f:
+            old = f.read()
+        with open(argv[2], "rb") as f:
+            new = f.read()
+    elif len(argv) == 1:
+        old, new = synthetic()
+    else:
+        sys.exit(__doc__)
+
+    patch = ota_delta.check(old, new)
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = build(workdir)
+
+        # The running partition is larger than the image, as on the device
+        partition = old + b"\xff" * 4096
+        for chunk in CHUNKS:
+            code, out, err = run(exe, workdir, partition, patch, chunk)
+            ok = code == 0 and out == new
+            failures += not ok
+            print("chunk %7d: %s %s" % (chunk, "OK " if ok else "FAIL", err or
+                                        hashlib.sha256(out).hexdigest()[:16]))
+
+        other = bytearray(partition)
+        other[len(old) // 2] ^= 0xFF
+        code, _, err = run(exe, workdir, bytes(other), patch, 1436)
+        ok = code == 2
+        failures += not ok
+        print("other base:    %s %s" % ("OK " if ok else "FAIL", err))
+
+    print("%d bytes -> %d byte patch, %d failures" % (len(new), len(patch), failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,125 @@
+"""Package firmware for OTA: gzip image + SHA-256 manifest (optionally signed).
+
+Runs as a PlatformIO post-build script (see extra_scripts in platformio.ini)
+and writes next to firmware.bin:
+
+    firmware.bin.gz          - upload this on /ota_update
+    firmware.manifest.json   - {"version","size","sha256","sig"}
+    firmware.patch.gz        - delta against custom_ota_base, if configured
+
+The manifest describes the resulting image, so the same file is used for the
+full image and for the patch.
+
+It can also be used standalone:
+
+    python tools/ota_pack.py .pio/build/prod/firmware.bin [version] [base.bin]
+    python tools/ota_pack.py --gen-key   # creates signing key + src/ota_pubkey.h
+
+The device needs the manifest for every update. The signature is ECDSA P-256
+over SHA-256 of the uncompressed image, made with the openssl CLI so no extra
+Python packages are needed; once src/ota_pubkey.h exists, packing fails
+without tools/ota_signing_key.pem instead of writing an unsigned manifest.
+"""
+
+import base64
+import gzip
+import hashlib
+import json
+import os
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.join(ROOT, "tools"))
+import ota_delta  # noqa: E402
+KEY_PATH = os.path.join(ROOT, "tools", "ota_signing_key.pem")
+PUBKEY_HEADER = os.path.join(ROOT, "src", "ota_pubkey.h")
+
+
+def sign(image_path):
+    if not os.path.exists(KEY_PATH):
+        # The device would refuse an unsigned manifest
+        if os.path.exists(PUBKEY_HEADER):
+            sys.exit("%s is compiled in but %s is missing: cannot sign the "
+                     "manifest" % (os.path.relpath(PUBKEY_HEADER, ROOT),
+                                   os.path.relpath(KEY_PATH, ROOT)))
+        return ""
+    der = subprocess.check_output(
+        ["openssl", "dgst", "-sha256", "-sign", KEY_PATH, "-binary", image_path])
+    return base64.b64encode(der).decode()
+
+
+def pack(image_path, version="?", base_path=None):
+    with open(image_path, "rb") as f:
+        image = f.read()
+
+    base = image_path[:-len(".bin")] if image_path.endswith(".bin") else image_path
+    gz_path = image_path + ".gz"
+    manifest_path = base + ".manifest.json"
+
+    # mtime=0 keeps the output reproducible for identical images
+    with open(gz_path, "wb") as f:
+        f.write(gzip.compress(image, compresslevel=9, mtime=0))
+
+    manifest = {
+        "version": version,
+        "size": len(image),
+        "sha256": hashlib.sha256(image).hexdigest(),
+        "sig": sign(image_path),
+    }
+    with open(manifest_path, "w") as f:
+        json.dump(manifest, f)
+
+    print("OTA package: %s (%d -> %d bytes), manifest %s%s" % (
+        gz_path, len(image), os.path.getsize(gz_path), manifest_path,
+        " [signed]" if manifest["sig"] else ""))
+
+    if base_path:
+        if not os.path.isabs(base_path):
+            base_path = os.path.join(ROOT, base_path)
+        with open(base_path, "rb") as f:
+            patch = ota_delta.check(f.read(), image)  # diff + apply round trip
+        patch_path = base + ".patch.gz"
+        with open(patch_path, "wb") as f:
+            f.write(gzip.compress(patch, compresslevel=9, mtime=0))
+        print("OTA delta: %s (%d bytes) against %s" % (
+            patch_path, os.path.getsize(patch_path), os.path.relpath(base_path, ROOT)))
+
+
+def gen_key():
+    if os.path.exists(KEY_PATH):
+        sys.exit("%s already exists" % KEY_PATH)
+    subprocess.check_call(["openssl", "ecparam", "-name", "prime256v1",
+                           "-genkey", "-noout", "-out", KEY_PATH])
+    pem = subprocess.check_output(["openssl", "ec", "-in", KEY_PATH, "-pubout"],
+                                  stderr=subprocess.DEVNULL).decode()
+    with open(PUBKEY_HEADER, "w") as f:
+        f.write("#ifndef _OTA_PUBKEY_H_\n#define _OTA_PUBKEY_H_\n\n")
+        f.write("// Generated by tools/ota_pack.py --gen-key\n")
+        f.write("#define OTA_PUBKEY_PEM \\\n")
+        for line in pem.strip().splitlines():
+            f.write('  "%s\\n" \\\n' % line)
+        f.write('  ""\n\n#endif\n')
+    print("Wrote %s and %s" % (KEY_PATH, PUBKEY_HEADER))
+
+
+def _post_build(source, target, env):
+    version = env.GetProjectOption("custom_version", "") or "?"
+    for flag in env.get("CPPDEFINES", []):
+        if isinstance(flag, tuple) and flag[0] == "VERSION":
+            version = str(flag[1]).strip('\\"')
+    pack(str(target[0]), version, env.GetProjectOption("custom_ota_base", "") or None)
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", _post_build)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        if len(sys.argv) == 2 and sys.argv[1] == "--gen-key":
+            gen_key()
+        elif len(sys.argv) >= 2:
+            pack(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else "?",
+                 sys.argv[3] if len(sys.argv) > 3 else None)
+        else:
+            sys.exit(__doc__)
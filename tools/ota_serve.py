@@ -0,0 +1,84 @@
+"""Minimal static file server with HTTP Range support for pull OTA testing.
+
+    python tools/ota_serve.py [directory] [port]
+
+python -m http.server ignores Range headers, which the device needs to resume
+an interrupted download. Serve the build directory, e.g.
+
+    python tools/ota_serve.py .pio/build/prod 8000
+
+and start the update with http://<pc-ip>:8000/firmware.bin.gz (or
+firmware.patch.gz). Use --drop-every N to close the connection after every
+N bytes and exercise the resume path.
+"""
+
+import http.server
+import os
+import re
+import sys
+
+DROP_EVERY = 0
+
+
+class RangeHandler(http.server.SimpleHTTPRequestHandler):
+    def send_head(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            return super().send_head()
+
+        size = os.path.getsize(path)
+        start, end = 0, size - 1
+        match = re.match(r"bytes=(\d+)-(\d*)$", self.headers.get("Range", ""))
+        if match:
+            start = int(match.group(1))
+            if match.group(2):
+                end = min(int(match.group(2)), size - 1)
+            if start >= size:
+                self.send_error(416, "Requested Range Not Satisfiable")
+                return None
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        else:
+            self.send_response(200)
+
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(end - start + 1))
+        self.send_header("Accept-Ranges", "bytes")
+        self.end_headers()
+
+        f = open(path, "rb")
+        f.seek(start)
+        self._remaining = end - start + 1
+        return f
+
+    def copyfile(self, source, outputfile):
+        limit = self._remaining
+        if DROP_EVERY:
+            limit = min(limit, DROP_EVERY)
+        while limit > 0:
+            chunk = source.read(min(16384, limit))
+            if not chunk:
+                break
+            outputfile.write(chunk)
+            limit -= len(chunk)
+        if DROP_EVERY and self._remaining > DROP_EVERY:
+            self.log_message("dropping connection to test resume")
+            self.close_connection = True
+
+
+def main(argv):
+    global DROP_EVERY
+    if "--drop-every" in argv:
+        i = argv.index("--drop-every")
+        DROP_EVERY = int(argv[i + 1])
+        del argv[i:i + 2]
+    directory = argv[1] if len(argv) > 1 else "."
+    port = int(argv[2]) if len(argv) > 2 else 8000
+    os.chdir(directory)
+    server = http.server.ThreadingHTTPServer(("", port), RangeHandler)
+    print("Serving %s on port %d (Range enabled)" % (os.getcwd(), port))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main(sys.argv)
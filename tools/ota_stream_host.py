@@ -0,0 +1,340 @@
+"""Host harness for the OTA stream writer (src/ota_stream.cpp).
+
+    python tools/ota_stream_host.py                 # ota/firmware.bin
+    python tools/ota_stream_host.py firmware.bin
+
+Packs the image with tools/ota_pack.py (firmware.bin.gz, manifest and a
+delta against a slightly different base), builds src/ota_stream.cpp and
+src/ota_delta.cpp with g++ against the stand-ins in host_build.py and feeds
+the packages to OtaStream::write() in chunk sizes from 1 byte to 64 KB.
+What reaches Update must be the image, with the manifest's SHA-256 and byte
+count. Truncated and corrupted streams and bad manifests must be refused
+without committing. The inflater is zlib behind the tinfl API, so this
+covers the stream handling around it, not miniz itself. Needs g++ and
+zlib headers.
+"""
+
+import hashlib
+import json
+import os
+import shutil
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+import ota_pack  # noqa: E402
+
+CHUNKS = (1, 7, 512, 1436, 4096, 1 << 16)
+
+STUBS = dict(host_build.FREERTOS, **host_build.PARTITION)
+STUBS.update({
+    "Arduino.h": host_build.ARDUINO_H,
+    "mbedtls/sha256.h": host_build.SHA256_H,
+    "mbedtls/base64.h": "#pragma once\n",
+    "mbedtls/pk.h": "#pragma once\n",
+    "esp_system.h": "#pragma once\ntypedef enum { ESP_RST_UNKNOWN } esp_reset_reason_t;\n",
+    "esp_rom_crc.h": r"""
+#pragma once
+#include <zlib.h>
+inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  return crc32(crc, buf, len);
+}
+""",
+    # tinfl's streaming contract on top of zlib's raw inflate
+    "esp32/rom/miniz.h": r"""
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+#define TINFL_LZ_DICT_SIZE 32768
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+typedef enum {
+  TINFL_STATUS_FAILED = -1,
+  TINFL_STATUS_DONE = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+typedef struct { z_stream z; } tinfl_decompressor;
+inline void tinfl_init(tinfl_decompressor *r) {
+  memset(&r->z, 0, sizeof(r->z));
+  inflateInit2(&r->z, -15);
+}
+inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in, size_t *inSize,
+                                     uint8_t *, uint8_t *out, size_t *outSize, uint32_t) {
+  r->z.next_in = (Bytef *)in;
+  r->z.avail_in = *inSize;
+  r->z.next_out = out;
+  r->z.avail_out = *outSize;
+  int ret = inflate(&r->z, Z_NO_FLUSH);
+  *inSize -= r->z.avail_in;
+  *outSize -= r->z.avail_out;
+  if (ret == Z_STREAM_END) {
+    inflateEnd(&r->z);
+    return TINFL_STATUS_DONE;
+  }
+  if (ret != Z_OK && ret != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+  return r->z.avail_out ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_HAS_MORE_OUTPUT;
+}
+""",
+    "Update.h": r"""
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+class UpdateClass {
+public:
+  bool begin(size_t size);
+  size_t write(uint8_t *data, size_t len);
+  bool end(bool evenIfRemaining = false);
+  void abort();
+  const char *errorString();
+};
+extern UpdateClass Update;
+""",
+    # Only the parts of ArduinoJson the manifest parser uses: a flat object
+    # of strings and numbers
+    "ArduinoJson.h": r"""
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <string>
+struct JsonValue {
+  std::string text;
+  bool present = false;
+  bool isString = false;
+  long operator|(int def) const { return present && !isString ? strtol(text.c_str(), nullptr, 10) : def; }
+  const char *operator|(const char *def) const { return present && isString ? text.c_str() : def; }
+};
+struct DeserializationError {
+  bool failed;
+  explicit operator bool() const { return failed; }
+};
+class JsonDocument {
+public:
+  std::map<std::string, JsonValue> values;
+  const JsonValue &operator[](const char *key) const {
+    static const JsonValue missing;
+    auto it = values.find(key);
+    return it == values.end() ? missing : it->second;
+  }
+};
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *p) {
+  auto skip = [&]() { while (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r') p++; };
+  auto string = [&](std::string &out) {
+    if (*p++ != '"') return false;
+    while (*p && *p != '"') out += *p++;
+    return *p++ == '"';
+  };
+  skip();
+  if (*p++ != '{') return {true};
+  skip();
+  while (*p != '}') {
+    std::string key;
+    JsonValue v;
+    v.present = true;
+    if (!string(key)) return {true};
+    skip();
+    if (*p++ != ':') return {true};
+    skip();
+    if (*p == '"') {
+      v.isString = true;
+      if (!string(v.text)) return {true};
+    } else {
+      while ((*p >= '0' && *p <= '9') || *p == '-') v.text += *p++;
+      if (v.text.empty()) return {true};
+    }
+    doc.values[key] = v;
+    skip();
+    if (*p == ',') p++;
+    else if (*p != '}') return {true};
+    skip();
+  }
+  return {false};
+}
+""",
+    "arduino.cpp": host_build.ARDUINO_CPP,
+    "freertos.cpp": host_build.FREERTOS_CPP,
+    "partition.cpp": host_build.PARTITION_CPP,
+    "sha256.cpp": host_build.SHA256_CPP,
+    "logger_stub.cpp": host_build.LOGGER_CPP,
+})
+
+# Update and Trace stand-ins, and the driver:
+#   driver <manifest|-> <input> <chunk> <out> [partition]
+# Prints "<image bytes> <input bytes> <committed>"; exit 0 committed,
+# 2 base mismatch, 1 refused (error on stderr).
+DRIVER = r"""
+#include "ota_stream.h"
+#include "trace.h"
+#include <Update.h>
+#include <vector>
+
+extern std::vector<uint8_t> hostPartition;
+UpdateClass Update;
+static FILE *out;
+static size_t expected, written;
+static bool committed;
+
+bool UpdateClass::begin(size_t size) {
+  expected = size;
+  return true;
+}
+size_t UpdateClass::write(uint8_t *data, size_t len) {
+  written += len;
+  return fwrite(data, 1, len, out);
+}
+bool UpdateClass::end(bool) {
+  committed = written == expected;
+  return committed;
+}
+void UpdateClass::abort() {}
+const char *UpdateClass::errorString() { return "Update error"; }
+
+namespace Trace {
+void mark(Marker, uint32_t) {}
+}
+
+static std::vector<uint8_t> load(const char *path) {
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path, "rb");
+  int c;
+  while (f && (c = fgetc(f)) != EOF) data.push_back(c);
+  if (f) fclose(f);
+  return data;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 5) return 1;
+  std::vector<uint8_t> manifest = load(argv[1]);
+  manifest.push_back(0);
+  std::vector<uint8_t> input = load(argv[2]);
+  size_t chunk = strtoul(argv[3], nullptr, 10);
+  out = fopen(argv[4], "wb");
+  if (argc > 5) hostPartition = load(argv[5]);
+
+  bool ok = OtaStream::begin((const char *)manifest.data());
+  for (size_t ofs = 0; ok && ofs < input.size(); ofs += chunk) {
+    ok = OtaStream::write(input.data() + ofs, std::min(chunk, input.size() - ofs));
+  }
+  ok = ok && OtaStream::end();
+  if (!ok) {
+    OtaStream::abort();
+  }
+  fclose(out);
+  OtaStream::Stats stats = OtaStream::getStats();
+  printf("%u %u %d\n", stats.imageBytes, stats.inputBytes, committed);
+  if (!ok) {
+    fprintf(stderr, "%s\n", OtaStream::errorString());
+    return OtaStream::isBaseMismatch() ? 2 : 1;
+  }
+  return 0;
+}
+"""
+
+
+class Harness:
+    def __init__(self, workdir):
+        self.workdir = workdir
+        self.exe = host_build.build(workdir, ["ota_stream.cpp", "ota_delta.cpp"],
+                                    dict(STUBS, **{"driver.cpp": DRIVER}), ["-lz"])
+        self.failures = 0
+
+    def feed(self, manifest, data, chunk, partition=b""):
+        paths = [os.path.join(self.workdir, n) for n in
+                 ("in.manifest.json", "in.bin", "out.bin", "partition.bin")]
+        for path, content in ((paths[0], manifest), (paths[1], data), (paths[3], partition)):
+            with open(path, "wb") as f:
+                f.write(content)
+        result, elapsed = host_build.run([self.exe, paths[0], paths[1], str(chunk), paths[2],
+                                          paths[3]], text=True)
+        with open(paths[2], "rb") as f:
+            written = f.read()
+        image_bytes, input_bytes, committed = (result.stdout.split() + ["0"] * 3)[:3]
+        return (result.returncode, written, int(image_bytes), int(input_bytes),
+                committed == "1", result.stderr.strip(), elapsed)
+
+    def accept(self, label, manifest, data, chunk, image, partition=b""):
+        code, written, image_bytes, input_bytes, committed, err, elapsed = \
+            self.feed(manifest, data, chunk, partition)
+        ok = (code == 0 and committed and written == image and image_bytes == len(image) and
+              input_bytes == len(data) and
+              hashlib.sha256(written).hexdigest() == json.loads(manifest)["sha256"])
+        self.failures += not ok
+        print("%-22s %s %s" % (label, "OK " if ok else "FAIL", err or "%d bytes, sha256 %s, %.2f s" % (
+            image_bytes, hashlib.sha256(written).hexdigest()[:16], elapsed)))
+
+    def refuse(self, label, manifest, data, expect=None):
+        code, _, _, _, committed, err, _ = self.feed(manifest, data, 1436)
+        ok = code != 0 and not committed and (expect is None or expect in err)
+        self.failures += not ok
+        print("%-22s %s %s" % (label, "OK " if ok else "FAIL", err or "accepted"))
+
+
+def main(argv):
+    if len(argv) > 2:
+        sys.exit(__doc__)
+    source = argv[1] if len(argv) == 2 else os.path.join(host_build.ROOT, "ota", "firmware.bin")
+
+    with tempfile.TemporaryDirectory() as workdir:
+        image_path = os.path.join(workdir, "firmware.bin")
+        shutil.copy(source, image_path)
+        with open(image_path, "rb") as f:
+            image = f.read()
+
+        # Running firmware for the delta: the image with a few bytes changed
+        base = bytearray(image)
+        for i in range(1000, len(base), 50000):
+            base[i] ^= 0x55
+        base_path = os.path.join(workdir, "base.bin")
+        with open(base_path, "wb") as f:
+            f.write(base)
+
+        ota_pack.pack(image_path, "host", base_path)
+        with open(image_path + ".gz", "rb") as f:
+            gz = f.read()
+        with open(os.path.join(workdir, "firmware.manifest.json"), "rb") as f:
+            manifest = f.read()
+        with open(os.path.join(workdir, "firmware.patch.gz"), "rb") as f:
+            patch = f.read()
+
+        h = Harness(workdir)
+        for chunk in CHUNKS:
+            h.accept("gzip, chunk %d:" % chunk, manifest, gz, chunk, image)
+        h.accept("plain, chunk 4096:", manifest, image, 4096, image)
+        partition = bytes(base) + b"\xff" * 4096
+        h.accept("delta, chunk 1436:", manifest, patch, 1436, image, partition)
+
+        for cut in (5, 12, len(gz) // 2, len(gz) - 6):
+            h.refuse("truncated at %d:" % cut, manifest, gz[:cut])
+        for label, ofs, expect in (("corrupt deflate:", len(gz) // 2, None),
+                                   ("corrupt CRC32:", len(gz) - 8, "CRC32 mismatch"),
+                                   ("corrupt ISIZE:", len(gz) - 1, "size mismatch"),
+                                   ("corrupt magic:", 1, "Not a deflate gzip")):
+            bad = bytearray(gz)
+            bad[ofs] ^= 0x01
+            h.refuse(label, manifest, bytes(bad), expect)
+
+        fields = json.loads(manifest)
+        h.refuse("no manifest:", b"", gz, "Manifest required")
+        h.refuse("manifest, no sha256:", json.dumps({"size": len(image)}).encode(), gz,
+                 "no valid sha256")
+        h.refuse("manifest, no size:", json.dumps(dict(fields, size=0)).encode(), gz,
+                 "no size")
+        other = hashlib.sha256(b"other").hexdigest()
+        h.refuse("manifest, other hash:", json.dumps(dict(fields, sha256=other)).encode(), gz,
+                 "SHA-256 does not match")
+        h.refuse("manifest, short size:", json.dumps(dict(fields, size=len(image) - 1)).encode(),
+                 gz, "larger than the manifest")
+        h.refuse("manifest, long size:", json.dumps(dict(fields, size=len(image) + 1)).encode(),
+                 gz, "size does not match")
+
+    print("%d bytes -> %d byte gzip, %d byte patch, %d failures" % (
+        len(image), len(gz), len(patch), h.failures))
+    sys.exit(1 if h.failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
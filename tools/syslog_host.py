@@ -0,0 +1,389 @@
+"""Host harness for the syslog sink (src/syslog_sink.cpp) against syslog_listen.py.
+
+    python tools/syslog_host.py
+
+Starts tools/syslog_listen.py on a free local port and builds
+src/syslog_sink.cpp with g++ against the stand-ins in host_build.py and a
+WiFiUDP that sends real datagrams over a POSIX socket. The driver writes
+through SyslogSink::write() as the logger drain task does and checks the
+counters and the datagrams it sent: no lookups without WiFi, no tokens
+spent before the server resolves, the level filter, the per-tag token
+bucket (burst 30, 10 per second), batching up to 1200 bytes and send
+failures. Afterwards every line the listener printed must match the
+datagrams sent, in the same grouping. Needs g++.
+"""
+
+import os
+import re
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+import syslog_listen  # noqa: E402
+
+LISTENER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "syslog_listen.py")
+
+STUBS = {
+    "Arduino.h": host_build.ARDUINO_H,
+    "WiFi.h": r"""
+#pragma once
+#include <Arduino.h>
+extern bool hostWifiUp;
+extern bool hostResolvable;
+extern int hostLookups;
+struct WiFiClass {
+  bool isConnected() { return hostWifiUp; }
+  int hostByName(const char *, IPAddress &ip) {
+    hostLookups++;
+    if (!hostResolvable) return 0;
+    ip = IPAddress(127, 0, 0, 1);
+    return 1;
+  }
+};
+extern WiFiClass WiFi;
+""",
+    # One POSIX UDP socket; every datagram is also kept in hostDatagrams
+    "WiFiUdp.h": r"""
+#pragma once
+#include <Arduino.h>
+#include <vector>
+extern std::vector<std::string> hostDatagrams;
+extern bool hostSendFails;
+class WiFiUDP {
+public:
+  int beginPacket(IPAddress ip, uint16_t port);
+  size_t write(const uint8_t *data, size_t len);
+  int endPacket();
+
+private:
+  int fd = -1;
+  IPAddress ip;
+  uint16_t port = 0;
+  std::string packet;
+};
+""",
+    "udp.cpp": r"""
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+bool hostWifiUp = false;
+bool hostResolvable = false;
+int hostLookups = 0;
+bool hostSendFails = false;
+WiFiClass WiFi;
+std::vector<std::string> hostDatagrams;
+int WiFiUDP::beginPacket(IPAddress to, uint16_t toPort) {
+  if (fd < 0) fd = socket(AF_INET, SOCK_DGRAM, 0);
+  ip = to;
+  port = toPort;
+  packet.clear();
+  return fd >= 0;
+}
+size_t WiFiUDP::write(const uint8_t *data, size_t len) {
+  packet.append((const char *)data, len);
+  return len;
+}
+int WiFiUDP::endPacket() {
+  if (hostSendFails) return 0;
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+  if (sendto(fd, packet.data(), packet.size(), 0, (sockaddr *)&addr, sizeof(addr)) !=
+      (ssize_t)packet.size()) {
+    return 0;
+  }
+  hostDatagrams.push_back(packet);
+  return 1;
+}
+""",
+    "arduino.cpp": host_build.ARDUINO_CPP,
+}
+
+# Prints "case <name> <0|1> <detail>", then "line <datagram> <text>" for
+# every line of every datagram sent
+DRIVER = r"""
+#include "syslog_sink.h"
+#include "types.h"
+#include <WiFi.h>
+#include <WiFiUdp.h>
+
+Config Cfg;
+
+using SyslogSink::Stats;
+using SyslogSink::getStats;
+
+static int failures = 0;
+
+static void report(const char *name, bool ok, const char *format, ...) {
+  char detail[256];
+  va_list a;
+  va_start(a, format);
+  vsnprintf(detail, sizeof(detail), format, a);
+  va_end(a);
+  printf("case\t%s\t%d\t%s\n", name, ok ? 1 : 0, detail);
+  failures += !ok;
+}
+
+static void write(uint8_t level, const char *tag, const char *format, int n) {
+  char message[160];
+  snprintf(message, sizeof(message), format, n);
+  SyslogSink::write(level, tag, millis(), message);
+}
+
+// Lines of the datagrams sent since first
+static size_t linesSince(size_t first) {
+  size_t lines = 0;
+  for (size_t i = first; i < hostDatagrams.size(); i++) {
+    lines += std::count(hostDatagrams[i].begin(), hostDatagrams[i].end(), '\n') + 1;
+  }
+  return lines;
+}
+
+static void testNoNetwork() {
+  for (int i = 0; i < 5; i++) {
+    write(6, "BOOT", "no WiFi %d", i);
+  }
+  Stats s = getStats();
+  report("no WiFi", s.dropped == 5 && s.sent == 0 && hostLookups == 0 && hostDatagrams.empty(),
+         "%u dropped, %d lookups", s.dropped, hostLookups);
+}
+
+// The name does not resolve at first: one lookup per 30 s, no tokens spent
+static void testResolve() {
+  hostWifiUp = true;
+  Stats before = getStats();
+  for (int i = 0; i < 40; i++) {
+    write(6, "EARLY", "unresolved %d", i);
+  }
+  delay(10000);
+  write(6, "EARLY", "unresolved %d", 40);
+  int lookups = hostLookups;
+  Stats unresolved = getStats();
+
+  delay(20000);
+  hostResolvable = true;
+  size_t first = hostDatagrams.size();
+  for (int i = 0; i < 31; i++) {
+    write(6, "EARLY", "resolved %d", i);
+  }
+  Stats after = getStats();
+  report("resolve", lookups == 1 && unresolved.dropped - before.dropped == 41 && hostLookups == 2 &&
+                        after.sent - unresolved.sent == 30 &&
+                        after.dropped - unresolved.dropped == 1 && linesSince(first) == 30,
+         "1 lookup for 41 messages in 10 s, resolved after 30 s; then a full burst: 30 of 31 sent");
+}
+
+static void testLevels() {
+  static const char *const names[] = {"emerg", "alert", "crit", "err",
+                                      "warning", "notice", "info", "debug"};
+  Stats before = getStats();
+  size_t first = hostDatagrams.size();
+  Cfg.syslogLevel = 6;
+  for (int level = 0; level < 8; level++) {
+    write(level, "LEVELS", names[level], 0);
+  }
+  Cfg.syslogLevel = 3;
+  write(4, "LEVELS", "warning at level 3 %d", 0);
+  write(3, "LEVELS", "err at level 3 %d", 0);
+  Cfg.syslogLevel = 6;
+  Stats after = getStats();
+  bool severities = hostDatagrams.size() - first == 8;
+  for (size_t i = first; severities && i < hostDatagrams.size(); i++) {
+    unsigned pri = 0;
+    sscanf(hostDatagrams[i].c_str(), "<%u>", &pri);
+    severities = pri == 16 * 8 + (i - first < 7 ? i - first : 3);
+  }
+  report("levels", severities && after.sent - before.sent == 8 && after.dropped == before.dropped,
+         "level 6 passes 0..6, level 3 passes err only; PRI = local0 * 8 + severity");
+}
+
+static void testRateLimit() {
+  Stats before = getStats();
+  for (int i = 0; i < 100; i++) {
+    write(6, "FLOOD", "flood %d", i);
+  }
+  for (int i = 0; i < 5; i++) {
+    write(6, "OTHER", "other %d", i);
+  }
+  Stats burst = getStats();
+  delay(1000);
+  for (int i = 0; i < 20; i++) {
+    write(6, "FLOOD", "after 1 s %d", i);
+  }
+  Stats second = getStats();
+  delay(500);
+  for (int i = 0; i < 10; i++) {
+    write(6, "FLOOD", "after 1.5 s %d", i);
+  }
+  Stats after = getStats();
+  uint32_t flood = burst.sent - before.sent - 5;
+  report("rate limit", flood == 30 && burst.dropped - before.dropped == 70 &&
+                           second.sent - burst.sent == 10 && after.sent - second.sent == 5,
+         "100 at once: %u sent, other tag unaffected; then %u after 1 s, %u after 0.5 s", flood,
+         second.sent - burst.sent, after.sent - second.sent);
+}
+
+static void testBatch() {
+  Cfg.syslogBatch = true;
+  Stats before = getStats();
+  size_t first = hostDatagrams.size();
+  for (int i = 0; i < 12; i++) {
+    write(6, "BATCH", "batched %d", i);
+  }
+  size_t beforeFlush = hostDatagrams.size();
+  SyslogSink::flush();
+  Stats one = getStats();
+  bool single = beforeFlush == first && hostDatagrams.size() == first + 1 &&
+                linesSince(first) == 12 && one.batched - before.batched == 11 &&
+                one.datagrams - before.datagrams == 1;
+
+  // Longer lines: datagrams fill up to 1200 bytes, no line is split
+  first = hostDatagrams.size();
+  for (int i = 0; i < 60; i++) {
+    delay(100); // One token per message
+    write(6, "BATCH", "%04d a longer message that fills the datagram sooner ..........", i);
+  }
+  SyslogSink::flush();
+  size_t largest = 0;
+  bool full = true;
+  for (size_t i = first; i < hostDatagrams.size(); i++) {
+    size_t len = hostDatagrams[i].size();
+    largest = len > largest ? len : largest;
+    size_t next = i + 1 < hostDatagrams.size() ? hostDatagrams[i + 1].find('\n') : 0;
+    full &= len <= 1200 && (i + 1 == hostDatagrams.size() || len + 1 + next > 1200);
+  }
+  Cfg.syslogBatch = false;
+  report("batch", single && full && linesSince(first) == 60 && hostDatagrams.size() - first > 1,
+         "12 messages in 1 datagram; 60 longer ones in %zu datagrams, largest %zu bytes",
+         hostDatagrams.size() - first, largest);
+}
+
+static void testSendFailure() {
+  Stats before = getStats();
+  hostSendFails = true;
+  Cfg.syslogBatch = true;
+  for (int i = 0; i < 4; i++) {
+    write(6, "FAIL", "lost %d", i);
+  }
+  SyslogSink::flush();
+  hostSendFails = false;
+  Cfg.syslogBatch = false;
+  Stats after = getStats();
+  report("send fails", after.dropped - before.dropped == 4 && after.sent == before.sent,
+         "a failed batch of 4 counts 4 dropped");
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) return 1;
+  hostClockMs = 1000;
+  Cfg.syslogEnabled = true;
+  Cfg.syslogPort = atoi(argv[1]);
+  strcpy(Cfg.syslogServer, "collector.lan");
+  strcpy(Cfg.hostname, "ess-host");
+
+  testNoNetwork();
+  testResolve();
+  testLevels();
+  testRateLimit();
+  testBatch();
+  testSendFailure();
+
+  Stats s = getStats();
+  printf("stat\tsent\t%u\nstat\tdatagrams\t%u\n", s.sent, s.datagrams);
+  for (size_t i = 0; i < hostDatagrams.size(); i++) {
+    size_t start = 0;
+    for (;;) {
+      size_t end = hostDatagrams[i].find('\n', start);
+      printf("line\t%zu\t%s\n", i + 1, hostDatagrams[i].substr(start, end - start).c_str());
+      if (end == std::string::npos) break;
+      start = end + 1;
+    }
+  }
+  return failures ? 1 : 0;
+}
+"""
+
+
+def expected_listener_output(lines):
+    """What syslog_listen.py prints for the datagrams, from its own format"""
+    out, messages, count = [], 0, {}
+    for datagram, _ in lines:
+        count[datagram] = count.get(datagram, 0) + 1
+    for i, (datagram, text) in enumerate(lines):
+        messages += 1
+        m = syslog_listen.RFC5424.match(text)
+        pri, stamp, host, _, _, msgid, _, msg = m.groups()
+        out.append("#%d %s %s %s[%s] %s" % (
+            datagram, stamp, host, syslog_listen.SEVERITY[int(pri) & 7], msgid, msg))
+        last = i + 1 == len(lines) or lines[i + 1][0] != datagram
+        if last and count[datagram] > 1:
+            out.append("   (%d messages in one datagram, %d total in %d datagrams)" % (
+                count[datagram], messages, datagram))
+    return out
+
+
+def main(argv):
+    if len(argv) != 1:
+        sys.exit(__doc__)
+
+    probe = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    probe.bind(("127.0.0.1", 0))
+    port = probe.getsockname()[1]
+    probe.close()
+    listener = subprocess.Popen([sys.executable, "-u", LISTENER, str(port)],
+                                stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        ready = listener.stdout.readline().strip()
+        if ready != "Listening on udp/%d" % port:
+            sys.exit("syslog_listen.py did not start: %r" % ready)
+        with tempfile.TemporaryDirectory() as workdir:
+            exe = host_build.build(workdir, ["syslog_sink.cpp"],
+                                   dict(STUBS, **{"driver.cpp": DRIVER}))
+            result, _ = host_build.run([exe, str(port)])
+    finally:
+        # The listener may still be reading; give it a moment before SIGINT
+        try:
+            listener.wait(timeout=0.5)
+        except subprocess.TimeoutExpired:
+            listener.send_signal(signal.SIGINT)
+        heard = listener.communicate(timeout=5)[0].splitlines()
+
+    failures = 0
+    stats, lines = {}, []
+    for line in result.stdout.decode().split("\n"):
+        fields = line.split("\t")
+        if fields[0] == "case":
+            ok = fields[2] == "1"
+            failures += not ok
+            print("%-12s %s %s" % (fields[1] + ":", "OK " if ok else "FAIL", fields[3]))
+        elif fields[0] == "stat":
+            stats[fields[1]] = int(fields[2])
+        elif fields[0] == "line":
+            lines.append((int(fields[1]), fields[2]))
+    if "sent" not in stats:
+        sys.exit("driver failed (%d): %s" % (result.returncode, result.stderr.decode()))
+
+    want = expected_listener_output(lines)
+    malformed = [h for h in heard if re.search(r": malformed: ", h)]
+    ok = heard == want and not malformed
+    failures += not ok
+    print("%-12s %s %d messages in %d datagrams printed as sent" % (
+        "listener:", "OK " if ok else "FAIL", len(lines), stats["datagrams"]))
+    if not ok:
+        for got, expect in zip(heard + [""] * len(want), want + [""] * len(heard)):
+            if got != expect:
+                print("  listener %r\n  expected %r" % (got, expect))
+                break
+    print("%d failures" % failures)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
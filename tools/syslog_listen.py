@@ -0,0 +1,47 @@
+"""Tiny UDP syslog listener for checking the device's syslog output.
+
+    python tools/syslog_listen.py [port]        # default 5514
+
+Prints every message with the datagram it arrived in, so batching is
+visible. Point Syslog > Server at this machine and Port at the same port
+(514 needs root).
+"""
+
+import re
+import socket
+import sys
+
+RFC5424 = re.compile(r"<(\d+)>1 (\S+) (\S+) (\S+) (\S+) (\S+) (\S+) (.*)")
+SEVERITY = ["EMERG", "ALERT", "CRIT", "ERROR", "WARN", "NOTICE", "INFO", "DEBUG"]
+
+
+def main(argv):
+    port = int(argv[1]) if len(argv) > 1 else 5514
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("0.0.0.0", port))
+    print("Listening on udp/%d" % port)
+
+    datagrams = messages = 0
+    while True:
+        data, addr = sock.recvfrom(65535)
+        datagrams += 1
+        lines = data.decode("utf-8", "replace").split("\n")
+        for line in lines:
+            messages += 1
+            m = RFC5424.match(line)
+            if not m:
+                print("#%d %s: malformed: %r" % (datagrams, addr[0], line))
+                continue
+            pri, stamp, host, app, _, msgid, _, msg = m.groups()
+            print("#%d %s %s %s[%s] %s" % (
+                datagrams, stamp, host, SEVERITY[int(pri) & 7], msgid, msg))
+        if len(lines) > 1:
+            print("   (%d messages in one datagram, %d total in %d datagrams)" % (
+                len(lines), messages, datagrams))
+
+
+if __name__ == "__main__":
+    try:
+        main(sys.argv)
+    except KeyboardInterrupt:
+        pass
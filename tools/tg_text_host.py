@@ -0,0 +1,549 @@
+"""Host harness for the Telegram message texts (src/tg.cpp, src/tg_text.cpp).
+
+    python tools/tg_text_host.py            # render, compare, soak
+    python tools/tg_text_host.py --update   # rewrite the golden texts
+
+Builds src/tg.cpp (included by the driver, so its templates and deliver()
+are reachable) and src/tg_text.cpp with g++ against the stand-ins in
+host_build.py, and renders every message kind over the state, charge band
+and BMS error/warning matrix. The texts must equal
+tools/testdata/tg_text_golden.json and, where a message existed before the
+templates, the old String-built one byte for byte (the functions below are
+the pre-template code). malloc is interposed to count allocations: the
+template path must make none. Cutting a status text into every buffer size
+must give a prefix that ends on a UTF-8 boundary. Prints ns per message,
+old and new. Needs g++ and glibc.
+"""
+
+import json
+import os
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import host_build  # noqa: E402
+
+GOLDEN = os.path.join(host_build.TESTDATA, "tg_text_golden.json")
+SOAK = 20000
+
+STUBS = dict(host_build.FREERTOS)
+STUBS.update({
+    "Arduino.h": host_build.ARDUINO_H,
+    "HardwareSerial.h": "#pragma once\n#include <Arduino.h>\n",
+    "esp_system.h": "#pragma once\ntypedef enum { ESP_RST_UNKNOWN } esp_reset_reason_t;\n",
+    # sendMessage() takes the rendered buffer as is, so what is counted is
+    # the rendering; the real FastBot copies it into one String
+    "FastBot.h": r"""
+#pragma once
+#include <Arduino.h>
+#define FB_MARKDOWN 1
+struct FB_msg {
+  String text;
+  String chatID;
+  String toString() const { return text; }
+};
+extern const char *hostSent;
+class FastBot {
+public:
+  void setToken(const char *) {}
+  void setChatID(const char *) {}
+  void setTextMode(int) {}
+  void attach(void (*)(FB_msg &)) {}
+  void tick() {}
+  uint8_t sendMessage(const char *text, const char * = nullptr) {
+    hostSent = text;
+    return 1;
+  }
+};
+""",
+    "WiFiClientSecure.h": r"""
+#pragma once
+#include <Arduino.h>
+class WiFiClientSecure : public Print {
+public:
+  void setInsecure() {}
+  void setTimeout(int) {}
+  bool connect(const char *, int) { return false; }
+  using Print::write;
+  size_t write(const uint8_t *, size_t n) { return n; }
+  String readStringUntil(char) { return String(); }
+  void stop() {}
+};
+""",
+    # glibc lets a program replace malloc; operator new goes through it
+    "malloc_count.cpp": r"""
+#include <cstddef>
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+size_t hostMallocs = 0;
+void *malloc(size_t n) { hostMallocs++; return __libc_malloc(n); }
+void *calloc(size_t n, size_t size) { hostMallocs++; return __libc_calloc(n, size); }
+void *realloc(void *p, size_t n) { hostMallocs++; return __libc_realloc(p, n); }
+}
+""",
+    "arduino.cpp": host_build.ARDUINO_CPP,
+    "freertos.cpp": host_build.FREERTOS_CPP,
+    "logger_stub.cpp": host_build.LOGGER_CPP,
+})
+
+# Prints "case <label> <text>" per message (\n and \ escaped), "fail <what>"
+# per problem and "stat <name> <value>"
+DRIVER = r"""
+#include "tg.cpp"
+#include <chrono>
+#include <string>
+#include <vector>
+
+Config Cfg;
+volatile EssStatus Ess;
+const char *hostSent = nullptr;
+extern "C" size_t hostMallocs;
+
+namespace Alerts {
+uint32_t head() { return 0; }
+bool next(uint32_t *, Event *) { return false; }
+bool isActive(Rule) { return false; }
+bool isPrimed() { return true; }
+}
+namespace CAN {
+uint32_t getKeepAliveCounter() { return 0; }
+uint32_t getKeepAliveFailures() { return 0; }
+uint32_t getTimeSinceLastKeepAlive() { return 0; }
+EssStatus getEssStatus() { return {}; }
+}
+namespace Trace {
+void alive(Task) {}
+void mark(Marker, uint32_t) {}
+}
+namespace Chart {
+void begin(Renderer &, uint8_t) {}
+size_t size() { return 0; }
+size_t read(Renderer &, uint8_t *, size_t) { return 0; }
+}
+
+using namespace TG;
+
+// The messages as they were built before the templates
+String legacyStatus(State state, const EssStatus &ess) {
+  String s;
+  switch (state) {
+  case State::Balance:
+    s = "⚪️ Статус: *простій*.\n\n";
+    break;
+  case State::Charging:
+    s = "🟢 Статус: *заряджання*.\n\n";
+    break;
+  case State::Discharging:
+    s = "🔴 Статус: *розряджання*.\n\n";
+    break;
+  default:
+    s = "🟡 Статус: *невизначений*.\n\n";
+    break;
+  }
+  if (ess.charge > 75) {
+    s += "🟩🟩🟩🟩";
+  } else if (ess.charge > 50) {
+    s += "🟩🟩🟩🟦";
+  } else if (ess.charge > 25) {
+    s += "🟩🟩🟦🟦";
+  } else {
+    s += "🟩🟦🟦🟦";
+  }
+  s += " Заряд: *" + String(ess.charge) + "%*\n";
+  s += "🔌 Навантаження: *" + String(ess.current, 1) + "A*\n";
+  s += "⚡️ Напруга: *" + String(ess.voltage, 2) + "V*, номінальна: *" +
+       String(ess.ratedVoltage, 2) + "V*\n";
+  s += "🌡️ Температура батареї: *" + String(ess.temperature, 1) + "°C*\n";
+  s += "🍀 Здоров'я батареї: *" + String(ess.health) + "%*\n";
+  if (ess.bmsError > 0 || ess.bmsWarning > 0) {
+    s += "\n⚠️ *УВАГА!*\n";
+    if (ess.bmsError > 0) {
+      s += "🚨 Критична помилка: *" + String(ess.bmsError) + "*\n";
+    }
+    if (ess.bmsWarning > 0) {
+      s += "⚠️ Попередження: *" + String(ess.bmsWarning) + "*\n";
+    }
+  } else {
+    s += "\n✅ Помилок немає\n";
+  }
+  return s;
+}
+
+String legacyPower(State state, const EssStatus &ess) {
+  if (state == State::Discharging) {
+    return "🕯️ *Переключено на живлення від батарейки.* Грилі не "
+           "смажимо.\n\n||" + legacyStatus(state, ess) + "||";
+  }
+  return "💡 *Електрохарчування відновлено.*\n\n||" + legacyStatus(state, ess) + "||";
+}
+
+String legacyBmsError(const EssStatus &ess) {
+  String errorMsg = "🚨 *КРИТИЧНА ПОМИЛКА БАТАРЕЇ!*\n\n";
+  errorMsg += "⚠️ Код помилки: *" + String(ess.bmsError) + "*\n";
+  errorMsg += "Батарея може вимкнутися!\n\n";
+  errorMsg += "Поточний стан:\n";
+  errorMsg += "🔋 Заряд: *" + String(ess.charge) + "%*\n";
+  errorMsg += "⚡️ Напруга: *" + String(ess.voltage, 2) + "V*\n";
+  errorMsg += "🔌 Струм: *" + String(ess.current, 1) + "A*\n";
+  errorMsg += "🌡️ Температура: *" + String(ess.temperature, 1) + "°C*\n";
+  return errorMsg;
+}
+
+String legacyBmsWarning(const EssStatus &ess) {
+  String warningMsg = "⚠️ *ПОПЕРЕДЖЕННЯ БАТАРЕЇ*\n\n";
+  warningMsg += "Код попередження: *" + String(ess.bmsWarning) + "*\n";
+  warningMsg += "Можливі причини: висока температура, напруга або розбалансування.\n\n";
+  warningMsg += "Поточний стан:\n";
+  warningMsg += "🔋 Заряд: *" + String(ess.charge) + "%*\n";
+  warningMsg += "⚡️ Напруга: *" + String(ess.voltage, 2) + "V*\n";
+  warningMsg += "🔌 Струм: *" + String(ess.current, 1) + "A*\n";
+  warningMsg += "🌡️ Температура: *" + String(ess.temperature, 1) + "°C*\n";
+  return warningMsg;
+}
+
+String legacyCan(uint32_t keepAliveCount, uint32_t keepAliveFailures, uint32_t timeSinceLast) {
+  String canMsg = "📡 *Статус CAN шини*\n\n";
+  canMsg += "✅ Keep-alive відправлено: *" + String(keepAliveCount) + "*\n";
+  canMsg += "❌ Помилок відправки: *" + String(keepAliveFailures) + "*\n";
+  canMsg += "⏱️ Останній keep-alive: *" + String(timeSinceLast / 1000.0, 1) + "с* тому\n\n";
+  if (timeSinceLast > 5000) {
+    canMsg += "🚨 *УВАГА!* Давно не було keep-alive!\n";
+    canMsg += "Батарея може відключитися через 20 хв без keep-alive.\n";
+  } else if (timeSinceLast > 2000) {
+    canMsg += "⚠️ Затримка з відправкою keep-alive.\n";
+  } else {
+    canMsg += "🟢 Keep-alive працює нормально.\n";
+  }
+  if (keepAliveFailures > 0) {
+    canMsg += "\n⚠️ Виявлено " + String(keepAliveFailures) + " помилок відправки!\n";
+    canMsg += "Можливо проблема з CAN шиною або MCP2515.\n";
+  }
+  return canMsg;
+}
+
+typedef struct Case {
+  std::string label;
+  Outbound msg;
+  bool hasLegacy;
+  std::string legacy;
+} Case;
+
+std::vector<Case> cases;
+int failures = 0;
+
+const char *STATE_NAMES[] = {"undef", "charging", "discharging", "idle"};
+const int16_t CHARGES[] = {0, 25, 26, 50, 51, 75, 76, 100};
+const uint8_t ERRORS[][2] = {{0, 0}, {3, 0}, {0, 5}, {3, 5}};
+
+EssStatus essFor(State state, int16_t charge, uint8_t error, uint8_t warning) {
+  EssStatus ess = {};
+  ess.charge = charge;
+  ess.health = 97;
+  ess.voltage = 52.31f;
+  ess.current = state == State::Charging ? 12.5f : state == State::Discharging ? -8.3f :
+                state == State::Balance ? 0.4f : 0;
+  ess.ratedVoltage = 51.2f;
+  ess.temperature = 23.4f;
+  ess.bmsError = error;
+  ess.bmsWarning = warning;
+  return ess;
+}
+
+void add(const char *label, MessageKind kind, State state, const TgText::Values &values,
+         const String *legacy = nullptr) {
+  Case c;
+  c.label = label;
+  c.msg = {};
+  c.msg.kind = kind;
+  c.msg.state = state;
+  c.msg.values = values;
+  c.hasLegacy = legacy != nullptr;
+  if (legacy) {
+    c.legacy = *legacy;
+  }
+  cases.push_back(c);
+}
+
+void buildCases() {
+  char label[96];
+  for (int s = 0; s < 4; s++) {
+    for (int16_t charge : CHARGES) {
+      for (const uint8_t *e : ERRORS) {
+        TgText::Values v = {};
+        v.ess = essFor((State)s, charge, e[0], e[1]);
+        snprintf(label, sizeof(label), "status/%s/charge=%d/error=%u/warning=%u", STATE_NAMES[s],
+                 charge, e[0], e[1]);
+        String legacy = legacyStatus((State)s, v.ess);
+        add(label, MSG_STATUS, (State)s, v, &legacy);
+      }
+    }
+    for (int e = 0; e < 4; e += 3) {
+      TgText::Values v = {};
+      v.ess = essFor((State)s, 60, ERRORS[e][0], ERRORS[e][1]);
+      snprintf(label, sizeof(label), "on_battery/%s/error=%u", STATE_NAMES[s], ERRORS[e][0]);
+      add(label, MSG_ON_BATTERY, (State)s, v);
+      snprintf(label, sizeof(label), "power_restored/%s/error=%u", STATE_NAMES[s], ERRORS[e][0]);
+      add(label, MSG_POWER_RESTORED, (State)s, v);
+    }
+  }
+
+  // The old code only sent power changes between two known states
+  for (State s : {State::Discharging, State::Charging}) {
+    TgText::Values v = {};
+    v.ess = essFor(s, 64, 0, 0);
+    String legacy = legacyPower(s, v.ess);
+    snprintf(label, sizeof(label), "%s/legacy", s == State::Discharging ? "on_battery" :
+                                                "power_restored");
+    add(label, s == State::Discharging ? MSG_ON_BATTERY : MSG_POWER_RESTORED, s, v, &legacy);
+  }
+
+  for (uint8_t code : {3, 255}) {
+    TgText::Values v = {};
+    v.ess = essFor(State::Discharging, 41, code, 0);
+    v.code = v.value = code;
+    String legacy = legacyBmsError(v.ess);
+    snprintf(label, sizeof(label), "bms_error/code=%u", code);
+    add(label, MSG_BMS_ERROR, State::Discharging, v, &legacy);
+
+    v.ess = essFor(State::Discharging, 41, 0, code);
+    legacy = legacyBmsWarning(v.ess);
+    snprintf(label, sizeof(label), "bms_warning/code=%u", code);
+    add(label, MSG_BMS_WARNING, State::Discharging, v, &legacy);
+
+    v.ess = essFor(State::Discharging, 41, 0, 0);
+    v.code = v.value = 0;
+    v.previous = code;
+    legacy = "✅ *Критична помилка батареї усунена.*\n\nКод помилки: " + String(code) + " → 0";
+    snprintf(label, sizeof(label), "bms_error_cleared/previous=%u", code);
+    add(label, MSG_BMS_ERROR_CLEARED, State::Discharging, v, &legacy);
+    legacy = "✅ *Попередження батареї усунене.*\n\nКод попередження: " + String(code) + " → 0";
+    snprintf(label, sizeof(label), "bms_warning_cleared/previous=%u", code);
+    add(label, MSG_BMS_WARNING_CLEARED, State::Discharging, v, &legacy);
+  }
+
+  TgText::Values v = {};
+  v.ess = essFor(State::Discharging, 9, 0, 0);
+  v.value = 9;
+  add("low_charge", MSG_LOW_CHARGE, State::Discharging, v);
+  v.ess.charge = 21;
+  add("low_charge_cleared", MSG_LOW_CHARGE_CLEARED, State::Charging, v);
+  v.ess = essFor(State::Charging, 80, 0, 0);
+  v.ess.temperature = v.value = 47.5f;
+  add("high_temperature", MSG_HIGH_TEMPERATURE, State::Charging, v);
+  v.ess.temperature = 38.0f;
+  add("high_temperature_cleared", MSG_HIGH_TEMPERATURE_CLEARED, State::Charging, v);
+  v.ess = essFor(State::Discharging, 55, 0, 0);
+  v.value = 37.4f;
+  add("current_step", MSG_CURRENT_STEP, State::Discharging, v);
+  add("current_step_cleared", MSG_CURRENT_STEP_CLEARED, State::Discharging, v);
+
+  for (uint32_t ms : {0u, 1250u, 1350u, 2000u, 2001u, 5000u, 5001u, 123456u}) {
+    for (uint32_t failed : {0u, 7u}) {
+      TgText::Values v = {};
+      v.count = 12345;
+      v.failures = failed;
+      v.age = ms / 1000.0f;
+      String legacy = legacyCan(v.count, failed, ms);
+      snprintf(label, sizeof(label), "can_status/age_ms=%u/failures=%u", ms, failed);
+      add(label, MSG_CAN_STATUS, State::Balance, v, &legacy);
+    }
+  }
+}
+
+void printEscaped(const char *s) {
+  for (; *s; s++) {
+    if (*s == '\n') {
+      fputs("\\n", stdout);
+    } else if (*s == '\\') {
+      fputs("\\\\", stdout);
+    } else {
+      fputc(*s, stdout);
+    }
+  }
+}
+
+// Every cut of the longest status text: a prefix ending on a character
+void checkCuts() {
+  const Case *longest = nullptr;
+  size_t longestLen = 0;
+  for (const Case &c : cases) {
+    deliver(c.msg);
+    if (c.msg.kind == MSG_STATUS && strlen(hostSent) > longestLen) {
+      longest = &c;
+      longestLen = strlen(hostSent);
+    }
+  }
+  std::string full = (deliver(longest->msg), hostSent);
+  std::vector<char> small(full.size() + 2);
+  int bad = 0;
+  for (size_t size = 1; size <= full.size() + 1; size++) {
+    TgText::Buffer buf;
+    TgText::init(buf, small.data(), size);
+    appendStatus(buf, longest->msg.state, longest->msg.values);
+    bool ok = buf.len < size && strlen(buf.data) == buf.len &&
+              full.compare(0, buf.len, buf.data) == 0 &&
+              buf.truncated == (full.size() >= size) &&
+              (buf.len == full.size() || ((uint8_t)full[buf.len] & 0xC0) != 0x80);
+    if (!ok && bad++ < 3) {
+      printf("fail\tcut at buffer size %zu: %zu bytes, truncated %d\n", size, buf.len,
+             buf.truncated);
+    }
+  }
+  failures += bad;
+  printf("stat\tcuts\t%zu\n", full.size() + 1);
+}
+
+int main() {
+  buildCases();
+  size_t legacyChecked = 0;
+  size_t renderMallocs = 0;
+  for (const Case &c : cases) {
+    size_t before = hostMallocs;
+    if (!deliver(c.msg)) {
+      printf("fail\t%s: not delivered\n", c.label.c_str());
+      failures++;
+    }
+    renderMallocs += hostMallocs - before;
+    printf("case\t%s\t", c.label.c_str());
+    printEscaped(hostSent);
+    putchar('\n');
+    if (c.hasLegacy) {
+      legacyChecked++;
+      if (c.legacy != hostSent) {
+        printf("fail\t%s: differs from the String-built text\n", c.label.c_str());
+        failures++;
+      }
+    }
+  }
+  checkCuts();
+
+  // Soak: every message SOAK times, allocations and time, old and new
+  size_t before = hostMallocs;
+  auto started = std::chrono::steady_clock::now();
+  for (int i = 0; i < SOAK; i++) {
+    for (const Case &c : cases) {
+      deliver(c.msg);
+    }
+  }
+  double newNs = std::chrono::duration<double, std::nano>(
+                     std::chrono::steady_clock::now() - started).count() / SOAK / cases.size();
+  size_t soakMallocs = hostMallocs - before;
+
+  size_t statusCount = 0;
+  before = hostMallocs;
+  started = std::chrono::steady_clock::now();
+  for (int i = 0; i < SOAK; i++) {
+    for (const Case &c : cases) {
+      if (c.msg.kind == MSG_STATUS) {
+        String s = legacyStatus(c.msg.state, c.msg.values.ess);
+        statusCount++;
+      }
+    }
+  }
+  double oldNs = std::chrono::duration<double, std::nano>(
+                     std::chrono::steady_clock::now() - started).count() / statusCount;
+  double oldMallocs = (double)(hostMallocs - before) / statusCount;
+
+  before = hostMallocs;
+  started = std::chrono::steady_clock::now();
+  for (int i = 0; i < SOAK; i++) {
+    for (const Case &c : cases) {
+      if (c.msg.kind == MSG_STATUS) {
+        deliver(c.msg);
+      }
+    }
+  }
+  double statusNs = std::chrono::duration<double, std::nano>(
+                        std::chrono::steady_clock::now() - started).count() / statusCount;
+  soakMallocs += hostMallocs - before;
+
+  printf("stat\tcases\t%zu\n", cases.size());
+  printf("stat\tlegacy\t%zu\n", legacyChecked);
+  printf("stat\trender_mallocs\t%zu\n", renderMallocs);
+  printf("stat\tsoak_messages\t%zu\n", (size_t)SOAK * cases.size() + statusCount);
+  printf("stat\tsoak_mallocs\t%zu\n", soakMallocs);
+  printf("stat\tns_per_message\t%.0f\n", newNs);
+  printf("stat\tstatus_ns\t%.0f\n", statusNs);
+  printf("stat\tlegacy_status_ns\t%.0f\n", oldNs);
+  printf("stat\tlegacy_status_mallocs\t%.1f\n", oldMallocs);
+  printf("stat\tlongest\t%u\n", (unsigned)longestMessage);
+  printf("stat\tcapacity\t%zu\n", sizeof(messageText));
+  return failures ? 1 : 0;
+}
+"""
+
+
+def unescape(text):
+    out, i = [], 0
+    while i < len(text):
+        if text[i] == "\\" and i + 1 < len(text):
+            out.append("\n" if text[i + 1] == "n" else text[i + 1])
+            i += 2
+        else:
+            out.append(text[i])
+            i += 1
+    return "".join(out)
+
+
+def main(argv):
+    update = "--update" in argv
+    if len(argv) > 1 + update:
+        sys.exit(__doc__)
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = host_build.build(workdir, ["tg_text.cpp"], dict(STUBS, **{"driver.cpp": DRIVER}),
+                               ["-DSOAK=%d" % SOAK])
+        result, _ = host_build.run([exe])
+
+    texts, stats = {}, {}
+    for line in result.stdout.split(b"\n"):
+        fields = line.split(b"\t")
+        if fields[0] == b"case":
+            try:
+                texts[fields[1].decode()] = unescape(fields[2].decode("utf-8"))
+            except UnicodeDecodeError as e:
+                failures += 1
+                print("%s: not UTF-8 (%s)" % (fields[1].decode(), e))
+        elif fields[0] == b"stat":
+            stats[fields[1].decode()] = fields[2].decode()
+        elif fields[0] == b"fail":
+            failures += 1
+            print(fields[1].decode())
+    if result.returncode not in (0, 1) or "capacity" not in stats:
+        sys.exit("driver failed (%d): %s" % (result.returncode, result.stderr.decode()))
+
+    if update:
+        os.makedirs(host_build.TESTDATA, exist_ok=True)
+        with open(GOLDEN, "w", encoding="utf-8") as f:
+            json.dump(texts, f, ensure_ascii=False, indent=1, sort_keys=True)
+            f.write("\n")
+        print("golden:     written to %s" % os.path.relpath(GOLDEN, host_build.ROOT))
+    else:
+        with open(GOLDEN, encoding="utf-8") as f:
+            golden = json.load(f)
+        differ = sorted(k for k in set(golden) | set(texts) if golden.get(k) != texts.get(k))
+        for label in differ[:5]:
+            print("golden:     %s differs\n  want %r\n  got  %r" % (
+                label, golden.get(label), texts.get(label)))
+        failures += len(differ)
+        print("golden:     %s %d texts" % ("FAIL" if differ else "OK ", len(texts)))
+
+    print("old text:   %s cases identical to the String-built messages" % stats["legacy"])
+    print("cuts:       %s buffer sizes, each a prefix on a UTF-8 boundary" % stats["cuts"])
+    render = int(stats["render_mallocs"]) + int(stats["soak_mallocs"])
+    failures += render != 0
+    print("malloc:     %s %d over %s rendered messages (old /status: %s each)" % (
+        "OK " if render == 0 else "FAIL", render, stats["soak_messages"],
+        stats["legacy_status_mallocs"]))
+    print("longest:    %s of %s bytes" % (stats["longest"], stats["capacity"]))
+    print("time:       %s ns per message, /status %s ns (old %s ns; host, -O2)" % (
+        stats["ns_per_message"], stats["status_ns"], stats["legacy_status_ns"]))
+    print("%d failures" % failures)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main(sys.argv)